@@ -35,12 +35,37 @@ typedef struct {
     int index;
 } sys_font_info;
 
+typedef struct {
+    int index; // into fontmap
+    int len;   // of the face name this slot was inserted for
+} font_lookup_slot;
+
 typedef struct {
     sys_font_info* fontmap;
     int len;
     int cap;
+    // hash table of face names, built once fontmap is complete
+    font_lookup_slot* lookup;
+    int lookup_cap;
 } pdf_fontlistMS;
 
+// a font file and the faces it contains (fontmap[first_face..first_face+n_faces])
+// Note: the file name must be the first field so that the structure
+//       can be treated like a simple string for searching
+typedef struct {
+    char name[MAX_PATH]; // relative to the font directory
+    ULONGLONG size;
+    ULONGLONG mtime;
+    int first_face;
+    int n_faces;
+} font_file_info;
+
+typedef struct {
+    font_file_info* files;
+    int len;
+    int cap;
+} font_file_list;
+
 typedef struct {
     ULONG uVersion;
     USHORT uNumOfTables;
@@ -97,14 +122,21 @@ static struct {
 };
 
 static pdf_fontlistMS fontlistMS = {
-    NULL,
-    0,
-    0,
+    NULL, 0, 0, NULL, 0,
 };
 
 static int did_init = 0;
+static int did_create_list = 0;
 static CRITICAL_SECTION cs_fonts;
 
+// the index of the Windows font directory is saved there (if set) so that
+// only new or modified font files have to be parsed on the next start
+static WCHAR* font_index_path = NULL;
+static HANDLE font_index_thread = NULL;
+static volatile LONG abort_font_index = 0;
+
+#define FONT_INDEX_MAGIC 0x31494653 // "SFI1"
+
 static inline USHORT BEtoHs(USHORT x) {
     BYTE* data = (BYTE*)&x;
     return (data[0] << 8) | data[1];
@@ -148,8 +180,81 @@ static int str_ends_with(const char* str, const char* end) {
     return len1 >= len2 && !strcmp(str + len1 - len2, end);
 }
 
+// case-insensitive FNV-1a of the first len chars of s
+static unsigned int hash_face_name(const char* s, int len) {
+    unsigned int h = 2166136261u;
+    int i;
+    for (i = 0; i < len; i++) {
+        unsigned char c = (unsigned char)s[i];
+        if (c >= 'A' && c <= 'Z')
+            c += 'a' - 'A';
+        h ^= c;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static sys_font_info* find_font_exact(pdf_fontlistMS* fl, const char* name, int len) {
+    unsigned int mask, i;
+    if (!fl->lookup)
+        return NULL;
+    mask = (unsigned int)fl->lookup_cap - 1;
+    for (i = hash_face_name(name, len) & mask; fl->lookup[i].index >= 0; i = (i + 1) & mask) {
+        font_lookup_slot* slot = &fl->lookup[i];
+        if (slot->len == len && !_strnicmp(fl->fontmap[slot->index].fontface, name, len))
+            return &fl->fontmap[slot->index];
+    }
+    return NULL;
+}
+
+// the first face inserted for a name wins
+static void insert_font_lookup(pdf_fontlistMS* fl, int index, int len) {
+    const char* name = fl->fontmap[index].fontface;
+    unsigned int mask = (unsigned int)fl->lookup_cap - 1;
+    unsigned int i;
+    for (i = hash_face_name(name, len) & mask; fl->lookup[i].index >= 0; i = (i + 1) & mask) {
+        font_lookup_slot* slot = &fl->lookup[i];
+        if (slot->len == len && !_strnicmp(fl->fontmap[slot->index].fontface, name, len))
+            return;
+    }
+    fl->lookup[i].index = index;
+    fl->lookup[i].len = len;
+}
+
+static void build_font_lookup(fz_context* ctx, pdf_fontlistMS* fl) {
+    int i, cap = 16;
+    // at most half full, also counting "-Roman" aliases
+    while (cap < fl->len * 4)
+        cap *= 2;
+    free(fl->lookup);
+    fl->lookup = (font_lookup_slot*)malloc(cap * sizeof(font_lookup_slot));
+    if (!fl->lookup)
+        fz_throw(ctx, FZ_ERROR_GENERIC, "OOM in build_font_lookup");
+    for (i = 0; i < cap; i++)
+        fl->lookup[i].index = -1;
+    fl->lookup_cap = cap;
+
+    for (i = 0; i < fl->len; i++)
+        insert_font_lookup(fl, i, strlen(fl->fontmap[i].fontface));
+    // "EurostileExtended" also matches "EurostileExtended-Roman"
+    for (i = 0; i < fl->len; i++) {
+        int len = strlen(fl->fontmap[i].fontface);
+        if (len > 6 && !_stricmp(fl->fontmap[i].fontface + len - 6, "-roman"))
+            insert_font_lookup(fl, i, len - 6);
+    }
+}
+
+/* the same matching as lookup_compare, so that e.g. "EurostileExtended-Roman"
+   matches "EurostileExtended" or "Tahoma-Bold,Bold" matches "Tahoma-Bold" */
 static sys_font_info* pdf_find_windows_font_path(const char* fontname) {
-    return (sys_font_info*)bsearch(fontname, fontlistMS.fontmap, fontlistMS.len, sizeof(sys_font_info), lookup_compare);
+    int len = strlen(fontname);
+    const char* comma;
+    sys_font_info* found = find_font_exact(&fontlistMS, fontname, len);
+    for (comma = strchr(fontname, ','); !found && comma; comma = strchr(comma + 1, ','))
+        found = find_font_exact(&fontlistMS, fontname, (int)(comma - fontname));
+    if (!found && len > 6 && !_stricmp(fontname + len - 6, "-roman"))
+        found = find_font_exact(&fontlistMS, fontname, len - 6);
+    return found;
 }
 
 /* source and dest can be same */
@@ -271,7 +376,7 @@ static void makeFakePSName(char szName[MAX_FACENAME], const char* szStyle) {
     remove_spaces(szName);
 }
 
-static void parseTTF(fz_context* ctx, fz_stream* file, int offset, int index, const char* path) {
+static void parseTTF(fz_context* ctx, pdf_fontlistMS* fl, fz_stream* file, int offset, int index, const char* path) {
     TT_OFFSET_TABLE ttOffsetTableBE;
     TT_TABLE_DIRECTORY tblDirBE;
     TT_NAME_TABLE_HEADER ttNTHeaderBE;
@@ -352,27 +457,27 @@ static void parseTTF(fz_context* ctx, fz_stream* file, int offset, int index, co
     }
 
     if (szPSName[0])
-        append_mapping(ctx, &fontlistMS, szPSName, path, index);
+        append_mapping(ctx, fl, szPSName, path, index);
     if (szTTName[0]) {
         // derive a PostScript-like name and add it, if it's different from the font's
         // included PostScript name; cf. https://code.google.com/p/sumatrapdf/issues/detail?id=376
         makeFakePSName(szTTName, szStyle);
         // compare the two names before adding this one
         if (lookup_compare(szTTName, szPSName))
-            append_mapping(ctx, &fontlistMS, szTTName, path, index);
+            append_mapping(ctx, fl, szTTName, path, index);
     }
     if (szCJKName[0]) {
         makeFakePSName(szCJKName, szStyle);
         if (lookup_compare(szCJKName, szPSName) && lookup_compare(szCJKName, szTTName))
-            append_mapping(ctx, &fontlistMS, szCJKName, path, index);
+            append_mapping(ctx, fl, szCJKName, path, index);
     }
 }
 
-static void parseTTFs(fz_context* ctx, const char* path) {
+static void parseTTFs(fz_context* ctx, pdf_fontlistMS* fl, const char* path) {
     fz_stream* file = fz_open_file(ctx, path);
     /* "fonterror : %s not found", path */
     fz_try(ctx) {
-        parseTTF(ctx, file, 0, 0, path);
+        parseTTF(ctx, fl, file, 0, 0, path);
     }
     fz_always(ctx) {
         fz_drop_stream(ctx, file);
@@ -382,7 +487,7 @@ static void parseTTFs(fz_context* ctx, const char* path) {
     }
 }
 
-static void parseTTCs(fz_context* ctx, const char* path) {
+static void parseTTCs(fz_context* ctx, pdf_fontlistMS* fl, const char* path) {
     FONT_COLLECTION fontcollectionBE;
     ULONG i, numFonts, *offsettableBE = NULL;
 
@@ -405,7 +510,7 @@ static void parseTTCs(fz_context* ctx, const char* path) {
         int offset = (int)sizeof(FONT_COLLECTION);
         safe_read(ctx, file, offset, (char*)offsettableBE, numFonts * sizeof(ULONG));
         for (i = 0; i < numFonts; i++) {
-            parseTTF(ctx, file, BEtoHl(offsettableBE[i]), i, path);
+            parseTTF(ctx, fl, file, BEtoHl(offsettableBE[i]), i, path);
         }
     }
     fz_always(ctx) {
@@ -417,7 +522,24 @@ static void parseTTCs(fz_context* ctx, const char* path) {
     }
 }
 
-static void extend_system_font_list(fz_context* ctx, const WCHAR* path) {
+// parses a .ttf, .otf or .ttc file, ignoring other files
+static void parse_font_file(fz_context* ctx, pdf_fontlistMS* fl, const char* path) {
+    const char* fileExt;
+    if (strlen(path) < 4)
+        return;
+    fileExt = path + strlen(path) - 4;
+    fz_try(ctx) {
+        if (!_stricmp(fileExt, ".ttc"))
+            parseTTCs(ctx, fl, path);
+        else if (!_stricmp(fileExt, ".ttf") || !_stricmp(fileExt, ".otf"))
+            parseTTFs(ctx, fl, path);
+    }
+    fz_catch(ctx) {
+        // ignore errors occurring while parsing a given font file
+    }
+}
+
+static void extend_system_font_list(fz_context* ctx, pdf_fontlistMS* fl, const WCHAR* path) {
     WCHAR szPath[MAX_PATH], *lpFileName;
     WIN32_FIND_DATA FileData;
     HANDLE hList;
@@ -433,7 +555,7 @@ static void extend_system_font_list(fz_context* ctx, const WCHAR* path) {
     }
     do {
         if (!(FileData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
-            char szPathUtf8[MAX_PATH], *fileExt;
+            char szPathUtf8[MAX_PATH];
             int res;
             lstrcpyn(lpFileName, FileData.cFileName, szPath + MAX_PATH - lpFileName);
             res = WideCharToMultiByte(CP_UTF8, 0, szPath, -1, szPathUtf8, sizeof(szPathUtf8), NULL, NULL);
@@ -441,21 +563,255 @@ static void extend_system_font_list(fz_context* ctx, const WCHAR* path) {
                 fz_warn(ctx, "WideCharToMultiByte failed for %S", szPath);
                 continue;
             }
-            fileExt = szPathUtf8 + strlen(szPathUtf8) - 4;
-            fz_try(ctx) {
-                if (!_stricmp(fileExt, ".ttc"))
-                    parseTTCs(ctx, szPathUtf8);
-                else if (!_stricmp(fileExt, ".ttf") || !_stricmp(fileExt, ".otf"))
-                    parseTTFs(ctx, szPathUtf8);
-            }
-            fz_catch(ctx) {
-                // ignore errors occurring while parsing a given font file
-            }
+            parse_font_file(ctx, fl, szPathUtf8);
         }
     } while (FindNextFile(hList, &FileData));
     FindClose(hList);
 }
 
+static void append_font_file(fz_context* ctx, font_file_list* list, const char* name, ULONGLONG size,
+                             ULONGLONG mtime, int first_face) {
+    font_file_info* fi;
+    if (list->len == list->cap) {
+        int newcap = list->cap ? list->cap * 2 : 256;
+        font_file_info* newfiles = (font_file_info*)realloc(list->files, newcap * sizeof(font_file_info));
+        if (!newfiles)
+            fz_throw(ctx, FZ_ERROR_GENERIC, "OOM in append_font_file");
+        list->files = newfiles;
+        list->cap = newcap;
+    }
+    fi = &list->files[list->len++];
+    fz_strlcpy(fi->name, name, sizeof(fi->name));
+    fi->size = size;
+    fi->mtime = mtime;
+    fi->first_face = first_face;
+    fi->n_faces = 0;
+}
+
+typedef struct {
+    const BYTE* data;
+    size_t left;
+    int ok;
+} font_index_reader;
+
+static const BYTE* read_font_index(font_index_reader* r, size_t n) {
+    const BYTE* d = r->data;
+    if (!r->ok || r->left < n) {
+        r->ok = 0;
+        return NULL;
+    }
+    r->data += n;
+    r->left -= n;
+    return d;
+}
+
+static ULONGLONG read_font_index_num(font_index_reader* r, size_t n) {
+    ULONGLONG v = 0;
+    const BYTE* d = read_font_index(r, n);
+    if (d)
+        memcpy(&v, d, n);
+    return v;
+}
+
+// reads a string of at most size - 1 bytes
+static void read_font_index_str(font_index_reader* r, char* buf, size_t size) {
+    size_t len = (size_t)read_font_index_num(r, 2);
+    const BYTE* d = read_font_index(r, len);
+    if (!d || len >= size) {
+        r->ok = 0;
+        buf[0] = '\0';
+        return;
+    }
+    memcpy(buf, d, len);
+    buf[len] = '\0';
+}
+
+static void write_font_index_num(FILE* f, ULONGLONG v, size_t n) {
+    fwrite(&v, n, 1, f);
+}
+
+static void write_font_index_str(FILE* f, const char* s) {
+    size_t len = strlen(s);
+    write_font_index_num(f, len, 2);
+    fwrite(s, 1, len, f);
+}
+
+/* The index is:
+   u32 magic, u32 number of files, string font directory
+   for each file: string file name, u64 size, u64 modification time, u16 number of faces
+     for each face: string face name, u32 index within a .ttc
+   with strings being a u16 length followed by UTF-8 */
+static int load_font_index(fz_context* ctx, const WCHAR* index_path, const char* dir, font_file_list* files,
+                           pdf_fontlistMS* faces) {
+    FILE* f;
+    BYTE* data = NULL;
+    long size;
+    font_index_reader r;
+    char name[MAX_PATH], path[MAX_PATH];
+    ULONG n_files, i, j;
+
+    f = _wfopen(index_path, L"rb");
+    if (!f)
+        return 0;
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if (size > 0)
+        data = (BYTE*)malloc(size);
+    if (data && fread(data, 1, size, f) != (size_t)size) {
+        free(data);
+        data = NULL;
+    }
+    fclose(f);
+    if (!data)
+        return 0;
+
+    r.data = data;
+    r.left = size;
+    r.ok = 1;
+    if (read_font_index_num(&r, 4) != FONT_INDEX_MAGIC)
+        r.ok = 0;
+    n_files = (ULONG)read_font_index_num(&r, 4);
+    read_font_index_str(&r, path, sizeof(path));
+    // the index is only valid for the directory it was built for
+    if (r.ok && _stricmp(path, dir) != 0)
+        r.ok = 0;
+    for (i = 0; i < n_files && r.ok; i++) {
+        ULONGLONG file_size, mtime;
+        ULONG n_faces;
+        read_font_index_str(&r, name, sizeof(name));
+        file_size = read_font_index_num(&r, 8);
+        mtime = read_font_index_num(&r, 8);
+        n_faces = (ULONG)read_font_index_num(&r, 2);
+        if (!r.ok)
+            break;
+        append_font_file(ctx, files, name, file_size, mtime, faces->len);
+        fz_snprintf(path, sizeof(path), "%s\\%s", dir, name);
+        for (j = 0; j < n_faces && r.ok; j++) {
+            int index;
+            read_font_index_str(&r, name, MAX_FACENAME);
+            index = (int)read_font_index_num(&r, 4);
+            if (r.ok)
+                append_mapping(ctx, faces, name, path, index);
+        }
+        files->files[files->len - 1].n_faces = faces->len - files->files[files->len - 1].first_face;
+    }
+    free(data);
+    if (!r.ok || r.left != 0) {
+        files->len = 0;
+        faces->len = 0;
+        return 0;
+    }
+    // sort the files, so that they can be searched binarily
+    qsort(files->files, files->len, sizeof(font_file_info), _stricmp);
+    return 1;
+}
+
+static void save_font_index(const WCHAR* index_path, const char* dir, font_file_list* files, pdf_fontlistMS* faces) {
+    WCHAR tmp_path[MAX_PATH + 4];
+    FILE* f;
+    int i, j, ok;
+
+    // write to a temporary file first, so that an interrupted write doesn't leave a broken index
+    if (wcslen(index_path) >= MAX_PATH)
+        return;
+    swprintf_s(tmp_path, nelem(tmp_path), L"%s.tmp", index_path);
+    f = _wfopen(tmp_path, L"wb");
+    if (!f)
+        return;
+    write_font_index_num(f, FONT_INDEX_MAGIC, 4);
+    write_font_index_num(f, files->len, 4);
+    write_font_index_str(f, dir);
+    for (i = 0; i < files->len; i++) {
+        font_file_info* fi = &files->files[i];
+        write_font_index_str(f, fi->name);
+        write_font_index_num(f, fi->size, 8);
+        write_font_index_num(f, fi->mtime, 8);
+        write_font_index_num(f, fi->n_faces, 2);
+        for (j = fi->first_face; j < fi->first_face + fi->n_faces; j++) {
+            write_font_index_str(f, faces->fontmap[j].fontface);
+            write_font_index_num(f, faces->fontmap[j].index, 4);
+        }
+    }
+    ok = !ferror(f);
+    ok = fclose(f) == 0 && ok;
+    if (!ok || !MoveFileExW(tmp_path, index_path, MOVEFILE_REPLACE_EXISTING))
+        DeleteFileW(tmp_path);
+}
+
+/* Adds the faces of all fonts in dir to fl. Only font files that are new or
+   have changed size or modification time since the index at index_path
+   (if not NULL) was saved have to be parsed, which is what takes most of
+   the time with hundreds of fonts. The index is updated if needed. */
+static void index_font_dir(fz_context* ctx, pdf_fontlistMS* fl, const WCHAR* dir, const WCHAR* index_path) {
+    WCHAR pattern[MAX_PATH];
+    char dirUtf8[MAX_PATH], path[MAX_PATH], name[MAX_PATH];
+    WIN32_FIND_DATA FileData;
+    HANDLE hList;
+    font_file_list cached_files = {NULL, 0, 0};
+    pdf_fontlistMS cached_faces = {NULL, 0, 0, NULL, 0};
+    font_file_list files = {NULL, 0, 0};
+    int changed = 1;
+
+    if (wcslen(dir) + 7 > nelem(pattern))
+        return;
+    swprintf_s(pattern, nelem(pattern), L"%s\\*.?t?", dir);
+    if (!WideCharToMultiByte(CP_UTF8, 0, dir, -1, dirUtf8, sizeof(dirUtf8), NULL, NULL))
+        return;
+
+    fz_var(changed);
+    fz_try(ctx) {
+        if (index_path)
+            changed = !load_font_index(ctx, index_path, dirUtf8, &cached_files, &cached_faces);
+
+        hList = FindFirstFile(pattern, &FileData);
+        if (hList != INVALID_HANDLE_VALUE) {
+            do {
+                ULONGLONG size, mtime;
+                font_file_info* cached;
+                font_file_info* fi;
+                int i;
+                if (FileData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+                    continue;
+                if (!WideCharToMultiByte(CP_UTF8, 0, FileData.cFileName, -1, name, sizeof(name), NULL, NULL))
+                    continue;
+                if (fz_snprintf(path, sizeof(path), "%s\\%s", dirUtf8, name) >= sizeof(path))
+                    continue;
+                size = ((ULONGLONG)FileData.nFileSizeHigh << 32) | FileData.nFileSizeLow;
+                mtime = ((ULONGLONG)FileData.ftLastWriteTime.dwHighDateTime << 32) |
+                        FileData.ftLastWriteTime.dwLowDateTime;
+
+                append_font_file(ctx, &files, name, size, mtime, fl->len);
+                fi = &files.files[files.len - 1];
+                cached = (font_file_info*)bsearch(name, cached_files.files, cached_files.len,
+                                                  sizeof(font_file_info), _stricmp);
+                if (cached && cached->size == size && cached->mtime == mtime) {
+                    for (i = cached->first_face; i < cached->first_face + cached->n_faces; i++)
+                        append_mapping(ctx, fl, cached_faces.fontmap[i].fontface, path, cached_faces.fontmap[i].index);
+                } else {
+                    parse_font_file(ctx, fl, path);
+                    changed = 1;
+                }
+                fi->n_faces = fl->len - fi->first_face;
+            } while (!abort_font_index && FindNextFile(hList, &FileData));
+            FindClose(hList);
+        }
+        // were files removed?
+        if (files.len != cached_files.len)
+            changed = 1;
+        if (index_path && changed && !abort_font_index)
+            save_font_index(index_path, dirUtf8, &files, fl);
+    }
+    fz_always(ctx) {
+        free(cached_files.files);
+        free(cached_faces.fontmap);
+        free(files.files);
+    }
+    fz_catch(ctx) {
+        fz_rethrow(ctx);
+    }
+}
+
 // cf. https://blogs.msdn.com/b/oldnewthing/archive/2004/10/25/247180.aspx
 EXTERN_C IMAGE_DOS_HEADER __ImageBase;
 #define CURRENT_HMODULE ((HMODULE)&__ImageBase)
@@ -466,8 +822,8 @@ static void create_system_font_list(fz_context* ctx) {
 
     cch = GetWindowsDirectory(szFontDir, nelem(szFontDir) - 12);
     if (0 < cch && cch < nelem(szFontDir) - 12) {
-        wcscat_s(szFontDir, MAX_PATH, L"\\Fonts\\*.?t?");
-        extend_system_font_list(ctx, szFontDir);
+        wcscat_s(szFontDir, MAX_PATH, L"\\Fonts");
+        index_font_dir(ctx, &fontlistMS, szFontDir, font_index_path);
     }
 
     if (fontlistMS.len == 0)
@@ -483,12 +839,11 @@ static void create_system_font_list(fz_context* ctx) {
         szFontDir[nelem(szFontDir) - 1] = '\0';
         GetFullPathNameW(szFontDir, MAX_PATH, szFile, &lpFileName);
         lstrcpyn(lpFileName, L"DroidSansFallback.ttf", szFile + MAX_PATH - lpFileName);
-        extend_system_font_list(ctx, szFile);
+        extend_system_font_list(ctx, &fontlistMS, szFile);
     }
 #endif
 
-    // sort the font list, so that it can be searched binarily
-    qsort((void*)fontlistMS.fontmap, (size_t)fontlistMS.len, sizeof(sys_font_info), _stricmp);
+    build_font_lookup(ctx, &fontlistMS);
 
 #ifdef DEBUG
     // allow to overwrite system fonts for debugging purposes
@@ -496,18 +851,44 @@ static void create_system_font_list(fz_context* ctx) {
     cch = GetEnvironmentVariable(L"MUPDF_FONTS_PATTERN", szFontDir, nelem(szFontDir));
     if (0 < cch && cch < nelem(szFontDir)) {
         int i, prev_len = fontlistMS.len;
-        extend_system_font_list(ctx, szFontDir);
+        extend_system_font_list(ctx, &fontlistMS, szFontDir);
         for (i = prev_len; i < fontlistMS.len; i++) {
-            sys_font_info* entry = bsearch(fontlistMS.fontmap[i].fontface, fontlistMS.fontmap, prev_len,
-                                           sizeof(sys_font_info), lookup_compare);
+            sys_font_info* entry = pdf_find_windows_font_path(fontlistMS.fontmap[i].fontface);
             if (entry)
                 *entry = fontlistMS.fontmap[i];
         }
-        qsort(fontlistMS.fontmap, fontlistMS.len, sizeof(sys_font_info), _stricmp);
+        build_font_lookup(ctx, &fontlistMS);
     }
 #endif
 }
 
+// must be called inside cs_fonts
+static void ensure_system_font_list(fz_context* ctx) {
+    if (did_create_list)
+        return;
+    fz_try(ctx) {
+        create_system_font_list(ctx);
+    }
+    fz_catch(ctx) {
+    }
+    // an aborted index is incomplete, so build it again if it's needed after all
+    did_create_list = !abort_font_index;
+    if (abort_font_index)
+        fontlistMS.len = 0;
+}
+
+static DWORD WINAPI font_index_thread_proc(LPVOID data) {
+    fz_context* ctx = fz_new_context(NULL, NULL, FZ_STORE_UNLIMITED);
+    (void)data;
+    if (!ctx)
+        return 1;
+    EnterCriticalSection(&cs_fonts);
+    ensure_system_font_list(ctx);
+    LeaveCriticalSection(&cs_fonts);
+    fz_drop_context(ctx);
+    return 0;
+}
+
 // TODO(port): replace the caller
 static void* fz_resize_array(fz_context* ctx, void* p, unsigned int count, unsigned int size) {
     void* np = fz_realloc(ctx, p, count * size);
@@ -577,14 +958,9 @@ static fz_font* pdf_load_windows_font_by_name(fz_context* ctx, const char* orig_
     fz_font* font;
     fz_buffer* buffer;
 
+    // waits for start_system_font_index() to finish
     EnterCriticalSection(&cs_fonts);
-    if (fontlistMS.len == 0) {
-        fz_try(ctx) {
-            create_system_font_list(ctx);
-        }
-        fz_catch(ctx) {
-        }
-    }
+    ensure_system_font_list(ctx);
     LeaveCriticalSection(&cs_fonts);
 
     if (fontlistMS.len == 0)
@@ -789,11 +1165,56 @@ void init_system_font_list(void) {
 }
 
 void destroy_system_font_list(void) {
+    if (font_index_thread) {
+        InterlockedExchange(&abort_font_index, 1);
+        WaitForSingleObject(font_index_thread, INFINITE);
+        CloseHandle(font_index_thread);
+        font_index_thread = NULL;
+    }
     free(fontlistMS.fontmap);
+    free(fontlistMS.lookup);
     memset(&fontlistMS, 0, sizeof(fontlistMS));
+    free(font_index_path);
+    font_index_path = NULL;
     DeleteCriticalSection(&cs_fonts);
 }
 
+// builds the list of system fonts on a background thread, so that it's usually
+// ready by the time a document needs a non-embedded font. The index of the
+// font directory is saved to index_path (if not NULL) to speed up the next start
+void start_system_font_index(const WCHAR* index_path) {
+    init_system_font_list();
+    if (font_index_thread)
+        return;
+    EnterCriticalSection(&cs_fonts);
+    free(font_index_path);
+    font_index_path = index_path ? _wcsdup(index_path) : NULL;
+    LeaveCriticalSection(&cs_fonts);
+    font_index_thread = CreateThread(NULL, 0, font_index_thread_proc, NULL, 0, NULL);
+}
+
+// returns the number of font faces in dir (or -1 on error), using and updating
+// the index at index_path (if not NULL). For benchmarking, with any font directory
+int index_fonts_in_dir(const WCHAR* dir, const WCHAR* index_path) {
+    pdf_fontlistMS fl = {NULL, 0, 0, NULL, 0};
+    int n = -1;
+    fz_context* ctx = fz_new_context(NULL, NULL, FZ_STORE_UNLIMITED);
+    if (!ctx)
+        return -1;
+    fz_var(n);
+    fz_try(ctx) {
+        index_font_dir(ctx, &fl, dir, index_path);
+        build_font_lookup(ctx, &fl);
+        n = fl.len;
+    }
+    fz_catch(ctx) {
+    }
+    free(fl.fontmap);
+    free(fl.lookup);
+    fz_drop_context(ctx);
+    return n;
+}
+
 void pdf_install_load_system_font_funcs(fz_context* ctx) {
 #ifdef _WIN32
     // TODO(port): also fallback font?
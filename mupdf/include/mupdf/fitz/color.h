@@ -378,6 +378,44 @@ void fz_set_default_rgb(fz_context *ctx, fz_default_colorspaces *default_cs, fz_
 void fz_set_default_cmyk(fz_context *ctx, fz_default_colorspaces *default_cs, fz_colorspace *cs);
 void fz_set_default_output_intent(fz_context *ctx, fz_default_colorspaces *default_cs, fz_colorspace *cs);
 
+/**
+	Statistics of the color conversions done with a context (and
+	its clones), see fz_get_color_conversion_stats.
+
+	links_created: ICC links (transforms) that had to be built,
+	taking link_ms in total.
+
+	identity_links: links that turned out to leave colors unchanged
+	(give or take 1 in 8-bit). Pixmaps converted with them bypass
+	the color management engine.
+
+	link_lookups, link_cache_hits: links that were asked for and
+	the ones found in the cache of most recently used links.
+
+	pixmaps, pixels: pixmaps converted, taking convert_ms in total
+	(including the time to build links). fast_pixmaps were converted
+	without the color management engine, lut_pixmaps with a lookup
+	table built from an ICC link.
+*/
+typedef struct
+{
+	int links_created;
+	int identity_links;
+	int64_t link_lookups;
+	int64_t link_cache_hits;
+	int64_t pixmaps;
+	int64_t fast_pixmaps;
+	int64_t lut_pixmaps;
+	int64_t pixels;
+	double link_ms;
+	double convert_ms;
+} fz_color_conversion_stats;
+
+/**
+	Get the color conversion counters. They are cumulative.
+*/
+void fz_get_color_conversion_stats(fz_context *ctx, fz_color_conversion_stats *stats);
+
 /* Implementation details: subject to change. */
 
 struct fz_colorspace
@@ -608,6 +608,8 @@ struct fz_context
 	int icc_enabled;
 #endif
 	int throw_on_repair;
+	/* see pdf_set_repair_cache() */
+	struct pdf_repair_cache *repair_cache;
 
 	/* TODO: should these be unshared? */
 	fz_document_handler_context *handler;
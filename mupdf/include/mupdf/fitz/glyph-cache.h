@@ -73,6 +73,39 @@ void fz_prepare_t3_glyph(fz_context *ctx, fz_font *font, int gid);
 */
 void fz_dump_glyph_cache_stats(fz_context *ctx, fz_output *out);
 
+/**
+	Statistics of the glyph cache, see fz_get_glyph_cache_stats.
+*/
+typedef struct
+{
+	size_t size;
+	size_t max_size;
+	int max_glyph_size;
+	int entries;
+	int buckets;
+	int64_t hits;
+	int64_t misses;
+	int64_t evictions;
+} fz_glyph_cache_stats;
+
+/**
+	Set the budget of the glyph cache (in bytes) and the size (in
+	pixels) up to which glyphs are cached. Glyphs are evicted
+	immediately if the cache is larger than the new budget.
+
+	max_size: 0 for the default budget (1 MB).
+
+	max_glyph_size: 0 for the default (256 pixels). Larger glyphs
+	are drawn as paths (or not cached at all for type3 fonts).
+*/
+void fz_set_glyph_cache_limits(fz_context *ctx, size_t max_size, int max_glyph_size);
+
+/**
+	Get the current size and hit/miss/eviction counters of the
+	glyph cache. The counters are cumulative.
+*/
+void fz_get_glyph_cache_stats(fz_context *ctx, fz_glyph_cache_stats *stats);
+
 /**
 	Perform subpixel quantisation and adjustment on a glyph matrix.
 
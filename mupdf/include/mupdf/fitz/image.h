@@ -412,6 +412,33 @@ void fz_set_pixmap_image_tile(fz_context *ctx, fz_pixmap_image *cimg, fz_pixmap
 */
 fz_pixmap *fz_load_jpx(fz_context *ctx, const unsigned char *data, size_t size, fz_colorspace *cs);
 
+/**
+	Decode a JPEG 2000 image at a lower resolution by skipping
+	resolution levels. l2factor (may be NULL) is the number of
+	times the image may be halved on input, and the number of
+	times it still needs to be halved on output.
+*/
+fz_pixmap *fz_load_jpx_reduced(fz_context *ctx, const unsigned char *data, size_t size, fz_colorspace *cs, int *l2factor);
+
+/**
+	Create an image that decodes the JPEG 2000 data in buffer each
+	time it's needed, at the lowest resolution that's good enough
+	for the scale it's drawn at. decode (may be NULL) has
+	FZ_MAX_COLORS * 2 entries.
+
+	Returns NULL if the image doesn't match the (non-indexed)
+	colorspace cs, in which case it should be decoded with
+	fz_load_jpx.
+*/
+fz_image *fz_new_image_from_jpx_buffer(fz_context *ctx, fz_buffer *buffer, fz_colorspace *cs, const float *decode, fz_image *mask);
+
+/**
+	Set the number of threads used to decode a JPEG 2000 image
+	(for all contexts). 0 means one per cpu, 1 decodes on the
+	calling thread only.
+*/
+void fz_set_jpx_threads(fz_context *ctx, int threads);
+
 /**
 	Exposed for CBZ.
 */
@@ -173,6 +173,37 @@ void pdf_repair_xref(fz_context *ctx, pdf_document *doc);
 void pdf_repair_obj_stms(fz_context *ctx, pdf_document *doc);
 void pdf_repair_trailer(fz_context *ctx, pdf_document *doc);
 
+/*
+	Reconstructing the xref of a broken file means scanning the
+	whole file, which can take seconds for big files. A repair
+	cache lets the caller keep the result of a repair (xref,
+	trailer and object stream map) when a document is opened and
+	hand it back the next time the same file is opened.
+
+	load returns the data passed to save for this file (or NULL).
+	The data is checked against the length and the beginning and
+	end of the file and ignored if it doesn't match, so the caller
+	only needs to key it by e.g. file path and modification time.
+
+	The cache is used by documents opened while it is set, pass
+	NULL to stop using it. The caller owns the structure.
+*/
+typedef struct pdf_repair_cache
+{
+	void *opaque;
+	fz_buffer *(*load)(fz_context *ctx, void *opaque);
+	void (*save)(fz_context *ctx, void *opaque, fz_buffer *data);
+} pdf_repair_cache;
+
+void pdf_set_repair_cache(fz_context *ctx, pdf_repair_cache *cache);
+
+/*
+	Used by pdf_init_document. Restore the xref from the repair cache
+	(returns 0 if there's no matching data) or save it after a repair.
+*/
+int pdf_load_cached_repair(fz_context *ctx, pdf_document *doc);
+void pdf_save_cached_repair(fz_context *ctx, pdf_document *doc);
+
 /*
 	Ensure that the current populating xref has a single subsection
 	that covers the entire range.
@@ -67,8 +67,18 @@ fz_icc_link *fz_find_icc_link(fz_context *ctx,
 	int format,
 	int copy_spots,
 	int premult);
+void fz_drop_icc_link_unstored(fz_context *ctx, fz_icc_link *link);
+fz_icc_link *fz_keep_icc_link_locked(fz_context *ctx, fz_icc_link *link);
+int fz_icc_link_is_identity(fz_context *ctx, fz_icc_link *link);
 void fz_icc_transform_color(fz_context *ctx, fz_color_converter *cc, const float *src, float *dst);
-void fz_icc_transform_pixmap(fz_context *ctx, fz_icc_link *link, const fz_pixmap *src, fz_pixmap *dst, int copy_spots);
+/* Returns 1 if the pixmap was converted with a lookup table. */
+int fz_icc_transform_pixmap(fz_context *ctx, fz_icc_link *link, const fz_pixmap *src, fz_pixmap *dst, int copy_spots);
+
+/*
+	Most recently used links, kept in addition to the store
+	(which may evict them).
+*/
+typedef struct fz_pinned_links fz_pinned_links;
 
 #endif
 
@@ -93,7 +103,9 @@ struct fz_colorspace_context
 	fz_colorspace *gray, *rgb, *bgr, *cmyk, *lab;
 #if FZ_ENABLE_ICC
 	void *icc_instance;
+	fz_pinned_links *pinned_links;
 #endif
+	fz_color_conversion_stats stats;
 };
 
 void fz_drop_colorspace_store_key(fz_context *ctx, fz_colorspace *cs);
@@ -142,8 +142,16 @@ struct fz_icc_link
 {
 	fz_storable storable;
 	void *handle;
+	/* the link (nearly) leaves colors unchanged, see fz_icc_link_is_near_identity */
+	int identity;
+	/* all 256 levels of a 1 channel 8-bit source, built on first use */
+	unsigned char *lut;
 };
 
+/* Pixmaps smaller than this are transformed directly rather than
+ * building a lookup table for them. */
+#define FZ_ICC_LUT_MIN_PIXELS 4096
+
 #ifdef HAVE_LCMS2MT
 
 static void fz_lcms_log_error(cmsContext id, cmsUInt32Number error_code, const char *error_text)
@@ -273,6 +281,7 @@ void fz_drop_icc_link_imp(fz_context *ctx, fz_storable *storable)
 	GLOINIT
 	fz_icc_link *link = (fz_icc_link*)storable;
 	cmsDeleteTransform(GLO link->handle);
+	fz_free(ctx, link->lut);
 	fz_free(ctx, link);
 }
 
@@ -281,6 +290,105 @@ void fz_drop_icc_link(fz_context *ctx, fz_icc_link *link)
 	fz_drop_storable(ctx, &link->storable);
 }
 
+/* For references that outlive the store (fz_drop_storable needs it). */
+void fz_drop_icc_link_unstored(fz_context *ctx, fz_icc_link *link)
+{
+	if (fz_drop_imp(ctx, link, &link->storable.refs))
+		fz_drop_icc_link_imp(ctx, &link->storable);
+}
+
+/* Must be called with FZ_LOCK_ALLOC held. */
+fz_icc_link *fz_keep_icc_link_locked(fz_context *ctx, fz_icc_link *link)
+{
+	return fz_keep_imp_locked(ctx, link, &link->storable.refs);
+}
+
+int fz_icc_link_is_identity(fz_context *ctx, fz_icc_link *link)
+{
+	return link->identity;
+}
+
+/* Transforms all gray levels (or a grid over the color cube) and checks
+ * whether any component changes by more than 1. Links between different
+ * profiles for the same space (e.g. an embedded sRGB profile and our own)
+ * often do nothing more than that, and then aren't worth running. */
+static int
+fz_icc_link_is_near_identity(fz_context *ctx, cmsHTRANSFORM transform, int n, int extras)
+{
+	GLOINIT
+	int steps, count, pn, i, k, v;
+	unsigned char *src, *dst, *s;
+	int identity = 1;
+
+	switch (n)
+	{
+	case 1: steps = 256; break;
+	case 3: steps = 17; break;
+	case 4: steps = 9; break;
+	default: return 0;
+	}
+	for (count = 1, k = 0; k < n; k++)
+		count *= steps;
+	pn = n + extras;
+
+	src = fz_malloc_no_throw(ctx, (size_t)count * pn * 2);
+	if (!src)
+		return 0;
+	dst = src + (size_t)count * pn;
+	for (i = 0, s = src; i < count; i++)
+	{
+		for (k = 0, v = i; k < n; k++, v /= steps)
+			*s++ = (unsigned char)(v % steps * 255 / (steps - 1));
+		for (k = 0; k < extras; k++)
+			*s++ = 255;
+	}
+	cmsDoTransform(GLO transform, src, dst, count);
+	for (i = 0; i < count * pn; i++)
+	{
+		if (src[i] - dst[i] > 1 || dst[i] - src[i] > 1)
+		{
+			identity = 0;
+			break;
+		}
+	}
+	fz_free(ctx, src);
+	return identity;
+}
+
+static unsigned char *
+fz_icc_link_lut(fz_context *ctx, fz_icc_link *link, int dn)
+{
+	GLOINIT
+	unsigned char levels[256];
+	unsigned char *lut, *installed;
+	int i;
+
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	lut = link->lut;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+	if (lut)
+		return lut;
+
+	lut = fz_malloc_no_throw(ctx, 256 * dn);
+	if (!lut)
+		return NULL;
+	for (i = 0; i < 256; i++)
+		levels[i] = i;
+	cmsDoTransform(GLO link->handle, levels, lut, 256);
+
+	/* Another thread may have built it in the meantime. */
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	if (!link->lut)
+	{
+		link->lut = lut;
+		lut = NULL;
+	}
+	installed = link->lut;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+	fz_free(ctx, lut);
+	return installed;
+}
+
 fz_icc_link *
 fz_new_icc_link(fz_context *ctx,
 	fz_colorspace *src, int src_extras,
@@ -401,6 +509,11 @@ fz_new_icc_link(fz_context *ctx,
 		link = fz_malloc_struct(ctx, fz_icc_link);
 		FZ_INIT_STORABLE(link, 1, fz_drop_icc_link_imp);
 		link->handle = transform;
+		/* Only 8-bit links between the same kind of space are checked. The
+		 * extra channels of BGR are swapped to the front, so they're left out. */
+		if (!format && !prf_pro && src->type == dst->type && src->type != FZ_COLORSPACE_LAB &&
+			src_extras == dst_extras && !(src_bgr && src_extras > 0))
+			link->identity = fz_icc_link_is_near_identity(ctx, transform, src->n, src_extras);
 	}
 	fz_catch(ctx)
 	{
@@ -439,7 +552,7 @@ fz_icc_transform_color(fz_context *ctx, fz_color_converter *cc, const float *src
 #endif
 }
 
-void
+int
 fz_icc_transform_pixmap(fz_context *ctx, fz_icc_link *link, const fz_pixmap *src, fz_pixmap *dst, int copy_spots)
 {
 	GLOINIT
@@ -471,6 +584,50 @@ fz_icc_transform_pixmap(fz_context *ctx, fz_icc_link *link, const fz_pixmap *src
 
 	inputpos = src->samples;
 	outputpos = dst->samples;
+
+	/* A 1 channel 8-bit source only has 256 possible values, so for anything
+	 * but small pixmaps a lookup table is quicker than running the transform
+	 * (and gives the same results).
+	 * 3 and 4 channel sources don't get a table: lcms already optimizes
+	 * 8-bit links into a grid that is evaluated with tetrahedral
+	 * interpolation (see PrelinEval8 and OptimizeByResampling in cmsopt.c),
+	 * so a grid of our own would do the same work and interpolate twice. */
+	if (sn == 1 && dn == dc && T_BYTES(src_format) == 1 && (int64_t)sw * h >= FZ_ICC_LUT_MIN_PIXELS)
+	{
+		unsigned char *lut = fz_icc_link_lut(ctx, link, dc);
+		if (lut)
+		{
+			for (; h > 0; h--)
+			{
+				const unsigned char *s = inputpos;
+				unsigned char *d = outputpos;
+				int x, k;
+				if (dc == 3)
+				{
+					for (x = 0; x < sw; x++, d += 3)
+					{
+						const unsigned char *c = lut + 3 * *s++;
+						d[0] = c[0];
+						d[1] = c[1];
+						d[2] = c[2];
+					}
+				}
+				else
+				{
+					for (x = 0; x < sw; x++)
+					{
+						const unsigned char *c = lut + dc * *s++;
+						for (k = 0; k < dc; k++)
+							*d++ = c[k];
+					}
+				}
+				inputpos += ss;
+				outputpos += ds;
+			}
+			return 1;
+		}
+	}
+
 	/* LCMS can only handle premultiplied data if the number of 'extra'
 	 * channels is the same. If not, do it by steam. */
 	if (sa && cmm_extras != (int)T_EXTRA(dst_format))
@@ -505,6 +662,7 @@ fz_icc_transform_pixmap(fz_context *ctx, fz_icc_link *link, const fz_pixmap *src
 		inputpos += ss;
 		outputpos += ds;
 	}
+	return 0;
 }
 
 #endif
@@ -27,6 +27,36 @@
 #include <assert.h>
 #include <math.h>
 #include <string.h>
+#include <time.h>
+
+/* High resolution clock for the color conversion stats. */
+static double fz_color_clock_ms(void)
+{
+	struct timespec ts;
+	if (!timespec_get(&ts, TIME_UTC))
+		return 0;
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static void fz_record_color_conversion(fz_context *ctx, double start, int64_t pixels, int fast, int lut)
+{
+	double ms = fz_color_clock_ms() - start;
+	fz_colorspace_context *cct = ctx->colorspace;
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	cct->stats.pixmaps++;
+	cct->stats.fast_pixmaps += fast;
+	cct->stats.lut_pixmaps += lut;
+	cct->stats.pixels += pixels;
+	cct->stats.convert_ms += ms;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+}
+
+void fz_get_color_conversion_stats(fz_context *ctx, fz_color_conversion_stats *stats)
+{
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	*stats = ctx->colorspace->stats;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+}
 
 #if FZ_ENABLE_ICC
 
@@ -35,6 +65,9 @@
 #include "icc/cmyk.icc.h"
 #include "icc/lab.icc.h"
 
+static fz_pinned_links *fz_new_pinned_links(fz_context *ctx);
+static void fz_drop_pinned_links(fz_context *ctx, fz_pinned_links *pinned);
+
 void fz_new_colorspace_context(fz_context *ctx)
 {
 	fz_colorspace_context *cct;
@@ -51,6 +84,7 @@ void fz_new_colorspace_context(fz_context *ctx)
 
 	cct = ctx->colorspace = fz_malloc_struct(ctx, fz_colorspace_context);
 	cct->ctx_refs = 1;
+	cct->pinned_links = fz_new_pinned_links(ctx);
 
 	fz_new_icc_context(ctx);
 
@@ -134,6 +168,7 @@ void fz_drop_colorspace_context(fz_context *ctx)
 		fz_drop_colorspace(ctx, ctx->colorspace->cmyk);
 		fz_drop_colorspace(ctx, ctx->colorspace->lab);
 #if FZ_ENABLE_ICC
+		fz_drop_pinned_links(ctx, ctx->colorspace->pinned_links);
 		fz_drop_icc_context(ctx);
 #endif
 		fz_free(ctx, ctx->colorspace);
@@ -809,6 +844,85 @@ static fz_store_type fz_link_store_type =
 	NULL
 };
 
+/* Links take milliseconds to build and the store evicts them just like
+ * anything else when it fills up (e.g. with decoded images), so the most
+ * recently used ones are kept alive here as well. They belong to the lcms
+ * instance of the context, so this can't be shared between unrelated
+ * contexts. */
+
+#define FZ_MAX_PINNED_LINKS 16
+
+typedef struct
+{
+	fz_link_key key;
+	fz_icc_link *link;
+} fz_pinned_link;
+
+struct fz_pinned_links
+{
+	int len;
+	fz_pinned_link items[FZ_MAX_PINNED_LINKS];
+};
+
+static fz_pinned_links *fz_new_pinned_links(fz_context *ctx)
+{
+	return fz_malloc_struct(ctx, fz_pinned_links);
+}
+
+/* Called after the store has been dropped. */
+static void fz_drop_pinned_links(fz_context *ctx, fz_pinned_links *pinned)
+{
+	int i;
+	if (!pinned)
+		return;
+	for (i = 0; i < pinned->len; i++)
+		fz_drop_icc_link_unstored(ctx, pinned->items[i].link);
+	fz_free(ctx, pinned);
+}
+
+/* Returns a new reference to a pinned link (moving it to the front) or NULL.
+ * Must be called with FZ_LOCK_ALLOC held. */
+static fz_icc_link *
+fz_find_pinned_link_locked(fz_context *ctx, fz_pinned_links *pinned, fz_link_key *key)
+{
+	fz_pinned_link found;
+	int i;
+	for (i = 0; i < pinned->len; i++)
+	{
+		if (fz_cmp_link_key(ctx, &pinned->items[i].key, key))
+		{
+			found = pinned->items[i];
+			memmove(&pinned->items[1], &pinned->items[0], i * sizeof(fz_pinned_link));
+			pinned->items[0] = found;
+			return fz_keep_icc_link_locked(ctx, found.link);
+		}
+	}
+	return NULL;
+}
+
+/* Returns the least recently used link if it had to make room for this
+ * one, to be dropped once the lock is released. Must be called with
+ * FZ_LOCK_ALLOC held. */
+static fz_icc_link *
+fz_pin_link_locked(fz_context *ctx, fz_pinned_links *pinned, fz_link_key *key, fz_icc_link *link)
+{
+	fz_icc_link *evicted = NULL;
+	int i;
+
+	/* Another thread may have pinned it in the meantime. */
+	for (i = 0; i < pinned->len; i++)
+		if (fz_cmp_link_key(ctx, &pinned->items[i].key, key))
+			return NULL;
+
+	if (pinned->len == FZ_MAX_PINNED_LINKS)
+		evicted = pinned->items[--pinned->len].link;
+	memmove(&pinned->items[1], &pinned->items[0], pinned->len * sizeof(fz_pinned_link));
+	pinned->items[0].key = *key;
+	pinned->items[0].link = fz_keep_icc_link_locked(ctx, link);
+	pinned->len++;
+	return evicted;
+}
+
 fz_icc_link *
 fz_find_icc_link(fz_context *ctx,
 	fz_colorspace *src, int src_extras,
@@ -819,10 +933,14 @@ fz_find_icc_link(fz_context *ctx,
 	int copy_spots,
 	int premult)
 {
-	fz_icc_link *link, *old_link;
+	fz_colorspace_context *cct = ctx->colorspace;
+	fz_icc_link *link, *old_link, *evicted;
 	fz_link_key key, *new_key;
+	double start;
+	double link_ms = -1;
 
 	fz_var(link);
+	fz_var(link_ms);
 
 	/* Check the storable to see if we have a copy. */
 	key.refs = 1;
@@ -836,6 +954,15 @@ fz_find_icc_link(fz_context *ctx,
 	key.proof = (prf != NULL);
 	key.bgr = (dst->type == FZ_COLORSPACE_BGR);
 
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	cct->stats.link_lookups++;
+	link = fz_find_pinned_link_locked(ctx, cct->pinned_links, &key);
+	if (link)
+		cct->stats.link_cache_hits++;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+	if (link)
+		return link;
+
 	link = fz_find_item(ctx, fz_drop_icc_link_imp, &key, &fz_link_store_type);
 	if (!link)
 	{
@@ -843,7 +970,9 @@ fz_find_icc_link(fz_context *ctx,
 		memcpy(new_key, &key, sizeof (fz_link_key));
 		fz_try(ctx)
 		{
+			start = fz_color_clock_ms();
 			link = fz_new_icc_link(ctx, src, src_extras, dst, dst_extras, prf, rend, format, copy_spots, premult);
+			link_ms = fz_color_clock_ms() - start;
 			old_link = fz_store_item(ctx, new_key, link, 1000, &fz_link_store_type);
 			if (old_link)
 			{
@@ -862,6 +991,18 @@ fz_find_icc_link(fz_context *ctx,
 			fz_rethrow(ctx);
 		}
 	}
+
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	if (link_ms >= 0)
+	{
+		cct->stats.links_created++;
+		cct->stats.link_ms += link_ms;
+		if (fz_icc_link_is_identity(ctx, link))
+			cct->stats.identity_links++;
+	}
+	evicted = fz_pin_link_locked(ctx, cct->pinned_links, &key, link);
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+	fz_drop_icc_link(ctx, evicted);
 	return link;
 }
 
@@ -1404,10 +1545,16 @@ fz_convert_pixmap_samples(fz_context *ctx, const fz_pixmap *src, fz_pixmap *dst,
 	fz_pixmap *base_idx = NULL;
 	fz_pixmap *base_sep = NULL;
 	fz_icc_link *link = NULL;
+	double start = fz_color_clock_ms();
+	int64_t pixels = (int64_t)src->w * src->h;
+	int fast = 1;
+	int lut = 0;
 
 	fz_var(link);
 	fz_var(base_idx);
 	fz_var(base_sep);
+	fz_var(fast);
+	fz_var(lut);
 
 	if (!ds)
 	{
@@ -1465,12 +1612,14 @@ fz_convert_pixmap_samples(fz_context *ctx, const fz_pixmap *src, fz_pixmap *dst,
 		/* Use slow conversion path for indexed. */
 		else if (ss->type == FZ_COLORSPACE_INDEXED)
 		{
+			fast = 0;
 			fz_convert_slow_pixmap_samples(ctx, src, dst, prf, params, copy_spots);
 		}
 
 		/* Use slow conversion path for separation. */
 		else if (ss->type == FZ_COLORSPACE_SEPARATION)
 		{
+			fast = 0;
 			fz_convert_slow_pixmap_samples(ctx, src, dst, prf, params, copy_spots);
 		}
 
@@ -1488,11 +1637,19 @@ fz_convert_pixmap_samples(fz_context *ctx, const fz_pixmap *src, fz_pixmap *dst,
 				 * fz_icc_transform_pixmap will have to do it by steam. */
 				int premult = src->alpha && (sx == dx) && effectively_copying_spots;
 				link = fz_find_icc_link(ctx, ss, sx, ds, dx, prf, params, 0, effectively_copying_spots, premult);
-				fz_icc_transform_pixmap(ctx, link, src, dst, effectively_copying_spots);
+				/* Handle near identity case (e.g. an embedded sRGB profile to ours). */
+				if (fz_icc_link_is_identity(ctx, link))
+					fz_convert_fast_pixmap_samples(ctx, src, dst, copy_spots);
+				else
+				{
+					fast = 0;
+					lut = fz_icc_transform_pixmap(ctx, link, src, dst, effectively_copying_spots);
+				}
 			}
 			fz_catch(ctx)
 			{
 				fz_warn(ctx, "falling back to fast color conversion");
+				fast = 1;
 				fz_convert_fast_pixmap_samples(ctx, src, dst, copy_spots);
 			}
 		}
@@ -1502,10 +1659,13 @@ fz_convert_pixmap_samples(fz_context *ctx, const fz_pixmap *src, fz_pixmap *dst,
 		fz_drop_icc_link(ctx, link);
 		fz_drop_pixmap(ctx, base_sep);
 		fz_drop_pixmap(ctx, base_idx);
+		fz_record_color_conversion(ctx, start, pixels, fast, lut);
 	}
 	fz_catch(ctx)
 		fz_rethrow(ctx);
 #else
+	double start = fz_color_clock_ms();
 	fz_convert_fast_pixmap_samples(ctx, src, dst, copy_spots);
+	fz_record_color_conversion(ctx, start, (int64_t)src->w * src->h, 1, 0);
 #endif
 }
@@ -27,11 +27,16 @@
 
 #include <string.h>
 #include <math.h>
+#include <limits.h>
 
+/* Defaults, see fz_set_glyph_cache_limits */
 #define MAX_GLYPH_SIZE 256
 #define MAX_CACHE_SIZE (1024*1024)
 
+/* Initial number of buckets, the hash table grows with the number of
+ * cached glyphs. */
 #define GLYPH_HASH_LEN 509
+#define GLYPH_HASH_MAX_LOAD 2
 
 typedef struct
 {
@@ -46,7 +51,7 @@ typedef struct
 typedef struct fz_glyph_cache_entry
 {
 	fz_glyph_key key;
-	unsigned hash;
+	unsigned hash; /* full hash, the bucket is hash % hash_len */
 	struct fz_glyph_cache_entry *lru_prev;
 	struct fz_glyph_cache_entry *lru_next;
 	struct fz_glyph_cache_entry *bucket_next;
@@ -58,11 +63,15 @@ struct fz_glyph_cache
 {
 	int refs;
 	size_t total;
-#ifndef NDEBUG
-	int num_evictions;
+	size_t max_size;
+	int max_glyph_size;
+	int num_entries;
+	int64_t hits;
+	int64_t misses;
+	int64_t num_evictions;
 	ptrdiff_t evicted;
-#endif
-	fz_glyph_cache_entry *entry[GLYPH_HASH_LEN];
+	int hash_len;
+	fz_glyph_cache_entry **entry;
 	fz_glyph_cache_entry *lru_head;
 	fz_glyph_cache_entry *lru_tail;
 };
@@ -81,7 +90,17 @@ fz_new_glyph_cache_context(fz_context *ctx)
 	fz_glyph_cache *cache;
 
 	cache = fz_malloc_struct(ctx, fz_glyph_cache);
+	fz_try(ctx)
+		cache->entry = fz_calloc(ctx, GLYPH_HASH_LEN, sizeof(fz_glyph_cache_entry *));
+	fz_catch(ctx)
+	{
+		fz_free(ctx, cache);
+		fz_rethrow(ctx);
+	}
+	cache->hash_len = GLYPH_HASH_LEN;
 	cache->total = 0;
+	cache->max_size = MAX_CACHE_SIZE;
+	cache->max_glyph_size = MAX_GLYPH_SIZE;
 	cache->refs = 1;
 
 	ctx->glyph_cache = cache;
@@ -106,7 +125,8 @@ drop_glyph_cache_entry(fz_context *ctx, fz_glyph_cache_entry *entry)
 	if (entry->bucket_prev)
 		entry->bucket_prev->bucket_next = entry->bucket_next;
 	else
-		cache->entry[entry->hash] = entry->bucket_next;
+		cache->entry[entry->hash % cache->hash_len] = entry->bucket_next;
+	cache->num_entries--;
 	fz_drop_font(ctx, entry->key.font);
 	fz_drop_glyph(ctx, entry->val);
 	fz_free(ctx, entry);
@@ -119,7 +139,7 @@ do_purge(fz_context *ctx)
 	fz_glyph_cache *cache = ctx->glyph_cache;
 	int i;
 
-	for (i = 0; i < GLYPH_HASH_LEN; i++)
+	for (i = 0; i < cache->hash_len; i++)
 	{
 		while (cache->entry[i])
 			drop_glyph_cache_entry(ctx, cache->entry[i]);
@@ -128,6 +148,86 @@ do_purge(fz_context *ctx)
 	cache->total = 0;
 }
 
+/* The glyph cache lock is always held when this function is called. */
+static void
+evict_to_fit(fz_context *ctx)
+{
+	fz_glyph_cache *cache = ctx->glyph_cache;
+
+	while (cache->total > cache->max_size && cache->lru_tail)
+	{
+		cache->num_evictions++;
+		cache->evicted += fz_glyph_size(ctx, cache->lru_tail->val);
+		drop_glyph_cache_entry(ctx, cache->lru_tail);
+	}
+}
+
+/* The glyph cache lock is always held when this function is called.
+ * Keeps the chains short when the budget allows for many glyphs. If we
+ * can't allocate a bigger table, we just carry on with the old one. */
+static void
+grow_hash(fz_context *ctx)
+{
+	fz_glyph_cache *cache = ctx->glyph_cache;
+	fz_glyph_cache_entry **entries;
+	fz_glyph_cache_entry *entry, *next;
+	int i, new_len;
+
+	if (cache->num_entries <= cache->hash_len * GLYPH_HASH_MAX_LOAD || cache->hash_len > INT_MAX / 4)
+		return;
+	new_len = cache->hash_len * 2 + 1;
+	entries = fz_malloc_no_throw(ctx, (size_t)new_len * sizeof(fz_glyph_cache_entry *));
+	if (!entries)
+		return;
+	memset(entries, 0, (size_t)new_len * sizeof(fz_glyph_cache_entry *));
+
+	for (i = 0; i < cache->hash_len; i++)
+	{
+		for (entry = cache->entry[i]; entry; entry = next)
+		{
+			unsigned h = entry->hash % new_len;
+			next = entry->bucket_next;
+			entry->bucket_prev = NULL;
+			entry->bucket_next = entries[h];
+			if (entry->bucket_next)
+				entry->bucket_next->bucket_prev = entry;
+			entries[h] = entry;
+		}
+	}
+	fz_free(ctx, cache->entry);
+	cache->entry = entries;
+	cache->hash_len = new_len;
+}
+
+void
+fz_set_glyph_cache_limits(fz_context *ctx, size_t max_size, int max_glyph_size)
+{
+	fz_glyph_cache *cache = ctx->glyph_cache;
+
+	fz_lock(ctx, FZ_LOCK_GLYPHCACHE);
+	cache->max_size = max_size ? max_size : MAX_CACHE_SIZE;
+	cache->max_glyph_size = max_glyph_size > 0 ? max_glyph_size : MAX_GLYPH_SIZE;
+	evict_to_fit(ctx);
+	fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
+}
+
+void
+fz_get_glyph_cache_stats(fz_context *ctx, fz_glyph_cache_stats *stats)
+{
+	fz_glyph_cache *cache = ctx->glyph_cache;
+
+	fz_lock(ctx, FZ_LOCK_GLYPHCACHE);
+	stats->size = cache->total;
+	stats->max_size = cache->max_size;
+	stats->max_glyph_size = cache->max_glyph_size;
+	stats->entries = cache->num_entries;
+	stats->buckets = cache->hash_len;
+	stats->hits = cache->hits;
+	stats->misses = cache->misses;
+	stats->evictions = cache->num_evictions;
+	fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
+}
+
 void
 fz_purge_glyph_cache(fz_context *ctx)
 {
@@ -147,6 +247,7 @@ fz_drop_glyph_cache_context(fz_context *ctx)
 	if (ctx->glyph_cache->refs == 0)
 	{
 		do_purge(ctx);
+		fz_free(ctx, ctx->glyph_cache->entry);
 		fz_free(ctx, ctx->glyph_cache);
 		ctx->glyph_cache = NULL;
 	}
@@ -293,9 +394,11 @@ fz_render_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix *ctm, fz_colo
 	fz_var(caching);
 	fz_var(val);
 
+	cache = ctx->glyph_cache;
+
 	memset(&key, 0, sizeof key);
 	size = fz_subpixel_adjust(ctx, ctm, &subpix_ctm, &key.e, &key.f);
-	if (size <= MAX_GLYPH_SIZE)
+	if (size <= cache->max_glyph_size)
 	{
 		scissor = &fz_infinite_irect;
 		do_cache = 1;
@@ -312,8 +415,6 @@ fz_render_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix *ctm, fz_colo
 		do_cache = 0;
 	}
 
-	cache = ctx->glyph_cache;
-
 	key.font = font;
 	key.gid = gid;
 	key.a = subpix_ctm.a * 65536;
@@ -322,20 +423,23 @@ fz_render_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix *ctm, fz_colo
 	key.d = subpix_ctm.d * 65536;
 	key.aa = aa;
 
-	hash = do_hash((unsigned char *)&key, sizeof(key)) % GLYPH_HASH_LEN;
+	hash = do_hash((unsigned char *)&key, sizeof(key));
 	fz_lock(ctx, FZ_LOCK_GLYPHCACHE);
-	entry = cache->entry[hash];
+	entry = cache->entry[hash % cache->hash_len];
 	while (entry)
 	{
 		if (memcmp(&entry->key, &key, sizeof(key)) == 0)
 		{
 			move_to_front(cache, entry);
 			val = fz_keep_glyph(ctx, entry->val);
+			cache->hits++;
 			fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
 			return val;
 		}
 		entry = entry->bucket_next;
 	}
+	if (do_cache)
+		cache->misses++;
 
 	locked = 1;
 	caching = 0;
@@ -370,7 +474,7 @@ fz_render_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix *ctm, fz_colo
 		}
 		if (val && do_cache)
 		{
-			if (val->w < MAX_GLYPH_SIZE && val->h < MAX_GLYPH_SIZE)
+			if (val->w < cache->max_glyph_size && val->h < cache->max_glyph_size)
 			{
 				/* If we throw an exception whilst caching,
 				 * just ignore the exception and carry on. */
@@ -379,7 +483,7 @@ fz_render_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix *ctm, fz_colo
 				{
 					/* We had to unlock. Someone else might
 					 * have rendered in the meantime */
-					entry = cache->entry[hash];
+					entry = cache->entry[hash % cache->hash_len];
 					while (entry)
 					{
 						if (memcmp(&entry->key, &key, sizeof(key)) == 0)
@@ -396,10 +500,11 @@ fz_render_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix *ctm, fz_colo
 				entry = fz_malloc_struct(ctx, fz_glyph_cache_entry);
 				entry->key = key;
 				entry->hash = hash;
-				entry->bucket_next = cache->entry[hash];
+				entry->bucket_next = cache->entry[hash % cache->hash_len];
 				if (entry->bucket_next)
 					entry->bucket_next->bucket_prev = entry;
-				cache->entry[hash] = entry;
+				cache->entry[hash % cache->hash_len] = entry;
+				cache->num_entries++;
 				entry->val = fz_keep_glyph(ctx, val);
 				fz_keep_font(ctx, key.font);
 
@@ -411,14 +516,8 @@ fz_render_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix *ctm, fz_colo
 				cache->lru_head = entry;
 
 				cache->total += fz_glyph_size(ctx, val);
-				while (cache->total > MAX_CACHE_SIZE)
-				{
-#ifndef NDEBUG
-					cache->num_evictions++;
-					cache->evicted += fz_glyph_size(ctx, cache->lru_tail->val);
-#endif
-					drop_glyph_cache_entry(ctx, cache->lru_tail);
-				}
+				evict_to_fit(ctx);
+				grow_hash(ctx);
 			}
 		}
 unlock_and_return_val:
@@ -450,7 +549,7 @@ fz_render_glyph_pixmap(fz_context *ctx, fz_font *font, int gid, fz_matrix *ctm,
 	float size = fz_subpixel_adjust(ctx, ctm, &subpix_ctm, &qe, &qf);
 	int is_ft_font = !!fz_font_ft_face(ctx, font);
 
-	if (size <= MAX_GLYPH_SIZE)
+	if (size <= ctx->glyph_cache->max_glyph_size)
 	{
 		scissor = &fz_infinite_irect;
 	}
@@ -481,8 +580,8 @@ void
 fz_dump_glyph_cache_stats(fz_context *ctx, fz_output *out)
 {
 	fz_glyph_cache *cache = ctx->glyph_cache;
-	fz_write_printf(ctx, out, "Glyph Cache Size: %zu\n", cache->total);
-#ifndef NDEBUG
-	fz_write_printf(ctx, out, "Glyph Cache Evictions: %d (%zu bytes)\n", cache->num_evictions, cache->evicted);
-#endif
+	fz_write_printf(ctx, out, "Glyph Cache Size: %zu (of %zu)\n", cache->total, cache->max_size);
+	fz_write_printf(ctx, out, "Glyph Cache Entries: %d in %d buckets\n", cache->num_entries, cache->hash_len);
+	fz_write_printf(ctx, out, "Glyph Cache Hits: %ld, Misses: %ld\n", cache->hits, cache->misses);
+	fz_write_printf(ctx, out, "Glyph Cache Evictions: %ld (%zu bytes)\n", cache->num_evictions, cache->evicted);
 }
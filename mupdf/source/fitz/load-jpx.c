@@ -22,9 +22,12 @@
 
 #include "mupdf/fitz.h"
 
+#include "context-imp.h"
+#include "image-imp.h"
 #include "pixmap-imp.h"
 
 #include <assert.h>
+#include <limits.h>
 #include <string.h>
 
 #if FZ_ENABLE_JPX
@@ -69,6 +72,8 @@ typedef struct
 	fz_colorspace *cs;
 	int xres;
 	int yres;
+	/* decode at full resolution even for metadata */
+	int no_reduce;
 } fz_jpxd;
 
 typedef struct
@@ -85,21 +90,34 @@ typedef struct
  * In order to ensure that allocations throughout mupdf
  * are done consistently, we implement opj_malloc etc as
  * functions that call down to fz_malloc etc. These
- * require context variables, so we lock and unlock around
- * calls to openjpeg. Any attempt to call through
- * without setting these will be detected.
- *
- * It is therefore vital that any fz_lock/fz_unlock
- * handlers are shared between all the fz_contexts in
- * use at a time.
+ * require context variables, so we set the context of
+ * the thread decoding an image around calls to openjpeg.
+ * Any attempt to call through without setting these will
+ * be detected.
  */
 
-/* Potentially we can write different versions
- * of get_context and set_context for different
- * threading systems.
- */
+/*
+SumatraPDF: the context is per thread (instead of a global
+context protected by a global lock) so that images can be
+decoded on several threads at once.
+https://github.com/sumatrapdfreader/sumatrapdf/issues/1306
+
+OpenJPEG's own worker threads (see fz_set_jpx_threads) don't
+have a context. They allocate with the default allocator,
+so they're only used for contexts that use it too.
+*/
+
+#if defined(_MSC_VER)
+__declspec(thread) static fz_context *opj_secret = NULL;
+#else
+static __thread fz_context *opj_secret = NULL;
+#endif
 
-static fz_context *opj_secret = NULL;
+/* 0 means one thread per cpu */
+static int jpx_threads = 0;
+
+/* don't start threads for images whose data is smaller than this */
+#define JPX_MIN_THREADED_SIZE (128 << 10)
 
 static void set_opj_context(fz_context *ctx)
 {
@@ -111,56 +129,22 @@ static fz_context *get_opj_context(void)
 	return opj_secret;
 }
 
-/*
-sumatrapdf: need to add a single, global lock
-https://github.com/sumatrapdfreader/sumatrapdf/issues/1306
-*/
-
-#if defined(_WIN32)
-#define WIN32_LEAN_AND_MEAN
-#include <Windows.h>
-static int isInitialized = 0;
-static CRITICAL_SECTION opj_cs;
-
-void opj_lock(fz_context *ctx)
-{
-	/* this is racy, but should be good enough */
-	if (!isInitialized) {
-		InitializeCriticalSection(&opj_cs);
-		isInitialized = 1;
-	}
-
-	EnterCriticalSection(&opj_cs);
-	set_opj_context(ctx);
-}
-
-void opj_unlock(fz_context *ctx)
-{
-	set_opj_context(NULL);
-	LeaveCriticalSection(&opj_cs);
-}
-#else
 void opj_lock(fz_context *ctx)
 {
-	fz_lock(ctx, FZ_LOCK_FREETYPE);
-
 	set_opj_context(ctx);
 }
 
 void opj_unlock(fz_context *ctx)
 {
 	set_opj_context(NULL);
-
-	fz_unlock(ctx, FZ_LOCK_FREETYPE);
 }
-#endif
-
 
 void *opj_malloc(size_t size)
 {
 	fz_context *ctx = get_opj_context();
 
-	assert(ctx != NULL);
+	if (ctx == NULL)
+		return size ? fz_alloc_default.malloc(fz_alloc_default.user, size) : NULL;
 
 	return Memento_label(fz_malloc_no_throw(ctx, size), "opj_malloc");
 }
@@ -169,7 +153,16 @@ void *opj_calloc(size_t n, size_t size)
 {
 	fz_context *ctx = get_opj_context();
 
-	assert(ctx != NULL);
+	if (ctx == NULL)
+	{
+		void *p;
+		if (n == 0 || size == 0 || n > SIZE_MAX / size)
+			return NULL;
+		p = fz_alloc_default.malloc(fz_alloc_default.user, n * size);
+		if (p)
+			memset(p, 0, n * size);
+		return p;
+	}
 
 	return fz_calloc_no_throw(ctx, n, size);
 }
@@ -178,7 +171,15 @@ void *opj_realloc(void *ptr, size_t size)
 {
 	fz_context *ctx = get_opj_context();
 
-	assert(ctx != NULL);
+	if (ctx == NULL)
+	{
+		if (size == 0)
+		{
+			fz_alloc_default.free(fz_alloc_default.user, ptr);
+			return NULL;
+		}
+		return fz_alloc_default.realloc(fz_alloc_default.user, ptr, size);
+	}
 
 	return fz_realloc_no_throw(ctx, ptr, size);
 }
@@ -187,11 +188,34 @@ void opj_free(void *ptr)
 {
 	fz_context *ctx = get_opj_context();
 
-	assert(ctx != NULL);
+	if (ctx == NULL)
+	{
+		fz_alloc_default.free(fz_alloc_default.user, ptr);
+		return;
+	}
 
 	fz_free(ctx, ptr);
 }
 
+void fz_set_jpx_threads(fz_context *ctx, int threads)
+{
+	jpx_threads = fz_maxi(threads, 0);
+}
+
+static int jpx_decode_threads(fz_context *ctx, size_t size)
+{
+	int threads = jpx_threads;
+
+	if (!opj_has_thread_support() || size < JPX_MIN_THREADED_SIZE)
+		return 1;
+	/* worker threads use the default allocator */
+	if (ctx->alloc.malloc != fz_alloc_default.malloc || ctx->alloc.free != fz_alloc_default.free)
+		return 1;
+	if (threads == 0)
+		threads = opj_get_num_cpus();
+	return threads;
+}
+
 static void * opj_aligned_malloc_n(size_t alignment, size_t size)
 {
 	uint8_t *ptr;
@@ -400,8 +424,9 @@ template_copy_comp(unsigned char *dst0, int w, int h, int stride, const OPJ_INT3
 	}
 }
 
+/* x0, y0 is the origin of the image at the decoded resolution */
 static void
-copy_jpx_to_pixmap(fz_context *ctx, fz_pixmap *img, opj_image_t *jpx)
+copy_jpx_to_pixmap(fz_context *ctx, fz_pixmap *img, opj_image_t *jpx, int32_t x0, int32_t y0)
 {
 	unsigned char *dst;
 	int stride, comps;
@@ -420,8 +445,8 @@ copy_jpx_to_pixmap(fz_context *ctx, fz_pixmap *img, opj_image_t *jpx)
 		OPJ_UINT32 cdy = comp->dy;
 		OPJ_UINT32 cw = comp->w;
 		OPJ_UINT32 ch = comp->h;
-		int32_t oy = safe_mul32(ctx, comp->y0, cdy) - jpx->y0;
-		int32_t ox = safe_mul32(ctx, comp->x0, cdx) - jpx->x0;
+		int32_t oy = safe_mul32(ctx, comp->y0, cdy) - y0;
+		int32_t ox = safe_mul32(ctx, comp->x0, cdx) - x0;
 		unsigned char *dst0 = dst + oy * stride;
 		int prec = comp->prec;
 		int sgnd = comp->sgnd;
@@ -447,8 +472,38 @@ copy_jpx_to_pixmap(fz_context *ctx, fz_pixmap *img, opj_image_t *jpx)
 	}
 }
 
+/* number of times the image can be halved by decoding fewer resolution levels */
+static int
+jpx_max_reduce(opj_codec_t *codec)
+{
+	opj_codestream_info_v2_t *info = opj_get_cstr_info(codec);
+	int reduce = 0;
+	OPJ_UINT32 i;
+
+	if (!info)
+		return 0;
+	if (info->m_default_tile_info.tccp_info && info->nbcomps > 0)
+	{
+		reduce = INT_MAX;
+		for (i = 0; i < info->nbcomps; i++)
+			reduce = fz_mini(reduce, (int)info->m_default_tile_info.tccp_info[i].numresolutions - 1);
+	}
+	opj_destroy_cstr_info(&info);
+
+	return fz_maxi(reduce, 0);
+}
+
+static inline int32_t
+ceil_div_pow2(int32_t a, int b)
+{
+	return (int32_t)(((int64_t)a + ((int64_t)1 << b) - 1) >> b);
+}
+
+/* l2factor (if not NULL) is the number of times the image may be halved
+ * on input and the number of times it still needs to be halved on output.
+ * Metadata is read from a decode at the lowest resolution. */
 static fz_pixmap *
-jpx_read_image(fz_context *ctx, fz_jpxd *state, const unsigned char *data, size_t size, fz_colorspace *defcs, int onlymeta)
+jpx_read_image(fz_context *ctx, fz_jpxd *state, const unsigned char *data, size_t size, fz_colorspace *defcs, int onlymeta, int *l2factor)
 {
 	fz_pixmap *img = NULL;
 	opj_dparameters_t params;
@@ -458,6 +513,8 @@ jpx_read_image(fz_context *ctx, fz_jpxd *state, const unsigned char *data, size_
 	OPJ_CODEC_FORMAT format;
 	int a, n, k;
 	int w, h;
+	int threads, reduce;
+	int32_t x0, y0;
 	stream_block sb;
 	OPJ_UINT32 i;
 
@@ -486,6 +543,10 @@ jpx_read_image(fz_context *ctx, fz_jpxd *state, const unsigned char *data, size_
 		fz_throw(ctx, FZ_ERROR_GENERIC, "j2k decode failed");
 	}
 
+	threads = onlymeta ? 1 : jpx_decode_threads(ctx, size);
+	if (threads > 1)
+		opj_codec_set_threads(codec, threads);
+
 	stream = opj_stream_default_create(OPJ_TRUE);
 	sb.data = data;
 	sb.pos = 0;
@@ -505,11 +566,30 @@ jpx_read_image(fz_context *ctx, fz_jpxd *state, const unsigned char *data, size_
 		fz_throw(ctx, FZ_ERROR_GENERIC, "Failed to read JPX header");
 	}
 
+	reduce = 0;
+	if (!state->no_reduce && (onlymeta || (l2factor && *l2factor > 0)))
+	{
+		reduce = jpx_max_reduce(codec);
+		if (!onlymeta)
+			reduce = fz_mini(reduce, *l2factor);
+		if (reduce > 0 && !opj_set_decoded_resolution_factor(codec, reduce))
+		{
+			opj_set_decoded_resolution_factor(codec, 0);
+			reduce = 0;
+		}
+	}
+
 	if (!opj_decode(codec, stream, jpx))
 	{
 		opj_stream_destroy(stream);
 		opj_destroy_codec(codec);
 		opj_image_destroy(jpx);
+		/* tiles might have fewer resolution levels than the header says */
+		if (reduce > 0)
+		{
+			state->no_reduce = 1;
+			return jpx_read_image(ctx, state, data, size, defcs, onlymeta, l2factor);
+		}
 		fz_throw(ctx, FZ_ERROR_GENERIC, "Failed to decode JPX image");
 	}
 
@@ -539,12 +619,18 @@ jpx_read_image(fz_context *ctx, fz_jpxd *state, const unsigned char *data, size_
 		}
 	}
 
-	w = state->width = jpx->x1 - jpx->x0;
-	h = state->height = jpx->y1 - jpx->y0;
+	state->width = jpx->x1 - jpx->x0;
+	state->height = jpx->y1 - jpx->y0;
 	state->xres = 72; /* openjpeg does not read the JPEG 2000 resc box */
 	state->yres = 72; /* openjpeg does not read the JPEG 2000 resc box */
 
-	if (w < 0 || h < 0)
+	/* size of the decoded image */
+	x0 = ceil_div_pow2(jpx->x0, reduce);
+	y0 = ceil_div_pow2(jpx->y0, reduce);
+	w = ceil_div_pow2(jpx->x1, reduce) - x0;
+	h = ceil_div_pow2(jpx->y1, reduce) - y0;
+
+	if (state->width < 0 || state->height < 0 || w < 0 || h < 0)
 	{
 		opj_image_destroy(jpx);
 		fz_throw(ctx, FZ_ERROR_GENERIC, "Unbelievable size for jpx");
@@ -611,7 +697,7 @@ jpx_read_image(fz_context *ctx, fz_jpxd *state, const unsigned char *data, size_
 		a = !!a; /* ignore any superfluous alpha channels */
 		img = fz_new_pixmap(ctx, state->cs, w, h, NULL, a);
 		fz_clear_pixmap_with_value(ctx, img, 0);
-		copy_jpx_to_pixmap(ctx, img, jpx);
+		copy_jpx_to_pixmap(ctx, img, jpx, x0, y0);
 
 		if (jpx->color_space == OPJ_CLRSPC_SYCC && n == 3 && a == 0)
 			jpx_ycc_to_rgb(ctx, img, 1, 1);
@@ -629,11 +715,20 @@ jpx_read_image(fz_context *ctx, fz_jpxd *state, const unsigned char *data, size_
 		fz_rethrow(ctx);
 	}
 
+	if (l2factor)
+		*l2factor -= reduce;
+
 	return img;
 }
 
 fz_pixmap *
 fz_load_jpx(fz_context *ctx, const unsigned char *data, size_t size, fz_colorspace *defcs)
+{
+	return fz_load_jpx_reduced(ctx, data, size, defcs, NULL);
+}
+
+fz_pixmap *
+fz_load_jpx_reduced(fz_context *ctx, const unsigned char *data, size_t size, fz_colorspace *defcs, int *l2factor)
 {
 	fz_jpxd state = { 0 };
 	fz_pixmap *pix = NULL;
@@ -641,7 +736,7 @@ fz_load_jpx(fz_context *ctx, const unsigned char *data, size_t size, fz_colorspa
 	fz_try(ctx)
 	{
 		opj_lock(ctx);
-		pix = jpx_read_image(ctx, &state, data, size, defcs, 0);
+		pix = jpx_read_image(ctx, &state, data, size, defcs, 0, l2factor);
 	}
 	fz_always(ctx)
 		opj_unlock(ctx);
@@ -651,6 +746,109 @@ fz_load_jpx(fz_context *ctx, const unsigned char *data, size_t size, fz_colorspa
 	return pix;
 }
 
+typedef struct
+{
+	fz_image super;
+	fz_buffer *buffer;
+	int has_decode;
+	float decode[FZ_MAX_COLORS * 2];
+} fz_jpx_image;
+
+static fz_pixmap *
+jpx_image_get_pixmap(fz_context *ctx, fz_image *image_, fz_irect *subarea, int w, int h, int *l2factor)
+{
+	fz_jpx_image *image = (fz_jpx_image *)image_;
+	fz_pixmap *pix;
+	unsigned char *data;
+	size_t len;
+
+	len = fz_buffer_storage(ctx, image->buffer, &data);
+	pix = fz_load_jpx_reduced(ctx, data, len, image->super.colorspace, l2factor);
+	if (image->has_decode)
+	{
+		fz_try(ctx)
+			fz_decode_tile(ctx, pix, image->decode);
+		fz_catch(ctx)
+		{
+			fz_drop_pixmap(ctx, pix);
+			fz_rethrow(ctx);
+		}
+	}
+
+	/* the whole image is always decoded */
+	if (subarea)
+	{
+		subarea->x0 = 0;
+		subarea->y0 = 0;
+		subarea->x1 = image->super.w;
+		subarea->y1 = image->super.h;
+	}
+
+	return pix;
+}
+
+static size_t
+jpx_image_get_size(fz_context *ctx, fz_image *image_)
+{
+	fz_jpx_image *image = (fz_jpx_image *)image_;
+
+	if (image == NULL)
+		return 0;
+
+	return sizeof(fz_jpx_image) + (image->buffer ? image->buffer->cap : 0);
+}
+
+static void
+drop_jpx_image(fz_context *ctx, fz_image *image_)
+{
+	fz_jpx_image *image = (fz_jpx_image *)image_;
+
+	fz_drop_buffer(ctx, image->buffer);
+}
+
+fz_image *
+fz_new_image_from_jpx_buffer(fz_context *ctx, fz_buffer *buffer, fz_colorspace *cs, const float *decode, fz_image *mask)
+{
+	fz_jpxd state = { 0 };
+	fz_jpx_image *image = NULL;
+	unsigned char *data;
+	size_t len;
+
+	if (!cs || fz_colorspace_is_indexed(ctx, cs))
+		return NULL;
+
+	len = fz_buffer_storage(ctx, buffer, &data);
+	fz_try(ctx)
+	{
+		opj_lock(ctx);
+		jpx_read_image(ctx, &state, data, len, cs, 1, NULL);
+	}
+	fz_always(ctx)
+		opj_unlock(ctx);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	/* the image doesn't match the colorspace, decode it up front instead */
+	if (state.cs != cs)
+	{
+		fz_drop_colorspace(ctx, state.cs);
+		return NULL;
+	}
+	fz_drop_colorspace(ctx, state.cs);
+
+	image = fz_new_derived_image(ctx, state.width, state.height, 8, cs,
+			state.xres, state.yres, 0, 0, NULL, NULL, mask, fz_jpx_image,
+			jpx_image_get_pixmap, jpx_image_get_size, drop_jpx_image);
+	image->buffer = fz_keep_buffer(ctx, buffer);
+	if (decode)
+	{
+		image->has_decode = 1;
+		memcpy(image->decode, decode, sizeof(image->decode));
+	}
+
+	return &image->super;
+}
+
 void
 fz_load_jpx_info(fz_context *ctx, const unsigned char *data, size_t size, int *wp, int *hp, int *xresp, int *yresp, fz_colorspace **cspacep)
 {
@@ -659,7 +857,7 @@ fz_load_jpx_info(fz_context *ctx, const unsigned char *data, size_t size, int *w
 	fz_try(ctx)
 	{
 		opj_lock(ctx);
-		jpx_read_image(ctx, &state, data, size, NULL, 1);
+		jpx_read_image(ctx, &state, data, size, NULL, 1, NULL);
 	}
 	fz_always(ctx)
 		opj_unlock(ctx);
@@ -675,12 +873,28 @@ fz_load_jpx_info(fz_context *ctx, const unsigned char *data, size_t size, int *w
 
 #else /* FZ_ENABLE_JPX */
 
+void fz_set_jpx_threads(fz_context *ctx, int threads)
+{
+}
+
 fz_pixmap *
 fz_load_jpx(fz_context *ctx, const unsigned char *data, size_t size, fz_colorspace *defcs)
 {
 	fz_throw(ctx, FZ_ERROR_GENERIC, "JPX support disabled");
 }
 
+fz_pixmap *
+fz_load_jpx_reduced(fz_context *ctx, const unsigned char *data, size_t size, fz_colorspace *defcs, int *l2factor)
+{
+	fz_throw(ctx, FZ_ERROR_GENERIC, "JPX support disabled");
+}
+
+fz_image *
+fz_new_image_from_jpx_buffer(fz_context *ctx, fz_buffer *buffer, fz_colorspace *cs, const float *decode, fz_image *mask)
+{
+	return NULL;
+}
+
 void
 fz_load_jpx_info(fz_context *ctx, const unsigned char *data, size_t size, int *wp, int *hp, int *xresp, int *yresp, fz_colorspace **cspacep)
 {
@@ -253,6 +253,7 @@ pdf_load_jpx(fz_context *ctx, pdf_document *doc, pdf_obj *dict, int forcemask)
 	fz_var(buf);
 	fz_var(colorspace);
 	fz_var(mask);
+	fz_var(img);
 
 	buf = pdf_load_stream(ctx, dict);
 
@@ -266,9 +267,6 @@ pdf_load_jpx(fz_context *ctx, pdf_document *doc, pdf_obj *dict, int forcemask)
 		if (obj)
 			colorspace = pdf_load_colorspace(ctx, obj);
 
-		len = fz_buffer_storage(ctx, buf, &data);
-		pix = fz_load_jpx(ctx, data, len, colorspace);
-
 		obj = pdf_dict_geta(ctx, dict, PDF_NAME(SMask), PDF_NAME(Mask));
 		if (pdf_is_dict(ctx, obj))
 		{
@@ -278,7 +276,26 @@ pdf_load_jpx(fz_context *ctx, pdf_document *doc, pdf_obj *dict, int forcemask)
 				mask = pdf_load_image_imp(ctx, doc, NULL, obj, NULL, 1);
 		}
 
+		/* SumatraPDF: decode the image when it's drawn, at the resolution it's
+		   drawn at (falls back to decoding it now if the colorspace doesn't match).
+		   soft masks are turned into an alpha pixmap by pdf_load_jpx_imp() */
 		obj = pdf_dict_geta(ctx, dict, PDF_NAME(Decode), PDF_NAME(D));
+		if (!forcemask && colorspace && !fz_colorspace_is_indexed(ctx, colorspace))
+		{
+			float decode[FZ_MAX_COLORS * 2];
+			int i;
+
+			for (i = 0; i < FZ_MAX_COLORS * 2; i++)
+				decode[i] = pdf_array_get_real(ctx, obj, i);
+
+			img = fz_new_image_from_jpx_buffer(ctx, buf, colorspace, obj ? decode : NULL, mask);
+			if (img)
+				break;
+		}
+
+		len = fz_buffer_storage(ctx, buf, &data);
+		pix = fz_load_jpx(ctx, data, len, colorspace);
+
 		if (obj && !fz_colorspace_is_indexed(ctx, colorspace))
 		{
 			float decode[FZ_MAX_COLORS * 2];
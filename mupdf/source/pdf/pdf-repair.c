@@ -749,3 +749,283 @@ pdf_repair_obj_stms(fz_context *ctx, pdf_document *doc)
 			fz_throw(ctx, FZ_ERROR_GENERIC, "invalid reference to non-object-stream: %d (%d 0 R)", (int)entry->ofs, i);
 	}
 }
+
+/* Repair cache */
+
+#define REPAIR_CACHE_MAGIC 0x31585253 /* "SRX1" */
+/* bytes hashed at the beginning and the end of the file */
+#define REPAIR_CACHE_SAMPLE (64 << 10)
+/* type, gen, ofs, stm_ofs, stm_len */
+#define REPAIR_CACHE_ENTRY_SIZE 28
+
+typedef struct
+{
+	const unsigned char *p;
+	const unsigned char *end;
+} repair_cache_reader;
+
+void
+pdf_set_repair_cache(fz_context *ctx, pdf_repair_cache *cache)
+{
+	ctx->repair_cache = cache;
+}
+
+/* Length of the file and a hash of its beginning and end. Much quicker
+ * than hashing the whole file and good enough to notice a file that has
+ * been rewritten or appended to. */
+static int64_t
+repair_cache_fingerprint(fz_context *ctx, pdf_document *doc, unsigned char digest[16])
+{
+	unsigned char buf[4096];
+	fz_md5 md5;
+	int64_t len, ofs;
+	size_t left, n;
+	int pass;
+
+	fz_seek(ctx, doc->file, 0, SEEK_END);
+	len = fz_tell(ctx, doc->file);
+
+	fz_md5_init(&md5);
+	for (pass = 0; pass < 2; pass++)
+	{
+		ofs = pass == 0 ? 0 : fz_maxi64(len - REPAIR_CACHE_SAMPLE, REPAIR_CACHE_SAMPLE);
+		if (ofs >= len)
+			break;
+		fz_seek(ctx, doc->file, ofs, SEEK_SET);
+		left = REPAIR_CACHE_SAMPLE;
+		while (left > 0)
+		{
+			n = fz_read(ctx, doc->file, buf, fz_minz(left, sizeof buf));
+			if (n == 0)
+				break;
+			fz_md5_update(&md5, buf, n);
+			left -= n;
+		}
+	}
+	fz_md5_final(&md5, digest);
+
+	return len;
+}
+
+static void
+append_int64_le(fz_context *ctx, fz_buffer *buf, int64_t x)
+{
+	fz_append_int32_le(ctx, buf, (int)(x & 0xffffffff));
+	fz_append_int32_le(ctx, buf, (int)(x >> 32));
+}
+
+static int
+read_int32_le(fz_context *ctx, repair_cache_reader *r)
+{
+	uint32_t x;
+	if (r->end - r->p < 4)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "truncated repair cache");
+	x = r->p[0] | (r->p[1] << 8) | (r->p[2] << 16) | ((uint32_t)r->p[3] << 24);
+	r->p += 4;
+	return (int)x;
+}
+
+static int64_t
+read_int64_le(fz_context *ctx, repair_cache_reader *r)
+{
+	uint32_t lo = (uint32_t)read_int32_le(ctx, r);
+	uint32_t hi = (uint32_t)read_int32_le(ctx, r);
+	return (int64_t)(((uint64_t)hi << 32) | lo);
+}
+
+void
+pdf_save_cached_repair(fz_context *ctx, pdf_document *doc)
+{
+	pdf_repair_cache *cache = ctx->repair_cache;
+	unsigned char digest[16];
+	fz_buffer *buf = NULL;
+	fz_buffer *trailer = NULL;
+	fz_output *out = NULL;
+	unsigned char *trailer_data;
+	size_t trailer_len;
+	int64_t len;
+	int i, xref_len;
+
+	if (!cache || !cache->save)
+		return;
+
+	fz_var(buf);
+	fz_var(trailer);
+	fz_var(out);
+
+	fz_try(ctx)
+	{
+		len = repair_cache_fingerprint(ctx, doc, digest);
+		xref_len = pdf_xref_len(ctx, doc);
+
+		buf = fz_new_buffer(ctx, 64 + (size_t)xref_len * REPAIR_CACHE_ENTRY_SIZE);
+		fz_append_int32_le(ctx, buf, REPAIR_CACHE_MAGIC);
+		append_int64_le(ctx, buf, len);
+		fz_append_data(ctx, buf, digest, sizeof digest);
+		fz_append_int32_le(ctx, buf, xref_len);
+		for (i = 0; i < xref_len; i++)
+		{
+			pdf_xref_entry *entry = pdf_get_xref_entry(ctx, doc, i);
+			int stm_len = -1;
+
+			/* pdf_repair_xref corrects the stream lengths of unencrypted files */
+			if (entry->type == 'n' && entry->stm_ofs && !doc->crypt && pdf_is_dict(ctx, entry->obj))
+			{
+				pdf_obj *length = pdf_dict_get(ctx, entry->obj, PDF_NAME(Length));
+				if (pdf_is_int(ctx, length) && !pdf_is_indirect(ctx, length))
+					stm_len = pdf_to_int(ctx, length);
+			}
+
+			fz_append_int32_le(ctx, buf, entry->type);
+			fz_append_int32_le(ctx, buf, entry->gen);
+			append_int64_le(ctx, buf, entry->ofs);
+			append_int64_le(ctx, buf, entry->stm_ofs);
+			fz_append_int32_le(ctx, buf, stm_len);
+		}
+
+		trailer = fz_new_buffer(ctx, 256);
+		out = fz_new_output_with_buffer(ctx, trailer);
+		pdf_print_obj(ctx, out, pdf_trailer(ctx, doc), 1, 1);
+		fz_close_output(ctx, out);
+		trailer_len = fz_buffer_storage(ctx, trailer, &trailer_data);
+		fz_append_int32_le(ctx, buf, (int)trailer_len);
+		fz_append_data(ctx, buf, trailer_data, trailer_len);
+
+		cache->save(ctx, cache->opaque, buf);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_output(ctx, out);
+		fz_drop_buffer(ctx, trailer);
+		fz_drop_buffer(ctx, buf);
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow_if(ctx, FZ_ERROR_TRYLATER);
+		fz_warn(ctx, "cannot save repaired xref");
+	}
+}
+
+int
+pdf_load_cached_repair(fz_context *ctx, pdf_document *doc)
+{
+	pdf_repair_cache *cache = ctx->repair_cache;
+	unsigned char digest[16];
+	repair_cache_reader r;
+	const unsigned char *entries;
+	fz_buffer *buf = NULL;
+	fz_stream *stm = NULL;
+	pdf_obj *trailer = NULL;
+	pdf_obj *dict = NULL;
+	int64_t len;
+	int i, xref_len, trailer_len;
+	int restored = 0;
+
+	if (!cache || !cache->load)
+		return 0;
+
+	fz_var(buf);
+	fz_var(stm);
+	fz_var(trailer);
+	fz_var(dict);
+	fz_var(restored);
+
+	/* the cached data is the result of an earlier repair. This also makes
+	 * objects that fail to load below throw instead of starting a repair. */
+	doc->repair_attempted = 1;
+	doc->repair_in_progress = 1;
+
+	fz_try(ctx)
+	{
+		buf = cache->load(ctx, cache->opaque);
+		if (buf)
+		{
+			r.p = buf->data;
+			r.end = buf->data + buf->len;
+			len = repair_cache_fingerprint(ctx, doc, digest);
+			if (read_int32_le(ctx, &r) != REPAIR_CACHE_MAGIC || read_int64_le(ctx, &r) != len)
+				fz_throw(ctx, FZ_ERROR_GENERIC, "cached repair is for a different file");
+			if (r.end - r.p < (ptrdiff_t)sizeof digest || memcmp(r.p, digest, sizeof digest) != 0)
+				fz_throw(ctx, FZ_ERROR_GENERIC, "cached repair is for a different file");
+			r.p += sizeof digest;
+
+			xref_len = read_int32_le(ctx, &r);
+			if (xref_len <= 0 || xref_len > PDF_MAX_OBJECT_NUMBER + 1 || (r.end - r.p) / REPAIR_CACHE_ENTRY_SIZE < xref_len)
+				fz_throw(ctx, FZ_ERROR_GENERIC, "corrupt repair cache");
+
+			pdf_forget_xref(ctx, doc);
+			pdf_ensure_solid_xref(ctx, doc, xref_len);
+
+			entries = r.p;
+			for (i = 0; i < xref_len; i++)
+			{
+				pdf_xref_entry *entry = pdf_get_populating_xref_entry(ctx, doc, i);
+				int type = read_int32_le(ctx, &r);
+				if (type != 'n' && type != 'o' && type != 'f')
+					fz_throw(ctx, FZ_ERROR_GENERIC, "corrupt repair cache");
+				entry->type = type;
+				entry->gen = read_int32_le(ctx, &r);
+				entry->ofs = read_int64_le(ctx, &r);
+				entry->stm_ofs = read_int64_le(ctx, &r);
+				entry->num = type == 'f' ? 0 : i;
+				(void)read_int32_le(ctx, &r);
+			}
+
+			trailer_len = read_int32_le(ctx, &r);
+			if (trailer_len <= 0 || r.end - r.p < trailer_len)
+				fz_throw(ctx, FZ_ERROR_GENERIC, "corrupt repair cache");
+			stm = fz_open_memory(ctx, r.p, trailer_len);
+			trailer = pdf_parse_stm_obj(ctx, doc, stm, &doc->lexbuf.base);
+			if (!pdf_is_dict(ctx, trailer))
+				fz_throw(ctx, FZ_ERROR_GENERIC, "corrupt repair cache");
+			pdf_set_populating_xref_trailer(ctx, doc, trailer);
+
+			/* apply the stream length corrections of pdf_repair_xref */
+			r.p = entries;
+			for (i = 0; i < xref_len; i++)
+			{
+				int stm_len;
+				pdf_obj *old_obj = NULL;
+
+				r.p += REPAIR_CACHE_ENTRY_SIZE - 4;
+				stm_len = read_int32_le(ctx, &r);
+				if (stm_len < 0)
+					continue;
+				dict = pdf_load_object(ctx, doc, i);
+				pdf_dict_get_put_drop(ctx, dict, PDF_NAME(Length), pdf_new_int(ctx, stm_len), &old_obj);
+				if (old_obj)
+					orphan_object(ctx, doc, old_obj);
+				pdf_drop_obj(ctx, dict);
+				dict = NULL;
+			}
+
+			restored = 1;
+		}
+	}
+	fz_always(ctx)
+	{
+		pdf_drop_obj(ctx, dict);
+		pdf_drop_obj(ctx, trailer);
+		fz_drop_stream(ctx, stm);
+		fz_drop_buffer(ctx, buf);
+		doc->repair_in_progress = 0;
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow_if(ctx, FZ_ERROR_TRYLATER);
+		fz_rethrow_if(ctx, FZ_ERROR_MEMORY);
+		fz_warn(ctx, "ignoring cached repair: %s", fz_caught_message(ctx));
+		restored = 0;
+	}
+
+	if (!restored)
+	{
+		/* let pdf_repair_xref do the actual repair */
+		doc->repair_attempted = 0;
+	}
+	else
+	{
+		fz_warn(ctx, "using cached repair of PDF document");
+	}
+	return restored;
+}
@@ -1601,6 +1601,7 @@ pdf_init_document(fz_context *ctx, pdf_document *doc)
 {
 	pdf_obj *encrypt, *id;
 	int repaired = 0;
+	int repair_cached = 0;
 
 	fz_try(ctx)
 	{
@@ -1648,7 +1649,9 @@ pdf_init_document(fz_context *ctx, pdf_document *doc)
 			/* pdf_repair_xref may access xref_index, so reset it properly */
 			if (doc->xref_index)
 				memset(doc->xref_index, 0, sizeof(int) * doc->max_xref_len);
-			pdf_repair_xref(ctx, doc);
+			repair_cached = pdf_load_cached_repair(ctx, doc);
+			if (!repair_cached)
+				pdf_repair_xref(ctx, doc);
 			pdf_prime_xref_index(ctx, doc);
 		}
 
@@ -1660,9 +1663,10 @@ pdf_init_document(fz_context *ctx, pdf_document *doc)
 		/* Allow lazy clients to read encrypted files with a blank password */
 		(void)pdf_authenticate_password(ctx, doc, "");
 
-		if (repaired)
+		if (repaired && !repair_cached)
 		{
 			pdf_repair_trailer(ctx, doc);
+			pdf_save_cached_repair(ctx, doc);
 		}
 	}
 	fz_catch(ctx)
@@ -39,6 +39,7 @@ function makelzsa_files()
     "ByteWriter.*",
     "ColorUtil.*",
     "CmdLineArgsIter.*",
+    "CryptoUtil.*",
     "Dpi.*",
     "FileUtil.*",
     "GeomUtil.*",
@@ -493,6 +494,7 @@ function sumatrapdf_files()
     "CanvasAboutUI.*",
     "ChmModel.*",
     "Commands.*",
+    "ContentBoxCache.*",
     "Controller.h",
     "CrashHandler.*",
     "DisplayModel.*",
@@ -585,7 +587,9 @@ function utils_files()
     "ApiHook.*",
     "Archive.*",
     "BaseUtil.*",
+    "BenchReport.*",
     "BitReader.*",
+    "BlockCachedStream.*",
     "BuildConfig.h",
     "ByteOrderDecoder.*",
     "ByteReader.*",
@@ -600,6 +604,7 @@ function utils_files()
     "Dpi.*",
     "GeomUtil.*",
     "GuessFileType.*",
+    "FileChangeDebouncer.*",
     "FileUtil.*",
     "FileWatcher.*",
     "FzImgReader.*",
@@ -613,7 +618,9 @@ function utils_files()
     "Log.*",
     "LzmaSimpleArchive.*",
     "MinHook.*",
+    "PageResultCache.*",
     "PEB.h",
+    "PixelConvert.*",
     "RegistryPaths.*",
     "Scoped.h",
     "ScopedWin.h",
@@ -628,6 +635,7 @@ function utils_files()
     "TempAllocator.*",
     "ThreadUtil.*",
     "TgaReader.*",
+    "Trace.*",
     "TrivialHtmlParser.*",
     "TxtParser.*",
     "UITask.*",
@@ -989,7 +997,9 @@ end
 function test_util_files()
   files_in_dir( "src/utils", {
     "BaseUtil.*",
+    "BenchReport.*",
     "BitManip.*",
+    "BlockCachedStream.*",
     "ByteOrderDecoder.*",
     "CmdLineArgsIter.*",
     "ColorUtil.*",
@@ -997,12 +1007,15 @@ function test_util_files()
     "CssParser.*",
     "Dict.*",
     "Dpi.*",
+    "FileChangeDebouncer.*",
     "FileUtil.*",
     "GeomUtil.*",
     "HtmlParserLookup.*",
     "HtmlPrettyPrint.*",
     "HtmlPullParser.*",
     "JsonParser.*",
+    "PageResultCache.*",
+    "PixelConvert.*",
     "Scoped.*",
     "SettingsUtil.*",
     "Log.*",
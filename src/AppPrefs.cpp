@@ -66,6 +66,21 @@ WCHAR* GetSettingsPath() {
     return AppGenDataFilename(GetSettingsFileNameTemp());
 }
 
+// binary snapshot of the settings file, see LoadGlobalPrefsSnapshot()
+static WCHAR* GetSettingsSnapshotPath() {
+    return AppGenDataFilename(L"SumatraPDF-settings.bin");
+}
+
+static bool GetSettingsFileInfo(const WCHAR* path, FILETIME* timeOut, i64* sizeOut) {
+    WIN32_FILE_ATTRIBUTE_DATA fa{};
+    if (!GetFileAttributesExW(path, GetFileExInfoStandard, &fa)) {
+        return false;
+    }
+    *timeOut = fa.ftLastWriteTime;
+    *sizeOut = ((i64)fa.nFileSizeHigh << 32) | fa.nFileSizeLow;
+    return true;
+}
+
 /* Caller needs to prefs::CleanUp() */
 bool Load() {
     CrashIf(gGlobalPrefs);
@@ -77,20 +92,33 @@ bool Load() {
     };
 
     AutoFreeWstr path = GetSettingsPath();
-    AutoFree prefsData = file::ReadFile(path.Get());
+    AutoFreeWstr snapshotPath = GetSettingsSnapshotPath();
+    FILETIME textTime{};
+    i64 textSize = -1;
+    bool textExists = GetSettingsFileInfo(path, &textTime, &textSize);
+    if (textExists) {
+        gGlobalPrefs = LoadGlobalPrefsSnapshot(snapshotPath, textTime, textSize);
+    }
 
-    gGlobalPrefs = NewGlobalPrefs(prefsData.data);
-    CrashAlwaysIf(!gGlobalPrefs);
-    auto* gprefs = gGlobalPrefs;
+    if (!gGlobalPrefs) {
+        AutoFree prefsData = file::ReadFile(path.Get());
+        gGlobalPrefs = NewGlobalPrefs(prefsData.data);
+        CrashAlwaysIf(!gGlobalPrefs);
 
-    // in pre-release builds between 3.1.10079 and 3.1.10377,
-    // RestoreSession was a string with the additional option "auto"
-    // TODO: remove this after 3.2 has been released
+        // in pre-release builds between 3.1.10079 and 3.1.10377,
+        // RestoreSession was a string with the additional option "auto"
+        // TODO: remove this after 3.2 has been released
 #if defined(DEBUG) || defined(PRE_RELEASE_VER)
-    if (!gprefs->restoreSession && prefsData.data && str::Find(prefsData.data, "\nRestoreSession = auto")) {
-        gprefs->restoreSession = true;
-    }
+        if (!gGlobalPrefs->restoreSession && prefsData.data &&
+            str::Find(prefsData.data, "\nRestoreSession = auto")) {
+            gGlobalPrefs->restoreSession = true;
+        }
 #endif
+        if (textExists && HasPermission(Perm::SavePreferences)) {
+            SaveGlobalPrefsSnapshot(snapshotPath, gGlobalPrefs, textTime, textSize);
+        }
+    }
+    auto* gprefs = gGlobalPrefs;
 
     if (!gprefs->uiLanguage || !trans::ValidateLangCode(gprefs->uiLanguage)) {
         // guess the ui language on first start
@@ -219,11 +247,21 @@ bool Save() {
         return true;
     }
 
+    FILETIME prevTime{};
+    i64 prevSize = -1;
+    GetSettingsFileInfo(path, &prevTime, &prevSize);
+
     bool ok = file::WriteFile(path.Get(), prefs);
     if (!ok) {
         return false;
     }
-    gGlobalPrefs->lastPrefUpdate = file::GetModificationTime(path.Get());
+    FILETIME time{};
+    i64 size = -1;
+    GetSettingsFileInfo(path, &time, &size);
+    gGlobalPrefs->lastPrefUpdate = time;
+
+    AutoFreeWstr snapshotPath = GetSettingsSnapshotPath();
+    UpdateGlobalPrefsSnapshot(snapshotPath, gGlobalPrefs, prevTime, prevSize, time, size);
     return true;
 }
 
@@ -288,6 +326,7 @@ bool Reload() {
     }
 
     UpdateDocumentColors();
+    UpdateRepairCacheDir();
     UpdateFixedPageScrollbarsVisibility();
     return true;
 }
@@ -295,6 +334,7 @@ bool Reload() {
 void CleanUp() {
     DeleteGlobalPrefs(gGlobalPrefs);
     gGlobalPrefs = nullptr;
+    FreeGlobalPrefsSnapshotState();
 }
 
 void schedulePrefsReload() {
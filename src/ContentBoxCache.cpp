@@ -0,0 +1,327 @@
+/* Copyright 2021 the SumatraPDF project authors (see AUTHORS file).
+   License: GPLv3 */
+
+#include "utils/BaseUtil.h"
+#include "utils/ScopedWin.h"
+#include "utils/FileUtil.h"
+#include "utils/ThreadUtil.h"
+#include "utils/UITask.h"
+#include "utils/WinUtil.h"
+
+#include "wingui/TreeModel.h"
+#include "DisplayMode.h"
+#include "Controller.h"
+#include "EngineBase.h"
+#include "EngineAll.h"
+#include "SettingsStructs.h"
+#include "GlobalPrefs.h"
+#include "SumatraPDF.h"
+#include "AppTools.h"
+#include "ContentBoxCache.h"
+
+#include "utils/Log.h"
+
+// same directory as thumbnails
+constexpr const char* kContentBoxCacheDirName = "sumatrapdfcache";
+constexpr const WCHAR* kContentBoxCachePattern = L"*.cbox";
+constexpr u32 kContentBoxCacheMagic = 0x31584243; // "CBX1"
+// saved content boxes not used for that long are removed by CleanUpContentBoxCache()
+constexpr int kContentBoxCacheMaxAgeDays = 90;
+constexpr int kMaxContentBoxWorkers = 4;
+
+// caches with pending ui notifications might have been deleted
+// by the time the notification is processed. only accessed on the ui thread
+static Vec<ContentBoxCache*> gContentBoxCaches;
+static LONG gNextContentBoxCacheId = 0;
+
+struct ContentBoxCacheHeader {
+    u32 magic;
+    u32 nPages;
+};
+
+struct ContentBoxCacheRecord {
+    float x, y, dx, dy;
+    u32 isKnown;
+};
+
+class ContentBoxWorker : public ThreadBase {
+  public:
+    ContentBoxCache* cache = nullptr;
+
+    explicit ContentBoxWorker(ContentBoxCache* cache) : ThreadBase("ContentBoxWorker"), cache(cache) {
+    }
+
+    void Run() override {
+        // PageContentBox() on the document's engine would compete with rendering
+        // for the engine's lock, so use a copy of the engine if possible
+        EngineBase* clone = cache->engine->Clone();
+        EngineBase* engine = clone ? clone : cache->engine;
+        for (;;) {
+            int pageNo = cache->NextPage();
+            if (pageNo == 0) {
+                break;
+            }
+            RectF box = engine->PageContentBox(pageNo);
+            cache->SetBox(pageNo, box);
+        }
+        delete clone;
+        DestroyTempAllocator();
+    }
+};
+
+static WCHAR* GetContentBoxCachePath(const WCHAR* filePath) {
+    if (!filePath || !HasPermission(Perm::SavePreferences | Perm::DiskAccess)) {
+        return nullptr;
+    }
+    if (!gGlobalPrefs || !gGlobalPrefs->rememberOpenedFiles) {
+        return nullptr;
+    }
+    AutoFree fingerprint = file::GetFingerprint(filePath);
+    if (!fingerprint) {
+        return nullptr;
+    }
+
+    char* cacheDir = AppGenDataFilenameTemp(kContentBoxCacheDirName);
+    if (!cacheDir) {
+        return nullptr;
+    }
+    AutoFree res = str::Format(R"(%s\%s.cbox)", cacheDir, fingerprint.Get());
+    return strconv::Utf8ToWstr(res.Get());
+}
+
+ContentBoxCache::ContentBoxCache(EngineBase* engine, const std::function<void()>& onUpdated)
+    : engine(engine), onUpdated(onUpdated) {
+    InitializeCriticalSection(&cs);
+    nPages = engine->PageCount();
+    boxes.AppendBlanks(nPages);
+    states.AppendBlanks(nPages);
+    id = ++gNextContentBoxCacheId;
+    gContentBoxCaches.Append(this);
+
+    cachePath = GetContentBoxCachePath(engine->FileName());
+    Load();
+}
+
+ContentBoxCache::~ContentBoxCache() {
+    EnterCriticalSection(&cs);
+    abort = true;
+    LeaveCriticalSection(&cs);
+    // workers only finish the page they're working on
+    for (ContentBoxWorker* w : workers) {
+        w->Join();
+        delete w;
+    }
+    Save();
+    gContentBoxCaches.Remove(this);
+    free(cachePath);
+    DeleteCriticalSection(&cs);
+}
+
+void ContentBoxCache::Load() {
+    if (!cachePath) {
+        return;
+    }
+    AutoFree data = file::ReadFile(cachePath);
+    size_t expectedSize = sizeof(ContentBoxCacheHeader) + (size_t)nPages * sizeof(ContentBoxCacheRecord);
+    if (!data.data || data.size() != expectedSize) {
+        return;
+    }
+    ContentBoxCacheHeader hdr;
+    memcpy(&hdr, data.data, sizeof(hdr));
+    if (hdr.magic != kContentBoxCacheMagic || hdr.nPages != (u32)nPages) {
+        return;
+    }
+    const char* d = data.data + sizeof(hdr);
+    for (int i = 0; i < nPages; i++, d += sizeof(ContentBoxCacheRecord)) {
+        ContentBoxCacheRecord rec;
+        memcpy(&rec, d, sizeof(rec));
+        if (!rec.isKnown) {
+            continue;
+        }
+        boxes[i] = RectF(rec.x, rec.y, rec.dx, rec.dy);
+        states[i] = BoxState::Known;
+        nKnown++;
+    }
+    // mark as recently used for CleanUpContentBoxCache()
+    FILETIME now;
+    GetSystemTimeAsFileTime(&now);
+    file::SetModificationTime(cachePath, now);
+    logf("ContentBoxCache: loaded %d of %d content boxes\n", nKnown, nPages);
+}
+
+void ContentBoxCache::Save() {
+    if (!cachePath) {
+        return;
+    }
+    str::Str data;
+    {
+        ScopedCritSec scope(&cs);
+        if (!isDirty) {
+            return;
+        }
+        isDirty = false;
+        ContentBoxCacheHeader hdr{kContentBoxCacheMagic, (u32)nPages};
+        data.Append((const char*)&hdr, sizeof(hdr));
+        for (int i = 0; i < nPages; i++) {
+            RectF& r = boxes[i];
+            ContentBoxCacheRecord rec{r.x, r.y, r.dx, r.dy, states[i] == BoxState::Known ? 1u : 0u};
+            data.Append((const char*)&rec, sizeof(rec));
+        }
+    }
+    AutoFreeWstr cacheDir = path::GetDir(cachePath);
+    if (dir::Create(cacheDir)) {
+        file::WriteFile(cachePath, data.AsSpan());
+    }
+}
+
+bool ContentBoxCache::Get(int pageNo, RectF& boxOut) {
+    CrashIf(pageNo < 1 || pageNo > nPages);
+    ScopedCritSec scope(&cs);
+    BoxState& state = states[pageNo - 1];
+    if (state == BoxState::Known) {
+        boxOut = boxes[pageNo - 1];
+        return true;
+    }
+    if (state == BoxState::Unknown) {
+        state = BoxState::Requested;
+        nRequested++;
+        StartWorkers();
+    }
+    return false;
+}
+
+void ContentBoxCache::RequestAll() {
+    ScopedCritSec scope(&cs);
+    if (nKnown == nPages) {
+        return;
+    }
+    for (BoxState& state : states) {
+        if (state == BoxState::Unknown) {
+            state = BoxState::Requested;
+            nRequested++;
+        }
+    }
+    StartWorkers();
+}
+
+void ContentBoxCache::SetPriority(int firstPageNo, int lastPageNo) {
+    ScopedCritSec scope(&cs);
+    priorityFirst = firstPageNo;
+    priorityLast = lastPageNo;
+}
+
+void ContentBoxCache::DocumentLoaded() {
+    ScopedCritSec scope(&cs);
+    StartWorkers();
+}
+
+// must be called inside cs
+void ContentBoxCache::StartWorkers() {
+    if (abort) {
+        return;
+    }
+    // pages that haven't been read yet are empty (and the engine can't be cloned),
+    // so we'd compute (and save) wrong boxes. Requested pages are computed in DocumentLoaded()
+    if (EngineMupdfIsLoadingProgressively(engine)) {
+        return;
+    }
+    // threads of workers that ran out of pages have already exited
+    // (or are about to) so waiting for them is quick
+    for (int i = workers.isize() - 1; i >= 0 && workers.isize() > nRunningWorkers; i--) {
+        if (workers[i]->Join(0)) {
+            delete workers[i];
+            workers.RemoveAt(i);
+        }
+    }
+
+    SYSTEM_INFO si{};
+    GetSystemInfo(&si);
+    // leave cpus for rendering
+    int maxWorkers = std::clamp((int)si.dwNumberOfProcessors / 2, 1, kMaxContentBoxWorkers);
+    while (nRunningWorkers < maxWorkers && nRunningWorkers < nRequested) {
+        auto worker = new ContentBoxWorker(this);
+        workers.Append(worker);
+        nRunningWorkers++;
+        worker->Start();
+    }
+}
+
+// returns the requested page closest to the visible pages or 0 if there are none
+// (in which case the calling worker exits)
+int ContentBoxCache::NextPage() {
+    ScopedCritSec scope(&cs);
+    if (abort || nRequested == 0) {
+        nRunningWorkers--;
+        return 0;
+    }
+    int bestPageNo = 0;
+    int bestDist = INT_MAX;
+    for (int pageNo = 1; pageNo <= nPages; pageNo++) {
+        if (states[pageNo - 1] != BoxState::Requested) {
+            continue;
+        }
+        // pages after the visible ones are more likely to be needed next than those before
+        int dist = 0;
+        if (pageNo < priorityFirst) {
+            dist = (priorityFirst - pageNo) * 2 + 1;
+        } else if (pageNo > priorityLast) {
+            dist = (pageNo - priorityLast) * 2;
+        }
+        if (dist < bestDist) {
+            bestDist = dist;
+            bestPageNo = pageNo;
+        }
+    }
+    CrashIf(bestPageNo == 0);
+    states[bestPageNo - 1] = BoxState::Computing;
+    nRequested--;
+    return bestPageNo;
+}
+
+static void NotifyContentBoxCacheUpdated(LONG cacheId) {
+    for (ContentBoxCache* cache : gContentBoxCaches) {
+        if (cache->GetId() == cacheId) {
+            cache->OnUpdated();
+            return;
+        }
+    }
+}
+
+void ContentBoxCache::SetBox(int pageNo, RectF box) {
+    ScopedCritSec scope(&cs);
+    boxes[pageNo - 1] = box;
+    states[pageNo - 1] = BoxState::Known;
+    nKnown++;
+    isDirty = true;
+    // coalesce notifications, the ui re-layouts at most once per posted notification
+    if (!updatePosted) {
+        updatePosted = true;
+        LONG cacheId = id;
+        uitask::Post([cacheId] { NotifyContentBoxCacheUpdated(cacheId); });
+    }
+}
+
+void ContentBoxCache::OnUpdated() {
+    bool isComplete;
+    {
+        ScopedCritSec scope(&cs);
+        updatePosted = false;
+        isComplete = nKnown == nPages;
+    }
+    if (isComplete) {
+        Save();
+    }
+    if (onUpdated) {
+        onUpdated();
+    }
+}
+
+void CleanUpContentBoxCache(bool removeAll) {
+    char* cacheDir = AppGenDataFilenameTemp(kContentBoxCacheDirName);
+    if (!cacheDir) {
+        return;
+    }
+    AutoFreeWstr cacheDirW = strconv::Utf8ToWstr(cacheDir);
+    // the modification time is updated when they're used
+    dir::DeleteOldFiles(cacheDirW, kContentBoxCachePattern, removeAll ? 0 : kContentBoxCacheMaxAgeDays);
+}
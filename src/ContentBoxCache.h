@@ -0,0 +1,82 @@
+/* Copyright 2021 the SumatraPDF project authors (see AUTHORS file).
+   License: GPLv3 */
+
+// Computes EngineBase::PageContentBox() of all pages of a document on
+// background threads, pages closest to the visible ones first.
+//
+// PageContentBox() can be slow (EngineImages decodes the whole image,
+// EngineMupdf runs the page through a bbox device), so for ZOOM_FIT_CONTENT
+// DisplayModel lays out pages with their mediabox until the content box
+// is known and re-layouts when it arrives.
+//
+// Computed content boxes are saved in the cache directory, keyed by a
+// fingerprint of the file (path, size and modification time), so that
+// re-opening a document doesn't need to compute them again.
+
+class ContentBoxWorker;
+
+class ContentBoxCache {
+  public:
+    // onUpdated is called on the ui thread after some content boxes have been computed
+    ContentBoxCache(EngineBase* engine, const std::function<void()>& onUpdated);
+    ContentBoxCache(ContentBoxCache const&) = delete;
+    ContentBoxCache& operator=(ContentBoxCache const&) = delete;
+    ~ContentBoxCache();
+
+    // returns false if the content box of pageNo isn't known yet,
+    // in which case it's queued for computing
+    bool Get(int pageNo, RectF& boxOut);
+    // queue all pages for computing
+    void RequestAll();
+    // pages closest to firstPageNo..lastPageNo are computed first
+    void SetPriority(int firstPageNo, int lastPageNo);
+    // content boxes aren't computed while a document is being loaded
+    // progressively. Call once it's been read completely
+    void DocumentLoaded();
+
+    [[nodiscard]] LONG GetId() const {
+        return id;
+    }
+    // called on the ui thread after SetBox()
+    void OnUpdated();
+
+  private:
+    friend class ContentBoxWorker;
+
+    enum class BoxState : u8 {
+        Unknown,
+        Requested,
+        Computing,
+        Known,
+    };
+
+    void Load();
+    void Save();
+    void StartWorkers();
+    int NextPage();
+    void SetBox(int pageNo, RectF box);
+
+    EngineBase* engine = nullptr;
+    std::function<void()> onUpdated;
+    int nPages = 0;
+    // nullptr if content boxes shouldn't be saved
+    WCHAR* cachePath = nullptr;
+    // identifies this cache in notifications posted to the ui thread
+    LONG id = 0;
+
+    CRITICAL_SECTION cs;
+    Vec<RectF> boxes;
+    Vec<BoxState> states;
+    int nRequested = 0;
+    int nKnown = 0;
+    int priorityFirst = 1;
+    int priorityLast = 1;
+    bool updatePosted = false;
+    bool isDirty = false;
+    bool abort = false;
+    Vec<ContentBoxWorker*> workers;
+    int nRunningWorkers = 0;
+};
+
+// removes saved content boxes that haven't been used in a while (or all of them)
+void CleanUpContentBoxCache(bool removeAll);
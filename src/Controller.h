@@ -53,6 +53,9 @@ struct ControllerCallback {
     virtual void RequestRendering(int pageNo) = 0;
     virtual void CleanUp(DisplayModel* dm) = 0;
     virtual void RenderThumbnail(DisplayModel* dm, Size size, const onBitmapRenderedCb&) = 0;
+    // called on a background thread while a document is loaded progressively:
+    // pageNo needs re-rendering, or (pageNo == 0) the whole document has been loaded
+    virtual void LoadProgress(DisplayModel* dm, int pageNo) = 0;
     // ChmModel //
     // tell the UI to move focus back to the main window
     // (if always == false, then focus is only moved if it's inside
@@ -58,6 +58,7 @@
 #include "GlobalPrefs.h"
 #include "PdfSync.h"
 #include "ProgressUpdateUI.h"
+#include "ContentBoxCache.h"
 #include "TextSelection.h"
 #include "TextSearch.h"
 
@@ -240,11 +241,8 @@ SizeF DisplayModel::PageSizeAfterRotation(int pageNo, bool fitToContent) const {
     PageInfo* pageInfo = GetPageInfo(pageNo);
     CrashIf(!pageInfo);
 
-    if (fitToContent && pageInfo->contentBox.IsEmpty()) {
-        pageInfo->contentBox = engine->PageContentBox(pageNo);
-        if (pageInfo->contentBox.IsEmpty()) {
-            return PageSizeAfterRotation(pageNo);
-        }
+    if (fitToContent && GetKnownContentBox(pageNo).IsEmpty()) {
+        return PageSizeAfterRotation(pageNo);
     }
 
     RectF box = fitToContent ? pageInfo->contentBox : pageInfo->page;
@@ -304,12 +302,17 @@ DisplayModel::DisplayModel(EngineBase* engine, ControllerCallback* cb) : Control
     textCache = new DocumentTextCache(engine);
     textSelection = new TextSelection(engine, textCache);
     textSearch = new TextSearch(engine, textCache);
+    contentBoxes = new ContentBoxCache(engine, [this] { ContentBoxesUpdated(); });
+    engine->SetLoadProgressCallback([this](int pageNo) { this->cb->LoadProgress(this, pageNo); });
 }
 
 DisplayModel::~DisplayModel() {
     dontRenderFlag = true;
+    engine->SetLoadProgressCallback(nullptr);
     cb->CleanUp(this);
 
+    // must be deleted before the engine it's using
+    delete contentBoxes;
     delete pdfSync;
     delete textSearch;
     delete textSelection;
@@ -489,12 +492,8 @@ float DisplayModel::ZoomRealFromVirtualForPage(float zoomVirtual, int pageNo) co
         RectF box;
         for (int i = first; i <= last; i++) {
             PageInfo* pageInfo = GetPageInfo(i);
-            if (pageInfo->contentBox.IsEmpty()) {
-                pageInfo->contentBox = engine->PageContentBox(i);
-            }
-
             RectF pageBox = engine->Transform(pageInfo->page, i, 1.0, rotation);
-            RectF contentBox = engine->Transform(pageInfo->contentBox, i, 1.0, rotation);
+            RectF contentBox = engine->Transform(GetKnownContentBox(i), i, 1.0, rotation);
             if (contentBox.IsEmpty()) {
                 contentBox = pageBox;
             }
@@ -1109,6 +1108,12 @@ void DisplayModel::RenderVisibleParts() {
         return;
     }
 
+    if (ZOOM_FIT_CONTENT == zoomVirtual) {
+        // compute content boxes of the pages closest to the visible ones first
+        contentBoxes->SetPriority(firstVisiblePage, lastVisiblePage);
+        contentBoxes->RequestAll();
+    }
+
     // rendering happens LIFO except if the queue is currently
     // empty, so request the visible pages first and last to
     // make sure they're rendered before the predicted pages
@@ -1167,14 +1172,69 @@ void DisplayModel::SetViewPortSize(Size newViewPortSize) {
     }
 }
 
-RectF DisplayModel::GetContentBox(int pageNo) const {
-    RectF cbox{};
-    // we cache the contentBox
+// returns an empty rect if the content box hasn't been computed yet, in which
+// case it's computed in the background and ContentBoxesUpdated() is called when done
+RectF DisplayModel::GetKnownContentBox(int pageNo) const {
     PageInfo* pageInfo = GetPageInfo(pageNo);
     if (pageInfo->contentBox.IsEmpty()) {
-        pageInfo->contentBox = engine->PageContentBox(pageNo);
+        RectF box;
+        if (contentBoxes->Get(pageNo, box)) {
+            pageInfo->contentBox = box;
+        }
+    }
+    return pageInfo->contentBox;
+}
+
+// until the content boxes are known, pages are laid out using their mediabox,
+// so re-layout if that was the case for any of the visible pages
+void DisplayModel::ContentBoxesUpdated() {
+    if (ZOOM_FIT_CONTENT != zoomVirtual || dontRenderFlag || !pagesInfo || !ValidPageNo(startPage)) {
+        return;
+    }
+    bool needsRelayout = false;
+    for (int pageNo = 1; pageNo <= PageCount(); pageNo++) {
+        PageInfo* pageInfo = GetPageInfo(pageNo);
+        if (!pageInfo->shown || 0.0 == pageInfo->visibleRatio || !pageInfo->contentBox.IsEmpty()) {
+            continue;
+        }
+        if (!GetKnownContentBox(pageNo).IsEmpty()) {
+            needsRelayout = true;
+        }
+    }
+    if (!needsRelayout) {
+        return;
+    }
+    ScrollState ss = GetScrollState();
+    Relayout(zoomVirtual, rotation);
+    // when fitting to content, let GoToPage do the necessary scrolling
+    GoToPage(ss.page, 0);
+}
+
+void DisplayModel::PageSizesChanged() {
+    if (dontRenderFlag || !pagesInfo) {
+        return;
+    }
+    contentBoxes->DocumentLoaded();
+    bool changed = false;
+    for (int pageNo = 1; pageNo <= PageCount(); pageNo++) {
+        RectF mediabox = engine->PageMediabox(pageNo);
+        PageInfo* pageInfo = GetPageInfo(pageNo);
+        if (!mediabox.IsEmpty() && mediabox != pageInfo->page) {
+            pageInfo->page = mediabox;
+            changed = true;
+        }
+    }
+    if (!changed) {
+        return;
     }
-    cbox = pageInfo->contentBox;
+    ScrollState ss = GetScrollState();
+    Relayout(zoomVirtual, rotation);
+    SetScrollState(ss);
+}
+
+RectF DisplayModel::GetContentBox(int pageNo) const {
+    RectF cbox = GetKnownContentBox(pageNo);
+    PageInfo* pageInfo = GetPageInfo(pageNo);
     float zoom = pageInfo->zoomReal;
     // TODO: must be a better way
     if (zoom == 0) {
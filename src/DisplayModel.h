@@ -48,6 +48,7 @@ struct ScrollState {
 };
 
 struct DocumentTextCache;
+class ContentBoxCache;
 struct TextSelection;
 class TextSearch;
 struct TextSel;
@@ -128,6 +129,8 @@ struct DisplayModel : Controller {
     TextSelection* textSelection{nullptr};
     // access only from Search thread
     TextSearch* textSearch{nullptr};
+    // content boxes for ZOOM_FIT_CONTENT, computed in the background
+    ContentBoxCache* contentBoxes{nullptr};
 
     [[nodiscard]] PageInfo* GetPageInfo(int pageNo) const;
 
@@ -135,6 +138,10 @@ struct DisplayModel : Controller {
     [[nodiscard]] int GetRotation() const;
     [[nodiscard]] float GetZoomReal(int pageNo) const;
     void Relayout(float zoomVirtual, int rotation);
+    // re-layout if the engine reports different page sizes than when laid out
+    // (e.g. after a progressively loaded document has been read completely,
+    // which is also when content boxes can be computed)
+    void PageSizesChanged();
 
     [[nodiscard]] Rect GetViewPort() const;
     [[nodiscard]] bool IsHScrollbarVisible() const;
@@ -199,7 +206,9 @@ struct DisplayModel : Controller {
     void RecalcVisibleParts() const;
     void RenderVisibleParts();
     void AddNavPoint();
+    RectF GetKnownContentBox(int pageNo) const;
     RectF GetContentBox(int pageNo) const;
+    void ContentBoxesUpdated();
     void CalcZoomReal(float zoomVirtual);
     void GoToPage(int pageNo, int scrollY, bool addNavPt = false, int scrollX = -1);
     bool GoToPrevPage(int scrollY);
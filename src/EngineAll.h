@@ -58,6 +58,69 @@ Annotation* EngineMupdfCreateAnnotation(EngineBase*, AnnotationType type, int pa
 int EngineMupdfGetAnnotations(EngineBase*, Vec<Annotation*>*);
 bool EngineMupdfHasUnsavedAnnotations(EngineBase*);
 bool EngineMupdfSupportsAnnotations(EngineBase*);
+
+struct GlyphCacheStats {
+    i64 size = 0;
+    i64 maxSize = 0;
+    int maxGlyphSize = 0;
+    int entries = 0;
+    // cumulative
+    i64 hits = 0;
+    i64 misses = 0;
+    i64 evictions = 0;
+};
+bool EngineMupdfGetGlyphCacheStats(EngineBase*, GlyphCacheStats* statsOut);
+// resolves a link of a mupdf document (kindDestinationMupdf) into a destination that
+// doesn't depend on the engine (e.g. to use it after the engine is closed).
+// the caller owns the result, nullptr if it can't be resolved
+IPageDestination* EngineMupdfResolveDest(EngineBase*, IPageDestination*);
+
+// color conversions of the pixmaps rendered for a document, cumulative
+struct ColorConversionStats {
+    // ICC links (transforms) built and the time it took
+    int linksCreated = 0;
+    double linkMs = 0;
+    // links that leave colors unchanged (+/- 1) and aren't run
+    int identityLinks = 0;
+    i64 linkLookups = 0;
+    i64 linkCacheHits = 0;
+    i64 pixmaps = 0;
+    // converted without an ICC link
+    i64 fastPixmaps = 0;
+    // converted with a lookup table built from an ICC link
+    i64 lutPixmaps = 0;
+    i64 pixels = 0;
+    // includes linkMs
+    double convertMs = 0;
+};
+bool EngineMupdfGetColorConversionStats(EngineBase*, ColorConversionStats* statsOut);
+// overrides the glyph cache budget derived from display dpi and fonts (0 to reset)
+void EngineMupdfSetGlyphCacheSize(EngineBase*, i64 maxSize);
+
+// number of threads used to decode a JPEG 2000 image, 0 means one per cpu (the default)
+void SetEngineMupdfJpxThreads(int nThreads);
+
+// Linearized PDFs that aren't on a local drive are shown while they're still being read.
+// If kbps > 0, all linearized PDFs are loaded that way, reading at kbps kB per second
+// (to measure time to first page as if on slow storage). 0 resets to the default.
+void SetEngineMupdfProgressiveThrottle(int kbps);
+// true until a document shown while it's being read has been read completely
+bool EngineMupdfIsLoadingProgressively(EngineBase*);
+
+// PDFs with a broken xref are repaired by scanning the whole file. The repair is
+// saved in dir (nullptr to not save it) so that it's only done once per file.
+// Only affects documents loaded afterwards
+void SetEngineMupdfRepairCacheDir(const WCHAR* dir);
+// removes repairs saved in dir that haven't been used in a while (or all of them)
+void CleanUpEngineMupdfRepairCache(const WCHAR* dir, bool removeAll);
+struct PdfRepairStats {
+    bool wasRepaired = false;
+    // the repair saved on a previous open was used instead of scanning the file
+    bool usedSavedRepair = false;
+    // time it took to open (and repair) the document
+    double ms = 0;
+};
+bool EngineMupdfGetRepairStats(EngineBase*, PdfRepairStats* statsOut);
 bool EngineMupdfSaveUpdated(EngineBase* engine, std::string_view path,
                             std::function<void(std::string_view)> showErrorFunc);
 Annotation* EngineMupdfGetAnnotationAtPos(EngineBase*, int pageNo, PointF pos, AnnotationType* allowedAnnots);
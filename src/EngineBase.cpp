@@ -144,9 +144,23 @@ IPageDestination* TocItem::GetPageDestination() const {
     return dest;
 }
 
+TocItem* TocItem::GetChild() {
+    if (childrenLoader) {
+        CrashIf(child);
+        TocItemLoader* loader = childrenLoader;
+        childrenLoader = nullptr;
+        child = loader->LoadChildren(this);
+    }
+    return child;
+}
+
+bool TocItem::HasChildren() const {
+    return child || childrenLoader;
+}
+
 int TocItem::ChildCount() {
     int n = 0;
-    auto node = child;
+    auto node = GetChild();
     while (node) {
         n++;
         node = node->next;
@@ -156,9 +170,9 @@ int TocItem::ChildCount() {
 
 TocItem* TocItem::ChildAt(int n) {
     if (n == 0) {
-        currChild = child;
+        currChild = GetChild();
         currChildNo = 0;
-        return child;
+        return currChild;
     }
     // speed up sequential iteration over children
     if (currChild != nullptr && n == currChildNo + 1) {
@@ -166,7 +180,7 @@ TocItem* TocItem::ChildAt(int n) {
         ++currChildNo;
         return currChild;
     }
-    auto node = child;
+    auto node = GetChild();
     while (n > 0) {
         n--;
         node = node->next;
@@ -176,7 +190,7 @@ TocItem* TocItem::ChildAt(int n) {
 
 bool TocItem::IsExpanded() {
     // leaf items cannot be expanded
-    if (child == nullptr) {
+    if (!HasChildren()) {
         return false;
     }
     // item is expanded when:
@@ -203,6 +217,7 @@ TocTree::TocTree(TocItem* root) {
 
 TocTree::~TocTree() {
     delete root;
+    delete childrenLoader;
 }
 
 TreeItem TocTree::Root() {
@@ -229,6 +244,11 @@ TreeItem TocTree::ChildAt(TreeItem ti, int idx) {
     return (TreeItem)tocItem->ChildAt(idx);
 }
 
+bool TocTree::HasChildren(TreeItem ti) {
+    auto tocItem = (TocItem*)ti;
+    return tocItem->HasChildren();
+}
+
 bool TocTree::IsExpanded(TreeItem ti) {
     auto tocItem = (TocItem*)ti;
     return tocItem->IsExpanded();
@@ -256,8 +276,8 @@ bool VisitTocTree(TocItem* ti, const std::function<bool(TocItem*)>& f) {
     bool cont;
     while (ti) {
         cont = f(ti);
-        if (cont && ti->child) {
-            cont = VisitTocTree(ti->child, f);
+        if (cont && ti->HasChildren()) {
+            cont = VisitTocTree(ti->GetChild(), f);
         }
         if (!cont) {
             return false;
@@ -272,8 +292,8 @@ static bool VisitTocTreeWithParentRecursive(TocItem* ti, TocItem* parent,
     bool cont;
     while (ti) {
         cont = f(ti, parent);
-        if (cont && ti->child) {
-            cont = VisitTocTreeWithParentRecursive(ti->child, ti, f);
+        if (cont && ti->HasChildren()) {
+            cont = VisitTocTreeWithParentRecursive(ti->GetChild(), ti, f);
         }
         if (!cont) {
             return false;
@@ -396,6 +416,10 @@ bool EngineBase::HandleLink(IPageDestination*, ILinkHandler*) {
     return false;
 }
 
+void EngineBase::SetLoadProgressCallback(const std::function<void(int pageNo)>&) {
+    // documents are fully loaded by default
+}
+
 // skip file:// and maybe file:/// from s. It might be added by mupdf.
 // do not free the result
 static const WCHAR* SkipFileProtocolTemp(const WCHAR* s) {
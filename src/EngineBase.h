@@ -269,6 +269,16 @@ extern Kind kindTocFzLink;
 extern Kind kindTocFzOutlineAttachment;
 extern Kind kindTocDjvu;
 
+struct TocItem;
+
+// loads the children of TocItems on demand, for documents with
+// lots of ToC items (see TocItem::childrenLoader)
+struct TocItemLoader {
+    virtual ~TocItemLoader() = default;
+    // returns the first of the children of item (nullptr if it has none)
+    virtual TocItem* LoadChildren(TocItem* item) = 0;
+};
+
 // an item in a document's Table of Content
 struct TocItem {
     HTREEITEM hItem{nullptr};
@@ -308,11 +318,17 @@ struct TocItem {
     IPageDestination* dest{nullptr};
     bool destNotOwned{false};
 
-    // first child item
+    // first child item (only if the children are loaded, see GetChild())
     TocItem* child{nullptr};
     // next sibling
     TocItem* next{nullptr};
 
+    // if set, the item has children that haven't been loaded yet.
+    // Not owned, owned by TocTree
+    TocItemLoader* childrenLoader{nullptr};
+    // identifies the children for childrenLoader
+    int childrenRef{0};
+
     // caching to speed up ChildAt
     TocItem* currChild{nullptr};
     int currChildNo{0};
@@ -339,6 +355,10 @@ struct TocItem {
 
     IPageDestination* GetPageDestination() const;
 
+    // loads the children if they haven't been loaded yet
+    TocItem* GetChild();
+    // doesn't load the children
+    [[nodiscard]] bool HasChildren() const;
     int ChildCount();
     TocItem* ChildAt(int n);
     bool IsExpanded();
@@ -348,6 +368,8 @@ struct TocItem {
 
 struct TocTree : TreeModel {
     TocItem* root{nullptr};
+    // loads children of items on demand, can be nullptr
+    TocItemLoader* childrenLoader{nullptr};
 
     TocTree() = default;
     explicit TocTree(TocItem* root);
@@ -360,6 +382,7 @@ struct TocTree : TreeModel {
     TreeItem Parent(TreeItem) override;
     int ChildCount(TreeItem) override;
     TreeItem ChildAt(TreeItem, int index) override;
+    bool HasChildren(TreeItem) override;
     bool IsExpanded(TreeItem) override;
     bool IsChecked(TreeItem) override;
 
@@ -367,6 +390,7 @@ struct TocTree : TreeModel {
     HTREEITEM GetHandle(TreeItem) override;
 };
 
+// visit all items, loading children that haven't been loaded yet
 bool VisitTocTree(TocItem* ti, const std::function<bool(TocItem*)>& f);
 bool VisitTocTreeWithParent(TocItem* ti, const std::function<bool(TocItem* ti, TocItem* parent)>& f);
 void SetTocTreeParents(TocItem* treeRoot);
@@ -388,6 +412,9 @@ struct RenderPageArgs {
     RectF* pageRect{nullptr};
     RenderTarget target = RenderTarget::View;
     AbortCookie** cookie_out{nullptr};
+    // trade quality for speed (less anti-aliasing, no image interpolation)
+    // for a quick low-resolution pass that's replaced by a full rendering
+    bool isPreview{false};
 
     RenderPageArgs(int pageNo, float zoom, int rotation, RectF* pageRect = nullptr,
                    RenderTarget target = RenderTarget::View, AbortCookie** cookie_out = nullptr);
@@ -520,6 +547,13 @@ class EngineBase {
     // all code there)
     virtual bool HandleLink(IPageDestination*, ILinkHandler*);
 
+    // for documents that are shown while they're still being loaded (e.g. linearized
+    // PDFs on slow storage). onLoadProgress is called on a background thread with the
+    // number of a page that was rendered before it was loaded and should be rendered
+    // again, and with 0 once the whole document was loaded (page sizes might've changed).
+    // Changing the callback (e.g. to nullptr) waits until a call in progress has returned
+    virtual void SetLoadProgressCallback(const std::function<void(int pageNo)>& onLoadProgress);
+
     // protected:
     void SetFileName(const WCHAR* s);
 };
@@ -3,11 +3,18 @@
 
 #include "utils/BaseUtil.h"
 #include "utils/ScopedWin.h"
+#include "utils/BenchReport.h"
 #include "utils/CmdLineArgsIter.h"
+#include "utils/CryptoUtil.h"
+#include "utils/DirIter.h"
 #include "utils/FileUtil.h"
 #include "utils/GdiPlusUtil.h"
+#include "utils/GuessFileType.h"
 #include "mui/Mui.h"
+#include "utils/PageResultCache.h"
 #include "utils/TgaReader.h"
+#include "utils/ThreadUtil.h"
+#include "utils/Timer.h"
 #include "utils/WinUtil.h"
 
 #include "wingui/TreeModel.h"
@@ -209,14 +216,14 @@ void DumpTocItem(EngineBase* engine, TocItem* item, int level, int& idCounter) {
                 Out(" Target%s", rectStr.Get());
             }
         }
-        if (!item->child) {
+        if (!item->HasChildren()) {
             Out1(" />\n");
         } else {
             if (item->isOpenDefault) {
                 Out1(" Expanded=\"yes\"");
             }
             Out1(">\n");
-            DumpTocItem(engine, item->child, level + 1, idCounter);
+            DumpTocItem(engine, item->GetChild(), level + 1, idCounter);
             for (int i = 0; i < level; i++) {
                 Out1("\t");
             }
@@ -461,6 +468,339 @@ bool RenderDocument(EngineBase* engine, const WCHAR* renderPath, float zoom = 1.
     return success;
 }
 
+// -bench mode: loads all documents in a directory with a pool of worker
+// threads, times loading, rendering, text extraction and toc of every
+// document/page and writes a BenchReport as JSON
+//
+// with -cache <dir>, results of every page (hashes of the rendered bitmap
+// and of the text, timings) are saved per document and engine version
+// (see PageResultCache.h), so that re-running the benchmark only renders
+// documents and pages that haven't been rendered by this engine version yet.
+// With -baseline-version, pages that render differently than with the
+// baseline engine version are reported
+
+struct BenchCache {
+    // nullptr if results aren't cached
+    const WCHAR* dir = nullptr;
+    const char* version = nullptr;
+    // nullptr if not comparing against a baseline
+    const char* baselineVersion = nullptr;
+};
+
+// results depend on zoom and on which operations are timed
+constexpr const char* kBenchCacheOptions = "render,text";
+
+struct BenchResult {
+    BenchSamples samples[(int)BenchMetric::Count];
+    int files = 0;
+    int failedFiles = 0;
+    i64 pages = 0;
+    i64 cachedPages = 0;
+    i64 mismatchedPages = 0;
+
+    BenchSamples& Get(BenchMetric m) {
+        return samples[(int)m];
+    }
+};
+
+static bool CalcFileDigest(const WCHAR* filePath, u8 digest[16]) {
+    AutoFree data = file::ReadFile(filePath);
+    if (data.empty()) {
+        return false;
+    }
+    CalcMD5Digest(data.Get(), data.size(), digest);
+    return true;
+}
+
+static void AddCachedPage(const WCHAR* filePath, const PageResult& pr, BenchResult& res) {
+    if (!pr.renderHash[0]) {
+        ErrOut("Error: Failed to render page %d for %s!", pr.pageNo, filePath);
+        return;
+    }
+    res.Get(BenchMetric::Render).Add(pr.renderMs);
+    res.Get(BenchMetric::Text).Add(pr.textMs);
+    res.pages++;
+    res.cachedPages++;
+}
+
+static void CompareToBaseline(const WCHAR* filePath, const u8 digest[16], float zoom, const BenchCache& cache,
+                              DocResults& docRes, BenchResult& res) {
+    AutoFree key = PageResultsKey(digest, cache.baselineVersion, zoom, kBenchCacheOptions);
+    DocResults baseline;
+    if (!LoadPageResults(cache.dir, key, baseline)) {
+        ErrOut("Warning: no baseline results for %s", filePath);
+        return;
+    }
+    for (PageResult& pr : docRes.pages) {
+        PageResult* base = baseline.GetPage(pr.pageNo);
+        if (!base) {
+            continue;
+        }
+        bool renderDiffers = !str::Eq(pr.renderHash, base->renderHash);
+        bool textDiffers = !str::Eq(pr.textHash, base->textHash);
+        if (renderDiffers || textDiffers) {
+            ErrOut("Mismatch: page %d of %s (%s%s%s)", pr.pageNo, filePath, renderDiffers ? L"rendering" : L"",
+                   renderDiffers && textDiffers ? L", " : L"", textDiffers ? L"text" : L"");
+            res.mismatchedPages++;
+        }
+    }
+}
+
+static void BenchDocument(const WCHAR* filePath, float zoom, const BenchCache& cache, BenchResult& res) {
+    res.files++;
+    DocResults docRes;
+    AutoFree key;
+    u8 digest[16];
+    bool useCache = cache.dir && CalcFileDigest(filePath, digest);
+    if (useCache) {
+        key.Set(PageResultsKey(digest, cache.version, zoom, kBenchCacheOptions));
+        LoadPageResults(cache.dir, key, docRes);
+    }
+
+    if (docRes.IsComplete()) {
+        // everything is known, no need to even load the document
+        res.Get(BenchMetric::Load).Add(docRes.loadMs);
+        res.Get(BenchMetric::Toc).Add(docRes.tocMs);
+        for (PageResult& pr : docRes.pages) {
+            AddCachedPage(filePath, pr, res);
+        }
+    } else {
+        auto t = TimeGet();
+        EngineBase* engine = CreateEngine(filePath, nullptr, true);
+        if (!engine) {
+            ErrOut("Error: Couldn't create an engine for %s!", filePath);
+            res.failedFiles++;
+            return;
+        }
+        double loadMs = TimeSinceInMs(t);
+        res.Get(BenchMetric::Load).Add(loadMs);
+
+        t = TimeGet();
+        engine->GetToc();
+        double tocMs = TimeSinceInMs(t);
+        res.Get(BenchMetric::Toc).Add(tocMs);
+
+        int nPages = engine->PageCount();
+        if (docRes.nPages != nPages) {
+            docRes.Reset();
+        }
+        docRes.nPages = nPages;
+        docRes.loadMs = loadMs;
+        docRes.tocMs = tocMs;
+
+        for (int pageNo = 1; pageNo <= nPages; pageNo++) {
+            PageResult* cached = docRes.GetPage(pageNo);
+            if (cached) {
+                AddCachedPage(filePath, *cached, res);
+                continue;
+            }
+            t = TimeGet();
+            engine->BenchLoadPage(pageNo);
+            RenderPageArgs args(pageNo, zoom, 0);
+            RenderedBitmap* bmp = engine->RenderPage(args);
+            double renderMs = TimeSinceInMs(t);
+            if (!bmp) {
+                ErrOut("Error: Failed to render page %d for %s!", pageNo, filePath);
+                if (useCache) {
+                    docRes.SetPage(pageNo, {}, nullptr, renderMs, 0);
+                }
+                continue;
+            }
+            ByteSlice bmpData;
+            if (useCache) {
+                bmpData = SerializeBitmap(bmp->GetBitmap());
+            }
+            delete bmp;
+            res.Get(BenchMetric::Render).Add(renderMs);
+
+            t = TimeGet();
+            PageText pageText = engine->ExtractPageText(pageNo);
+            double textMs = TimeSinceInMs(t);
+            res.Get(BenchMetric::Text).Add(textMs);
+            if (useCache) {
+                TempStr text = ToUtf8Temp(pageText.text ? pageText.text : L"");
+                docRes.SetPage(pageNo, bmpData, text.Get(), renderMs, textMs);
+                str::Free(bmpData.data());
+            }
+            FreePageText(&pageText);
+            res.pages++;
+        }
+        delete engine;
+        if (useCache && !SavePageResults(cache.dir, key, docRes)) {
+            ErrOut("Error: failed to save results for %s in %s!", filePath, cache.dir);
+        }
+    }
+
+    if (useCache && cache.baselineVersion) {
+        CompareToBaseline(filePath, digest, zoom, cache, docRes, res);
+    }
+    ResetTempAllocator();
+}
+
+class BenchWorker : public ThreadBase {
+  public:
+    WStrVec* files = nullptr;
+    LONG* nextFile = nullptr;
+    float zoom = 1.f;
+    const BenchCache* cache = nullptr;
+    BenchResult res;
+
+    void Run() override {
+        for (;;) {
+            int idx = (int)InterlockedIncrement(nextFile) - 1;
+            if (idx >= files->isize()) {
+                break;
+            }
+            BenchDocument(files->at(idx), zoom, *cache, res);
+        }
+        DestroyTempAllocator();
+    }
+};
+
+static void CollectFilesToBench(const WCHAR* path, WStrVec& files) {
+    if (file::Exists(path)) {
+        files.Append(str::Dup(path));
+        return;
+    }
+    DirIter di(path, true /* recursive */);
+    for (const WCHAR* filePath = di.First(); filePath; filePath = di.Next()) {
+        Kind kind = GuessFileType(filePath, true);
+        if (IsSupportedFileType(kind, true)) {
+            files.Append(str::Dup(filePath));
+        }
+    }
+    // so that the order (and the reports) don't depend on the file system
+    files.Sort();
+}
+
+// identifies the build of EngineDump, so that the results cached
+// by an older build aren't re-used after re-compiling
+static char* GetExeFingerprint() {
+    TempWstr exePath = GetExePathTemp();
+    FILETIME ft = file::GetModificationTime(exePath.Get());
+    i64 size = file::GetSize(ToUtf8Temp(exePath.Get()).AsView());
+    return str::Format("%llx-%08x%08x", size, ft.dwHighDateTime, ft.dwLowDateTime);
+}
+
+// returns 1 if some pages render differently than with the baseline version
+static int RunBenchmark(const WCHAR* path, int nWorkers, float zoom, const BenchCache& cache,
+                        const WCHAR* reportPath) {
+    WStrVec files;
+    CollectFilesToBench(path, files);
+    if (files.size() == 0) {
+        ErrOut("Error: no documents to benchmark in %s!", path);
+        return 1;
+    }
+    nWorkers = std::clamp(nWorkers, 1, std::max(files.isize(), 1));
+
+    auto t = TimeGet();
+    LONG nextFile = 0;
+    Vec<BenchWorker*> workers;
+    for (int i = 0; i < nWorkers; i++) {
+        auto w = new BenchWorker();
+        w->files = &files;
+        w->nextFile = &nextFile;
+        w->zoom = zoom;
+        w->cache = &cache;
+        w->Start();
+        workers.Append(w);
+    }
+
+    BenchResult total;
+    for (auto w : workers) {
+        w->Join();
+        for (int i = 0; i < (int)BenchMetric::Count; i++) {
+            total.samples[i].Append(w->res.samples[i]);
+        }
+        total.files += w->res.files;
+        total.failedFiles += w->res.failedFiles;
+        total.pages += w->res.pages;
+        total.cachedPages += w->res.cachedPages;
+        total.mismatchedPages += w->res.mismatchedPages;
+        delete w;
+    }
+
+    BenchReport report;
+    report.workers = nWorkers;
+    report.files = total.files;
+    report.failedFiles = total.failedFiles;
+    report.pages = total.pages;
+    report.wallMs = TimeSinceInMs(t);
+    report.peakMemBytes = GetPeakMemoryUsage();
+    for (int i = 0; i < (int)BenchMetric::Count; i++) {
+        report.metrics[i] = total.samples[i].Summarize();
+    }
+
+    if (cache.dir) {
+        ErrOut("%lld of %lld page(s) from cache", total.cachedPages, total.pages);
+    }
+    if (cache.baselineVersion) {
+        ErrOut("%lld page(s) differ from baseline", total.mismatchedPages);
+    }
+    int res = total.mismatchedPages > 0 ? 1 : 0;
+
+    str::Str json;
+    BenchReportToJson(report, json);
+    if (!reportPath) {
+        Out1(json.Get());
+        return res;
+    }
+    if (!file::WriteFile(reportPath, json.AsByteSlice())) {
+        ErrOut("Error: failed to write %s!", reportPath);
+        return 1;
+    }
+    return res;
+}
+
+// -bench-pdf mode: rasterizes a document to a temporary PDF with
+// PdfCreator::RenderToFile and reports pages/sec and peak memory
+static int BenchRenderToPdf(const WCHAR* filePath, int nWorkers, int dpi, int jpegQuality) {
+    EngineBase* engine = CreateEngine(filePath, nullptr, false);
+    if (!engine) {
+        ErrOut("Error: Couldn't create an engine for %s!", path::GetBaseNameTemp(filePath));
+        return 1;
+    }
+    AutoFreeWstr pdfPath = path::GetTempFilePath(L"pdf");
+    auto pdfPathA = ToUtf8Temp(pdfPath);
+    int nPages = engine->PageCount();
+    auto t = TimeGet();
+    bool ok = PdfCreator::RenderToFile(pdfPathA.Get(), engine, dpi, nWorkers, jpegQuality);
+    double ms = TimeSinceInMs(t);
+    i64 size = file::GetSize(pdfPathA.AsView());
+    file::Delete(pdfPath);
+    delete engine;
+    if (!ok) {
+        ErrOut("Error: Failed to render %s to PDF!", path::GetBaseNameTemp(filePath));
+        return 1;
+    }
+    Out("pages: %d, dpi: %d, workers: %d, time: %.2f ms, pages/sec: %.2f, size: %lld, peak memory: %lld\n", nPages, dpi,
+        nWorkers, ms, nPages * 1000.0 / ms, size, GetPeakMemoryUsage());
+    return 0;
+}
+
+static bool LoadBenchReport(const WCHAR* path, BenchReport& report) {
+    AutoFree data = file::ReadFile(path);
+    if (data.empty() || !BenchReportFromJson(data.Get(), report)) {
+        ErrOut("Error: %s is not a valid benchmark report!", path);
+        return false;
+    }
+    return true;
+}
+
+// returns 1 if curr has regressions compared to base
+static int CompareBenchmarks(const WCHAR* basePath, const WCHAR* currPath, double thresholdPercent) {
+    BenchReport base, curr;
+    if (!LoadBenchReport(basePath, base) || !LoadBenchReport(currPath, curr)) {
+        return 2;
+    }
+    // differences of less than 1 ms are noise
+    str::Str out;
+    int nRegressions = CompareBenchReports(base, curr, thresholdPercent, 1.0, out);
+    Out1(out.Get());
+    Out("%d regression(s) (threshold: %g%%)\n", nRegressions, thresholdPercent);
+    return nRegressions > 0 ? 1 : 0;
+}
+
 class PasswordHolder : public PasswordUI {
     const WCHAR* password;
 
@@ -484,6 +824,13 @@ int main(__unused int argc, __unused char** argv) {
     Usage:
         ErrOut("%s [-pwd <password>][-quick][-render <path-%%d.tga>] <filename>",
                path::GetBaseNameTemp(argList.args[0]));
+        ErrOut("%s -bench <dir> [-j <workers>][-zoom <percent>][-bench-out <report.json>]",
+               path::GetBaseNameTemp(argList.args[0]));
+        ErrOut1("       [-cache <dir>][-cache-version <version>][-baseline-version <version>]");
+        ErrOut("%s -bench-compare <base.json> <new.json> [-threshold <percent>]",
+               path::GetBaseNameTemp(argList.args[0]));
+        ErrOut("%s -bench-pdf <filename> [-j <workers>][-dpi <dpi>][-jpeg <quality>]",
+               path::GetBaseNameTemp(argList.args[0]));
         return 2;
     }
 
@@ -493,6 +840,18 @@ int main(__unused int argc, __unused char** argv) {
     WCHAR* renderPath = nullptr;
     float renderZoom = 1.f;
     bool loadOnly = false, silent = false;
+    WCHAR* benchPath = nullptr;
+    WCHAR* benchOutPath = nullptr;
+    WCHAR* benchComparePaths[2] = {nullptr, nullptr};
+    int benchWorkers = 1;
+    float benchZoom = 1.f;
+    float benchThreshold = 10.f;
+    bool benchPdf = false;
+    int benchDpi = 300;
+    int benchJpegQuality = 0;
+    WCHAR* benchCacheDir = nullptr;
+    WCHAR* benchCacheVersion = nullptr;
+    WCHAR* benchBaselineVersion = nullptr;
 
     for (int i = 1; i < nArgs; i++) {
         if (str::Eq(argList.at(i), L"-pwd") && i + 1 < nArgs && !password) {
@@ -512,6 +871,31 @@ int main(__unused int argc, __unused char** argv) {
             loadOnly = true;
         } else if (str::Eq(argList.at(i), L"-silent")) {
             silent = true;
+        } else if (str::Eq(argList.at(i), L"-bench") && i + 1 < nArgs) {
+            benchPath = argList.at(++i);
+        } else if (str::Eq(argList.at(i), L"-j") && i + 1 < nArgs) {
+            benchWorkers = _wtoi(argList.at(++i));
+        } else if (str::Eq(argList.at(i), L"-zoom") && i + 1 < nArgs) {
+            benchZoom = (float)_wtof(argList.at(++i)) / 100.f;
+        } else if (str::Eq(argList.at(i), L"-bench-out") && i + 1 < nArgs) {
+            benchOutPath = argList.at(++i);
+        } else if (str::Eq(argList.at(i), L"-cache") && i + 1 < nArgs) {
+            benchCacheDir = argList.at(++i);
+        } else if (str::Eq(argList.at(i), L"-cache-version") && i + 1 < nArgs) {
+            benchCacheVersion = argList.at(++i);
+        } else if (str::Eq(argList.at(i), L"-baseline-version") && i + 1 < nArgs) {
+            benchBaselineVersion = argList.at(++i);
+        } else if (str::Eq(argList.at(i), L"-bench-compare") && i + 2 < nArgs) {
+            benchComparePaths[0] = argList.at(++i);
+            benchComparePaths[1] = argList.at(++i);
+        } else if (str::Eq(argList.at(i), L"-bench-pdf")) {
+            benchPdf = true;
+        } else if (str::Eq(argList.at(i), L"-dpi") && i + 1 < nArgs) {
+            benchDpi = _wtoi(argList.at(++i));
+        } else if (str::Eq(argList.at(i), L"-jpeg") && i + 1 < nArgs) {
+            benchJpegQuality = _wtoi(argList.at(++i));
+        } else if (str::Eq(argList.at(i), L"-threshold") && i + 1 < nArgs) {
+            benchThreshold = (float)_wtof(argList.at(++i));
         } else if (str::Eq(argList.at(i), L"-full")) {
             // -full is for backward compatibility
             fullDump = true;
@@ -521,9 +905,40 @@ int main(__unused int argc, __unused char** argv) {
             goto Usage;
         }
     }
+    if (benchComparePaths[0]) {
+        return CompareBenchmarks(benchComparePaths[0], benchComparePaths[1], benchThreshold);
+    }
+    if (benchPath) {
+        if (benchZoom <= 0.f || (benchBaselineVersion && !benchCacheDir)) {
+            goto Usage;
+        }
+        BenchCache cache;
+        AutoFree cacheVersion;
+        AutoFree baselineVersion;
+        if (benchCacheDir) {
+            cacheVersion.Set(benchCacheVersion ? strconv::WstrToUtf8(benchCacheVersion) : GetExeFingerprint());
+            cache.dir = benchCacheDir;
+            cache.version = cacheVersion.Get();
+        }
+        if (benchBaselineVersion) {
+            baselineVersion.Set(strconv::WstrToUtf8(benchBaselineVersion));
+            cache.baselineVersion = baselineVersion.Get();
+        }
+        ScopedGdiPlus gdiPlus;
+        ScopedMui miniMui;
+        return RunBenchmark(benchPath, benchWorkers, benchZoom, cache, benchOutPath);
+    }
     if (!filePath) {
         goto Usage;
     }
+    if (benchPdf) {
+        if (benchDpi <= 0) {
+            goto Usage;
+        }
+        ScopedGdiPlus gdiPlus;
+        ScopedMui miniMui;
+        return BenchRenderToPdf(filePath, benchWorkers, benchDpi, benchJpegQuality);
+    }
 
     if (silent) {
         FILE* nul;
@@ -128,6 +128,8 @@ class EngineEbook : public EngineBase {
     PoolAllocator allocator;
     // TODO: still needed?
     CRITICAL_SECTION pagesAccess;
+    // decoded images, shared by all renders of this document
+    DecodedImageCache imageCache;
     // page dimensions can vary between filetypes
     RectF pageRect;
     float pageBorder;
@@ -332,7 +334,7 @@ RenderedBitmap* EngineEbook::RenderPage(RenderPageArgs& args) {
 
     mui::ITextRender* textDraw = mui::TextRenderGdiplus::Create(&g);
     DrawHtmlPage(&g, textDraw, GetHtmlPage(pageNo), pageBorder, pageBorder, false, Color((ARGB)Color::Black),
-                 cookie ? &cookie->abort : nullptr);
+                 cookie ? &cookie->abort : nullptr, &imageCache);
     delete textDraw;
     DeleteDC(hDC);
 
@@ -12,6 +12,7 @@ extern "C" {
 #include "utils/FileUtil.h"
 #include "utils/GuessFileType.h"
 #include "utils/DirIter.h"
+#include "utils/ThreadUtil.h"
 #include "utils/HtmlParserLookup.h"
 #include "utils/HtmlPullParser.h"
 #include "utils/TrivialHtmlParser.h"
@@ -29,20 +30,83 @@ extern "C" {
 
 #include "utils/Log.h"
 
+// runs of consecutive pages with the same mediabox. Most documents
+// have a single page size, so this doesn't grow with the number of pages
+struct MediaboxRun {
+    int firstPageNo = 0;
+    RectF mediabox;
+};
+
+// Sub-engines are loaded (in parallel) when opening the folder to get the
+// number of pages, page sizes and the toc, and are closed right after.
+// They're loaded again when a page is needed (e.g. for rendering) and
+// at most EngineMulti::kMaxLoadedEngines stay loaded.
 struct EngineInfo {
     TocItem* tocRoot = nullptr;
+    WCHAR* filePath = nullptr;
+    int nPages = 0;
+    // number of pages of the (checked) engines before this one
+    int pageOffset = 0;
+    Vec<MediaboxRun> mediaboxes;
+    // EngineMupdf's Transform() only depends on the mediabox
+    bool isMupdf = false;
+
+    // nullptr if not loaded. Only accessed under EngineMulti::enginesAccess
     EngineBase* engine = nullptr;
+    // the engine can't be closed while > 0
+    int nUsers = 0;
+    u64 lastUse = 0;
+
+    EngineInfo() = default;
+    EngineInfo(EngineInfo const&) = delete;
+    EngineInfo& operator=(EngineInfo const&) = delete;
+    ~EngineInfo() {
+        delete engine;
+        str::Free(filePath);
+    }
+
+    [[nodiscard]] RectF PageMediabox(int pageNo) const;
 };
 
-struct EnginePage {
-    int pageNoInEngine = 0;
-    EngineBase* engine = nullptr;
+// copies of the page elements of a sub-engine page, owned by EngineMulti
+struct PageElementsCopy {
+    int pageNo = 0;
+    Vec<IPageElement*> elements;
+    u64 lastUse = 0;
+
+    PageElementsCopy() = default;
+    PageElementsCopy(PageElementsCopy const&) = delete;
+    PageElementsCopy& operator=(PageElementsCopy const&) = delete;
+    ~PageElementsCopy() {
+        DeleteVecMembers(elements);
+    }
 };
 
+RectF EngineInfo::PageMediabox(int pageNo) const {
+    CrashIf(mediaboxes.size() == 0);
+    // the last run starting at or before pageNo
+    int lo = 0;
+    int hi = mediaboxes.isize() - 1;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (mediaboxes[mid].firstPageNo <= pageNo) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return mediaboxes[lo].mediabox;
+}
+
 Kind kindEngineMulti = "enginePdfMulti";
 
 class EngineMulti : public EngineBase {
   public:
+    // how many sub-engines are kept loaded
+    static constexpr int kMaxLoadedEngines = 8;
+    // for how many pages we keep copies of the page elements
+    static constexpr int kMaxPagesWithElements = 16;
+
     EngineMulti();
     ~EngineMulti() override;
     EngineBase* Clone() override;
@@ -68,6 +132,7 @@ class EngineMulti : public EngineBase {
     IPageElement* GetElementAtPos(int pageNo, PointF pt) override;
 
     RenderedBitmap* GetImageForPageElement(IPageElement*) override;
+    bool HandleLink(IPageDestination*, ILinkHandler*) override;
 
     IPageDestination* GetNamedDest(const WCHAR* name) override;
     TocTree* GetToc() override;
@@ -77,57 +142,209 @@ class EngineMulti : public EngineBase {
 
     bool Load(const WCHAR* fileName, PasswordUI* pwdUI);
     bool LoadFromFiles(std::string_view dir, VecStr& files);
-    void UpdatePagesForEngines(Vec<EngineInfo>& enginesInfo);
-
-    EngineBase* PageToEngine(int& pageNo) const;
-    Vec<EnginePage> pageToEngine;
-    Vec<EngineInfo> enginesInfo;
+    void UpdatePagesForEngines();
+
+    EngineInfo* PageToEngineInfo(int& pageNo) const;
+    EngineBase* AcquireEngine(EngineInfo* ei) const;
+    void ReleaseEngine(EngineInfo* ei) const;
+    void CloseUnusedEngines(Vec<EngineBase*>& toDelete) const;
+    Vec<IPageElement*> GetPageElementCopies(int pageNo, int* indexOut = nullptr, PointF* pt = nullptr);
+    PageElementsCopy* FindElementsCopy(int pageNo);
+    void RetireElements(PageElementsCopy* copy);
+
+    // all successfully loaded files, in order
+    Vec<EngineInfo*> enginesInfo;
+    // engines whose pages are shown, ordered by pageOffset
+    Vec<EngineInfo*> pageEngines;
     TocTree* tocTree = nullptr;
+
+    mutable CRITICAL_SECTION enginesAccess;
+    mutable u64 useCounter = 0;
+
+    // sub-engines (which own the page elements) get closed while the ui
+    // still uses the elements, so we hand out copies that we own.
+    // at most kMaxPagesWithElements, the least recently used are dropped
+    Vec<PageElementsCopy*> elementsCopies;
+    // copies that were dropped or replaced by more complete ones (e.g. the
+    // page wasn't fully loaded) while the ui might still use them. The ui
+    // only holds on to elements of the page it last asked for, so they're
+    // freed when the elements of a different page are asked for
+    Vec<IPageElement*> retiredElements;
+    int lastElementsPageNo = 0;
+    u64 elementsUseCounter = 0;
+    CRITICAL_SECTION elementsAccess;
+};
+
+// loads a sub-engine if needed and keeps it loaded while in scope.
+// engine is nullptr if the file can no longer be loaded
+struct SubEngine {
+    const EngineMulti* multi = nullptr;
+    EngineInfo* ei = nullptr;
+    EngineBase* engine = nullptr;
+
+    SubEngine(const EngineMulti* multi, EngineInfo* ei) : multi(multi), ei(ei) {
+        engine = multi->AcquireEngine(ei);
+    }
+    ~SubEngine() {
+        multi->ReleaseEngine(ei);
+    }
+    SubEngine(SubEngine const&) = delete;
+    SubEngine& operator=(SubEngine const&) = delete;
 };
 
-EngineBase* EngineMulti::PageToEngine(int& pageNo) const {
-    const EnginePage& ep = pageToEngine[pageNo - 1];
-    pageNo = ep.pageNoInEngine;
-    return ep.engine;
+// binary search in page offsets of engines. pageNo is converted
+// to the page number within the engine
+EngineInfo* EngineMulti::PageToEngineInfo(int& pageNo) const {
+    CrashIf(pageNo < 1 || pageNo > pageCount);
+    // the last engine with pageOffset < pageNo
+    int lo = 0;
+    int hi = pageEngines.isize() - 1;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (pageEngines[mid]->pageOffset < pageNo) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    EngineInfo* ei = pageEngines[lo];
+    pageNo -= ei->pageOffset;
+    return ei;
+}
+
+EngineBase* EngineMulti::AcquireEngine(EngineInfo* ei) const {
+    {
+        ScopedCritSec scope(&enginesAccess);
+        // also keeps the engine from being closed while we're loading it
+        ei->nUsers++;
+        ei->lastUse = ++useCounter;
+        if (ei->engine) {
+            return ei->engine;
+        }
+    }
+
+    // loading can be slow, so other sub-engines can be used in the meantime
+    EngineBase* engine = CreateEngine(ei->filePath, nullptr, true);
+    // the file might have changed since we've opened the folder
+    if (engine && engine->PageCount() != ei->nPages) {
+        logf("EngineMulti: page count of '%s' changed\n", ToUtf8Temp(ei->filePath).Get());
+        delete engine;
+        engine = nullptr;
+    }
+
+    Vec<EngineBase*> toDelete;
+    EngineBase* res = nullptr;
+    {
+        ScopedCritSec scope(&enginesAccess);
+        if (ei->engine) {
+            // another thread has loaded it first
+            toDelete.Append(engine);
+        } else {
+            ei->engine = engine;
+        }
+        res = ei->engine;
+        CloseUnusedEngines(toDelete);
+    }
+    DeleteVecMembers(toDelete);
+    return res;
+}
+
+void EngineMulti::ReleaseEngine(EngineInfo* ei) const {
+    ScopedCritSec scope(&enginesAccess);
+    CrashIf(ei->nUsers <= 0);
+    ei->nUsers--;
+}
+
+// closes least recently used engines (which are usually the ones
+// farthest from what's visible) that are not in use. They're added
+// to toDelete, to be deleted after enginesAccess is released
+void EngineMulti::CloseUnusedEngines(Vec<EngineBase*>& toDelete) const {
+    int nLoaded = 0;
+    for (EngineInfo* ei : enginesInfo) {
+        if (ei->engine) {
+            nLoaded++;
+        }
+    }
+    while (nLoaded > kMaxLoadedEngines) {
+        EngineInfo* lru = nullptr;
+        for (EngineInfo* ei : enginesInfo) {
+            if (ei->engine && ei->nUsers == 0 && (!lru || ei->lastUse < lru->lastUse)) {
+                lru = ei;
+            }
+        }
+        if (!lru) {
+            return;
+        }
+        toDelete.Append(lru->engine);
+        lru->engine = nullptr;
+        nLoaded--;
+    }
 }
 
 EngineMulti::EngineMulti() {
     kind = kindEngineMulti;
     defaultExt = L""; // TODO: no extension, is it important?
     fileDPI = 72.0f;
+    InitializeCriticalSection(&enginesAccess);
+    InitializeCriticalSection(&elementsAccess);
 }
 
 EngineMulti::~EngineMulti() {
-    for (auto&& ei : enginesInfo) {
-        delete ei.engine;
-    }
+    DeleteVecMembers(elementsCopies);
+    DeleteVecMembers(retiredElements);
+    DeleteVecMembers(enginesInfo);
     delete tocTree;
+    DeleteCriticalSection(&elementsAccess);
+    DeleteCriticalSection(&enginesAccess);
 }
 
+// callers (e.g. ContentBoxWorker) fall back to using this engine
 EngineBase* EngineMulti::Clone() {
     // TODO: support CreateFromFiles()
-    CrashIf(true);
     return nullptr;
 }
 
 RectF EngineMulti::PageMediabox(int pageNo) {
-    EngineBase* e = PageToEngine(pageNo);
-    return e->PageMediabox(pageNo);
+    EngineInfo* ei = PageToEngineInfo(pageNo);
+    return ei->PageMediabox(pageNo);
 }
 
 RectF EngineMulti::PageContentBox(int pageNo, RenderTarget target) {
-    EngineBase* e = PageToEngine(pageNo);
-    return e->PageContentBox(pageNo, target);
+    EngineInfo* ei = PageToEngineInfo(pageNo);
+    SubEngine e(this, ei);
+    if (!e.engine) {
+        return ei->PageMediabox(pageNo);
+    }
+    return e.engine->PageContentBox(pageNo, target);
 }
 
 RenderedBitmap* EngineMulti::RenderPage(RenderPageArgs& args) {
-    EngineBase* e = PageToEngine(args.pageNo);
-    return e->RenderPage(args);
+    EngineInfo* ei = PageToEngineInfo(args.pageNo);
+    SubEngine e(this, ei);
+    if (!e.engine) {
+        return nullptr;
+    }
+    return e.engine->RenderPage(args);
 }
 
 RectF EngineMulti::Transform(const RectF& rect, int pageNo, float zoom, int rotation, bool inverse) {
-    EngineBase* e = PageToEngine(pageNo);
-    return e->Transform(rect, pageNo, zoom, rotation, inverse);
+    EngineInfo* ei = PageToEngineInfo(pageNo);
+    if (!ei->isMupdf) {
+        SubEngine e(this, ei);
+        if (e.engine) {
+            return e.engine->Transform(rect, pageNo, zoom, rotation, inverse);
+        }
+    }
+    // same as EngineMupdf::Transform() but without loading the engine
+    if (zoom <= 0) {
+        zoom = 1;
+    }
+    fz_matrix ctm = FzCreateViewCtm(ToFzRect(ei->PageMediabox(pageNo)), zoom, rotation);
+    if (inverse) {
+        ctm = fz_invert_matrix(ctm);
+    }
+    fz_rect rect2 = fz_transform_rect(ToFzRect(rect), ctm);
+    return ToRectF(rect2);
 }
 
 ByteSlice EngineMulti::GetFileData() {
@@ -143,13 +360,21 @@ bool EngineMulti::SaveFileAsPDF(const char*) {
 }
 
 PageText EngineMulti::ExtractPageText(int pageNo) {
-    EngineBase* e = PageToEngine(pageNo);
-    return e->ExtractPageText(pageNo);
+    EngineInfo* ei = PageToEngineInfo(pageNo);
+    SubEngine e(this, ei);
+    if (!e.engine) {
+        return {};
+    }
+    return e.engine->ExtractPageText(pageNo);
 }
 
 bool EngineMulti::HasClipOptimizations(int pageNo) {
-    EngineBase* e = PageToEngine(pageNo);
-    return e->HasClipOptimizations(pageNo);
+    EngineInfo* ei = PageToEngineInfo(pageNo);
+    SubEngine e(this, ei);
+    if (!e.engine) {
+        return false;
+    }
+    return e.engine->HasClipOptimizations(pageNo);
 }
 
 WCHAR* EngineMulti::GetProperty(DocumentProperty prop) {
@@ -157,51 +382,227 @@ WCHAR* EngineMulti::GetProperty(DocumentProperty prop) {
 }
 
 bool EngineMulti::BenchLoadPage(int pageNo) {
-    EngineBase* e = PageToEngine(pageNo);
-    return e->BenchLoadPage(pageNo);
+    EngineInfo* ei = PageToEngineInfo(pageNo);
+    SubEngine e(this, ei);
+    if (!e.engine) {
+        return false;
+    }
+    return e.engine->BenchLoadPage(pageNo);
+}
+
+static bool IsPageNavigationDestination(IPageDestination* dest) {
+    if (!dest) {
+        return false;
+    }
+    if (dest->GetKind() == kindDestinationScrollTo) {
+        return true;
+    }
+    // TODO: possibly more kinds
+    return false;
+}
+
+// sub-engines get closed, so we can't point to their destinations.
+// Engine-specific destinations are resolved using the (loaded) engine.
+// pageOffset is added to page numbers
+static IPageDestination* CloneDestination(IPageDestination* dest, EngineBase* engine, int pageOffset) {
+    if (!dest) {
+        return nullptr;
+    }
+    Kind kind = dest->GetKind();
+    IPageDestination* res = nullptr;
+    if (kind == kindDestinationMupdf) {
+        res = EngineMupdfResolveDest(engine, dest);
+    } else if (kind == kindDestinationLaunchURL) {
+        if (dest->GetValue()) {
+            res = new PageDestinationURL(dest->GetValue());
+            res->rect = dest->GetRect();
+        }
+        return res;
+    } else if (kind == kindDestinationLaunchFile) {
+        if (dest->GetValue()) {
+            res = new PageDestinationFile(dest->GetValue());
+            res->rect = dest->GetRect();
+        }
+        return res;
+    } else if (kind == kindDestinationDjVu) {
+        // only links to pages can be resolved without the engine
+        if (dest->GetPageNo() > 0) {
+            res = NewSimpleDest(dest->GetPageNo(), dest->GetRect(), dest->GetZoom());
+        }
+    } else {
+        // ScrollTo, LaunchEmbedded etc.
+        auto pdest = new PageDestination();
+        pdest->kind = kind;
+        pdest->pageNo = dest->GetPageNo();
+        pdest->rect = dest->GetRect();
+        pdest->zoom = dest->GetZoom();
+        pdest->value = str::Dup(dest->GetValue());
+        pdest->name = str::Dup(dest->GetName());
+        res = pdest;
+    }
+    if (IsPageNavigationDestination(res)) {
+        res->pageNo += pageOffset;
+    }
+    return res;
 }
 
+static IPageElement* ClonePageElement(IPageElement* el, EngineBase* engine, int pageOffset) {
+    IPageElement* res = nullptr;
+    Kind kind = el->GetKind();
+    if (kind == kindPageElementImage) {
+        auto img = new PageElementImage();
+        img->imageID = ((PageElementImage*)el)->imageID;
+        res = img;
+    } else if (kind == kindPageElementComment) {
+        res = new PageElementComment(el->GetValue());
+    } else if (kind == kindPageElementDest) {
+        res = new PageElementDestination(CloneDestination(el->AsLink(), engine, pageOffset));
+    } else {
+        res = new IPageElement();
+    }
+    res->kind = kind;
+    res->rect = el->GetRect();
+    res->pageNo = el->GetPageNo() + pageOffset;
+    return res;
+}
+
+// returns copies of the elements of the sub-engine, owned by us.
+// if pt is given, *indexOut is set to the index of the element at pt (or -1)
+Vec<IPageElement*> EngineMulti::GetPageElementCopies(int pageNo, int* indexOut, PointF* pt) {
+    int multiPageNo = pageNo;
+    EngineInfo* ei = PageToEngineInfo(pageNo);
+    SubEngine e(this, ei);
+    if (!e.engine) {
+        return {};
+    }
+    Vec<IPageElement*> els = e.engine->GetElements(pageNo);
+    if (pt) {
+        IPageElement* el = e.engine->GetElementAtPos(pageNo, *pt);
+        *indexOut = el ? els.Find(el) : -1;
+    }
+
+    {
+        ScopedCritSec scope(&elementsAccess);
+        if (multiPageNo != lastElementsPageNo) {
+            DeleteVecMembers(retiredElements);
+            lastElementsPageNo = multiPageNo;
+        }
+        PageElementsCopy* copy = FindElementsCopy(multiPageNo);
+        // the number changes if the page wasn't fully loaded before
+        if (copy && copy->elements.size() == els.size()) {
+            copy->lastUse = ++elementsUseCounter;
+            return copy->elements;
+        }
+    }
+
+    // cloning might have to resolve links, so do it outside the lock
+    auto copy = new PageElementsCopy();
+    copy->pageNo = multiPageNo;
+    for (IPageElement* el : els) {
+        copy->elements.Append(ClonePageElement(el, e.engine, ei->pageOffset));
+    }
+
+    ScopedCritSec scope(&elementsAccess);
+    PageElementsCopy* prev = FindElementsCopy(multiPageNo);
+    if (prev && prev->elements.size() == els.size()) {
+        // another thread was faster
+        delete copy;
+        prev->lastUse = ++elementsUseCounter;
+        return prev->elements;
+    }
+    if (prev) {
+        RetireElements(prev);
+    } else if (elementsCopies.isize() >= kMaxPagesWithElements) {
+        PageElementsCopy* lru = elementsCopies[0];
+        for (PageElementsCopy* c : elementsCopies) {
+            if (c->lastUse < lru->lastUse) {
+                lru = c;
+            }
+        }
+        RetireElements(lru);
+    }
+    copy->lastUse = ++elementsUseCounter;
+    elementsCopies.Append(copy);
+    return copy->elements;
+}
+
+// must be called under elementsAccess
+PageElementsCopy* EngineMulti::FindElementsCopy(int pageNo) {
+    for (PageElementsCopy* copy : elementsCopies) {
+        if (copy->pageNo == pageNo) {
+            return copy;
+        }
+    }
+    return nullptr;
+}
+
+// must be called under elementsAccess
+void EngineMulti::RetireElements(PageElementsCopy* copy) {
+    elementsCopies.Remove(copy);
+    retiredElements.Append(copy->elements.LendData(), copy->elements.size());
+    copy->elements.Reset();
+    delete copy;
+}
+
+// the elements are owned by us and stay valid at least until the elements
+// of another page are asked for
 Vec<IPageElement*> EngineMulti::GetElements(int pageNo) {
-    EngineBase* e = PageToEngine(pageNo);
-    return e->GetElements(pageNo);
+    return GetPageElementCopies(pageNo);
 }
 
 // don't delete the result
 IPageElement* EngineMulti::GetElementAtPos(int pageNo, PointF pt) {
-    EngineBase* e = PageToEngine(pageNo);
-    return e->GetElementAtPos(pageNo, pt);
+    int idx = -1;
+    Vec<IPageElement*> els = GetPageElementCopies(pageNo, &idx, &pt);
+    if (idx < 0 || idx >= els.isize()) {
+        return nullptr;
+    }
+    return els[idx];
 }
 
 RenderedBitmap* EngineMulti::GetImageForPageElement(IPageElement* ipel) {
     CrashIf(kindPageElementImage != ipel->GetKind());
     PageElementImage* pel = (PageElementImage*)ipel;
-    EngineBase* e = PageToEngine(pel->pageNo);
-    return e->GetImageForPageElement(pel);
+    int pageNo = pel->pageNo;
+    EngineInfo* ei = PageToEngineInfo(pageNo);
+    SubEngine e(this, ei);
+    if (!e.engine) {
+        return nullptr;
+    }
+    // the sub-engine expects its own page numbers
+    PageElementImage img;
+    img.imageID = pel->imageID;
+    img.rect = pel->rect;
+    img.pageNo = pageNo;
+    return e.engine->GetImageForPageElement(&img);
+}
+
+// destinations have been resolved by CloneDestination()
+bool EngineMulti::HandleLink(IPageDestination* dest, ILinkHandler* linkHandler) {
+    if (!dest || !linkHandler) {
+        return false;
+    }
+    linkHandler->GotoLink(dest);
+    return true;
 }
 
+// the caller owns the result
 IPageDestination* EngineMulti::GetNamedDest(const WCHAR* name) {
-    for (auto&& pe : pageToEngine) {
-        EngineBase* e = pe.engine;
-        auto dest = e->GetNamedDest(name);
+    for (EngineInfo* ei : pageEngines) {
+        SubEngine e(this, ei);
+        if (!e.engine) {
+            continue;
+        }
+        IPageDestination* dest = e.engine->GetNamedDest(name);
         if (dest) {
-            // TODO: fix up page number in returned destination
-            return dest;
+            IPageDestination* res = CloneDestination(dest, e.engine, ei->pageOffset);
+            delete dest;
+            return res;
         }
     }
     return nullptr;
 }
 
-static bool IsPageNavigationDestination(IPageDestination* dest) {
-    if (!dest) {
-        return false;
-    }
-    if (dest->GetKind() == kindDestinationScrollTo) {
-        return true;
-    }
-    // TODO: possibly more kinds
-    return false;
-}
-
 static void updateTocItemsPageNo(TocItem* ti, int nPageNoAdd, bool root) {
     if (nPageNoAdd == 0) {
         return;
@@ -212,8 +613,9 @@ static void updateTocItemsPageNo(TocItem* ti, int nPageNoAdd, bool root) {
     auto curr = ti;
     while (curr) {
         if (IsPageNavigationDestination(curr->dest)) {
-            auto dest = (PageDestination*)curr->dest;
-            dest->pageNo += nPageNoAdd;
+            curr->dest->pageNo += nPageNoAdd;
+        }
+        if (curr->pageNo > 0) {
             curr->pageNo += nPageNoAdd;
         }
 
@@ -235,17 +637,23 @@ WCHAR* EngineMulti::GetPageLabel(int pageNo) const {
         return nullptr;
     }
 
-    EngineBase* e = PageToEngine(pageNo);
-    return e->GetPageLabel(pageNo);
+    EngineInfo* ei = PageToEngineInfo(pageNo);
+    SubEngine e(this, ei);
+    if (!e.engine) {
+        return nullptr;
+    }
+    return e.engine->GetPageLabel(pageNo);
 }
 
 int EngineMulti::GetPageByLabel(const WCHAR* label) const {
-    for (auto&& pe : pageToEngine) {
-        EngineBase* e = pe.engine;
-        int pageNo = e->GetPageByLabel(label);
+    for (EngineInfo* ei : pageEngines) {
+        SubEngine e(this, ei);
+        if (!e.engine) {
+            continue;
+        }
+        int pageNo = e.engine->GetPageByLabel(label);
         if (pageNo != -1) {
-            // TODO: fixup page number
-            return pageNo;
+            return pageNo + ei->pageOffset;
         }
     }
     return -1;
@@ -285,7 +693,7 @@ static void CalcEndPageNo(TocItem* root, int nPages) {
 }
 #endif
 
-static TocItem* CloneTocItemRecur(TocItem* ti, bool removeUnchecked) {
+static TocItem* CloneTocItemRecur(TocItem* ti, TocItem* parent, EngineBase* engine, bool removeUnchecked) {
     if (ti == nullptr) {
         return nullptr;
     }
@@ -294,10 +702,10 @@ static TocItem* CloneTocItemRecur(TocItem* ti, bool removeUnchecked) {
         while (next && next->isUnchecked) {
             next = next->next;
         }
-        return CloneTocItemRecur(next, removeUnchecked);
+        return CloneTocItemRecur(next, parent, engine, removeUnchecked);
     }
     TocItem* res = new TocItem();
-    res->parent = ti->parent;
+    res->parent = parent;
     res->title = str::Dup(ti->title);
     res->isOpenDefault = ti->isOpenDefault;
     res->isOpenToggled = ti->isOpenToggled;
@@ -306,9 +714,10 @@ static TocItem* CloneTocItemRecur(TocItem* ti, bool removeUnchecked) {
     res->id = ti->id;
     res->fontFlags = ti->fontFlags;
     res->color = ti->color;
-    res->dest = ti->dest;
-    res->destNotOwned = true;
-    res->child = CloneTocItemRecur(ti->child, removeUnchecked);
+    // page numbers are updated in UpdatePagesForEngines()
+    res->dest = CloneDestination(ti->dest, engine, 0);
+    // sub-engines get closed, so all children have to be loaded
+    res->child = CloneTocItemRecur(ti->GetChild(), res, engine, removeUnchecked);
 
     res->nPages = ti->nPages;
     res->engineFilePath = str::Dup(ti->engineFilePath);
@@ -319,60 +728,108 @@ static TocItem* CloneTocItemRecur(TocItem* ti, bool removeUnchecked) {
             next = next->next;
         }
     }
-    res->next = CloneTocItemRecur(next, removeUnchecked);
+    res->next = CloneTocItemRecur(next, parent, engine, removeUnchecked);
     return res;
 }
 
 TocItem* CreateWrapperItem(EngineBase* engine) {
-    TocItem* tocFileRoot = nullptr;
+    int nPages = engine->PageCount();
+    const WCHAR* title = path::GetBaseNameTemp(engine->FileName());
+    TocItem* tocWrapper = new TocItem(nullptr, title, 0);
+    tocWrapper->isOpenDefault = true;
     TocTree* tocTree = engine->GetToc();
     // it's ok if engine doesn't have toc
     if (tocTree) {
-        tocFileRoot = CloneTocItemRecur(tocTree->root, false);
+        tocWrapper->child = CloneTocItemRecur(tocTree->root, tocWrapper, engine, false);
     }
-
-    int nPages = engine->PageCount();
-    const WCHAR* title = path::GetBaseNameTemp(engine->FileName());
-    TocItem* tocWrapper = new TocItem(tocFileRoot, title, 0);
-    tocWrapper->isOpenDefault = true;
-    tocWrapper->child = tocFileRoot;
     char* filePath = (char*)strconv::WstrToUtf8(engine->FileName());
     tocWrapper->engineFilePath = filePath;
     tocWrapper->nPages = nPages;
     tocWrapper->pageNo = 1;
-    if (tocFileRoot) {
-        tocFileRoot->parent = tocWrapper;
-    }
     return tocWrapper;
 }
 
+// gets what we need to know about a file without keeping it loaded
+static EngineInfo* LoadEngineInfo(std::string_view path) {
+    auto pathW = ToWstrTemp(path);
+    EngineBase* engine = CreateEngine(pathW, nullptr, true);
+    if (!engine) {
+        return nullptr;
+    }
+    EngineInfo* ei = new EngineInfo();
+    ei->filePath = str::Dup(pathW);
+    ei->nPages = engine->PageCount();
+    ei->isMupdf = engine->kind == kindEngineMupdf;
+    for (int pageNo = 1; pageNo <= ei->nPages; pageNo++) {
+        RectF mediabox = engine->PageMediabox(pageNo);
+        if (ei->mediaboxes.size() == 0 || ei->mediaboxes.Last().mediabox != mediabox) {
+            ei->mediaboxes.Append({pageNo, mediabox});
+        }
+    }
+    ei->tocRoot = CreateWrapperItem(engine);
+    delete engine;
+    return ei;
+}
+
+class EngineInfoLoader : public ThreadBase {
+  public:
+    VecStr* files = nullptr;
+    Vec<EngineInfo*>* infos = nullptr;
+    LONG* nextFile = nullptr;
+
+    void Run() override {
+        for (;;) {
+            int idx = (int)InterlockedIncrement(nextFile) - 1;
+            if (idx >= files->Size()) {
+                break;
+            }
+            infos->at(idx) = LoadEngineInfo(files->at(idx));
+        }
+        DestroyTempAllocator();
+    }
+};
+
 bool EngineMulti::LoadFromFiles(std::string_view dir, VecStr& files) {
     int n = files.Size();
+    Vec<EngineInfo*> infos;
+    infos.AppendBlanks(n);
+
+    // loading is mostly cpu bound so use all cores, but don't start
+    // a thread per file for large folders
+    SYSTEM_INFO si{};
+    GetSystemInfo(&si);
+    int nThreads = std::clamp((int)si.dwNumberOfProcessors, 1, std::max(n, 1));
+    LONG nextFile = 0;
+    Vec<EngineInfoLoader*> loaders;
+    for (int i = 0; i < nThreads; i++) {
+        auto loader = new EngineInfoLoader();
+        loader->files = &files;
+        loader->infos = &infos;
+        loader->nextFile = &nextFile;
+        loader->Start();
+        loaders.Append(loader);
+    }
+    for (auto loader : loaders) {
+        loader->Join();
+        delete loader;
+    }
+
     TocItem* tocFiles = nullptr;
-    for (int i = 0; i < n; i++) {
-        std::string_view path = files.at(i);
-        auto pathW = ToWstrTemp(path);
-        EngineBase* engine = CreateEngine(pathW, nullptr, true);
-        if (!engine) {
+    for (EngineInfo* ei : infos) {
+        if (!ei) {
             continue;
         }
-
-        TocItem* wrapper = CreateWrapperItem(engine);
         if (tocFiles == nullptr) {
-            tocFiles = wrapper;
+            tocFiles = ei->tocRoot;
         } else {
-            tocFiles->AddSiblingAtEnd(wrapper);
+            tocFiles->AddSiblingAtEnd(ei->tocRoot);
         }
-
-        EngineInfo ei;
-        ei.engine = engine;
-        ei.tocRoot = wrapper;
         enginesInfo.Append(ei);
     }
     if (tocFiles == nullptr) {
         return false;
     }
-    UpdatePagesForEngines(enginesInfo);
+    UpdatePagesForEngines();
 
     auto dirW = ToWstrTemp(dir);
     TocItem* root = new TocItem(nullptr, dirW, 0);
@@ -387,23 +844,19 @@ bool EngineMulti::LoadFromFiles(std::string_view dir, VecStr& files) {
     return true;
 }
 
-void EngineMulti::UpdatePagesForEngines(Vec<EngineInfo>& enginesInfo) {
+void EngineMulti::UpdatePagesForEngines() {
     int nTotalPages = 0;
-    for (auto&& ei : enginesInfo) {
-        TocItem* root = ei.tocRoot;
-        if (root->isUnchecked) {
+    for (EngineInfo* ei : enginesInfo) {
+        TocItem* root = ei->tocRoot;
+        if (root->isUnchecked || ei->nPages == 0) {
             continue;
         }
-        int nPages = ei.engine->PageCount();
-        for (int i = 1; i <= nPages; i++) {
-            EnginePage ep{i, ei.engine};
-            pageToEngine.Append(ep);
-        }
-        updateTocItemsPageNo(ei.tocRoot, nTotalPages, true);
-        nTotalPages += nPages;
+        ei->pageOffset = nTotalPages;
+        pageEngines.Append(ei);
+        updateTocItemsPageNo(ei->tocRoot, nTotalPages, true);
+        nTotalPages += ei->nPages;
     }
     pageCount = nTotalPages;
-    CrashIf((size_t)pageCount != pageToEngine.size());
 
     auto verifyPages = [&nTotalPages](TocItem* ti) -> bool {
         if (!IsPageNavigationDestination(ti->dest)) {
@@ -414,8 +867,8 @@ void EngineMulti::UpdatePagesForEngines(Vec<EngineInfo>& enginesInfo) {
         return true;
     };
 
-    for (auto&& ei : enginesInfo) {
-        TocItem* root = ei.tocRoot;
+    for (EngineInfo* ei : enginesInfo) {
+        TocItem* root = ei->tocRoot;
         if (root->isUnchecked) {
             continue;
         }
@@ -9,16 +9,20 @@ extern "C" {
 
 #include "utils/BaseUtil.h"
 #include "utils/Archive.h"
+#include "utils/BlockCachedStream.h"
 #include "utils/ScopedWin.h"
 #include "utils/FileUtil.h"
 #include "utils/GdiPlusUtil.h"
 #include "utils/GuessFileType.h"
 #include "utils/HtmlParserLookup.h"
 #include "utils/HtmlPullParser.h"
+#include "utils/PixelConvert.h"
 #include "utils/TrivialHtmlParser.h"
 #include "utils/WinUtil.h"
 #include "utils/ZipUtil.h"
+#include "utils/ThreadUtil.h"
 #include "utils/Timer.h"
+#include "utils/Trace.h"
 
 #include "AppColors.h"
 #include "Annotation.h"
@@ -392,17 +396,18 @@ static WCHAR* PdfCleanString(WCHAR* s) {
     return s;
 }
 
+// reads the IStream through a block cache (the stream might be
+// a slow shell stream and mupdf does a lot of seeking)
 struct istream_filter {
-    IStream* stream;
-    u8 buf[4096];
+    BlockCachedStream* stream;
+    u8 buf[16 * 1024];
 };
 
 extern "C" int next_istream(fz_context* ctx, fz_stream* stm, __unused size_t max) {
     istream_filter* state = (istream_filter*)stm->state;
-    ULONG cbRead = sizeof(state->buf);
-    HRESULT res = state->stream->Read(state->buf, sizeof(state->buf), &cbRead);
-    if (FAILED(res)) {
-        fz_throw(ctx, FZ_ERROR_GENERIC, "IStream read error: %x", res);
+    i64 cbRead = state->stream->ReadAt(stm->pos, state->buf, sizeof(state->buf));
+    if (cbRead < 0) {
+        fz_throw(ctx, FZ_ERROR_GENERIC, "IStream read error at %lld", (long long)stm->pos);
     }
     stm->rp = state->buf;
     stm->wp = stm->rp + cbRead;
@@ -413,17 +418,16 @@ extern "C" int next_istream(fz_context* ctx, fz_stream* stm, __unused size_t max
 
 extern "C" void seek_istream(fz_context* ctx, fz_stream* stm, i64 offset, int whence) {
     istream_filter* state = (istream_filter*)stm->state;
-    LARGE_INTEGER off;
-    ULARGE_INTEGER n;
-    off.QuadPart = offset;
-    HRESULT res = state->stream->Seek(off, whence, &n);
-    if (FAILED(res)) {
-        fz_throw(ctx, FZ_ERROR_GENERIC, "IStream seek error: %x", res);
+    // fz_seek() converts SEEK_CUR to SEEK_SET
+    if (whence == SEEK_END) {
+        offset += state->stream->Size();
+    } else if (whence != SEEK_SET) {
+        fz_throw(ctx, FZ_ERROR_GENERIC, "IStream seek error: invalid whence %d", whence);
     }
-    if (n.HighPart != 0 || n.LowPart > INT_MAX) {
-        fz_throw(ctx, FZ_ERROR_GENERIC, "documents beyond 2GB aren't supported");
+    if (offset < 0) {
+        fz_throw(ctx, FZ_ERROR_GENERIC, "IStream seek error: negative offset");
     }
-    stm->pos = n.LowPart;
+    stm->pos = offset;
     stm->rp = stm->wp = state->buf;
 }
 
@@ -438,21 +442,233 @@ static fz_stream* FzOpenIStream(fz_context* ctx, IStream* stream) {
         return nullptr;
     }
 
-    LARGE_INTEGER zero = {0};
-    HRESULT res = stream->Seek(zero, STREAM_SEEK_SET, nullptr);
-    if (FAILED(res)) {
-        fz_throw(ctx, FZ_ERROR_GENERIC, "IStream seek error: %x", res);
-    }
-
     istream_filter* state = fz_malloc_struct(ctx, istream_filter);
-    state->stream = stream;
-    stream->AddRef();
+    state->stream = GetBlockCachedStream(stream);
+    if (!state->stream) {
+        fz_free(ctx, state);
+        fz_throw(ctx, FZ_ERROR_GENERIC, "IStream error: can't get the size");
+    }
 
     fz_stream* stm = fz_new_stream(ctx, state, next_istream, drop_istream);
     stm->seek = seek_istream;
     return stm;
 }
 
+// linearized PDFs on slow storage are loaded progressively: this thread reads the
+// file from start to end and mupdf throws FZ_ERROR_TRYLATER when it needs data
+// that hasn't been read yet. A linearized PDF starts with everything needed for
+// the first page, so it can be shown long before the whole file has been read
+class ProgressiveFileReader : public ThreadBase {
+  public:
+    EngineMupdf* engine = nullptr;
+    AutoFreeWstr filePath;
+    i64 size = 0;
+    // if > 0, the file is read at kbps kB per second (to simulate slow storage)
+    int kbps = 0;
+    // set when the engine is ready for ProgressiveLoadProgress() calls
+    // (or when the engine is deleted)
+    HANDLE engineReady = nullptr;
+
+    ProgressiveFileReader(EngineMupdf* engine, const WCHAR* filePath, i64 size, int kbps);
+    ~ProgressiveFileReader() override;
+    i64 Available();
+    bool IsFullyRead();
+    void Run() override;
+
+  private:
+    CRITICAL_SECTION cs;
+    i64 available = 0;
+};
+
+// how often the engine is told about newly read data
+constexpr int kProgressiveNotifyMs = 250;
+
+ProgressiveFileReader::ProgressiveFileReader(EngineMupdf* engine, const WCHAR* filePath, i64 size, int kbps)
+    : ThreadBase("ProgressiveFileReader"), engine(engine), filePath(str::Dup(filePath)), size(size), kbps(kbps) {
+    InitializeCriticalSection(&cs);
+    engineReady = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+}
+
+ProgressiveFileReader::~ProgressiveFileReader() {
+    CloseHandle(engineReady);
+    DeleteCriticalSection(&cs);
+}
+
+i64 ProgressiveFileReader::Available() {
+    ScopedCritSec scope(&cs);
+    return available;
+}
+
+bool ProgressiveFileReader::IsFullyRead() {
+    return Available() >= size;
+}
+
+void ProgressiveFileReader::Run() {
+    HANDLE h = CreateFileW(filePath, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN,
+                           nullptr);
+    const DWORD kChunkSize = 64 * 1024;
+    u8* buf = AllocArray<u8>(kChunkSize);
+    auto timeStart = TimeGet();
+    auto timeNotified = timeStart;
+    i64 pos = 0;
+    while (h != INVALID_HANDLE_VALUE && pos < size && !WasCancelRequested()) {
+        DWORD nRead = 0;
+        if (!ReadFile(h, buf, kChunkSize, &nRead, nullptr) || nRead == 0) {
+            break;
+        }
+        pos += nRead;
+        if (kbps > 0) {
+            double msLeft = (double)pos * 1000.0 / (kbps * 1024.0) - TimeSinceInMs(timeStart);
+            while (msLeft > 0 && !WasCancelRequested()) {
+                Sleep((DWORD)std::min(msLeft, 100.0) + 1);
+                msLeft = (double)pos * 1000.0 / (kbps * 1024.0) - TimeSinceInMs(timeStart);
+            }
+        }
+        {
+            ScopedCritSec scope(&cs);
+            available = pos;
+        }
+        bool isReady = WaitForSingleObject(engineReady, 0) == WAIT_OBJECT_0;
+        if (isReady && TimeSinceInMs(timeNotified) >= kProgressiveNotifyMs && !WasCancelRequested()) {
+            engine->ProgressiveLoadProgress(false);
+            timeNotified = TimeGet();
+        }
+    }
+    free(buf);
+    if (h != INVALID_HANDLE_VALUE) {
+        CloseHandle(h);
+    }
+    {
+        // after a read error, mupdf reads the rest itself (and reports the error)
+        ScopedCritSec scope(&cs);
+        available = size;
+    }
+    WaitForSingleObject(engineReady, INFINITE);
+    if (!WasCancelRequested()) {
+        engine->ProgressiveLoadProgress(true);
+    }
+}
+
+struct progressive_filter {
+    ProgressiveFileReader* reader;
+    HANDLE hFile;
+    u8 buf[16 * 1024];
+};
+
+extern "C" int next_progressive(fz_context* ctx, fz_stream* stm, __unused size_t max) {
+    progressive_filter* state = (progressive_filter*)stm->state;
+    i64 size = state->reader->size;
+    i64 available = state->reader->Available();
+    if (stm->pos >= size) {
+        return EOF;
+    }
+    if (stm->pos >= available) {
+        fz_throw(ctx, FZ_ERROR_TRYLATER, "not enough data yet at %lld", (long long)stm->pos);
+    }
+    DWORD toRead = (DWORD)std::min((i64)sizeof(state->buf), available - stm->pos);
+    LARGE_INTEGER off;
+    off.QuadPart = stm->pos;
+    DWORD cbRead = 0;
+    if (!SetFilePointerEx(state->hFile, off, nullptr, FILE_BEGIN) ||
+        !ReadFile(state->hFile, state->buf, toRead, &cbRead, nullptr)) {
+        fz_throw(ctx, FZ_ERROR_GENERIC, "read error at %lld", (long long)stm->pos);
+    }
+    stm->rp = state->buf;
+    stm->wp = stm->rp + cbRead;
+    stm->pos += cbRead;
+
+    return cbRead > 0 ? *stm->rp++ : EOF;
+}
+
+extern "C" void seek_progressive(fz_context* ctx, fz_stream* stm, i64 offset, int whence) {
+    progressive_filter* state = (progressive_filter*)stm->state;
+    // fz_seek() converts SEEK_CUR to SEEK_SET
+    if (whence == SEEK_END) {
+        offset += state->reader->size;
+    }
+    if (offset < 0) {
+        fz_throw(ctx, FZ_ERROR_GENERIC, "seek error: negative offset");
+    }
+    stm->pos = offset;
+    stm->rp = stm->wp = state->buf;
+}
+
+extern "C" void drop_progressive(fz_context* ctx, void* state_) {
+    progressive_filter* state = (progressive_filter*)state_;
+    CloseHandle(state->hFile);
+    fz_free(ctx, state);
+}
+
+// the reader must outlive the stream
+static fz_stream* FzOpenProgressiveFile(fz_context* ctx, ProgressiveFileReader* reader) {
+    HANDLE h = file::OpenReadOnly(reader->filePath);
+    if (h == INVALID_HANDLE_VALUE) {
+        fz_throw(ctx, FZ_ERROR_GENERIC, "cannot open %s", ToUtf8Temp(reader->filePath).Get());
+    }
+    progressive_filter* state = fz_malloc_struct(ctx, progressive_filter);
+    state->reader = reader;
+    state->hFile = h;
+    fz_stream* stm = fz_new_stream(ctx, state, next_progressive, drop_progressive);
+    stm->seek = seek_progressive;
+    // makes pdf_open_document() load a linearized PDF with pdf_load_linear()
+    stm->progressive = 1;
+    return stm;
+}
+
+// extracting links and images of a page builds its stext, which can take longer
+// than rendering it, so it's done on this thread after the page has been rendered.
+// The most recently requested pages (i.e. the visible ones) come first
+class PageElementsLoader : public ThreadBase {
+  public:
+    EngineMupdf* engine = nullptr;
+    // signaled when pages are requested (or when the engine is deleted)
+    HANDLE wakeUp = nullptr;
+
+    explicit PageElementsLoader(EngineMupdf* engine);
+    ~PageElementsLoader() override;
+    void Request(int pageNo);
+    void Run() override;
+
+  private:
+    CRITICAL_SECTION cs;
+    Vec<int> pageNos;
+};
+
+PageElementsLoader::PageElementsLoader(EngineMupdf* engine) : ThreadBase("PageElementsLoader"), engine(engine) {
+    InitializeCriticalSection(&cs);
+    wakeUp = CreateEventW(nullptr, FALSE, FALSE, nullptr);
+}
+
+PageElementsLoader::~PageElementsLoader() {
+    CloseHandle(wakeUp);
+    DeleteCriticalSection(&cs);
+}
+
+void PageElementsLoader::Request(int pageNo) {
+    ScopedCritSec scope(&cs);
+    pageNos.Remove(pageNo);
+    pageNos.Append(pageNo);
+    SetEvent(wakeUp);
+}
+
+void PageElementsLoader::Run() {
+    while (!WasCancelRequested()) {
+        int pageNo = 0;
+        {
+            ScopedCritSec scope(&cs);
+            if (pageNos.size() > 0) {
+                pageNo = pageNos.Pop();
+            }
+        }
+        if (pageNo == 0) {
+            WaitForSingleObject(wakeUp, INFINITE);
+            continue;
+        }
+        engine->LoadRequestedPageElements(pageNo);
+    }
+    DestroyTempAllocator();
+}
+
 static void* FzMemdup(fz_context* ctx, void* p, size_t size) {
     void* res = fz_malloc_no_throw(ctx, size);
     if (!res) {
@@ -510,6 +726,132 @@ static fz_stream* FzOpenFile2(fz_context* ctx, const WCHAR* filePath) {
     return stm;
 }
 
+void SetEngineMupdfJpxThreads(int nThreads) {
+    // the setting is global, the context isn't used
+    fz_set_jpx_threads(nullptr, nThreads);
+}
+
+// if > 0, all linearized PDFs are loaded progressively, at this many kB per second
+static int gProgressiveThrottleKBps = 0;
+
+void SetEngineMupdfProgressiveThrottle(int kbps) {
+    gProgressiveThrottleKBps = kbps;
+}
+
+bool EngineMupdfIsLoadingProgressively(EngineBase* engine) {
+    EngineMupdf* epdf = AsEngineMupdf(engine);
+    return epdf && epdf->isLoadingProgressively;
+}
+
+// checks the first object of the file for a linearization dictionary
+// (which is what pdf_load_linear() needs)
+static bool IsLinearizedPdfFile(const WCHAR* path) {
+    char buf[1024];
+    int n = file::ReadN(path, buf, sizeof(buf) - 1);
+    if (n <= 0) {
+        return false;
+    }
+    buf[n] = 0;
+    return str::StartsWith(buf, "%PDF") && str::Find(buf, "/Linearized");
+}
+
+// small files are read into memory anyway (see FzOpenFile2) and
+// local drives are fast enough to not need it
+static bool ShouldLoadProgressively(const WCHAR* path) {
+    if (!str::EqI(path::GetExtTemp(path), L".pdf")) {
+        return false;
+    }
+    if (gProgressiveThrottleKBps <= 0) {
+        i64 fileSize = file::GetSize(ToUtf8Temp(path).AsView());
+        if (fileSize < kMaxMemoryFileSize || path::IsOnFixedDrive(path)) {
+            return false;
+        }
+    }
+    return IsLinearizedPdfFile(path);
+}
+
+constexpr const WCHAR* kRepairCachePattern = L"*.xref";
+// saved repairs not used for that long are removed by CleanUpEngineMupdfRepairCache()
+constexpr int kRepairCacheMaxAgeDays = 90;
+
+// directory for saved repairs of damaged PDFs, nullptr if they're not saved
+static WCHAR* gRepairCacheDir = nullptr;
+
+// documents can be loaded on other threads while gRepairCacheDir changes
+static CRITICAL_SECTION* RepairCacheDirAccess() {
+    static CRITICAL_SECTION cs;
+    static bool initialized = [] {
+        InitializeCriticalSection(&cs);
+        return true;
+    }();
+    return &cs;
+}
+
+void SetEngineMupdfRepairCacheDir(const WCHAR* dir) {
+    ScopedCritSec scope(RepairCacheDirAccess());
+    str::ReplaceWithCopy(&gRepairCacheDir, dir);
+}
+
+void CleanUpEngineMupdfRepairCache(const WCHAR* dir, bool removeAll) {
+    // the modification time is updated when they're used
+    dir::DeleteOldFiles(dir, kRepairCachePattern, removeAll ? 0 : kRepairCacheMaxAgeDays);
+}
+
+// the saved repair is keyed by path, size and modification time of the file.
+// mupdf additionally checks it against the beginning and end of the file
+static WCHAR* GetRepairCachePath(const WCHAR* filePath) {
+    AutoFreeWstr dir;
+    {
+        ScopedCritSec scope(RepairCacheDirAccess());
+        dir.SetCopy(gRepairCacheDir);
+    }
+    if (!dir || !filePath) {
+        return nullptr;
+    }
+    AutoFree fingerprint = file::GetFingerprint(filePath);
+    if (!fingerprint) {
+        return nullptr;
+    }
+    AutoFree fileName = str::Format("%s.xref", fingerprint.Get());
+    return path::Join(dir, ToWstrTemp(fileName.Get()));
+}
+
+static fz_buffer* LoadRepairCache(fz_context* ctx, void* opaque) {
+    EngineMupdf* e = (EngineMupdf*)opaque;
+    AutoFree data = file::ReadFile(e->repairCachePath);
+    if (!data.data) {
+        return nullptr;
+    }
+    // mark as recently used for CleanUpEngineMupdfRepairCache()
+    FILETIME now;
+    GetSystemTimeAsFileTime(&now);
+    file::SetModificationTime(e->repairCachePath, now);
+    fz_buffer* buf = nullptr;
+    fz_try(ctx) {
+        buf = fz_new_buffer_from_copied_data(ctx, (const u8*)data.data, data.size());
+        e->repairCacheLoaded = true;
+    }
+    fz_catch(ctx) {
+        buf = nullptr;
+    }
+    return buf;
+}
+
+// the saved repair is ignored by mupdf (and then overwritten) if it doesn't match the file
+static bool RepairCacheUsed(EngineMupdf* e) {
+    return e->repairCacheLoaded && !e->repairCacheSaved;
+}
+
+static void SaveRepairCache(fz_context* ctx, void* opaque, fz_buffer* buf) {
+    EngineMupdf* e = (EngineMupdf*)opaque;
+    u8* data = nullptr;
+    size_t size = fz_buffer_storage(ctx, buf, &data);
+    AutoFreeWstr dir = path::GetDir(e->repairCachePath);
+    if (dir::Create(dir) && file::WriteFile(e->repairCachePath, {data, size})) {
+        e->repairCacheSaved = true;
+    }
+}
+
 static void FzStreamFingerprint(fz_context* ctx, fz_stream* stm, u8 digest[16]) {
     i64 fileLen = -1;
     fz_buffer* buf = nullptr;
@@ -972,6 +1314,36 @@ static fz_pixmap* FzConvertPixmap2(fz_context* ctx, fz_pixmap* pix, fz_colorspac
     return cvt;
 }
 
+using ConvertToBgraFunc = void (*)(const u8* src, u8* dst, size_t n);
+
+// returns a function that converts a row of pixmap to BGRA with exactly the same
+// result as FzConvertPixmap2() to fz_device_bgr(), nullptr if there's none
+static ConvertToBgraFunc GetConvertToBgraFunc(fz_context* ctx, fz_pixmap* pixmap) {
+    fz_colorspace* cs = pixmap->colorspace;
+    if (!pixmap->samples || pixmap->s != 0 || !cs) {
+        return nullptr;
+    }
+    int alpha = pixmap->alpha;
+    // DeviceRGB and DeviceBGR share the same profile, so fz_convert_pixmap()
+    // only re-orders the bytes even if color management is enabled
+    if (cs == fz_device_rgb(ctx)) {
+        return alpha ? ConvertRgbaToBgra : ConvertRgbToBgra;
+    }
+    // other colorspaces go through an icc link unless color management is disabled
+#if FZ_ENABLE_ICC
+    if (ctx->icc_enabled) {
+        return nullptr;
+    }
+#endif
+    if (cs == fz_device_gray(ctx)) {
+        return alpha ? ConvertGrayAlphaToBgra : ConvertGrayToBgra;
+    }
+    if (cs == fz_device_cmyk(ctx) && !alpha) {
+        return ConvertCmykToBgra;
+    }
+    return nullptr;
+}
+
 RenderedBitmap* NewRenderedFzPixmap(fz_context* ctx, fz_pixmap* pixmap) {
     if (pixmap->n == 4 && fz_colorspace_is_rgb(ctx, pixmap->colorspace)) {
         RenderedBitmap* res = TryRenderAsPaletteImage(pixmap);
@@ -982,6 +1354,9 @@ RenderedBitmap* NewRenderedFzPixmap(fz_context* ctx, fz_pixmap* pixmap) {
 
     ScopedMem<BITMAPINFO> bmi((BITMAPINFO*)calloc(1, sizeof(BITMAPINFO) + 255 * sizeof(RGBQUAD)));
 
+    // common formats are converted directly into the bitmap
+    ConvertToBgraFunc convertRow = GetConvertToBgraFunc(ctx, pixmap);
+
     fz_pixmap* bgrPixmap = nullptr;
     fz_colorspace* csdest = nullptr;
     fz_color_params cp;
@@ -991,24 +1366,27 @@ RenderedBitmap* NewRenderedFzPixmap(fz_context* ctx, fz_pixmap* pixmap) {
     fz_var(cp);
 
     /* BGRA is a GDI compatible format */
-    fz_try(ctx) {
-        csdest = fz_device_bgr(ctx);
-        cp = fz_default_color_params;
-        bgrPixmap = FzConvertPixmap2(ctx, pixmap, csdest, nullptr, nullptr, cp, 1);
-    }
-    fz_catch(ctx) {
-        return nullptr;
-    }
+    if (!convertRow) {
+        fz_try(ctx) {
+            csdest = fz_device_bgr(ctx);
+            cp = fz_default_color_params;
+            bgrPixmap = FzConvertPixmap2(ctx, pixmap, csdest, nullptr, nullptr, cp, 1);
+        }
+        fz_catch(ctx) {
+            return nullptr;
+        }
 
-    if (!bgrPixmap || !bgrPixmap->samples) {
-        return nullptr;
+        if (!bgrPixmap || !bgrPixmap->samples) {
+            return nullptr;
+        }
     }
 
-    int w = bgrPixmap->w;
-    int h = bgrPixmap->h;
-    int n = bgrPixmap->n;
-    int imgSize = bgrPixmap->stride * h;
-    int bitsCount = n * 8;
+    // bgrPixmap is always BGRA
+    int w = pixmap->w;
+    int h = pixmap->h;
+    int stride = w * 4;
+    int imgSize = stride * h;
+    int bitsCount = 32;
 
     BITMAPINFOHEADER* bmih = &bmi.Get()->bmiHeader;
     bmih->biSize = sizeof(*bmih);
@@ -1026,7 +1404,11 @@ RenderedBitmap* NewRenderedFzPixmap(fz_context* ctx, fz_pixmap* pixmap) {
     HANDLE hMap = CreateFileMappingW(hFile, nullptr, fl, 0, imgSize, nullptr);
     uint usage = DIB_RGB_COLORS;
     HBITMAP hbmp = CreateDIBSection(nullptr, bmi, usage, &data, hMap, 0);
-    if (data) {
+    if (data && convertRow) {
+        for (int y = 0; y < h; y++) {
+            convertRow(pixmap->samples + y * pixmap->stride, (u8*)data + y * stride, (size_t)w);
+        }
+    } else if (data) {
         u8* samples = bgrPixmap->samples;
         memcpy(data, samples, imgSize);
     }
@@ -1184,16 +1566,7 @@ static void FzFindImagePositions(fz_context* ctx, int pageNo, Vec<FitzPageImageI
     }
 }
 
-static fz_image* FzFindImageAtIdx(fz_context* ctx, FzPageInfo* pageInfo, int idx) {
-    fz_stext_options opts{};
-    opts.flags = FZ_STEXT_PRESERVE_IMAGES;
-    fz_stext_page* stext = nullptr;
-    fz_var(stext);
-    fz_try(ctx) {
-        stext = fz_new_stext_page_from_page(ctx, pageInfo->page, &opts);
-    }
-    fz_catch(ctx) {
-    }
+static fz_image* FzFindImageAtIdx(fz_context* ctx, fz_stext_page* stext, int idx) {
     if (!stext) {
         return nullptr;
     }
@@ -1211,15 +1584,12 @@ static fz_image* FzFindImageAtIdx(fz_context* ctx, FzPageInfo* pageInfo, int idx
             // TODO: this is probably not right
             if (idx == 0) {
                 // TODO: or maybe get pixmap here
-                image = fz_keep_image(ctx, image);
-                fz_drop_stext_page(ctx, stext);
-                return image;
+                return fz_keep_image(ctx, image);
             }
             idx--;
         }
         block = block->next;
     }
-    fz_drop_stext_page(ctx, stext);
     return nullptr;
 }
 
@@ -1307,6 +1677,101 @@ static fz_outline* PdfLoadAttachments(fz_context* ctx, pdf_document* doc) {
     return root.next;
 }
 
+// PDF outlines can have 100k+ items. Instead of loading all of them with
+// fz_load_outline() we only collect the object numbers of the items
+// and load an item when its parent is expanded in the ToC
+struct PdfOutlineNode {
+    int objNum = 0;
+    // number of items below this item, the children
+    // of nodes[i] start at nodes[i + 1]
+    int nDescendants = 0;
+};
+
+// collects the items in pre-order (the order in which fz_load_outline() returns them),
+// stops at items that aren't dictionaries or are in the outline more than once
+// Note: make sure to only call with ctxAccess
+static void PdfCollectOutlineNodes(fz_context* ctx, pdf_document* doc, Vec<PdfOutlineNode>& nodes) {
+    pdf_obj* root = pdf_dict_get(ctx, pdf_trailer(ctx, doc), PDF_NAME(Root));
+    pdf_obj* obj = pdf_dict_get(ctx, pdf_dict_get(ctx, root, PDF_NAME(Outlines)), PDF_NAME(First));
+    if (!obj) {
+        return;
+    }
+
+    int nObjs = pdf_xref_len(ctx, doc);
+    bool* seen = AllocArray<bool>(nObjs);
+    // an explicit stack so that deeply nested outlines don't overflow the stack
+    Vec<int> parents;
+    Vec<pdf_obj*> parentsNext;
+    fz_try(ctx) {
+        for (;;) {
+            int num = pdf_is_indirect(ctx, obj) ? pdf_to_num(ctx, obj) : 0;
+            if (num > 0 && num < nObjs && !seen[num] && pdf_is_dict(ctx, obj)) {
+                seen[num] = true;
+                int idx = nodes.isize();
+                nodes.Append({num, 0});
+                pdf_obj* next = pdf_dict_get(ctx, obj, PDF_NAME(Next));
+                obj = pdf_dict_get(ctx, obj, PDF_NAME(First));
+                if (obj) {
+                    parents.Append(idx);
+                    parentsNext.Append(next);
+                } else {
+                    obj = next;
+                }
+                continue;
+            }
+            if (num > 0 && num < nObjs && seen[num]) {
+                fz_warn(ctx, "Cycle detected in outlines");
+            }
+            if (parents.size() == 0) {
+                break;
+            }
+            int idx = parents.Pop();
+            nodes[idx].nDescendants = nodes.isize() - idx - 1;
+            obj = parentsNext.Pop();
+        }
+    }
+    fz_always(ctx) {
+        free(seen);
+    }
+    fz_catch(ctx) {
+        fz_rethrow(ctx);
+    }
+}
+
+// like an item returned by fz_load_outline(), without next and down
+// Note: make sure to only call with ctxAccess
+static fz_outline* PdfLoadOutlineItem(fz_context* ctx, pdf_document* doc, int objNum) {
+    fz_outline* item = fz_new_outline(ctx);
+    pdf_obj* obj = nullptr;
+    fz_var(obj);
+    fz_try(ctx) {
+        obj = pdf_load_object(ctx, doc, objNum);
+        pdf_obj* title = pdf_dict_get(ctx, obj, PDF_NAME(Title));
+        if (title) {
+            item->title = fz_strdup(ctx, pdf_to_text_string(ctx, title));
+        }
+        pdf_obj* dest = pdf_dict_get(ctx, obj, PDF_NAME(Dest));
+        if (dest) {
+            item->uri = pdf_parse_link_dest(ctx, doc, dest);
+        } else {
+            pdf_obj* action = pdf_dict_get(ctx, obj, PDF_NAME(A));
+            if (action) {
+                item->uri = pdf_parse_link_action(ctx, doc, action, -1);
+            }
+        }
+        item->is_open = pdf_to_int(ctx, pdf_dict_get(ctx, obj, PDF_NAME(Count))) > 0;
+        item->page = fz_resolve_link(ctx, (fz_document*)doc, item->uri, &item->x, &item->y);
+    }
+    fz_always(ctx) {
+        pdf_drop_obj(ctx, obj);
+    }
+    fz_catch(ctx) {
+        // show the item even if it's broken
+        fz_warn(ctx, "Couldn't load outline item %d", objNum);
+    }
+    return item;
+}
+
 struct PageLabelInfo {
     int startAt = 0;
     int countFrom = 0;
@@ -1514,6 +1979,19 @@ EngineMupdf::EngineMupdf() {
 }
 
 EngineMupdf::~EngineMupdf() {
+    if (progressiveReader) {
+        // must be stopped before taking the locks, as it might be waiting for them
+        progressiveReader->RequestCancel();
+        SetEvent(progressiveReader->engineReady);
+        progressiveReader->Join();
+    }
+    if (elementsLoader) {
+        elementsLoader->RequestCancel();
+        SetEvent(elementsLoader->wakeUp);
+        elementsLoader->Join();
+        delete elementsLoader;
+    }
+
     EnterCriticalSection(&pagesAccess);
 
     // TODO: remove this lock and see what happens
@@ -1526,6 +2004,9 @@ EngineMupdf::~EngineMupdf() {
         if (pi->retainedLinks) {
             fz_drop_link(ctx, pi->retainedLinks);
         }
+        if (pi->stext) {
+            fz_drop_stext_page(ctx, pi->stext);
+        }
         if (pi->page) {
             fz_drop_page(ctx, pi->page);
         }
@@ -1533,6 +2014,9 @@ EngineMupdf::~EngineMupdf() {
 
     fz_drop_outline(ctx, outline);
     fz_drop_outline(ctx, attachments);
+    for (fz_outline* item : outlineItems) {
+        fz_drop_outline(ctx, item);
+    }
 
     if (pdfInfo) {
         pdf_drop_obj(ctx, pdfInfo);
@@ -1543,6 +2027,8 @@ EngineMupdf::~EngineMupdf() {
     }
 
     fz_drop_document(ctx, _doc);
+    // the document's stream reads through it
+    delete progressiveReader;
     drop_cached_fonts_for_ctx(ctx);
     fz_drop_context(ctx);
 
@@ -1577,7 +2063,7 @@ class PasswordCloner : public PasswordUI {
 
 EngineBase* EngineMupdf::Clone() {
     ScopedCritSec scope(ctxAccess);
-    if (!FileName()) {
+    if (!FileName() || isLoadingProgressively) {
         // before port we could clone streams but it's no longer possible
         return nullptr;
     }
@@ -1591,6 +2077,8 @@ EngineBase* EngineMupdf::Clone() {
     }
 
     EngineMupdf* clone = new EngineMupdf();
+    clone->displayDPI = displayDPI;
+    clone->glyphCacheSizeOverride = glyphCacheSizeOverride;
     bool ok = clone->Load(FileName(), pwdUI);
     if (!ok) {
         delete clone;
@@ -1719,7 +2207,16 @@ static ByteSlice PalmDocToHTML(const WCHAR* path) {
     return {(u8*)res, html.size()};
 }
 
+static TraceHistogram gTraceMupdfLoadUs("EngineMupdf.load.us");
+static TraceHistogram gTraceMupdfRenderUs("EngineMupdf.render.us");
+static TraceCounter gTraceMupdfRenderedBytes("EngineMupdf.render.bytes");
+static TraceHistogram gTraceMupdfRepairUs("EngineMupdf.repair.us");
+
+// number of bits of anti-aliasing for RenderPageArgs.isPreview
+constexpr int kPreviewAALevel = 2;
+
 bool EngineMupdf::Load(const WCHAR* path, PasswordUI* pwdUI) {
+    TraceScope scope("EngineMupdf.Load", 0, &gTraceMupdfLoadUs);
     CrashIf(FileName() || _doc || !ctx);
     SetFileName(path);
 
@@ -1765,6 +2262,11 @@ bool EngineMupdf::Load(const WCHAR* path, PasswordUI* pwdUI) {
     }
 
     fz_stream* file = nullptr;
+    repairCachePath.Set(GetRepairCachePath(fnCopy));
+
+    if (streamNo < 0 && ShouldLoadProgressively(fnCopy)) {
+        return LoadProgressively(fnCopy, pwdUI);
+    }
 
     fz_var(file);
     fz_try(ctx) {
@@ -1804,6 +2306,8 @@ bool EngineMupdf::Load(const WCHAR* path, PasswordUI* pwdUI) {
 
     fz_drop_document(ctx, _doc);
     _doc = nullptr;
+    // the saved repair is for the containing file
+    repairCachePath.Reset();
 
     if (!LoadFromStream(file, ToUtf8Temp(FileName()).Get(), pwdUI)) {
         return false;
@@ -1812,6 +2316,36 @@ bool EngineMupdf::Load(const WCHAR* path, PasswordUI* pwdUI) {
     return FinishLoading();
 }
 
+bool EngineMupdf::LoadProgressively(const WCHAR* path, PasswordUI* pwdUI) {
+    i64 fileSize = file::GetSize(ToUtf8Temp(path).AsView());
+    progressiveReader = new ProgressiveFileReader(this, path, fileSize, gProgressiveThrottleKBps);
+    progressiveReader->Start();
+    isLoadingProgressively = true;
+
+    // the document can only be opened once the linearization dictionary
+    // and the first page's xref section have been read
+    while (!_doc) {
+        bool wasFullyRead = progressiveReader->IsFullyRead();
+        fz_stream* file = nullptr;
+        fz_var(file);
+        fz_try(ctx) {
+            file = FzOpenProgressiveFile(ctx, progressiveReader);
+        }
+        fz_catch(ctx) {
+            file = nullptr;
+        }
+        if (LoadFromStream(file, ToUtf8Temp(FileName()).Get(), pwdUI)) {
+            break;
+        }
+        if (_doc || !file || wasFullyRead) {
+            // wrong password or a broken file
+            return false;
+        }
+        Sleep(20);
+    }
+    return FinishLoading();
+}
+
 #if 0
 const char* custom_css = R"(
 * {
@@ -1888,6 +2422,13 @@ bool EngineMupdf::LoadFromStream(fz_stream* stm, const char* nameHint, PasswordU
         fz_set_user_css(ctx, custom_css);
     }
 
+    // a damaged PDF is only repaired the first time it's opened
+    pdf_repair_cache repairCache{this, LoadRepairCache, SaveRepairCache};
+    if (repairCachePath) {
+        pdf_set_repair_cache(ctx, &repairCache);
+    }
+    auto timeStart = TimeGet();
+
     float dx, dy, fontDy;
     _doc = nullptr;
     fz_var(dx);
@@ -1903,6 +2444,7 @@ bool EngineMupdf::LoadFromStream(fz_stream* stm, const char* nameHint, PasswordU
     }
     fz_always(ctx) {
         fz_drop_stream(ctx, stm);
+        pdf_set_repair_cache(ctx, nullptr);
     }
     fz_catch(ctx) {
         _doc = nullptr;
@@ -1911,6 +2453,13 @@ bool EngineMupdf::LoadFromStream(fz_stream* stm, const char* nameHint, PasswordU
         return false;
     }
 
+    if (pdfdoc && pdf_was_repaired(ctx, pdfdoc)) {
+        repairMs = TimeSinceInMs(timeStart);
+        gTraceMupdfRepairUs.Record((i64)(repairMs * 1000));
+        logf("EngineMupdf: repaired xref of '%s' in %.2f ms%s\n", nameHint, repairMs,
+             RepairCacheUsed(this) ? " (saved repair)" : "");
+    }
+
     docStream = stm;
 
     isPasswordProtected = fz_needs_password(ctx, _doc);
@@ -1924,6 +2473,10 @@ bool EngineMupdf::LoadFromStream(fz_stream* stm, const char* nameHint, PasswordU
 
     // TODO: make this work for non-PDF formats?
     u8 digest[16 + 32] = {0};
+    while (progressiveReader && !progressiveReader->IsFullyRead()) {
+        // the fingerprint is computed from the whole file
+        Sleep(20);
+    }
     if (pdfdoc) {
         FzStreamFingerprint(ctx, pdfdoc->file, digest);
     }
@@ -2080,6 +2633,7 @@ static void FinishNonPDFLoading(EngineMupdf* e) {
 }
 
 bool EngineMupdf::FinishLoading() {
+    TraceScope scope("EngineMupdf.FinishLoading");
     pdfdoc = pdf_specifics(ctx, _doc);
 
     pageCount = 0;
@@ -2104,11 +2658,121 @@ bool EngineMupdf::FinishLoading() {
         auto pi = new FzPageInfo();
         pages.Append(pi);
     }
+    UpdateGlyphCacheLimits(nullptr);
     if (!pdfdoc) {
         FinishNonPDFLoading(this);
         return true;
     }
 
+    if (isLoadingProgressively) {
+        // the rest is done in FinishProgressiveLoading() once the whole file has been read
+        SetPlaceholderMediaboxes();
+        SetEvent(progressiveReader->engineReady);
+        return true;
+    }
+    return FinishPdfLoading();
+}
+
+// until the page tree can be loaded, all pages are assumed to have the size of the first page
+void EngineMupdf::SetPlaceholderMediaboxes() {
+    ScopedCritSec scope(ctxAccess);
+
+    fz_rect mbox{};
+    bool wasFullyRead = false;
+    while (fz_is_empty_rect(mbox) && !wasFullyRead) {
+        wasFullyRead = progressiveReader->IsFullyRead();
+        fz_page* page = nullptr;
+        fz_var(page);
+        bool tryLater = false;
+        fz_try(ctx) {
+            page = fz_load_page(ctx, _doc, 0);
+            mbox = fz_bound_page(ctx, page);
+        }
+        fz_always(ctx) {
+            fz_drop_page(ctx, page);
+        }
+        fz_catch(ctx) {
+            tryLater = fz_caught(ctx) == FZ_ERROR_TRYLATER;
+            mbox = {};
+        }
+        if (!tryLater) {
+            break;
+        }
+        Sleep(20);
+    }
+
+    if (fz_is_empty_rect(mbox)) {
+        mbox.x0 = 0;
+        mbox.y0 = 0;
+        mbox.x1 = 612;
+        mbox.y1 = 792;
+    }
+    for (int i = 0; i < pageCount; i++) {
+        FzPageInfo* pageInfo = pages[i];
+        pageInfo->mediabox = ToRectF(mbox);
+        pageInfo->pageNo = i + 1;
+    }
+}
+
+// must be called within pagesAccess and ctxAccess
+void EngineMupdf::FinishProgressiveLoading() {
+    fz_try(ctx) {
+        // reads the remaining objects and the main xref section
+        pdf_progressive_advance(ctx, pdfdoc, pageCount - 1);
+    }
+    fz_catch(ctx) {
+        fz_warn(ctx, "pdf_progressive_advance() failed");
+    }
+    // from now on, pages are looked up through the page tree
+    pdfdoc->file_reading_linearly = 0;
+    isLoadingProgressively = false;
+    FinishPdfLoading();
+
+    // text extracted so far might be incomplete and page elements haven't been extracted
+    for (FzPageInfo* pageInfo : pages) {
+        DropStextPage(pageInfo);
+        if (pageInfo->page) {
+            RequestPageElements(pageInfo->pageNo);
+        }
+    }
+}
+
+// called on ProgressiveFileReader's thread after more of the file has been read
+void EngineMupdf::ProgressiveLoadProgress(bool isComplete) {
+    // the callback is called inside pagesAccess so that SetLoadProgressCallback(nullptr)
+    // waits until it has returned (it usually captures an object about to be deleted)
+    ScopedCritSec scope(&pagesAccess);
+    Vec<int> pageNos;
+    {
+        ScopedCritSec ctxScope(ctxAccess);
+        if (isComplete && isLoadingProgressively) {
+            FinishProgressiveLoading();
+        }
+        for (FzPageInfo* pageInfo : pages) {
+            if (pageInfo->renderedIncomplete) {
+                pageInfo->renderedIncomplete = false;
+                pageNos.Append(pageInfo->pageNo);
+            }
+        }
+    }
+    if (!onLoadProgress) {
+        return;
+    }
+    for (int pageNo : pageNos) {
+        onLoadProgress(pageNo);
+    }
+    if (isComplete) {
+        onLoadProgress(0);
+    }
+}
+
+// waits for a call of the previous callback in progress
+void EngineMupdf::SetLoadProgressCallback(const std::function<void(int pageNo)>& onLoadProgress) {
+    ScopedCritSec scope(&pagesAccess);
+    this->onLoadProgress = onLoadProgress;
+}
+
+bool EngineMupdf::FinishPdfLoading() {
     ScopedCritSec scope(ctxAccess);
 
     bool loadPageTreeFailed = false;
@@ -2136,8 +2800,12 @@ bool EngineMupdf::FinishLoading() {
             fz_var(page);
             fz_var(mbox);
             fz_try(ctx) {
-                page = pdf_load_page(ctx, pdfdoc, pageNo);
-                pageInfo->page = (fz_page*)page;
+                // pages might already have been loaded while loading progressively
+                page = (pdf_page*)pageInfo->page;
+                if (!page) {
+                    page = pdf_load_page(ctx, pdfdoc, pageNo);
+                    pageInfo->page = (fz_page*)page;
+                }
                 mbox = pdf_bound_page(ctx, page);
             }
             fz_catch(ctx) {
@@ -2186,16 +2854,7 @@ bool EngineMupdf::FinishLoading() {
         }
     }
 
-    fz_try(ctx) {
-        outline = fz_load_outline(ctx, _doc);
-    }
-    fz_catch(ctx) {
-        // ignore errors from pdf_load_outline()
-        // this information is not critical and checking the
-        // error might prevent loading some pdfs that would
-        // otherwise get displayed
-        fz_warn(ctx, "Couldn't load outline");
-    }
+    // the outline is loaded on demand in GetToc()
 
     fz_try(ctx) {
         attachments = PdfLoadAttachments(ctx, pdfdoc);
@@ -2285,50 +2944,55 @@ static NO_INLINE IPageDestination* DestFromAttachment(EngineMupdf* engine, fz_ou
     return dest;
 }
 
-TocItem* EngineMupdf::BuildTocTree(TocItem* parent, fz_outline* outline, int& idCounter, bool isAttachment) {
-    TocItem* root = nullptr;
-    TocItem* curr = nullptr;
+TocItem* EngineMupdf::NewTocItemFromOutline(TocItem* parent, fz_outline* outline, bool isAttachment) {
+    WCHAR* name = nullptr;
+    if (outline->title) {
+        name = strconv::Utf8ToWstr(outline->title);
+        name = PdfCleanString(name);
+    }
+    if (!name) {
+        name = str::Dup(L"");
+    }
 
-    while (outline) {
-        WCHAR* name = nullptr;
-        if (outline->title) {
-            name = strconv::Utf8ToWstr(outline->title);
-            name = PdfCleanString(name);
-        }
-        if (!name) {
-            name = str::Dup(L"");
-        }
+    int pageNo = FzGetPageNo(ctx, _doc, nullptr, outline);
+
+    IPageDestination* dest = nullptr;
+    Kind kindRaw = nullptr;
+    if (isAttachment) {
+        kindRaw = kindTocFzOutlineAttachment;
+        dest = DestFromAttachment(this, outline);
+    } else {
+        kindRaw = kindTocFzOutline;
+        dest = NewPageDestinationMupdf(ctx, _doc, nullptr, outline);
+    }
 
-        int pageNo = FzGetPageNo(ctx, _doc, nullptr, outline);
+    TocItem* item = NewTocItemWithDestination(parent, name, dest);
+    item->kindRaw = kindRaw;
+    item->rawVal1 = str::Dup(outline->title);
+    item->rawVal2 = str::Dup(outline->uri);
 
-        IPageDestination* dest = nullptr;
-        Kind kindRaw = nullptr;
-        if (isAttachment) {
-            kindRaw = kindTocFzOutlineAttachment;
-            dest = DestFromAttachment(this, outline);
-        } else {
-            kindRaw = kindTocFzOutline;
-            dest = NewPageDestinationMupdf(ctx, _doc, nullptr, outline);
-        }
+    free(name);
+    item->isOpenDefault = outline->is_open;
+    item->fontFlags = 0; // TODO: had outline->flags; but mupdf changed outline
+    item->pageNo = pageNo;
+    CrashIf(!item->PageNumbersMatch());
 
-        TocItem* item = NewTocItemWithDestination(parent, name, dest);
-        item->kindRaw = kindRaw;
-        item->rawVal1 = str::Dup(outline->title);
-        item->rawVal2 = str::Dup(outline->uri);
+    // TODO: had outline->n_color and outline->color but mupdf changed outline
+    /*
+    if (outline->n_color > 0) {
+        item->color = ColorRefFromPdfFloat(ctx, outline->n_color, outline->color);
+    }
+    */
+    return item;
+}
 
-        free(name);
-        item->isOpenDefault = outline->is_open;
-        item->id = ++idCounter;
-        item->fontFlags = 0; // TODO: had outline->flags; but mupdf changed outline
-        item->pageNo = pageNo;
-        CrashIf(!item->PageNumbersMatch());
+TocItem* EngineMupdf::BuildTocTree(TocItem* parent, fz_outline* outline, int& idCounter, bool isAttachment) {
+    TocItem* root = nullptr;
+    TocItem* curr = nullptr;
 
-        // TODO: had outline->n_color and outline->color but mupdf changed outline
-        /*
-        if (outline->n_color > 0) {
-            item->color = ColorRefFromPdfFloat(ctx, outline->n_color, outline->color);
-        }
-        */
+    while (outline) {
+        TocItem* item = NewTocItemFromOutline(parent, outline, isAttachment);
+        item->id = ++idCounter;
 
         if (outline->down) {
             item->child = BuildTocTree(item, outline->down, idCounter, isAttachment);
@@ -2351,12 +3015,57 @@ TocItem* EngineMupdf::BuildTocTree(TocItem* parent, fz_outline* outline, int& id
     return root;
 }
 
+// loads the items of a PDF outline one level at a time, when TocItem::GetChild() is called
+struct PdfTocLoader : TocItemLoader {
+    EngineMupdf* engine = nullptr;
+    Vec<PdfOutlineNode> nodes;
+
+    explicit PdfTocLoader(EngineMupdf* engine) : engine(engine) {
+    }
+    TocItem* LoadChildren(TocItem* item) override;
+    TocItem* LoadItems(TocItem* parent, int first, int end);
+};
+
+TocItem* PdfTocLoader::LoadChildren(TocItem* item) {
+    ScopedCritSec cs(engine->ctxAccess);
+    int idx = item->childrenRef;
+    return LoadItems(item, idx + 1, idx + 1 + nodes[idx].nDescendants);
+}
+
+// loads nodes[first] and its siblings up to end.
+// Note: make sure to only call with ctxAccess
+TocItem* PdfTocLoader::LoadItems(TocItem* parent, int first, int end) {
+    fz_context* ctx = engine->ctx;
+    TocItem* root = nullptr;
+    TocItem* curr = nullptr;
+    for (int i = first; i < end; i += 1 + nodes[i].nDescendants) {
+        fz_outline* outline = PdfLoadOutlineItem(ctx, engine->pdfdoc, nodes[i].objNum);
+        // PageDestinationMupdf refers to outline
+        engine->outlineItems.Append(outline);
+        TocItem* item = engine->NewTocItemFromOutline(parent, outline, false);
+        // same as the ids of BuildTocTree() so that the saved ToC state matches
+        item->id = i + 1;
+        if (nodes[i].nDescendants > 0) {
+            item->childrenLoader = this;
+            item->childrenRef = i;
+        }
+        if (!root) {
+            root = item;
+        } else {
+            curr->next = item;
+        }
+        curr = item;
+    }
+    return root;
+}
+
 // TODO: maybe build in FinishLoading
 TocTree* EngineMupdf::GetToc() {
     if (tocTree) {
         return tocTree;
     }
-    if (outline == nullptr && attachments == nullptr) {
+    if (isLoadingProgressively) {
+        // the outline usually is at the end of the file
         return nullptr;
     }
 
@@ -2364,9 +3073,32 @@ TocTree* EngineMupdf::GetToc() {
 
     ScopedCritSec cs(ctxAccess);
 
+    PdfTocLoader* loader = nullptr;
+    if (pdfdoc) {
+        loader = new PdfTocLoader(this);
+        fz_try(ctx) {
+            PdfCollectOutlineNodes(ctx, pdfdoc, loader->nodes);
+        }
+        fz_catch(ctx) {
+            // ignore errors, same as for fz_load_outline() in FinishNonPDFLoading()
+            fz_warn(ctx, "Couldn't load outline");
+            loader->nodes.Reset();
+        }
+        if (loader->nodes.size() == 0) {
+            delete loader;
+            loader = nullptr;
+        }
+    }
+    if (outline == nullptr && attachments == nullptr && loader == nullptr) {
+        return nullptr;
+    }
+
     TocItem* root = nullptr;
     TocItem* att = nullptr;
-    if (outline) {
+    if (loader) {
+        root = loader->LoadItems(nullptr, 0, loader->nodes.isize());
+        idCounter = loader->nodes.isize();
+    } else if (outline) {
         root = BuildTocTree(nullptr, outline, idCounter, false);
     }
     if (!attachments) {
@@ -2380,11 +3112,13 @@ TocTree* EngineMupdf::GetToc() {
     }
 MakeTree:
     if (!root) {
+        delete loader;
         return nullptr;
     }
     TocItem* realRoot = new TocItem();
     realRoot->child = root;
     tocTree = new TocTree(realRoot);
+    tocTree->childrenLoader = loader;
     return tocTree;
 }
 
@@ -2542,12 +3276,118 @@ static void MakePageElementCommentsFromAnnotations(fz_context* ctx, FzPageInfo*
     comments.Reverse();
 }
 
+// pages whose text is needed again soon (e.g. when searching forth and back
+// or selecting text on the visible pages) don't need to be run through
+// a stext device again
+constexpr int kMaxCachedStextPages = 16;
+
+// must be called inside ctxAccess. The result is owned by pageInfo
+// and only valid until GetStextPage() is called for another page
+fz_stext_page* EngineMupdf::GetStextPage(FzPageInfo* pageInfo) {
+    int pageNo = pageInfo->pageNo;
+    if (pageInfo->stext) {
+        stextPageNos.Remove(pageNo);
+        stextPageNos.Append(pageNo);
+        return pageInfo->stext;
+    }
+    if (!pageInfo->page) {
+        return nullptr;
+    }
+
+    fz_stext_page* stext = nullptr;
+    fz_var(stext);
+    fz_stext_options opts{};
+    opts.flags = FZ_STEXT_PRESERVE_IMAGES;
+    fz_try(ctx) {
+        stext = fz_new_stext_page_from_page(ctx, pageInfo->page, &opts);
+    }
+    fz_catch(ctx) {
+        stext = nullptr;
+    }
+    if (!stext) {
+        return nullptr;
+    }
+
+    if (stextPageNos.isize() >= kMaxCachedStextPages) {
+        DropStextPage(pages[stextPageNos[0] - 1]);
+    }
+    pageInfo->stext = stext;
+    stextPageNos.Append(pageNo);
+    return stext;
+}
+
+// must be called inside ctxAccess
+void EngineMupdf::DropStextPage(FzPageInfo* pageInfo) {
+    if (!pageInfo->stext) {
+        return;
+    }
+    fz_drop_stext_page(ctx, pageInfo->stext);
+    pageInfo->stext = nullptr;
+    stextPageNos.Remove(pageInfo->pageNo);
+}
+
+// must be called inside ctxAccess
+void EngineMupdf::LoadPageElements(FzPageInfo* pageInfo) {
+    if (pageInfo->elementsLoaded || !pageInfo->page) {
+        return;
+    }
+    pageInfo->elementsLoaded = true;
+    int pageNo = pageInfo->pageNo;
+
+    fz_link* link = fz_load_links(ctx, pageInfo->page);
+    link = FixupPageLinks(link); // TOOD: is this necessary?
+    pageInfo->retainedLinks = link;
+    while (link) {
+        auto pel = NewLinkDestination(pageNo, ctx, _doc, link, nullptr);
+        pageInfo->links.Append(pel);
+        link = link->next;
+    }
+
+    // comments are (re)built in GetFzPageInfo()
+    fz_stext_page* stext = GetStextPage(pageInfo);
+    if (!stext) {
+        return;
+    }
+
+    FzLinkifyPageText(pageInfo, stext);
+    FzFindImagePositions(ctx, pageNo, pageInfo->images, stext);
+}
+
+// queues extraction of page elements for a rendered page
+void EngineMupdf::RequestPageElements(int pageNo) {
+    ScopedCritSec scope(&pagesAccess);
+    if (pages[pageNo - 1]->fullyLoaded) {
+        return;
+    }
+    if (!elementsLoader) {
+        elementsLoader = new PageElementsLoader(this);
+        elementsLoader->Start();
+    }
+    elementsLoader->Request(pageNo);
+}
+
+// called on PageElementsLoader's thread. Doesn't block GetFzPageInfo() for
+// other pages while extracting, only rendering (which needs ctxAccess as well)
+void EngineMupdf::LoadRequestedPageElements(int pageNo) {
+    FzPageInfo* pageInfo = pages[pageNo - 1];
+    {
+        ScopedCritSec scope(ctxAccess);
+        // pages are requested again once the whole document has been read
+        if (isLoadingProgressively) {
+            return;
+        }
+        LoadPageElements(pageInfo);
+        if (!pageInfo->elementsLoaded) {
+            return;
+        }
+    }
+    ScopedCritSec scope(&pagesAccess);
+    pageInfo->fullyLoaded = true;
+}
+
 // Maybe: handle FZ_ERROR_TRYLATER, which can happen when parsing from network.
 // (I don't think we read from network now).
-// Maybe: when loading fully, cache extracted text in FzPageInfo
-// so that we don't have to re-do fz_new_stext_page_from_page() when doing search
 FzPageInfo* EngineMupdf::GetFzPageInfo(int pageNo, bool loadQuick) {
-    // TODO: minimize time spent under pagesAccess when fully loading
     ScopedCritSec scope(&pagesAccess);
 
     CrashIf(pageNo < 1 || pageNo > pageCount);
@@ -2561,6 +3401,14 @@ FzPageInfo* EngineMupdf::GetFzPageInfo(int pageNo, bool loadQuick) {
         }
         fz_catch(ctx) {
         }
+        if (pageInfo->page && pageInfo->page->incomplete) {
+            // some objects (e.g. annotations) haven't been read yet, try again later
+            fz_drop_page(ctx, pageInfo->page);
+            pageInfo->page = nullptr;
+        }
+        if (pageInfo->page) {
+            UpdateGlyphCacheLimits(pageInfo->page);
+        }
     }
 
     fz_page* page = pageInfo->page;
@@ -2574,44 +3422,63 @@ FzPageInfo* EngineMupdf::GetFzPageInfo(int pageNo, bool loadQuick) {
         pageInfo->commentsNeedRebuilding = false;
     }
 
-    if (loadQuick || pageInfo->fullyLoaded) {
+    // text extracted before the page's content has been read would be incomplete
+    if (loadQuick || pageInfo->fullyLoaded || isLoadingProgressively) {
         return pageInfo;
     }
 
     CrashIf(pageInfo->pageNo != pageNo);
 
+    // most pages get their elements from PageElementsLoader, this is
+    // for callers that need them right away (e.g. GetPageImage())
+    LoadPageElements(pageInfo);
     pageInfo->fullyLoaded = true;
+    return pageInfo;
+}
 
-    fz_stext_page* stext = nullptr;
-    fz_var(stext);
-    fz_stext_options opts{};
-    opts.flags = FZ_STEXT_PRESERVE_IMAGES;
-    fz_try(ctx) {
-        stext = fz_new_stext_page_from_page(ctx, page, &opts);
-    }
-    fz_catch(ctx) {
-    }
-
-    fz_link* link = fz_load_links(ctx, page);
-    link = FixupPageLinks(link); // TOOD: is this necessary?
-    pageInfo->retainedLinks = link;
-    while (link) {
-        auto pel = NewLinkDestination(pageNo, ctx, _doc, link, nullptr);
-        pageInfo->links.Append(pel);
-        link = link->next;
+// mupdf's default glyph cache of 1 MB is good for 96 dpi and a few fonts.
+// Glyphs are bigger at higher dpi and documents with many fonts (e.g. a
+// font subset per page) have many more distinct glyphs, so the cache
+// would keep evicting glyphs that are needed again for the next tile
+constexpr i64 kGlyphCacheBaseSize = 1024 * 1024;
+constexpr i64 kGlyphCacheMaxSize = 64 * 1024 * 1024;
+constexpr int kGlyphCacheBaseGlyphSize = 256;
+constexpr int kFontsPerGlyphCacheBaseSize = 8;
+
+// must be called inside ctxAccess. page is nullptr when called after loading
+void EngineMupdf::UpdateGlyphCacheLimits(fz_page* page) {
+    pdf_page* pdfpage = page ? pdf_page_from_fz_page(ctx, page) : nullptr;
+    if (pdfpage) {
+        int nFontsBefore = fontObjNums.isize();
+        fz_try(ctx) {
+            pdf_obj* fonts = pdf_dict_get(ctx, pdf_page_resources(ctx, pdfpage), PDF_NAME(Font));
+            int n = pdf_dict_len(ctx, fonts);
+            for (int i = 0; i < n; i++) {
+                // direct font objects (number 0) are rare
+                int num = pdf_to_num(ctx, pdf_dict_get_val(ctx, fonts, i));
+                if (num > 0 && !fontObjNums.Contains(num)) {
+                    fontObjNums.Append(num);
+                }
+            }
+        }
+        fz_catch(ctx) {
+        }
+        if (fontObjNums.isize() == nFontsBefore) {
+            return;
+        }
+    } else if (page) {
+        return;
     }
 
-    if (pdfdoc) {
-        MakePageElementCommentsFromAnnotations(ctx, pageInfo);
-    }
-    if (!stext) {
-        return pageInfo;
+    float dpiScale = std::max((float)displayDPI / 96.f, 1.f);
+    float fontScale = 1.f + (float)fontObjNums.isize() / kFontsPerGlyphCacheBaseSize;
+    i64 size = (i64)(kGlyphCacheBaseSize * dpiScale * dpiScale * fontScale);
+    size = std::min(size, kGlyphCacheMaxSize);
+    if (glyphCacheSizeOverride > 0) {
+        size = glyphCacheSizeOverride;
     }
-
-    FzLinkifyPageText(pageInfo, stext);
-    FzFindImagePositions(ctx, pageNo, pageInfo->images, stext);
-    fz_drop_stext_page(ctx, stext);
-    return pageInfo;
+    int maxGlyphSize = (int)(kGlyphCacheBaseGlyphSize * dpiScale);
+    fz_set_glyph_cache_limits(ctx, (size_t)size, maxGlyphSize);
 }
 
 RectF EngineMupdf::PageMediabox(int pageNo) {
@@ -2620,7 +3487,7 @@ RectF EngineMupdf::PageMediabox(int pageNo) {
 }
 
 RectF EngineMupdf::PageContentBox(int pageNo, RenderTarget target) {
-    FzPageInfo* pageInfo = GetFzPageInfo(pageNo, false);
+    FzPageInfo* pageInfo = GetFzPageInfo(pageNo, true);
     if (!pageInfo) {
         // maybe should return a dummy size. not sure how this
         // will play with layout. The page should fail to render
@@ -2697,12 +3564,19 @@ RectF EngineMupdf::Transform(const RectF& rect, int pageNo, float zoom, int rota
 
 RenderedBitmap* EngineMupdf::RenderPage(RenderPageArgs& args) {
     auto pageNo = args.pageNo;
+    TraceScope scope("EngineMupdf.RenderPage", pageNo, &gTraceMupdfRenderUs);
 
-    FzPageInfo* pageInfo = GetFzPageInfo(pageNo, false);
+    FzPageInfo* pageInfo = GetFzPageInfo(pageNo, true);
+    if ((!pageInfo || !pageInfo->page) && isLoadingProgressively) {
+        return RenderPlaceholderPage(args);
+    }
     if (!pageInfo || !pageInfo->page) {
         return nullptr;
     }
     fz_page* page = pageInfo->page;
+    if (!isLoadingProgressively) {
+        RequestPageElements(pageNo);
+    }
 
     fz_cookie* fzcookie = nullptr;
     FitzAbortCookie* cookie = nullptr;
@@ -2711,9 +3585,28 @@ RenderedBitmap* EngineMupdf::RenderPage(RenderPageArgs& args) {
         *args.cookie_out = cookie;
         fzcookie = &cookie->cookie;
     }
+    // tells us whether content that hasn't been read yet was skipped
+    fz_cookie progressiveCookie{};
+    if (!fzcookie && isLoadingProgressively) {
+        fzcookie = &progressiveCookie;
+    }
 
     ScopedCritSec cs(ctxAccess);
 
+    // anti-aliasing levels are per context, so restore them for other renderings
+    int prevTextAA = fz_text_aa_level(ctx);
+    int prevGraphicsAA = fz_graphics_aa_level(ctx);
+    if (args.isPreview) {
+        fz_set_text_aa_level(ctx, std::min(prevTextAA, kPreviewAALevel));
+        fz_set_graphics_aa_level(ctx, std::min(prevGraphicsAA, kPreviewAALevel));
+    }
+    defer {
+        if (args.isPreview) {
+            fz_set_text_aa_level(ctx, prevTextAA);
+            fz_set_graphics_aa_level(ctx, prevGraphicsAA);
+        }
+    };
+
     auto pageRect = args.pageRect;
     auto zoom = args.zoom;
     auto rotation = args.rotation;
@@ -2755,9 +3648,15 @@ RenderedBitmap* EngineMupdf::RenderPage(RenderPageArgs& args) {
             // TODO: in printing different style. old code use pdf_run_page_with_usage(), with usage ="View"
             // or "Print". "Export" is not used
             dev = fz_new_draw_device(ctx, ctm, pix);
+            if (args.isPreview) {
+                fz_enable_device_hints(ctx, dev, FZ_DONT_INTERPOLATE_IMAGES);
+            }
             pdf_run_page_with_usage(ctx, pdfpage, dev, fz_identity, usage, fzcookie);
             bitmap = NewRenderedFzPixmap(ctx, pix);
             fz_close_device(ctx, dev);
+            if (fzcookie && fzcookie->incomplete && isLoadingProgressively) {
+                pageInfo->renderedIncomplete = true;
+            }
         }
         fz_always(ctx) {
             if (dev) {
@@ -2767,6 +3666,9 @@ RenderedBitmap* EngineMupdf::RenderPage(RenderPageArgs& args) {
         }
         fz_catch(ctx) {
             delete bitmap;
+            if (isLoadingProgressively) {
+                return RenderPlaceholderPage(args);
+            }
             return nullptr;
         }
     } else {
@@ -2778,6 +3680,9 @@ RenderedBitmap* EngineMupdf::RenderPage(RenderPageArgs& args) {
             // fz_clear_pixmap(ctx, pix);
             // fz_fill_pixmap_with_color(ctx, pix, )
             dev = fz_new_draw_device(ctx, ctm, pix);
+            if (args.isPreview) {
+                fz_enable_device_hints(ctx, dev, FZ_DONT_INTERPOLATE_IMAGES);
+            }
             fz_run_page_contents(ctx, page, dev, fz_identity, NULL);
             fz_close_device(ctx, dev);
             fz_drop_device(ctx, dev);
@@ -2792,6 +3697,40 @@ RenderedBitmap* EngineMupdf::RenderPage(RenderPageArgs& args) {
         }
     }
 
+    // aborted renders are thrown away by the caller
+    if (bitmap && !(fzcookie && fzcookie->abort)) {
+        gTraceMupdfRenderedBytes.Add((i64)(ibounds.x1 - ibounds.x0) * (ibounds.y1 - ibounds.y0) * 3);
+    }
+    return bitmap;
+}
+
+// a blank page of the right size for a page that can't be loaded yet,
+// re-rendered through onLoadProgress once more of the file has been read
+RenderedBitmap* EngineMupdf::RenderPlaceholderPage(RenderPageArgs& args) {
+    ScopedCritSec cs(ctxAccess);
+    FzPageInfo* pageInfo = pages[args.pageNo - 1];
+    pageInfo->renderedIncomplete = true;
+
+    fz_rect pRect = ToFzRect(args.pageRect ? *args.pageRect : pageInfo->mediabox);
+    fz_matrix ctm = viewctm(args.pageNo, args.zoom, args.rotation);
+    fz_irect bbox = fz_round_rect(fz_transform_rect(pRect, ctm));
+
+    fz_pixmap* pix = nullptr;
+    RenderedBitmap* bitmap = nullptr;
+    fz_var(pix);
+    fz_var(bitmap);
+    fz_try(ctx) {
+        pix = fz_new_pixmap_with_bbox(ctx, fz_device_rgb(ctx), bbox, nullptr, 1);
+        fz_clear_pixmap_with_value(ctx, pix, 0xff);
+        bitmap = NewRenderedFzPixmap(ctx, pix);
+    }
+    fz_always(ctx) {
+        fz_drop_pixmap(ctx, pix);
+    }
+    fz_catch(ctx) {
+        delete bitmap;
+        return nullptr;
+    }
     return bitmap;
 }
 
@@ -2846,6 +3785,35 @@ void HandleLinkMupdf(EngineMupdf* e, IPageDestination* dest, ILinkHandler* linkH
     ctrl->ScrollTo(pageNo + 1, r, zoom);
 }
 
+IPageDestination* EngineMupdfResolveDest(EngineBase* engine, IPageDestination* dest) {
+    EngineMupdf* epdf = AsEngineMupdf(engine);
+    if (!epdf || !dest || dest->GetKind() != kindDestinationMupdf) {
+        return nullptr;
+    }
+    PageDestinationMupdf* link = (PageDestinationMupdf*)dest;
+    const char* uri = FzGetURL(link->link, link->outline);
+    if (!uri) {
+        return nullptr;
+    }
+    if (IsExternalLink(uri)) {
+        auto res = new PageDestinationURL(uri);
+        res->rect = dest->rect;
+        return res;
+    }
+
+    // same as HandleLinkMupdf()
+    float x = 0, y = 0;
+    int pageNo;
+    {
+        ScopedCritSec scope(epdf->ctxAccess);
+        pageNo = ResolveLink(epdf->ctx, epdf->_doc, uri, &x, &y);
+    }
+    if (pageNo <= 0) {
+        return nullptr;
+    }
+    return NewSimpleDest(pageNo, RectF(x, y, DEST_USE_DEFAULT, DEST_USE_DEFAULT));
+}
+
 bool EngineMupdf::HandleLink(IPageDestination* dest, ILinkHandler* linkHandler) {
     Kind k = dest->GetKind();
     if (k == kindDestinationMupdf) {
@@ -2899,7 +3867,7 @@ RenderedBitmap* EngineMupdf::GetPageImage(int pageNo, RectF rect, int imageIdx)
 
     ScopedCritSec scope(ctxAccess);
 
-    fz_image* image = FzFindImageAtIdx(ctx, pageInfo, imageIdx);
+    fz_image* image = FzFindImageAtIdx(ctx, GetStextPage(pageInfo), imageIdx);
     CrashIf(!image);
     if (!image) {
         return nullptr;
@@ -2917,6 +3885,7 @@ RenderedBitmap* EngineMupdf::GetPageImage(int pageNo, RectF rect, int imageIdx)
     }
     fz_always(ctx) {
         fz_drop_pixmap(ctx, pixmap);
+        fz_drop_image(ctx, image);
     }
     fz_catch(ctx) {
         bmp = nullptr;
@@ -2933,21 +3902,13 @@ PageText EngineMupdf::ExtractPageText(int pageNo) {
 
     ScopedCritSec scope(ctxAccess);
 
-    fz_stext_page* stext = nullptr;
-    fz_var(stext);
-    fz_stext_options opts{};
-    fz_try(ctx) {
-        stext = fz_new_stext_page_from_page(ctx, pageInfo->page, &opts);
-    }
-    fz_catch(ctx) {
-    }
+    fz_stext_page* stext = GetStextPage(pageInfo);
     if (!stext) {
         return {};
     }
     PageText res;
     // TODO: convert to return PageText
     WCHAR* text = FzTextPageToStr(stext, &res.coords);
-    fz_drop_stext_page(ctx, stext);
     res.text = text;
     res.len = (int)str::Len(text);
     return res;
@@ -2982,7 +3943,7 @@ WCHAR* EngineMupdf::ExtractFontList() {
     // collect all fonts from all page objects
     int nPages = PageCount();
     for (int i = 1; i <= nPages; i++) {
-        auto pageInfo = GetFzPageInfo(i, false);
+        auto pageInfo = GetFzPageInfo(i, true);
         if (!pageInfo) {
             continue;
         }
@@ -3496,6 +4457,65 @@ bool EngineMupdfHasUnsavedAnnotations(EngineBase* engine) {
     return res != 0;
 }
 
+bool EngineMupdfGetGlyphCacheStats(EngineBase* engine, GlyphCacheStats* statsOut) {
+    EngineMupdf* epdf = AsEngineMupdf(engine);
+    if (!epdf) {
+        return false;
+    }
+    fz_glyph_cache_stats stats{};
+    fz_get_glyph_cache_stats(epdf->ctx, &stats);
+    statsOut->size = (i64)stats.size;
+    statsOut->maxSize = (i64)stats.max_size;
+    statsOut->maxGlyphSize = stats.max_glyph_size;
+    statsOut->entries = stats.entries;
+    statsOut->hits = stats.hits;
+    statsOut->misses = stats.misses;
+    statsOut->evictions = stats.evictions;
+    return true;
+}
+
+bool EngineMupdfGetColorConversionStats(EngineBase* engine, ColorConversionStats* statsOut) {
+    EngineMupdf* epdf = AsEngineMupdf(engine);
+    if (!epdf) {
+        return false;
+    }
+    fz_color_conversion_stats stats{};
+    fz_get_color_conversion_stats(epdf->ctx, &stats);
+    statsOut->linksCreated = stats.links_created;
+    statsOut->linkMs = stats.link_ms;
+    statsOut->identityLinks = stats.identity_links;
+    statsOut->linkLookups = stats.link_lookups;
+    statsOut->linkCacheHits = stats.link_cache_hits;
+    statsOut->pixmaps = stats.pixmaps;
+    statsOut->fastPixmaps = stats.fast_pixmaps;
+    statsOut->lutPixmaps = stats.lut_pixmaps;
+    statsOut->pixels = stats.pixels;
+    statsOut->convertMs = stats.convert_ms;
+    return true;
+}
+
+bool EngineMupdfGetRepairStats(EngineBase* engine, PdfRepairStats* statsOut) {
+    EngineMupdf* epdf = AsEngineMupdf(engine);
+    if (!epdf || !epdf->pdfdoc) {
+        return false;
+    }
+    ScopedCritSec scope(epdf->ctxAccess);
+    statsOut->wasRepaired = pdf_was_repaired(epdf->ctx, epdf->pdfdoc);
+    statsOut->usedSavedRepair = statsOut->wasRepaired && RepairCacheUsed(epdf);
+    statsOut->ms = statsOut->wasRepaired ? epdf->repairMs : 0;
+    return true;
+}
+
+void EngineMupdfSetGlyphCacheSize(EngineBase* engine, i64 maxSize) {
+    EngineMupdf* epdf = AsEngineMupdf(engine);
+    if (!epdf) {
+        return;
+    }
+    ScopedCritSec scope(epdf->ctxAccess);
+    epdf->glyphCacheSizeOverride = maxSize;
+    epdf->UpdateGlyphCacheLimits(nullptr);
+}
+
 bool EngineMupdfSupportsAnnotations(EngineBase* engine) {
     EngineMupdf* epdf = AsEngineMupdf(engine);
     return (epdf->pdfdoc != nullptr);
@@ -3564,6 +4584,9 @@ void EngineMupdf::InvalideAnnotationsForPage(int pageNo) {
     FzPageInfo* pageInfo = pages[pageIdx];
     if (pageInfo) {
         pageInfo->commentsNeedRebuilding = true;
+        // the text of annotations is part of the page's text
+        ScopedCritSec ctxScope(ctxAccess);
+        DropStextPage(pageInfo);
     }
 }
 
@@ -2,6 +2,8 @@
    License: GPLv3 */
 
 struct Annotation;
+class ProgressiveFileReader;
+class PageElementsLoader;
 
 struct FitzPageImageInfo {
     fz_rect rect = fz_unit_rect;
@@ -34,6 +36,18 @@ struct FzPageInfo {
     bool fullyLoaded{false};
 
     bool commentsNeedRebuilding{true};
+
+    // rendered as a placeholder (or only partially) because the data for the
+    // page hadn't been read yet. Must be accessed inside ctxAccess
+    bool renderedIncomplete{false};
+
+    // links, autolinks and images have been extracted (inside ctxAccess).
+    // fullyLoaded is set afterwards (inside pagesAccess)
+    bool elementsLoaded{false};
+    // the page's text with image blocks, shared by page element extraction,
+    // ExtractPageText() and GetPageImage(). Only cached for the most recently
+    // used pages (see stextPageNos). Must be accessed inside ctxAccess
+    fz_stext_page* stext{nullptr};
 };
 
 class EngineMupdf : public EngineBase {
@@ -62,6 +76,7 @@ class EngineMupdf : public EngineBase {
     Vec<IPageElement*> GetElements(int pageNo) override;
     IPageElement* GetElementAtPos(int pageNo, PointF pt) override;
     bool HandleLink(IPageDestination*, ILinkHandler*) override;
+    void SetLoadProgressCallback(const std::function<void(int pageNo)>& onLoadProgress) override;
 
     RenderedBitmap* GetImageForPageElement(IPageElement*) override;
 
@@ -87,27 +102,67 @@ class EngineMupdf : public EngineBase {
     pdf_document* pdfdoc{nullptr};
     fz_stream* docStream{nullptr};
     Vec<FzPageInfo*> pages;
+    // only for non-PDF documents, PDF outline items are loaded on demand into outlineItems
     fz_outline* outline{nullptr};
     fz_outline* attachments{nullptr};
+    Vec<fz_outline*> outlineItems;
     pdf_obj* pdfInfo{nullptr};
     WStrVec* pageLabels{nullptr};
 
     TocTree* tocTree{nullptr};
 
+    // object numbers of the fonts used by loaded pages, for sizing the glyph cache
+    Vec<int> fontObjNums;
+    // if > 0, overrides the glyph cache budget derived from dpi and fonts
+    i64 glyphCacheSizeOverride{0};
+
+    // where the repaired xref of a damaged PDF is saved, nullptr if it isn't
+    AutoFreeWstr repairCachePath;
+    bool repairCacheLoaded{false};
+    bool repairCacheSaved{false};
+    // time it took to open a PDF whose xref had to be repaired
+    double repairMs{0};
+
+    // reads the file when a linearized PDF is loaded progressively
+    ProgressiveFileReader* progressiveReader{nullptr};
+    // true until the whole file has been read, must be changed inside ctxAccess.
+    // Also read outside of it (e.g. in RenderPage())
+    std::atomic<bool> isLoadingProgressively{false};
+    // guarded by pagesAccess, only called inside it
+    std::function<void(int pageNo)> onLoadProgress;
+
+    // extracts page elements of rendered pages in the background
+    PageElementsLoader* elementsLoader{nullptr};
+    // pages with a cached stext, least recently used first. Must be accessed inside ctxAccess
+    Vec<int> stextPageNos;
+
     bool Load(const WCHAR* filePath, PasswordUI* pwdUI = nullptr);
     bool Load(IStream* stream, const char* nameHint, PasswordUI* pwdUI = nullptr);
     // TODO(port): fz_stream can no-longer be re-opened (fz_clone_stream)
     // bool Load(fz_stream* stm, PasswordUI* pwdUI = nullptr);
     bool LoadFromStream(fz_stream* stm, const char* nameHing, PasswordUI* pwdUI = nullptr);
     bool FinishLoading();
+    bool LoadProgressively(const WCHAR* path, PasswordUI* pwdUI);
+    bool FinishPdfLoading();
+    void SetPlaceholderMediaboxes();
+    void FinishProgressiveLoading();
+    void ProgressiveLoadProgress(bool isComplete);
+    RenderedBitmap* RenderPlaceholderPage(RenderPageArgs& args);
     RenderedBitmap* GetPageImage(int pageNo, RectF rect, int imageIdx);
 
     FzPageInfo* GetFzPageInfoFast(int pageNo);
     FzPageInfo* GetFzPageInfo(int pageNo, bool loadQuick);
+    fz_stext_page* GetStextPage(FzPageInfo* pageInfo);
+    void DropStextPage(FzPageInfo* pageInfo);
+    void LoadPageElements(FzPageInfo* pageInfo);
+    void RequestPageElements(int pageNo);
+    void LoadRequestedPageElements(int pageNo);
     fz_matrix viewctm(int pageNo, float zoom, int rotation);
     fz_matrix viewctm(fz_page* page, float zoom, int rotation) const;
+    TocItem* NewTocItemFromOutline(TocItem* parent, fz_outline* outline, bool isAttachment);
     TocItem* BuildTocTree(TocItem* parent, fz_outline* outline, int& idCounter, bool isAttachment);
     WCHAR* ExtractFontList();
+    void UpdateGlyphCacheLimits(fz_page* page);
 
     ByteSlice LoadStreamFromPDFFile(const WCHAR* filePath);
     void InvalideAnnotationsForPage(int pageNo);
@@ -117,4 +172,5 @@ EngineMupdf* AsEngineMupdf(EngineBase* engine);
 
 fz_rect ToFzRect(RectF rect);
 RectF ToRectF(fz_rect rect);
+fz_matrix FzCreateViewCtm(fz_rect mediabox, float zoom, int rotation);
 RenderedBitmap* NewRenderedFzPixmap(fz_context* ctx, fz_pixmap* pixmap);
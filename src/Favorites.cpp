@@ -651,7 +651,7 @@ static TocItem* TocItemForPageNo(TocItem* item, int pageNo) {
         }
 
         // find any child item closer to the specified page
-        TocItem* subItem = TocItemForPageNo(item->child, pageNo);
+        TocItem* subItem = TocItemForPageNo(item->GetChild(), pageNo);
         if (subItem) {
             currItem = subItem;
         }
@@ -32,6 +32,8 @@ Flags::~Flags() {
     str::Free(updateSelfTo);
     str::Free(deleteFile);
     str::Free(search);
+    str::Free(tracePath);
+    str::Free(benchReportPath);
 
     // TODO: temporary
     str::Free(toEpubPath);
@@ -234,6 +236,7 @@ static void ParseScrollValue(Point* scroll, const WCHAR* txt) {
     V(Render, "render")                          \
     V(ExtractText, "extract-text")               \
     V(Bench, "bench")                            \
+    V(BenchReport, "bench-report")               \
     V(Dir, "d")                                  \
     V(Lang, "lang")                              \
     V(UpdateSelfTo, "update-self-to")            \
@@ -247,6 +250,7 @@ static void ParseScrollValue(Point* scroll, const WCHAR* txt) {
     V(MangaMode, "manga-mode")                   \
     V(ToEpub, "to-epub")                         \
     V(Search, "search")                          \
+    V(Trace, "trace")                            \
     V(SetColorRange, "set-color-range")
 
 #define MAKE_ARG(__arg, __name) __arg,
@@ -540,6 +544,10 @@ void ParseFlags(const WCHAR* cmdLine, Flags& i) {
             i.exitImmediately = true;
             continue;
         }
+        if (arg == Arg::BenchReport) {
+            i.benchReportPath = str::Dup(param);
+            continue;
+        }
         if (arg == Arg::Dir) {
             i.installDir = str::Dup(param);
             continue;
@@ -566,6 +574,10 @@ void ParseFlags(const WCHAR* cmdLine, Flags& i) {
             i.search = str::Dup(param);
             continue;
         }
+        if (arg == Arg::Trace) {
+            i.tracePath = str::Dup(param);
+            continue;
+        }
         if (arg == Arg::BgCol || arg == Arg::BgCol2 || arg == Arg::FwdSearchOffset || arg == Arg::FwdSearchWidth ||
             arg == Arg::FwdSearchColor || arg == Arg::FwdSearchPermanent || arg == Arg::MangaMode) {
             i.globalPrefArgs.Append(str::Dup(argName));
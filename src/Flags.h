@@ -15,6 +15,8 @@ struct Flags {
     //   to benchmark. It can also be a string "loadonly" which means we'll
     //   only benchmark loading of the catalog
     WStrVec pathsToBenchmark;
+    // -bench-report <path> : save timings of -bench as JSON (see BenchReport.h)
+    WCHAR* benchReportPath{nullptr};
     bool exitWhenDone{false};
     bool printDialog{false};
     WCHAR* printerName{nullptr};
@@ -44,6 +46,9 @@ struct Flags {
     // the document in new window
     bool inNewWindow{false};
     WCHAR* search{nullptr};
+    // -trace <path> : record a trace of rendering/loading and save it
+    // to path in Chrome trace event format
+    WCHAR* tracePath{nullptr};
 
     // stress-testing related
     WCHAR* stressTestPath{nullptr};
@@ -13,6 +13,7 @@ extern "C" {
 #include "utils/WinUtil.h"
 #include "utils/GdiPlusUtil.h"
 #include "utils/FileUtil.h"
+#include "utils/PixelConvert.h"
 
 #include "FzImgReader.h"
 
@@ -173,6 +174,10 @@ static Gdiplus::Bitmap* ImageFromJp2Data(fz_context* ctx, const u8* data, int le
         u8* bmpPixels = (u8*)bmpData.Scan0;
         size_t dataSize = pix_argb->stride * h;
         memcpy(bmpPixels, pix_argb->samples, dataSize);
+        // mupdf's alpha is premultiplied, PixelFormat32bppARGB's isn't
+        if (pix->alpha) {
+            UnpremultiplyBgra(bmpPixels, (size_t)w * h);
+        }
     }
     fz_always(ctx) {
         bmp.UnlockBits(&bmpData);
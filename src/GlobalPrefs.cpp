@@ -128,3 +128,324 @@ void SetFileStatePath(FileState* fs, const WCHAR* path) {
     char* pathA = ToUtf8Temp(path);
     SetFileStatePath(fs, pathA);
 }
+
+/* Binary snapshot of the settings file.
+
+Parsing SumatraPDF-settings.txt on every start gets slow when the history
+has thousands of entries. Next to it we keep a binary copy of the parsed
+settings that loads with a single read and without any text parsing.
+The text file remains the source of truth: the snapshot records modification
+time and size of the text file it was made from and is ignored (and re-created
+by prefs::Load()) if the text file doesn't match.
+
+The snapshot is a header, the whole serialized GlobalPrefs and a list of
+FileState records. Each record replaces the FileState for the same path (if any)
+and moves it to the front of the history, which is what FileHistory does when
+a file is opened. That way most saves only append a few records instead of
+rewriting the whole snapshot. */
+
+constexpr u32 kPrefsSnapshotMagic = 0x53504653; // "SFPS"
+// rewrite the whole snapshot when there are too many records
+constexpr u32 kMaxPrefsSnapshotRecords = 128;
+// changes to FileStates past that many most recently used ones rewrite the whole snapshot
+constexpr int kMaxRecordsPerUpdate = 16;
+
+struct PrefsSnapshotHeader {
+    u32 magic;
+    // StructInfoHash() of gGlobalPrefsInfo
+    u32 schemaHash;
+    // the text file this is a snapshot of
+    FILETIME textTime;
+    i64 textSize;
+    u32 prefsSize;
+    u32 nRecords;
+    u32 recordsSize;
+    u32 reserved;
+};
+
+static bool IsValidSnapshotHeader(const PrefsSnapshotHeader& hdr, i64 fileSize) {
+    if (hdr.magic != kPrefsSnapshotMagic || hdr.schemaHash != StructInfoHash(&gGlobalPrefsInfo)) {
+        return false;
+    }
+    i64 size = (i64)sizeof(hdr) + (i64)hdr.prefsSize + (i64)hdr.recordsSize;
+    return size <= fileSize;
+}
+
+static int FindFileStateByPath(Vec<FileState*>* states, const char* filePath) {
+    for (int i = 0; i < states->isize(); i++) {
+        const char* fp = states->at(i)->filePath;
+        if (fp && filePath && str::EqI(fp, filePath)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void ApplySnapshotRecord(GlobalPrefs* prefs, FileState* fs) {
+    int idx = FindFileStateByPath(prefs->fileStates, fs->filePath);
+    if (idx >= 0) {
+        DeleteDisplayState(prefs->fileStates->at(idx));
+        prefs->fileStates->RemoveAt(idx);
+    }
+    prefs->fileStates->InsertAt(0, fs);
+}
+
+static GlobalPrefs* ParsePrefsSnapshot(ByteSlice data, FILETIME textTime, i64 textSize) {
+    if (data.size() < sizeof(PrefsSnapshotHeader)) {
+        return nullptr;
+    }
+    PrefsSnapshotHeader hdr;
+    memcpy(&hdr, data.data(), sizeof(hdr));
+    if (!IsValidSnapshotHeader(hdr, (i64)data.size())) {
+        return nullptr;
+    }
+    if (!FileTimeEq(hdr.textTime, textTime) || hdr.textSize != textSize) {
+        return nullptr;
+    }
+
+    ByteSlice d(data.data() + sizeof(hdr), hdr.prefsSize);
+    GlobalPrefs* prefs = (GlobalPrefs*)DeserializeStructBinary(&gGlobalPrefsInfo, d);
+    if (!prefs || d.size() != 0) {
+        DeleteGlobalPrefs(prefs);
+        return nullptr;
+    }
+
+    ByteSlice records(data.data() + sizeof(hdr) + hdr.prefsSize, hdr.recordsSize);
+    for (u32 i = 0; i < hdr.nRecords; i++) {
+        FileState* fs = (FileState*)DeserializeStructBinary(&gFileStateInfo, records);
+        if (!fs) {
+            DeleteGlobalPrefs(prefs);
+            return nullptr;
+        }
+        ApplySnapshotRecord(prefs, fs);
+    }
+    return prefs;
+}
+
+// returns nullptr if there's no snapshot or if it's out of date
+GlobalPrefs* LoadGlobalPrefsSnapshot(const WCHAR* path, FILETIME textTime, i64 textSize) {
+    AutoFree data = file::ReadFile(path);
+    if (!data.data) {
+        return nullptr;
+    }
+    return ParsePrefsSnapshot(data.AsSpan(), textTime, textSize);
+}
+
+static bool WritePrefsSnapshot(const WCHAR* path, GlobalPrefs* prefs, PrefsSnapshotHeader& hdr) {
+    hdr.magic = kPrefsSnapshotMagic;
+    hdr.schemaHash = StructInfoHash(&gGlobalPrefsInfo);
+    hdr.nRecords = 0;
+    hdr.recordsSize = 0;
+
+    str::Str out;
+    out.Append((const char*)&hdr, sizeof(hdr));
+    SerializeStructBinary(out, &gGlobalPrefsInfo, prefs);
+    hdr.prefsSize = (u32)(out.size() - sizeof(hdr));
+    memcpy(out.Get(), &hdr, sizeof(hdr));
+    return file::WriteFile(path, out.AsSpan());
+}
+
+// prefs must be what the text file deserializes to
+bool SaveGlobalPrefsSnapshot(const WCHAR* path, GlobalPrefs* prefs, FILETIME textTime, i64 textSize) {
+    PrefsSnapshotHeader hdr{};
+    hdr.textTime = textTime;
+    hdr.textSize = textSize;
+    return WritePrefsSnapshot(path, prefs, hdr);
+}
+
+// what the snapshot contains, so that updating it after a save doesn't
+// have to read, parse and re-serialize it
+struct PrefsSnapshotState {
+    PrefsSnapshotHeader hdr{};
+    // GlobalPrefs serialized without the FileStates
+    str::Str settings;
+    // FileStates serialized in history order, the i-th one
+    // is at fileStates[offsets[i]] up to fileStates[offsets[i + 1]]
+    str::Str fileStates;
+    Vec<size_t> offsets;
+    Vec<char*> filePaths;
+
+    PrefsSnapshotState() = default;
+    PrefsSnapshotState(PrefsSnapshotState const&) = delete;
+    PrefsSnapshotState& operator=(PrefsSnapshotState const&) = delete;
+    ~PrefsSnapshotState() {
+        for (char* s : filePaths) {
+            str::Free(s);
+        }
+    }
+};
+
+static PrefsSnapshotState* gPrefsSnapshotState = nullptr;
+
+static PrefsSnapshotState* NewPrefsSnapshotState(GlobalPrefs* prefs) {
+    auto state = new PrefsSnapshotState();
+    Vec<FileState*> empty;
+    Vec<FileState*>* states = prefs->fileStates;
+    prefs->fileStates = &empty;
+    SerializeStructBinary(state->settings, &gGlobalPrefsInfo, prefs);
+    prefs->fileStates = states;
+
+    for (FileState* fs : *states) {
+        state->offsets.Append(state->fileStates.size());
+        SerializeStructBinary(state->fileStates, &gFileStateInfo, fs);
+        state->filePaths.Append(str::Dup(fs->filePath));
+    }
+    state->offsets.Append(state->fileStates.size());
+    return state;
+}
+
+static ByteSlice GetFileStateRecord(PrefsSnapshotState* state, int i) {
+    size_t off = state->offsets[i];
+    return {(u8*)state->fileStates.Get() + off, state->offsets[i + 1] - off};
+}
+
+static bool IsSameData(ByteSlice d1, ByteSlice d2) {
+    return d1.size() == d2.size() && memcmp(d1.data(), d2.data(), d1.size()) == 0;
+}
+
+// index of filePath among the first n FileStates, -1 if it's not there
+static int FindFilePath(PrefsSnapshotState* state, int n, const char* filePath) {
+    for (int i = 0; i < n; i++) {
+        const char* fp = state->filePaths[i];
+        if (fp && filePath && str::EqI(fp, filePath)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// returns n such that moving the first n FileStates of curr to the front
+// of prev (in reverse order) results in curr. -1 if there's none or if it'd
+// take more than kMaxRecordsPerUpdate records
+static int FindChangedFileStates(PrefsSnapshotState* prev, PrefsSnapshotState* curr) {
+    int nCurr = curr->filePaths.isize();
+    int maxN = std::min(kMaxRecordsPerUpdate, nCurr);
+    // FileStates that haven't been moved to the front are in the same order,
+    // so match them from the end
+    int i = nCurr - 1;
+    int n = 0;
+    for (int j = prev->filePaths.isize() - 1; j >= 0; j--) {
+        if (i >= 0 && IsSameData(GetFileStateRecord(prev, j), GetFileStateRecord(curr, i))) {
+            i--;
+            continue;
+        }
+        int idx = FindFilePath(curr, maxN, prev->filePaths[j]);
+        if (idx < 0) {
+            // removed from the history or moved too far
+            return -1;
+        }
+        n = std::max(n, idx + 1);
+    }
+    n = std::max(n, i + 1);
+    return n <= maxN ? n : -1;
+}
+
+static bool AppendSnapshotRecords(const WCHAR* path, const PrefsSnapshotHeader& prevHdr, PrefsSnapshotHeader& hdr,
+                                  str::Str& records) {
+    HANDLE h = CreateFileW(path, GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+                           nullptr);
+    if (h == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    AutoCloseHandle hScope(h);
+
+    // make sure the snapshot is still what we think it is
+    PrefsSnapshotHeader fileHdr;
+    DWORD n = 0;
+    BOOL ok = ReadFile(h, &fileHdr, sizeof(fileHdr), &n, nullptr) && n == sizeof(fileHdr);
+    if (!ok || memcmp(&fileHdr, &prevHdr, sizeof(fileHdr)) != 0) {
+        return false;
+    }
+
+    // append the records first and only then update the header so that
+    // an interrupted update leaves a snapshot that's just out of date
+    LARGE_INTEGER off;
+    off.QuadPart = (LONGLONG)sizeof(hdr) + hdr.prefsSize + hdr.recordsSize;
+    ok = SetFilePointerEx(h, off, nullptr, FILE_BEGIN);
+    ok = ok && WriteFile(h, records.Get(), (DWORD)records.size(), &n, nullptr) && n == (DWORD)records.size();
+    ok = ok && SetEndOfFile(h);
+    if (!ok) {
+        return false;
+    }
+    hdr.recordsSize += (u32)records.size();
+    off.QuadPart = 0;
+    ok = SetFilePointerEx(h, off, nullptr, FILE_BEGIN);
+    ok = ok && WriteFile(h, &hdr, sizeof(hdr), &n, nullptr) && n == sizeof(hdr);
+    return ok;
+}
+
+// returns what the snapshot contains if it's for the given text file
+static PrefsSnapshotState* GetPrefsSnapshotState(const WCHAR* path, FILETIME textTime, i64 textSize) {
+    PrefsSnapshotState* state = gPrefsSnapshotState;
+    gPrefsSnapshotState = nullptr;
+    if (state && FileTimeEq(state->hdr.textTime, textTime) && state->hdr.textSize == textSize) {
+        return state;
+    }
+    delete state;
+
+    // first save since start or the text file was saved by another process
+    AutoFree data = file::ReadFile(path);
+    if (!data.data) {
+        return nullptr;
+    }
+    GlobalPrefs* prefs = ParsePrefsSnapshot(data.AsSpan(), textTime, textSize);
+    if (!prefs) {
+        return nullptr;
+    }
+    state = NewPrefsSnapshotState(prefs);
+    memcpy(&state->hdr, data.data, sizeof(state->hdr));
+    DeleteGlobalPrefs(prefs);
+    return state;
+}
+
+// called after prefs have been saved to the text file. prevTextTime and
+// prevTextSize are of the text file before it was overwritten
+void UpdateGlobalPrefsSnapshot(const WCHAR* path, GlobalPrefs* prefs, FILETIME prevTextTime, i64 prevTextSize,
+                               FILETIME textTime, i64 textSize) {
+    if (!prefs->rememberStatePerDocument || !prefs->rememberOpenedFiles) {
+        // SerializeGlobalPrefs() only writes out some of FileState fields,
+        // so the snapshot would differ from the text. prefs::Load() will re-create it
+        file::Delete(path);
+        FreeGlobalPrefsSnapshotState();
+        return;
+    }
+
+    PrefsSnapshotState* prev = GetPrefsSnapshotState(path, prevTextTime, prevTextSize);
+    PrefsSnapshotState* curr = NewPrefsSnapshotState(prefs);
+    defer {
+        delete prev;
+    };
+    curr->hdr.textTime = textTime;
+    curr->hdr.textSize = textSize;
+
+    if (prev && IsSameData(prev->settings.AsByteSlice(), curr->settings.AsByteSlice())) {
+        int nChanged = FindChangedFileStates(prev, curr);
+        if (nChanged >= 0 && prev->hdr.nRecords + nChanged <= kMaxPrefsSnapshotRecords) {
+            str::Str records;
+            // the most recently used FileState has to be applied last
+            for (int i = nChanged - 1; i >= 0; i--) {
+                ByteSlice d = GetFileStateRecord(curr, i);
+                records.Append((const char*)d.data(), d.size());
+            }
+            PrefsSnapshotHeader hdr = prev->hdr;
+            hdr.textTime = textTime;
+            hdr.textSize = textSize;
+            hdr.nRecords += (u32)nChanged;
+            if (records.size() <= hdr.prefsSize && AppendSnapshotRecords(path, prev->hdr, hdr, records)) {
+                curr->hdr = hdr;
+                gPrefsSnapshotState = curr;
+                return;
+            }
+        }
+    }
+    if (WritePrefsSnapshot(path, prefs, curr->hdr)) {
+        gPrefsSnapshotState = curr;
+    } else {
+        delete curr;
+    }
+}
+
+void FreeGlobalPrefsSnapshotState() {
+    delete gPrefsSnapshotState;
+    gPrefsSnapshotState = nullptr;
+}
@@ -13,6 +13,12 @@ GlobalPrefs* NewGlobalPrefs(const char* data);
 ByteSlice SerializeGlobalPrefs(GlobalPrefs* prefs, const char* prevData);
 void DeleteGlobalPrefs(GlobalPrefs* gp);
 
+GlobalPrefs* LoadGlobalPrefsSnapshot(const WCHAR* path, FILETIME textTime, i64 textSize);
+bool SaveGlobalPrefsSnapshot(const WCHAR* path, GlobalPrefs* prefs, FILETIME textTime, i64 textSize);
+void UpdateGlobalPrefsSnapshot(const WCHAR* path, GlobalPrefs* prefs, FILETIME prevTextTime, i64 prevTextSize,
+                               FILETIME textTime, i64 textSize);
+void FreeGlobalPrefsSnapshotState();
+
 SessionData* NewSessionData();
 TabState* NewTabState(FileState* fs);
 void ResetSessionState(Vec<SessionData*>* sessionData);
@@ -2,12 +2,14 @@
    License: Simplified BSD (see COPYING.BSD) */
 
 #include "utils/BaseUtil.h"
+#include "utils/ScopedWin.h"
 #include "utils/GdiPlusUtil.h"
 #include "utils/HtmlParserLookup.h"
 #include "utils/CssParser.h"
 #include "utils/HtmlPullParser.h"
 #include "mui/Mui.h"
 #include "utils/Timer.h"
+#include "utils/Trace.h"
 
 #include "EbookBase.h"
 #include "FzImgReader.h"
@@ -167,6 +169,9 @@ HtmlFormatter::HtmlFormatter(HtmlFormatterArgs* args)
 
     gfx = mui::AllocGraphicsForMeasureText();
     textMeasure = CreateTextRender(args->textRenderMethod, gfx, 10, 10);
+    if (args->cacheTextMeasure) {
+        textMeasure = mui::TextRenderMeasureCached::Create(textMeasure);
+    }
     defaultFontName.SetCopy(args->GetFontName());
     defaultFontSize = args->fontSize;
 
@@ -1382,6 +1387,7 @@ HtmlPage* HtmlFormatter::Next(bool skipEmptyPages) {
 
 // convenience method to format the whole html
 Vec<HtmlPage*>* HtmlFormatter::FormatAllPages(bool skipEmptyPages) {
+    TraceScope scope("HtmlFormatter.FormatAllPages");
     Vec<HtmlPage*>* pages = new Vec<HtmlPage*>();
     for (HtmlPage* pd = Next(skipEmptyPages); pd; pd = Next(skipEmptyPages)) {
         pages->Append(pd);
@@ -1389,12 +1395,187 @@ Vec<HtmlPage*>* HtmlFormatter::FormatAllPages(bool skipEmptyPages) {
     return pages;
 }
 
+static TraceCounter gTraceImageCacheHits("DecodedImageCache.hits");
+static TraceCounter gTraceImageCacheMisses("DecodedImageCache.misses");
+
+struct DecodedImageCache::Entry {
+    // identity of the image data
+    const u8* data = nullptr;
+    size_t len = 0;
+    // size of bmp. If native, it's the size of the image,
+    // otherwise the image has been scaled down to this size
+    int dx = 0;
+    int dy = 0;
+    bool native = false;
+    Bitmap* bmp = nullptr;
+    i64 bytes = 0;
+    u64 lastUse = 0;
+};
+
+DecodedImageCache::DecodedImageCache(i64 maxBytes) : maxBytes(maxBytes) {
+    InitializeCriticalSection(&cs);
+}
+
+DecodedImageCache::~DecodedImageCache() {
+    Clear();
+    DeleteCriticalSection(&cs);
+}
+
+void DecodedImageCache::FreeEntry(Entry* e) {
+    stats.bytes -= e->bytes;
+    delete e->bmp;
+    delete e;
+}
+
+void DecodedImageCache::Clear() {
+    ScopedCritSec scope(&cs);
+    for (Entry* e : entries) {
+        FreeEntry(e);
+    }
+    entries.Reset();
+}
+
+DecodedImageCache::Stats DecodedImageCache::GetStats() {
+    ScopedCritSec scope(&cs);
+    return stats;
+}
+
+// always keeps the most recently used image, even if it's larger than maxBytes
+void DecodedImageCache::EvictIfNeeded() {
+    while (stats.bytes > maxBytes && entries.size() > 1) {
+        int oldest = 0;
+        for (int i = 1; i < entries.isize(); i++) {
+            if (entries[i]->lastUse < entries[oldest]->lastUse) {
+                oldest = i;
+            }
+        }
+        FreeEntry(entries[oldest]);
+        entries.RemoveAt(oldest);
+        stats.evictions++;
+    }
+}
+
+// converts to 32bpp PARGB, which is what GDI+ draws fastest, optionally
+// scaling to dx/dy. This also forces a full decode for formats that
+// GDI+ decodes lazily
+static Bitmap* ToCachedBitmap(Bitmap* bmp, int dx, int dy) {
+    Bitmap* res = new Bitmap(dx, dy, PixelFormat32bppPARGB);
+    if (res->GetLastStatus() != Ok) {
+        delete res;
+        return nullptr;
+    }
+    Graphics g(res);
+    g.SetCompositingMode(Gdiplus::CompositingModeSourceCopy);
+    g.SetInterpolationMode(Gdiplus::InterpolationModeHighQualityBicubic);
+    g.SetPixelOffsetMode(Gdiplus::PixelOffsetModeHalf);
+    Gdiplus::Rect r(0, 0, dx, dy);
+    // prevents darkened edges when scaling
+    Gdiplus::ImageAttributes attrs;
+    attrs.SetWrapMode(Gdiplus::WrapModeTileFlipXY);
+    Status status = g.DrawImage(bmp, r, 0, 0, (int)bmp->GetWidth(), (int)bmp->GetHeight(), UnitPixel, &attrs);
+    if (status != Ok) {
+        delete res;
+        return nullptr;
+    }
+    return res;
+}
+
+DecodedImageCache::Entry* DecodedImageCache::Get(ByteSlice data, int dx, int dy) {
+    for (Entry* e : entries) {
+        if (e->data != data.data() || e->len != data.size()) {
+            continue;
+        }
+        // an image at native size is good for drawing at any larger size
+        bool matches = e->native ? (dx >= e->dx || dy >= e->dy) : (dx == e->dx && dy == e->dy);
+        if (matches) {
+            e->lastUse = ++useCounter;
+            stats.hits++;
+            gTraceImageCacheHits.Add();
+            return e;
+        }
+    }
+
+    stats.misses++;
+    gTraceImageCacheMisses.Add();
+    Bitmap* bmp = BitmapFromData(data);
+    if (!bmp) {
+        return nullptr;
+    }
+    int imgDx = (int)bmp->GetWidth();
+    int imgDy = (int)bmp->GetHeight();
+    // only scale down: scaling up is done when drawing
+    bool native = dx <= 0 || dy <= 0 || (dx >= imgDx || dy >= imgDy);
+    if (native) {
+        dx = imgDx;
+        dy = imgDy;
+    }
+    Bitmap* cached = ToCachedBitmap(bmp, dx, dy);
+    if (cached) {
+        delete bmp;
+        bmp = cached;
+    } else {
+        // draw the original image (which is at native size)
+        native = true;
+        dx = imgDx;
+        dy = imgDy;
+    }
+
+    // drop versions at other sizes: they're unlikely to be used
+    // again, as a page is usually drawn at a single zoom level
+    for (int i = entries.isize() - 1; i >= 0; i--) {
+        Entry* e = entries[i];
+        if (e->data == data.data() && e->len == data.size()) {
+            FreeEntry(e);
+            entries.RemoveAt(i);
+        }
+    }
+
+    Entry* e = new Entry();
+    e->data = data.data();
+    e->len = data.size();
+    e->dx = dx;
+    e->dy = dy;
+    e->native = native;
+    e->bmp = bmp;
+    e->bytes = (i64)dx * (i64)dy * 4;
+    e->lastUse = ++useCounter;
+    entries.Append(e);
+    stats.bytes += e->bytes;
+    EvictIfNeeded();
+    return e;
+}
+
+bool DecodedImageCache::DrawImage(Graphics* g, ByteSlice data, RectF bbox) {
+    // the size of bbox on the device, independent of rotation
+    Matrix m;
+    g->GetTransform(&m);
+    float el[6];
+    m.GetElements(el);
+    float scaleX = sqrtf(el[0] * el[0] + el[1] * el[1]);
+    float scaleY = sqrtf(el[2] * el[2] + el[3] * el[3]);
+    int dx = (int)ceilf(bbox.dx * scaleX);
+    int dy = (int)ceilf(bbox.dy * scaleY);
+
+    // GDI+ objects can't be used from multiple threads at once,
+    // so the image is drawn while holding the lock
+    ScopedCritSec scope(&cs);
+    Entry* e = Get(data, dx, dy);
+    if (!e) {
+        return false;
+    }
+    Status status = g->DrawImage(e->bmp, ToGdipRectF(bbox), 0, 0, (float)e->dx, (float)e->dy, UnitPixel);
+    // GDI+ sometimes seems to succeed in loading an image because it lazily decodes it
+    CrashIf(status != Ok && status != Win32Error);
+    return true;
+}
+
 // TODO: draw link in the appropriate format (blue text, underlined, should show hand cursor when
 // mouse is over a link. There's a slight complication here: we only get explicit information about
 // strings, not about the whitespace and we should underline the whitespace as well. Also the text
 // should be underlined at a baseline
 void DrawHtmlPage(Graphics* g, mui::ITextRender* textDraw, Vec<DrawInstr>* drawInstructions, float offX, float offY,
-                  bool showBbox, Color textColor, bool* abortCookie) {
+                  bool showBbox, Color textColor, bool* abortCookie, DecodedImageCache* imageCache) {
+    TraceScope scope("DrawHtmlPage", drawInstructions->isize());
     Pen debugPen(Color(255, 0, 0), 1);
     // Pen linePen(Color(0, 0, 0), 2.f);
     Pen linePen(Color(0x5F, 0x4B, 0x32), 2.f);
@@ -1446,15 +1627,18 @@ void DrawHtmlPage(Graphics* g, mui::ITextRender* textDraw, Vec<DrawInstr>* drawI
             status = g->DrawLine(&linePen, p1, p2);
             CrashIf(status != Ok);
         } else if (DrawInstrType::Image == i.type) {
-            // TODO: cache the bitmap somewhere (?)
-            Bitmap* bmp = BitmapFromData(i.GetImage());
-            if (bmp) {
-                status = g->DrawImage(bmp, ToGdipRectF(bbox), 0, 0, (float)bmp->GetWidth(), (float)bmp->GetHeight(),
-                                      UnitPixel);
-                // GDI+ sometimes seems to succeed in loading an image because it lazily decodes it
-                CrashIf(status != Ok && status != Win32Error);
+            if (imageCache) {
+                imageCache->DrawImage(g, i.GetImage(), bbox);
+            } else {
+                Bitmap* bmp = BitmapFromData(i.GetImage());
+                if (bmp) {
+                    status = g->DrawImage(bmp, ToGdipRectF(bbox), 0, 0, (float)bmp->GetWidth(),
+                                          (float)bmp->GetHeight(), UnitPixel);
+                    // GDI+ sometimes seems to succeed in loading an image because it lazily decodes it
+                    CrashIf(status != Ok && status != Win32Error);
+                }
+                delete bmp;
             }
-            delete bmp;
         } else if (DrawInstrType::LinkStart == i.type) {
             // TODO: set text color to blue
             float y = floorf(bbox.y + bbox.dy + 0.5f);
@@ -141,6 +141,8 @@ struct HtmlFormatterArgs {
     Allocator* textAllocator{nullptr};
 
     mui::TextRenderMethod textRenderMethod = mui::TextRenderMethod::Gdiplus;
+    // cache measured words per font (shared with other layouts using the same font)
+    bool cacheTextMeasure{true};
 
     ByteSlice htmlStr;
 
@@ -287,8 +289,52 @@ class HtmlFormatter {
     Vec<HtmlPage*>* FormatAllPages(bool skipEmptyPages = true);
 };
 
+// Caches images decoded by DrawHtmlPage so that repainting a page
+// (e.g. another tile or a scroll) doesn't decode the JPEG/PNG again.
+// Images are keyed by their data (which must outlive the cache, i.e. be
+// owned by the document) and the size they're drawn at on the device:
+// images drawn smaller than their native size are cached pre-scaled.
+// Least recently used images are evicted when over maxBytes.
+// Safe to use from multiple threads.
+class DecodedImageCache {
+  public:
+    static constexpr i64 kDefaultMaxBytes = 64 * 1024 * 1024;
+
+    struct Stats {
+        i64 hits = 0;
+        i64 misses = 0;
+        i64 evictions = 0;
+        i64 bytes = 0;
+    };
+
+    explicit DecodedImageCache(i64 maxBytes = kDefaultMaxBytes);
+    DecodedImageCache(DecodedImageCache const&) = delete;
+    DecodedImageCache& operator=(DecodedImageCache const&) = delete;
+    ~DecodedImageCache();
+
+    // draws image data into bbox (in g's coordinates). returns false
+    // if the image can't be decoded
+    bool DrawImage(Graphics* g, ByteSlice data, RectF bbox);
+    void Clear();
+    Stats GetStats();
+
+  private:
+    struct Entry;
+
+    Entry* Get(ByteSlice data, int dx, int dy);
+    void FreeEntry(Entry* e);
+    void EvictIfNeeded();
+
+    CRITICAL_SECTION cs;
+    Vec<Entry*> entries;
+    u64 useCounter = 0;
+    i64 maxBytes = 0;
+    Stats stats;
+};
+
 void DrawHtmlPage(Graphics* g, mui::ITextRender* textDraw, Vec<DrawInstr>* drawInstructions, float offX, float offY,
-                  bool showBbox, Color textColor, bool* abortCookie = nullptr);
+                  bool showBbox, Color textColor, bool* abortCookie = nullptr,
+                  DecodedImageCache* imageCache = nullptr);
 
 mui::TextRenderMethod GetTextRenderMethod();
 void SetTextRenderMethod(mui::TextRenderMethod method);
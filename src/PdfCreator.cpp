@@ -10,6 +10,8 @@ extern "C" {
 #include "utils/ScopedWin.h"
 #include "utils/GdiPlusUtil.h"
 #include "utils/WinUtil.h"
+#include "utils/FileUtil.h"
+#include "utils/ThreadUtil.h"
 
 #include "wingui/TreeModel.h"
 #include "DisplayMode.h"
@@ -268,24 +270,25 @@ bool PdfCreator::AddPageFromImageData(ByteSlice data, float imgDpi) const {
     return ok;
 }
 
+// adapted from EngineMupdf::GetProperty
+static struct {
+    DocumentProperty prop;
+    const char* name;
+} pdfPropNames[] = {
+    {DocumentProperty::Title, "Title"},
+    {DocumentProperty::Author, "Author"},
+    {DocumentProperty::Subject, "Subject"},
+    {DocumentProperty::Copyright, "Copyright"},
+    {DocumentProperty::ModificationDate, "ModDate"},
+    {DocumentProperty::CreatorApp, "Creator"},
+    {DocumentProperty::PdfProducer, "Producer"},
+};
+
 bool PdfCreator::SetProperty(DocumentProperty prop, const WCHAR* value) const {
     if (!ctx || !doc) {
         return false;
     }
 
-    // adapted from EngineMupdf::GetProperty
-    static struct {
-        DocumentProperty prop;
-        const char* name;
-    } pdfPropNames[] = {
-        {DocumentProperty::Title, "Title"},
-        {DocumentProperty::Author, "Author"},
-        {DocumentProperty::Subject, "Subject"},
-        {DocumentProperty::Copyright, "Copyright"},
-        {DocumentProperty::ModificationDate, "ModDate"},
-        {DocumentProperty::CreatorApp, "Creator"},
-        {DocumentProperty::PdfProducer, "Producer"},
-    };
     const char* name = nullptr;
     for (int i = 0; i < dimof(pdfPropNames) && !name; i++) {
         if (pdfPropNames[i].prop == prop) {
@@ -327,6 +330,15 @@ static DocumentProperty propsToCopy[] = {
 };
 // clang-format on
 
+static bool IsPropToCopy(DocumentProperty prop) {
+    for (auto p : propsToCopy) {
+        if (p == prop) {
+            return true;
+        }
+    }
+    return false;
+}
+
 bool PdfCreator::CopyProperties(EngineBase* engine) const {
     bool ok;
     for (int i = 0; i < dimof(propsToCopy); i++) {
@@ -382,26 +394,417 @@ bool PdfCreator::SaveToFile(const char* filePath) const {
     return true;
 }
 
-bool PdfCreator::RenderToFile(const char* pdfFileName, EngineBase* engine, int dpi) {
-    PdfCreator* c = new PdfCreator();
+// RenderToFile() renders pages on a pool of worker threads and writes
+// them to the file in order as soon as they're ready, so that memory
+// use depends on the number of pages in flight, not the number of pages.
+// The PDF is written directly (not through pdf_document) because the
+// whole document would otherwise be kept in memory until saving.
+
+// how many pages per worker can be rendered ahead of the page being written
+constexpr int kPdfPagesInFlightPerWorker = 2;
+
+struct PdfPageImage {
+    bool done;
+    bool ok;
+    bool isJpeg;
+    // in pixels
+    Size size;
+    // compressed RGB pixels, allocated with malloc
+    u8* data;
+    size_t len;
+};
+
+// state shared by the workers and the thread writing the pages
+struct PdfRenderState {
+    CRITICAL_SECTION cs;
+    CONDITION_VARIABLE changed;
+    int dpi = 0;
+    int jpegQuality = 0;
+    int nPages = 0;
+    int maxInFlight = 0;
+    // next page to be rendered
+    int nextPage = 1;
+    // next page to be written
+    int nextToWrite = 1;
+    bool aborted = false;
+    Vec<PdfPageImage> pages;
+
+    PdfRenderState() {
+        InitializeCriticalSection(&cs);
+        InitializeConditionVariable(&changed);
+    }
+    ~PdfRenderState() {
+        for (auto& page : pages) {
+            free(page.data);
+        }
+        DeleteCriticalSection(&cs);
+    }
+};
+
+// 24-bit RGB pixels, top-down, without row padding
+static u8* GetBitmapRgb(HBITMAP hbmp, Size size) {
+    int w = size.dx;
+    int h = size.dy;
+    int stride = ((w * 3 + 3) / 4) * 4;
+    u8* data = AllocArray<u8>((size_t)stride * h);
+    if (!data) {
+        return nullptr;
+    }
+
+    BITMAPINFO bmi = {0};
+    bmi.bmiHeader.biSize = sizeof(bmi.bmiHeader);
+    bmi.bmiHeader.biWidth = w;
+    bmi.bmiHeader.biHeight = -h;
+    bmi.bmiHeader.biPlanes = 1;
+    bmi.bmiHeader.biBitCount = 24;
+    bmi.bmiHeader.biCompression = BI_RGB;
+
+    HDC hDC = GetDC(nullptr);
+    int res = GetDIBits(hDC, hbmp, 0, h, data, &bmi, DIB_RGB_COLORS);
+    ReleaseDC(nullptr, hDC);
+    if (res == 0) {
+        free(data);
+        return nullptr;
+    }
+
+    // convert BGR to RGB and remove the padding
+    for (int y = 0; y < h; y++) {
+        u8* s = data + (size_t)y * stride;
+        u8* d = data + (size_t)y * w * 3;
+        for (int x = 0; x < w; x++) {
+            u8 b = s[0];
+            d[1] = s[1];
+            d[0] = s[2];
+            d[2] = b;
+            s += 3;
+            d += 3;
+        }
+    }
+    return data;
+}
+
+static bool CompressPageFlate(fz_context* ctx, HBITMAP hbmp, Size size, PdfPageImage& page) {
+    u8* rgb = GetBitmapRgb(hbmp, size);
+    if (!rgb) {
+        return false;
+    }
+    size_t rgbLen = (size_t)size.dx * size.dy * 3;
     bool ok = true;
-    // render all pages to images
-    float zoom = dpi / engine->GetFileDPI();
-    for (int i = 1; ok && i <= engine->PageCount(); i++) {
-        RenderPageArgs args(i, zoom, 0, nullptr, RenderTarget::Export);
-        RenderedBitmap* bmp = engine->RenderPage(args);
+    fz_var(ok);
+    fz_try(ctx) {
+        size_t len = fz_deflate_bound(ctx, rgbLen);
+        page.data = AllocArray<u8>(len);
+        if (!page.data) {
+            fz_throw(ctx, FZ_ERROR_GENERIC, "failed to allocate %d bytes", (int)len);
+        }
+        fz_deflate(ctx, page.data, &len, rgb, rgbLen, FZ_DEFLATE_DEFAULT);
+        page.len = len;
+    }
+    fz_catch(ctx) {
         ok = false;
-        if (bmp) {
-            ok = AddPageFromHBITMAP(c, bmp->GetBitmap(), bmp->Size(), dpi);
+    }
+    free(rgb);
+    return ok;
+}
+
+static bool CompressPageJpeg(HBITMAP hbmp, int quality, PdfPageImage& page) {
+    Gdiplus::Bitmap bmp(hbmp, nullptr);
+    ScopedComPtr<IStream> stream;
+    if (FAILED(CreateStreamOnHGlobal(nullptr, TRUE, &stream))) {
+        return false;
+    }
+    CLSID jpgEncId = GetEncoderClsid(L"image/jpeg");
+    Gdiplus::EncoderParameters params;
+    ULONG q = (ULONG)quality;
+    params.Count = 1;
+    params.Parameter[0].Guid = Gdiplus::EncoderQuality;
+    params.Parameter[0].Type = Gdiplus::EncoderParameterValueTypeLong;
+    params.Parameter[0].NumberOfValues = 1;
+    params.Parameter[0].Value = &q;
+    if (bmp.Save(stream, &jpgEncId, &params) != Ok) {
+        return false;
+    }
+    ByteSlice d = GetDataFromStream(stream, nullptr);
+    page.data = d.data();
+    page.len = d.size();
+    page.isJpeg = true;
+    return page.data != nullptr;
+}
+
+class PdfRenderWorker : public ThreadBase {
+  public:
+    PdfRenderState* state = nullptr;
+    EngineBase* engine = nullptr;
+    bool ownsEngine = false;
+    fz_context* ctx = nullptr;
+
+    PdfRenderWorker(PdfRenderState* state, EngineBase* engine, bool ownsEngine)
+        : ThreadBase("PdfRenderWorker"), state(state), engine(engine), ownsEngine(ownsEngine) {
+        // fz_deflate() only needs a context for allocations and errors
+        ctx = fz_new_context(nullptr, nullptr, FZ_STORE_DEFAULT);
+    }
+    ~PdfRenderWorker() override {
+        fz_drop_context(ctx);
+        if (ownsEngine) {
+            delete engine;
+        }
+    }
+
+    void RenderPage(int pageNo, PdfPageImage& page) {
+        float zoom = state->dpi / engine->GetFileDPI();
+        RenderPageArgs args(pageNo, zoom, 0, nullptr, RenderTarget::Export);
+        RenderedBitmap* bmp = engine->RenderPage(args);
+        if (!bmp || !ctx) {
+            delete bmp;
+            return;
+        }
+        page.size = bmp->Size();
+        if (state->jpegQuality > 0) {
+            page.ok = CompressPageJpeg(bmp->GetBitmap(), state->jpegQuality, page);
+        } else {
+            page.ok = CompressPageFlate(ctx, bmp->GetBitmap(), page.size, page);
         }
         delete bmp;
     }
-    if (!ok) {
-        delete c;
+
+    void Run() override {
+        for (;;) {
+            int pageNo;
+            {
+                ScopedCritSec scope(&state->cs);
+                while (!state->aborted && state->nextPage <= state->nPages &&
+                       state->nextPage - state->nextToWrite >= state->maxInFlight) {
+                    SleepConditionVariableCS(&state->changed, &state->cs, INFINITE);
+                }
+                if (state->aborted || state->nextPage > state->nPages) {
+                    break;
+                }
+                pageNo = state->nextPage++;
+            }
+
+            PdfPageImage page{};
+            RenderPage(pageNo, page);
+
+            ScopedCritSec scope(&state->cs);
+            page.done = true;
+            state->pages[pageNo - 1] = page;
+            WakeAllConditionVariable(&state->changed);
+        }
+        DestroyTempAllocator();
+    }
+};
+
+// writes a PDF with one image per page, object by object
+class PdfImageFileWriter {
+  public:
+    HANDLE h = INVALID_HANDLE_VALUE;
+    i64 pos = 0;
+    bool ok = true;
+    // offset of each object in the file, indexed by object number
+    Vec<i64> offsets;
+
+    // objects 1 to 3 are written at the end, then each page has an image,
+    // a content stream and a page object
+    static constexpr int kCatalogObj = 1;
+    static constexpr int kPagesObj = 2;
+    static constexpr int kInfoObj = 3;
+    static int PageObj(int pageNo, int n) {
+        return 4 + (pageNo - 1) * 3 + n;
+    }
+
+    ~PdfImageFileWriter() {
+        if (h != INVALID_HANDLE_VALUE) {
+            CloseHandle(h);
+        }
+    }
+
+    bool Open(const char* path, int nPages) {
+        h = CreateFileW(ToWstrTemp(path), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (h == INVALID_HANDLE_VALUE) {
+            return false;
+        }
+        offsets.AppendBlanks(PageObj(nPages + 1, 0));
+        Write("%PDF-1.4\n%\xE2\xE3\xCF\xD3\n");
+        return ok;
+    }
+
+    void Write(const void* d, size_t n) {
+        DWORD written = 0;
+        ok = ok && ::WriteFile(h, d, (DWORD)n, &written, nullptr) && written == (DWORD)n;
+        pos += n;
+    }
+    void Write(const char* s) {
+        Write(s, str::Len(s));
+    }
+    void Write(const str::Str& s) {
+        Write(s.Get(), s.size());
+    }
+
+    void StartObj(str::Str& s, int objNo) {
+        offsets[objNo] = pos + s.size();
+        s.AppendFmt("%d 0 obj\n", objNo);
+    }
+
+    void WritePage(int pageNo, const PdfPageImage& page, int dpi) {
+        float dx = page.size.dx * 72.0f / dpi;
+        float dy = page.size.dy * 72.0f / dpi;
+        int imageObj = PageObj(pageNo, 0);
+        int contentObj = PageObj(pageNo, 1);
+        int pageObj = PageObj(pageNo, 2);
+
+        str::Str s;
+        StartObj(s, imageObj);
+        s.AppendFmt("<< /Type /XObject /Subtype /Image /Width %d /Height %d /ColorSpace /DeviceRGB ", page.size.dx,
+                    page.size.dy);
+        s.AppendFmt("/BitsPerComponent 8 /Filter /%s /Length %d >>\nstream\n",
+                    page.isJpeg ? "DCTDecode" : "FlateDecode", (int)page.len);
+        Write(s);
+        Write(page.data, page.len);
+        s.Reset();
+        s.Append("\nendstream\nendobj\n");
+
+        str::Str content;
+        content.AppendFmt("q %.4f 0 0 %.4f 0 0 cm /Im0 Do Q", dx, dy);
+        StartObj(s, contentObj);
+        s.AppendFmt("<< /Length %d >>\nstream\n%s\nendstream\nendobj\n", (int)content.size(), content.Get());
+
+        StartObj(s, pageObj);
+        s.AppendFmt("<< /Type /Page /Parent %d 0 R /MediaBox [0 0 %.4f %.4f] ", kPagesObj, dx, dy);
+        s.AppendFmt("/Resources << /XObject << /Im0 %d 0 R >> >> /Contents %d 0 R >>\nendobj\n", imageObj,
+                    contentObj);
+        Write(s);
+    }
+
+    // PDF text string as UTF-16BE
+    static void AppendTextString(str::Str& s, const WCHAR* v) {
+        s.Append("<FEFF");
+        for (const WCHAR* c = v; *c; c++) {
+            s.AppendFmt("%04X", (unsigned int)*c);
+        }
+        s.AppendChar('>');
+    }
+
+    void Finish(EngineBase* engine, int nPages) {
+        str::Str s;
+        StartObj(s, kPagesObj);
+        s.Append("<< /Type /Pages /Kids [");
+        for (int pageNo = 1; pageNo <= nPages; pageNo++) {
+            s.AppendFmt("%s%d 0 R", pageNo > 1 ? " " : "", PageObj(pageNo, 2));
+        }
+        s.AppendFmt("] /Count %d >>\nendobj\n", nPages);
+
+        StartObj(s, kCatalogObj);
+        s.AppendFmt("<< /Type /Catalog /Pages %d 0 R >>\nendobj\n", kPagesObj);
+
+        StartObj(s, kInfoObj);
+        s.Append("<<");
+        for (auto& prop : pdfPropNames) {
+            AutoFreeWstr value;
+            if (prop.prop == DocumentProperty::PdfProducer) {
+                value.SetCopy(gPdfProducer);
+            } else if (IsPropToCopy(prop.prop)) {
+                value.Set(engine->GetProperty(prop.prop));
+            }
+            if (value) {
+                s.AppendFmt(" /%s ", prop.name);
+                AppendTextString(s, value);
+            }
+        }
+        s.Append(" >>\nendobj\n");
+        Write(s);
+
+        i64 xrefPos = pos;
+        s.Reset();
+        s.AppendFmt("xref\n0 %d\n0000000000 65535 f \n", offsets.isize());
+        for (int i = 1; i < offsets.isize(); i++) {
+            s.AppendFmt("%010lld 00000 n \n", offsets[i]);
+        }
+        s.AppendFmt("trailer\n<< /Size %d /Root %d 0 R /Info %d 0 R >>\n", offsets.isize(), kCatalogObj, kInfoObj);
+        s.AppendFmt("startxref\n%lld\n%%%%EOF\n", xrefPos);
+        Write(s);
+    }
+};
+
+static int GetDefaultWorkerCount() {
+    SYSTEM_INFO si{};
+    GetSystemInfo(&si);
+    return std::max((int)si.dwNumberOfProcessors, 1);
+}
+
+bool PdfCreator::RenderToFile(const char* pdfFileName, EngineBase* engine, int dpi, int nWorkers, int jpegQuality) {
+    int nPages = engine->PageCount();
+    if (nPages <= 0 || dpi <= 0) {
         return false;
     }
-    c->CopyProperties(engine);
-    ok = c->SaveToFile(pdfFileName);
-    delete c;
+    if (nWorkers <= 0) {
+        nWorkers = GetDefaultWorkerCount();
+    }
+    nWorkers = std::min(nWorkers, nPages);
+
+    PdfImageFileWriter w;
+    if (!w.Open(pdfFileName, nPages)) {
+        return false;
+    }
+
+    PdfRenderState state;
+    state.dpi = dpi;
+    state.jpegQuality = jpegQuality;
+    state.nPages = nPages;
+    state.pages.AppendBlanks(nPages);
+
+    // most engines serialize rendering so each additional
+    // worker renders from its own copy of the document
+    Vec<PdfRenderWorker*> workers;
+    workers.Append(new PdfRenderWorker(&state, engine, false));
+    for (int i = 1; i < nWorkers; i++) {
+        EngineBase* clone = engine->Clone();
+        if (!clone) {
+            break;
+        }
+        workers.Append(new PdfRenderWorker(&state, clone, true));
+    }
+    state.maxInFlight = workers.isize() * kPdfPagesInFlightPerWorker;
+    for (auto worker : workers) {
+        worker->Start();
+    }
+
+    bool ok = true;
+    for (int pageNo = 1; ok && pageNo <= nPages; pageNo++) {
+        PdfPageImage page;
+        {
+            ScopedCritSec scope(&state.cs);
+            while (!state.pages[pageNo - 1].done) {
+                SleepConditionVariableCS(&state.changed, &state.cs, INFINITE);
+            }
+            page = state.pages[pageNo - 1];
+            state.pages[pageNo - 1].data = nullptr;
+        }
+        ok = page.ok;
+        if (ok) {
+            w.WritePage(pageNo, page, dpi);
+            ok = w.ok;
+        }
+        free(page.data);
+
+        ScopedCritSec scope(&state.cs);
+        state.nextToWrite = pageNo + 1;
+        state.aborted = !ok;
+        WakeAllConditionVariable(&state.changed);
+    }
+
+    for (auto worker : workers) {
+        worker->Join();
+        delete worker;
+    }
+
+    if (ok) {
+        w.Finish(engine, nPages);
+        ok = w.ok;
+    }
+    CloseHandle(w.h);
+    w.h = INVALID_HANDLE_VALUE;
+    if (!ok) {
+        file::Delete(pdfFileName);
+    }
     return ok;
 }
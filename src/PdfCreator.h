@@ -25,6 +25,9 @@ class PdfCreator {
     // this name is included in all saved PDF files
     static void SetProducerName(const WCHAR* name);
 
-    // creates a simple PDF with all pages rendered as a single image
-    static bool RenderToFile(const char* pdfFileName, EngineBase* engine, int dpi = 150);
+    // creates a simple PDF with all pages rendered as a single image.
+    // Pages are rendered by nWorkers threads (0 means one per cpu core) and
+    // compressed losslessly or as JPEG if jpegQuality (1-100) is given
+    static bool RenderToFile(const char* pdfFileName, EngineBase* engine, int dpi = 150, int nWorkers = 0,
+                             int jpegQuality = 0);
 };
@@ -6,6 +6,8 @@
 #include "utils/ScopedWin.h"
 #include "utils/WinUtil.h"
 #include "utils/FileUtil.h"
+#include "utils/ThreadUtil.h"
+#include "utils/Timer.h"
 
 #include "wingui/TreeModel.h"
 #include "DisplayMode.h"
@@ -27,41 +29,67 @@
 #define SYNCTEX_EXTENSION L".synctex"
 #define SYNCTEXGZ_EXTENSION L".synctex.gz"
 
-struct PdfsyncFileIndex {
-    size_t start, end; // first and one-after-last index of lines associated with a file
-};
-
 struct PdfsyncLine {
-    UINT record; // index for mapping line(s) to point(s)
-    size_t file; // index into srcfiles
-    UINT line, column;
+    u32 record; // index for mapping line(s) to point(s)
+    u32 file;   // index into srcfiles
+    u32 line, column;
 };
 
 struct PdfsyncPoint {
-    UINT record; // index for mapping point(s) to line(s)
-    UINT page, x, y;
+    u32 record; // index for mapping point(s) to line(s)
+    u32 page, x, y;
+};
+
+// Parsed content of a .pdfsync file.
+// lines and points are stored in declaration order and are never re-ordered
+// so that the sorted index arrays can refer to them by position. This allows
+// appending the entries of a grown sync file without re-parsing all of it.
+struct PdfsyncIndex {
+    AutoFreeWstr syncfilepath;
+    int nPages = 0;
+    u32 sheetCount = 0;
+
+    WStrVec srcfiles;         // source file names (each file only once)
+    Vec<PdfsyncLine> lines;   // record-to-line mapping
+    Vec<PdfsyncPoint> points; // record-to-point mapping
+
+    Vec<u32> linesByFileLine; // indexes into lines, sorted by (file, line)
+    Vec<u32> linesByRecord;   // indexes into lines, sorted by record
+    Vec<u32> pointsByPageY;   // indexes into points, sorted by (page, y)
+    Vec<u32> pointsByRecord;  // indexes into points, sorted by record
+
+    // parser state at the end of the last complete line, for resuming
+    Vec<u32> filestack;
+    u32 page = 1;
+    size_t parsedSize = 0;
+    u32 parsedHash = 0;
+
+    bool CanResume(ByteSlice data, int pageCount) const;
+    int Parse(char* data, size_t size, const WCHAR* dir, bool resume);
+    u32 AddSrcFile(WCHAR* filename);
+    void UpdateSortedIndexes(u32 firstNewLine, u32 firstNewPoint);
 };
 
 // Synchronizer based on .pdfsync file generated with the pdfsync tex package
+// The index is built on a background thread as soon as the synchronizer
+// is created. Queries only wait for it if it isn't ready yet.
 class Pdfsync : public Synchronizer {
   public:
-    Pdfsync(const WCHAR* syncfilename, EngineBase* engine) : Synchronizer(syncfilename), engine(engine) {
-        CrashIf(!str::EndsWithI(syncfilename, PDFSYNC_EXTENSION));
-    }
+    Pdfsync(const WCHAR* syncfilename, EngineBase* engine);
+    ~Pdfsync() override;
 
     int DocToSource(UINT pageNo, Point pt, AutoFreeWstr& filename, UINT* line, UINT* col) override;
     int SourceToDoc(const WCHAR* srcfilename, UINT line, UINT col, UINT* page, Vec<Rect>& rects) override;
 
   private:
     int RebuildIndex();
-    UINT SourceToRecord(const WCHAR* srcfilename, UINT line, UINT col, Vec<size_t>& records);
-
-    EngineBase* engine;              // needed for converting between coordinate systems
-    WStrVec srcfiles;                // source file names
-    Vec<PdfsyncLine> lines;          // record-to-line mapping
-    Vec<PdfsyncPoint> points;        // record-to-point mapping
-    Vec<PdfsyncFileIndex> fileIndex; // start and end of entries for a file in <lines>
-    Vec<size_t> sheetIndex;          // start of entries for a sheet in <points>
+    int EnsureIndex();
+    UINT SourceToRecord(const WCHAR* srcfilename, UINT line, UINT col, Vec<u32>& records);
+
+    EngineBase* engine;           // needed for converting between coordinate systems
+    PdfsyncIndex* index{nullptr}; // nullptr if the sync file couldn't be parsed
+    // signaled when no background rebuild of the index is in progress
+    HANDLE hIndexReady{nullptr};
 };
 
 // Synchronizer based on .synctex file generated with SyncTex
@@ -184,6 +212,17 @@ WCHAR* Synchronizer::PrepareCommandline(const WCHAR* pattern, const WCHAR* filen
 
 // PDFSYNC synchronizer
 
+// convert a coordinate from the sync file into a PDF coordinate
+#define SYNC_TO_PDF_COORDINATE(c) (c / 65781.76)
+// convert a PDF coordinate into a coordinate from the sync file
+#define PDF_TO_SYNC_COORDINATE(c) (c * 65781.76)
+
+// the index of the most recently closed Pdfsync, kept around so that
+// re-creating the synchronizer after a reload only has to parse the part
+// of the sync file that was appended since
+static Mutex gPdfsyncCacheMutex;
+static PdfsyncIndex* gPdfsyncCache = nullptr;
+
 // move to the next line in a list of zero-terminated lines
 static char* Advance0Line(char* line, char* end) {
     line += str::Len(line);
@@ -194,54 +233,117 @@ static char* Advance0Line(char* line, char* end) {
     return line < end ? line : nullptr;
 }
 
-// see http://itexmac.sourceforge.net/pdfsync.html for the specification
-int Pdfsync::RebuildIndex() {
-    AutoFree data(file::ReadFile(syncfilepath));
-    if (!data.data) {
-        return PDFSYNCERR_SYNCFILE_CANNOT_BE_OPENED;
+// returns the size of data up to and including the last line break
+// (a line without line break might still be in the process of being written)
+static size_t CompleteLinesSize(const char* data, size_t size) {
+    while (size > 0 && data[size - 1] != '\n' && data[size - 1] != '\r') {
+        size--;
     }
-    // convert the file data into a list of zero-terminated strings
-    str::TransCharsInPlace(data.data, "\r\n", "\0\0");
+    return size;
+}
 
-    // parse preamble (jobname and version marker)
-    char* line = data.data;
-    char* dataEnd = data.data + data.size();
+bool PdfsyncIndex::CanResume(ByteSlice data, int pageCount) const {
+    if (pageCount != nPages || parsedSize == 0 || parsedSize > data.size()) {
+        return false;
+    }
+    return MurmurHash2(data.data(), parsedSize) == parsedHash;
+}
 
-    // replace star by spaces (TeX uses stars instead of spaces in filenames)
-    str::TransCharsInPlace(line, "*/", " \\");
-    AutoFreeWstr jobName(strconv::AnsiToWstr(line));
-    jobName.Set(str::Join(jobName, L".tex"));
-    jobName.Set(PrependDir(jobName));
+u32 PdfsyncIndex::AddSrcFile(WCHAR* filename) {
+    int idx = srcfiles.FindI(filename);
+    if (idx >= 0) {
+        str::Free(filename);
+        return (u32)idx;
+    }
+    srcfiles.Append(filename);
+    return (u32)srcfiles.size() - 1;
+}
+
+// sorts the indexes of newly parsed lines and points and merges them into the
+// already sorted indexes of previously parsed ones. Both std::stable_sort and
+// std::inplace_merge preserve the declaration order of entries with equal keys
+void PdfsyncIndex::UpdateSortedIndexes(u32 firstNewLine, u32 firstNewPoint) {
+    PdfsyncLine* ls = lines.LendData();
+    PdfsyncPoint* ps = points.LendData();
+    auto byFileLine = [ls](u32 a, u32 b) {
+        if (ls[a].file != ls[b].file) {
+            return ls[a].file < ls[b].file;
+        }
+        return ls[a].line < ls[b].line;
+    };
+    auto byLineRecord = [ls](u32 a, u32 b) { return ls[a].record < ls[b].record; };
+    auto byPageY = [ps](u32 a, u32 b) {
+        if (ps[a].page != ps[b].page) {
+            return ps[a].page < ps[b].page;
+        }
+        return ps[a].y < ps[b].y;
+    };
+    auto byPointRecord = [ps](u32 a, u32 b) { return ps[a].record < ps[b].record; };
+
+    auto merge = [](Vec<u32>& idx, u32 first, u32 end, auto less) {
+        size_t nOld = idx.size();
+        for (u32 i = first; i < end; i++) {
+            idx.Append(i);
+        }
+        u32* d = idx.LendData();
+        std::stable_sort(d + nOld, d + idx.size(), less);
+        std::inplace_merge(d, d + nOld, d + idx.size(), less);
+    };
+    merge(linesByFileLine, firstNewLine, (u32)lines.size(), byFileLine);
+    merge(linesByRecord, firstNewLine, (u32)lines.size(), byLineRecord);
+    merge(pointsByPageY, firstNewPoint, (u32)points.size(), byPageY);
+    merge(pointsByRecord, firstNewPoint, (u32)points.size(), byPointRecord);
+}
 
-    line = Advance0Line(line, dataEnd);
-    UINT versionNumber = 0;
-    if (!line || !str::Parse(line, "version %u", &versionNumber) || versionNumber != 1) {
+// see http://itexmac.sourceforge.net/pdfsync.html for the specification
+// if resume is true, parsing continues at parsedSize with the saved parser state
+int PdfsyncIndex::Parse(char* data, size_t size, const WCHAR* dir, bool resume) {
+    size_t start = resume ? parsedSize : 0;
+    size_t end = CompleteLinesSize(data, size);
+    if (end < start) {
         return PDFSYNCERR_SYNCFILE_CANNOT_BE_OPENED;
     }
+    // must be calculated before the data is modified below
+    parsedHash = MurmurHash2(data, end);
+    parsedSize = end;
 
-    // reset synchronizer database
-    srcfiles.Reset();
-    lines.Reset();
-    points.Reset();
-    fileIndex.Reset();
-    sheetIndex.Reset();
+    // convert the file data into a list of zero-terminated strings
+    data[end] = 0;
+    str::TransCharsInPlace(data + start, "\r\n", "\0\0");
+
+    char* line = data + start;
+    char* dataEnd = data + end;
+    u32 firstNewLine = (u32)lines.size();
+    u32 firstNewPoint = (u32)points.size();
+
+    if (!resume) {
+        // parse preamble (jobname and version marker)
+        // replace star by spaces (TeX uses stars instead of spaces in filenames)
+        str::TransCharsInPlace(line, "*/", " \\");
+        AutoFreeWstr jobName(strconv::AnsiToWstr(line));
+        jobName.Set(str::Join(jobName, L".tex"));
+        jobName.Set(path::Join(dir, jobName));
 
-    Vec<size_t> filestack;
-    UINT page = 1;
-    sheetIndex.Append(0);
+        line = Advance0Line(line, dataEnd);
+        UINT versionNumber = 0;
+        if (!line || !str::Parse(line, "version %u", &versionNumber) || versionNumber != 1) {
+            return PDFSYNCERR_SYNCFILE_CANNOT_BE_OPENED;
+        }
 
-    // add the initial tex file to the source file stack
-    filestack.Append(srcfiles.size());
-    srcfiles.Append(jobName.StealData());
-    PdfsyncFileIndex findex = {0};
-    fileIndex.Append(findex);
+        // add the initial tex file to the source file stack
+        filestack.Append(AddSrcFile(jobName.StealData()));
+    } else {
+        // Advance0Line() skips the current line, so start at the
+        // terminator of the last line parsed before
+        line--;
+        *line = 0;
+    }
 
     PdfsyncLine psline;
     PdfsyncPoint pspoint;
 
     // parse data
-    UINT maxPageNo = engine->PageCount();
-    while (true) {
+    while (line) {
         line = Advance0Line(line, dataEnd);
         if (!line) {
             break;
@@ -260,7 +362,7 @@ int Pdfsync::RebuildIndex() {
 
             case 's':
                 if (str::Parse(line, "s %u", &page)) {
-                    sheetIndex.Append(points.size());
+                    sheetCount++;
                 }
                 // else dbg("Bad 's' line in the pdfsync file");
                 // if (0 == page || page > maxPageNo)
@@ -269,7 +371,7 @@ int Pdfsync::RebuildIndex() {
 
             case 'p':
                 pspoint.page = page;
-                if (0 == page || page > maxPageNo) {
+                if (0 == page || page > (u32)nPages) {
                     /* ignore point for invalid page number */;
                 } else if (str::Parse(line, "p %u %u %u", &pspoint.record, &pspoint.x, &pspoint.y)) {
                     points.Append(pspoint);
@@ -294,18 +396,15 @@ int Pdfsync::RebuildIndex() {
                 }
                 // ensure that the path is absolute
                 if (PathIsRelative(filename)) {
-                    filename.Set(PrependDir(filename));
+                    filename.Set(path::Join(dir, filename));
                 }
 
-                filestack.Append(srcfiles.size());
-                srcfiles.Append(filename.StealData());
-                findex.start = findex.end = lines.size();
-                fileIndex.Append(findex);
+                filestack.Append(AddSrcFile(filename.StealData()));
             } break;
 
             case ')':
                 if (filestack.size() > 1) {
-                    fileIndex.at(filestack.Pop()).end = lines.size();
+                    filestack.Pop();
                 }
                 // else dbg("Unbalanced ')' line in the pdfsync file");
                 break;
@@ -316,29 +415,93 @@ int Pdfsync::RebuildIndex() {
         }
     }
 
-    fileIndex.at(0).end = lines.size();
-    ReportIf(filestack.size() != 1);
+    UpdateSortedIndexes(firstNewLine, firstNewPoint);
+    return PDFSYNCERR_SUCCESS;
+}
 
-    return Synchronizer::RebuildIndex();
+Pdfsync::Pdfsync(const WCHAR* syncfilename, EngineBase* engine) : Synchronizer(syncfilename), engine(engine) {
+    CrashIf(!str::EndsWithI(syncfilename, PDFSYNC_EXTENSION));
+    // parsing a big sync file takes a while so we start right away
+    // on a background thread instead of on first forward/inverse search
+    hIndexReady = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+    RunAsync([this] {
+        RebuildIndex();
+        SetEvent(hIndexReady);
+    });
 }
 
-// convert a coordinate from the sync file into a PDF coordinate
-#define SYNC_TO_PDF_COORDINATE(c) (c / 65781.76)
+Pdfsync::~Pdfsync() {
+    WaitForSingleObject(hIndexReady, INFINITE);
+    CloseHandle(hIndexReady);
+    if (!index) {
+        return;
+    }
+    gPdfsyncCacheMutex.Lock();
+    delete gPdfsyncCache;
+    gPdfsyncCache = index;
+    gPdfsyncCacheMutex.Unlock();
+}
+
+// (re)builds the index. If the sync file only grew since the index was
+// built, only the appended lines are parsed
+int Pdfsync::RebuildIndex() {
+    AutoFree data(file::ReadFile(syncfilepath));
+    if (!data.data) {
+        return PDFSYNCERR_SYNCFILE_CANNOT_BE_OPENED;
+    }
 
-static int cmpLineRecords(const void* a, const void* b) {
-    return ((PdfsyncLine*)a)->record - ((PdfsyncLine*)b)->record;
+    PdfsyncIndex* idx = index;
+    index = nullptr;
+    if (!idx) {
+        gPdfsyncCacheMutex.Lock();
+        if (gPdfsyncCache && str::EqI(gPdfsyncCache->syncfilepath, syncfilepath)) {
+            idx = gPdfsyncCache;
+            gPdfsyncCache = nullptr;
+        }
+        gPdfsyncCacheMutex.Unlock();
+    }
+
+    int nPages = engine->PageCount();
+    bool resume = idx && idx->CanResume(data.AsSpan(), nPages);
+    if (!resume) {
+        delete idx;
+        idx = new PdfsyncIndex();
+        idx->syncfilepath.SetCopy(syncfilepath);
+        idx->nPages = nPages;
+    }
+
+    AutoFreeWstr dir(path::GetDir(syncfilepath));
+    int res = idx->Parse(data.data, data.size(), dir, resume);
+    if (res != PDFSYNCERR_SUCCESS) {
+        delete idx;
+        return res;
+    }
+    index = idx;
+
+    return Synchronizer::RebuildIndex();
 }
 
-int Pdfsync::DocToSource(UINT pageNo, Point pt, AutoFreeWstr& filename, UINT* line, UINT* col) {
-    if (IsIndexDiscarded()) {
+// waits for a pending background rebuild and re-builds the index
+// if the sync file has changed since
+int Pdfsync::EnsureIndex() {
+    WaitForSingleObject(hIndexReady, INFINITE);
+    if (IsIndexDiscarded() || !index) {
         if (RebuildIndex() != PDFSYNCERR_SUCCESS) {
             return PDFSYNCERR_SYNCFILE_CANNOT_BE_OPENED;
         }
     }
+    return PDFSYNCERR_SUCCESS;
+}
+
+int Pdfsync::DocToSource(UINT pageNo, Point pt, AutoFreeWstr& filename, UINT* line, UINT* col) {
+    int res = EnsureIndex();
+    if (res != PDFSYNCERR_SUCCESS) {
+        return res;
+    }
 
     // find the entry in the index corresponding to this page
     UINT nPages = (UINT)engine->PageCount();
-    if (pageNo == 0 || pageNo >= sheetIndex.size() || pageNo > nPages) {
+    if (pageNo == 0 || pageNo > index->sheetCount || pageNo > nPages) {
         return PDFSYNCERR_INVALID_PAGE_NUMBER;
     }
 
@@ -356,18 +519,32 @@ int Pdfsync::DocToSource(UINT pageNo, Point pt, AutoFreeWstr& filename, UINT* li
     UINT closest_xdist = UINT_MAX;        // horizontal distance between the hit point and the vertically-closest record
     UINT closest_ydist_record = UINT_MAX; // vertically-closest record
 
-    // read all the sections of 'p' declarations for this pdf sheet
-    for (size_t i = sheetIndex.at((size_t)pageNo); i < points.size() && points.at(i).page == pageNo; i++) {
+    // only points with a vertical distance below sqrt(PDFSYNC_EPSILON_SQUARE)
+    // and PDFSYNC_EPSILON_Y can be selected, so we only look at the points
+    // of this page within that band
+    int maxDy = std::max((int)sqrt((double)PDFSYNC_EPSILON_SQUARE), PDFSYNC_EPSILON_Y) + 1;
+    PdfsyncPoint* points = index->points.LendData();
+    u32 minY = (u32)PDF_TO_SYNC_COORDINATE(std::max(pt.y - maxDy, 0));
+    double maxYd = PDF_TO_SYNC_COORDINATE((double)std::max(pt.y + maxDy + 1, 0));
+    u32 maxY = maxYd >= (double)UINT_MAX ? UINT_MAX : (u32)maxYd;
+    auto it = std::lower_bound(index->pointsByPageY.begin(), index->pointsByPageY.end(), pageNo, [&](u32 i, UINT) {
+        return points[i].page < pageNo || (points[i].page == pageNo && points[i].y < minY);
+    });
+    for (; it != index->pointsByPageY.end(); it++) {
+        PdfsyncPoint& p = points[*it];
+        if (p.page != pageNo || p.y > maxY) {
+            break;
+        }
         // check whether it is closer than the closest point found so far
-        UINT dx = abs(pt.x - (int)SYNC_TO_PDF_COORDINATE(points.at(i).x));
-        UINT dy = abs(pt.y - (int)SYNC_TO_PDF_COORDINATE(points.at(i).y));
+        UINT dx = abs(pt.x - (int)SYNC_TO_PDF_COORDINATE(p.x));
+        UINT dy = abs(pt.y - (int)SYNC_TO_PDF_COORDINATE(p.y));
         UINT dist = dx * dx + dy * dy;
         if (dist < PDFSYNC_EPSILON_SQUARE && dist < closest_xydist) {
-            selected_record = points.at(i).record;
+            selected_record = p.record;
             closest_xydist = dist;
         } else if ((closest_xydist == UINT_MAX) && dy < PDFSYNC_EPSILON_Y &&
                    (dy < closest_ydist || (dy == closest_ydist && dx < closest_xdist))) {
-            closest_ydist_record = points.at(i).record;
+            closest_ydist_record = p.record;
             closest_ydist = dy;
             closest_xdist = dx;
         }
@@ -381,18 +558,17 @@ int Pdfsync::DocToSource(UINT pageNo, Point pt, AutoFreeWstr& filename, UINT* li
     }
 
     // We have a record number, we need to find its declaration ('l ...') in the syncfile
-    PdfsyncLine cmp;
-    cmp.record = selected_record;
-    PdfsyncLine* found =
-        (PdfsyncLine*)bsearch(&cmp, lines.LendData(), lines.size(), sizeof(PdfsyncLine), cmpLineRecords);
-    CrashIf(!found);
-    if (!found) {
+    PdfsyncLine* lines = index->lines.LendData();
+    auto found = std::lower_bound(index->linesByRecord.begin(), index->linesByRecord.end(), selected_record,
+                                  [lines](u32 i, UINT record) { return lines[i].record < record; });
+    if (found == index->linesByRecord.end() || lines[*found].record != selected_record) {
         return PDFSYNCERR_NO_SYNC_AT_LOCATION;
     }
 
-    filename.SetCopy(srcfiles.at(found->file));
-    *line = found->line;
-    *col = found->column;
+    PdfsyncLine& l = lines[*found];
+    filename.SetCopy(index->srcfiles.at(l.file));
+    *line = l.line;
+    *col = l.column;
 
     return PDFSYNCERR_SUCCESS;
 }
@@ -400,14 +576,14 @@ int Pdfsync::DocToSource(UINT pageNo, Point pt, AutoFreeWstr& filename, UINT* li
 // Find a record corresponding to the given source file, line number and optionally column number.
 // (at the moment the column parameter is ignored)
 //
-// If there are several *consecutively declared* records for the same line then they are all returned.
+// If there are several records for the same line then they are all returned.
 // The list of records is added to the vector 'records'
 //
 // If there is no record for that line, the record corresponding to the nearest line is selected
 // (within a range of EPSILON_LINE)
 //
 // The function returns PDFSYNCERR_SUCCESS if a matching record was found.
-UINT Pdfsync::SourceToRecord(const WCHAR* srcfilename, UINT line, __unused UINT col, Vec<size_t>& records) {
+UINT Pdfsync::SourceToRecord(const WCHAR* srcfilename, UINT line, __unused UINT col, Vec<u32>& records) {
     if (!srcfilename) {
         return PDFSYNCERR_INVALID_ARGUMENT;
     }
@@ -424,60 +600,68 @@ UINT Pdfsync::SourceToRecord(const WCHAR* srcfilename, UINT line, __unused UINT
     }
 
     // find the source file entry
-    size_t isrc;
-    for (isrc = 0; isrc < srcfiles.size(); isrc++) {
-        if (path::IsSame(srcfilepath, srcfiles.at(isrc))) {
+    u32 isrc;
+    for (isrc = 0; isrc < (u32)index->srcfiles.size(); isrc++) {
+        if (path::IsSame(srcfilepath, index->srcfiles.at(isrc))) {
             break;
         }
     }
-    if (isrc == srcfiles.size()) {
+    if (isrc == (u32)index->srcfiles.size()) {
         return PDFSYNCERR_UNKNOWN_SOURCEFILE;
     }
 
-    if (fileIndex.at(isrc).start == fileIndex.at(isrc).end) {
+    // the lines of the file are a contiguous range of linesByFileLine,
+    // sorted by line number
+    PdfsyncLine* lines = index->lines.LendData();
+    Vec<u32>& byFileLine = index->linesByFileLine;
+    auto first = std::lower_bound(byFileLine.begin(), byFileLine.end(), isrc,
+                                  [lines](u32 i, u32 file) { return lines[i].file < file; });
+    if (first == byFileLine.end() || lines[*first].file != isrc) {
         return PDFSYNCERR_NORECORD_IN_SOURCEFILE; // there is not any record declaration for that particular source file
     }
+    auto it = std::lower_bound(first, byFileLine.end(), line, [lines, isrc](u32 i, UINT l) {
+        return lines[i].file == isrc && lines[i].line < l;
+    });
 
-    // look for sections belonging to the specified file
-    // starting with the first section that is declared within the scope of the file.
+    // the closest record is either the first one at or after the line or the one before it
     UINT min_distance = EPSILON_LINE; // distance to the closest record
-    size_t lineIx = (size_t)-1;       // closest record-line index
-
-    for (size_t isec = fileIndex.at(isrc).start; isec < fileIndex.at(isrc).end; isec++) {
-        // does this section belong to the desired file?
-        if (lines.at(isec).file != isrc) {
-            continue;
-        }
-
-        UINT d = abs((int)lines.at(isec).line - (int)line);
+    u32* lineIx = nullptr;            // closest record-line index
+    if (it != first) {
+        UINT d = line - lines[*(it - 1)].line;
         if (d < min_distance) {
             min_distance = d;
-            lineIx = isec;
-            if (0 == d) {
-                break; // We have found a record for the requested line!
-            }
+            lineIx = it - 1;
         }
     }
-    if (lineIx == (size_t)-1) {
+    if (it != byFileLine.end() && lines[*it].file == isrc) {
+        UINT d = lines[*it].line - line;
+        if (d < min_distance) {
+            lineIx = it;
+        }
+    }
+    if (!lineIx) {
         return PDFSYNCERR_NORECORD_FOR_THATLINE;
     }
 
-    // we read all the consecutive records until we reach a record belonging to another line
-    for (size_t i = lineIx; i < lines.size() && lines.at(i).line == lines.at(lineIx).line; i++) {
-        records.Append(lines.at(i).record);
+    // all records of that line are next to each other
+    UINT foundLine = lines[*lineIx].line;
+    while (lineIx != first && lines[*(lineIx - 1)].line == foundLine) {
+        lineIx--;
+    }
+    for (; lineIx != byFileLine.end() && lines[*lineIx].file == isrc && lines[*lineIx].line == foundLine; lineIx++) {
+        records.Append(lines[*lineIx].record);
     }
 
     return PDFSYNCERR_SUCCESS;
 }
 
 int Pdfsync::SourceToDoc(const WCHAR* srcfilename, UINT line, UINT col, UINT* page, Vec<Rect>& rects) {
-    if (IsIndexDiscarded()) {
-        if (RebuildIndex() != PDFSYNCERR_SUCCESS) {
-            return PDFSYNCERR_SYNCFILE_CANNOT_BE_OPENED;
-        }
+    int res = EnsureIndex();
+    if (res != PDFSYNCERR_SUCCESS) {
+        return res;
     }
 
-    Vec<size_t> found_records;
+    Vec<u32> found_records;
     UINT ret = SourceToRecord(srcfilename, line, col, found_records);
     if (ret != PDFSYNCERR_SUCCESS || found_records.size() == 0) {
         return ret;
@@ -487,16 +671,27 @@ int Pdfsync::SourceToDoc(const WCHAR* srcfilename, UINT line, UINT col, UINT* pa
 
     // records have been found for the desired source position:
     // we now find the page and positions in the PDF corresponding to these found records
-    UINT firstPage = UINT_MAX;
-    for (size_t i = 0; i < points.size(); i++) {
-        if (!found_records.Contains(points.at(i).record)) {
-            continue;
+    PdfsyncPoint* points = index->points.LendData();
+    Vec<u32>& byRecord = index->pointsByRecord;
+    Vec<u32> found_points;
+    for (u32 record : found_records) {
+        auto it = std::lower_bound(byRecord.begin(), byRecord.end(), record,
+                                   [points](u32 i, u32 rec) { return points[i].record < rec; });
+        for (; it != byRecord.end() && points[*it].record == record; it++) {
+            found_points.Append(*it);
         }
-        if (firstPage != UINT_MAX && firstPage != points.at(i).page) {
+    }
+    // the page of the first declared point wins
+    std::sort(found_points.begin(), found_points.end());
+
+    UINT firstPage = UINT_MAX;
+    for (u32 i : found_points) {
+        PdfsyncPoint& p = points[i];
+        if (firstPage != UINT_MAX && firstPage != p.page) {
             continue;
         }
-        firstPage = *page = points.at(i).page;
-        RectF rc(SYNC_TO_PDF_COORDINATE(points.at(i).x), SYNC_TO_PDF_COORDINATE(points.at(i).y), MARK_SIZE, MARK_SIZE);
+        firstPage = *page = p.page;
+        RectF rc(SYNC_TO_PDF_COORDINATE(p.x), SYNC_TO_PDF_COORDINATE(p.y), MARK_SIZE, MARK_SIZE);
         // PdfSync coordinates are y-inversed
         RectF mbox = engine->PageMediabox(firstPage);
         rc.y = mbox.dy - (rc.y + rc.dy);
@@ -510,6 +705,60 @@ int Pdfsync::SourceToDoc(const WCHAR* srcfilename, UINT line, UINT col, UINT* pa
     return PDFSYNCERR_NOSYNCPOINT_FOR_LINERECORD;
 }
 
+// times building the index of a (big) .pdfsync file, re-building it after
+// a small amount of data was appended and a series of lookups
+void BenchPdfsyncIndex(const WCHAR* syncfilepath, int nPages) {
+    AutoFree data(file::ReadFile(syncfilepath));
+    if (!data.data) {
+        printf("failed to read '%s'\n", ToUtf8Temp(syncfilepath).Get());
+        return;
+    }
+    size_t size = data.size();
+    AutoFreeWstr dir(path::GetDir(syncfilepath));
+
+    // Parse() modifies the data so we work on copies of it
+    auto t = TimeGet();
+    PdfsyncIndex idx;
+    idx.nPages = nPages;
+    AutoFree d((char*)memdup(data.data, size, 1));
+    int res = idx.Parse(d.data, size, dir, false);
+    if (res != PDFSYNCERR_SUCCESS) {
+        printf("failed to parse '%s'\n", ToUtf8Temp(syncfilepath).Get());
+        return;
+    }
+    printf("full index build of %d MB: %.2f ms, %d lines, %d points\n", (int)(size / (1024 * 1024)), TimeSinceInMs(t),
+           (int)idx.lines.size(), (int)idx.points.size());
+
+    // simulate TeX appending a page to the sync file
+    str::Str tail;
+    u32 rec = (u32)idx.lines.size() + 1;
+    tail.AppendFmt("s %d\n", nPages);
+    for (int i = 0; i < 1000; i++) {
+        tail.AppendFmt("l %u %d\np %u %d %d\n", rec, i + 1, rec, 5000000, i * 50000);
+        rec++;
+    }
+    str::Str grown;
+    grown.Append(data.data, size);
+    grown.Append(tail.Get(), tail.size());
+
+    t = TimeGet();
+    bool resume = idx.CanResume(grown.AsByteSlice(), nPages);
+    idx.Parse(grown.Get(), grown.size(), dir, resume);
+    printf("tail update (resumed: %s): %.2f ms\n", resume ? "yes" : "no", TimeSinceInMs(t));
+
+    t = TimeGet();
+    PdfsyncLine* lines = idx.lines.LendData();
+    int nFound = 0;
+    for (u32 rec2 = 1; rec2 < rec; rec2 += 97) {
+        auto it = std::lower_bound(idx.linesByRecord.begin(), idx.linesByRecord.end(), rec2,
+                                   [lines](u32 i, u32 r) { return lines[i].record < r; });
+        if (it != idx.linesByRecord.end() && lines[*it].record == rec2) {
+            nFound++;
+        }
+    }
+    printf("%d record lookups: %.2f ms\n", nFound, TimeSinceInMs(t));
+}
+
 // SYNCTEX synchronizer
 
 int SyncTex::RebuildIndex() {
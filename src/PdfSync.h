@@ -56,3 +56,6 @@ class Synchronizer {
   public:
     static int Create(const WCHAR* pdffilename, EngineBase* engine, Synchronizer** sync);
 };
+
+// for benchmarking from Tester.cpp
+void BenchPdfsyncIndex(const WCHAR* syncfilepath, int nPages);
@@ -5,6 +5,7 @@
 #include "utils/ScopedWin.h"
 #include "utils/FileUtil.h"
 #include "utils/UITask.h"
+#include "utils/ThreadUtil.h"
 #include "utils/WinUtil.h"
 #include "utils/Log.h"
 
@@ -276,263 +277,580 @@ static RectF BoundSelectionOnPage(const Vec<SelectionOnPage>& sel, int pageNo) {
     return bounds;
 }
 
-static bool PrintToDevice(const PrintData& pd) {
-    CrashIf(!pd.engine);
-    if (!pd.engine) {
-        return false;
+// a sink that prints to a printer device context
+class HdcPrintSink : public PrintSink {
+  public:
+    HDC hdc = nullptr;
+
+    explicit HdcPrintSink(HDC hdc, DEVMODEW* devMode) : hdc(hdc) {
+        // MM_TEXT: Each logical unit is mapped to one device pixel.
+        // Positive x is to the right; positive y is down.
+        SetMapMode(hdc, MM_TEXT);
+
+        paperSize = Size(GetDeviceCaps(hdc, PHYSICALWIDTH), GetDeviceCaps(hdc, PHYSICALHEIGHT));
+        printable = Rect(GetDeviceCaps(hdc, PHYSICALOFFSETX), GetDeviceCaps(hdc, PHYSICALOFFSETY),
+                         GetDeviceCaps(hdc, HORZRES), GetDeviceCaps(hdc, VERTRES));
+        dpiX = (float)GetDeviceCaps(hdc, LOGPIXELSX);
+        dpiY = (float)GetDeviceCaps(hdc, LOGPIXELSY);
+        isPortrait = paperSize.dx < paperSize.dy;
+        if (devMode && (devMode->dmFields & DM_ORIENTATION)) {
+            isPortrait = DMORIENT_PORTRAIT == devMode->dmOrientation;
+        }
     }
-    CrashIf(!pd.printer);
-    if (!pd.printer) {
-        return false;
+    ~HdcPrintSink() override {
+        DeleteDC(hdc);
     }
 
-    auto progressUI = pd.progressUI;
-    auto abortCookie = pd.abortCookie;
+    bool StartDoc(const WCHAR* docName) override {
+        DOCINFOW di{};
+        di.cbSize = sizeof(DOCINFO);
+        di.lpszDocName = docName;
+        // for PDF Printer, this shows a file dialog to pick file name for destination PDF
+        return ::StartDoc(hdc, &di) > 0;
+    }
+    bool StartPage() override {
+        return ::StartPage(hdc) > 0;
+    }
+    bool DrawBand(RenderedBitmap* bmp, Rect rc) override {
+        return bmp->StretchDIBits(hdc, rc);
+    }
+    bool EndPage() override {
+        return ::EndPage(hdc) > 0;
+    }
+    void EndDoc() override {
+        ::EndDoc(hdc);
+    }
+    void AbortDoc() override {
+        ::AbortDoc(hdc);
+    }
+};
 
-    EngineBase& engine = *pd.engine;
-    AutoFreeWstr fileName;
+// Writes each band as a text line
+// "band <page> <x> <y> <dx> <dy> <bitmap dx> <bitmap dy> <bytes per pixel>\n"
+// followed by the pixel rows in the order they're stored in the bitmap
+class RawFilePrintSink : public PrintSink {
+  public:
+    AutoFreeWstr path;
+    HANDLE h = INVALID_HANDLE_VALUE;
+    int pageNo = 0;
+    bool ok = true;
 
-    DOCINFOW di{};
-    di.cbSize = sizeof(DOCINFO);
-    if (gPluginMode) {
-        fileName.Set(url::GetFileName(gPluginURL));
-        // fall back to a generic "filename" instead of the more confusing temporary filename
-        di.lpszDocName = fileName ? fileName.Get() : L"filename";
-    } else {
-        di.lpszDocName = engine.FileName();
+    bool Write(const void* d, size_t n) {
+        DWORD written = 0;
+        ok = ok && ::WriteFile(h, d, (DWORD)n, &written, nullptr) && written == (DWORD)n;
+        return ok;
     }
 
-    int current = 1, total = 0;
-    if (pd.sel.size() == 0) {
-        for (size_t i = 0; i < pd.ranges.size(); i++) {
-            if (pd.ranges.at(i).nToPage < pd.ranges.at(i).nFromPage) {
-                total += pd.ranges.at(i).nFromPage - pd.ranges.at(i).nToPage + 1;
-            } else {
-                total += pd.ranges.at(i).nToPage - pd.ranges.at(i).nFromPage + 1;
-            }
+    bool StartDoc(const WCHAR*) override {
+        h = CreateFileW(path, GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+        return h != INVALID_HANDLE_VALUE;
+    }
+    bool StartPage() override {
+        pageNo++;
+        return ok;
+    }
+    bool DrawBand(RenderedBitmap* bmp, Rect rc) override {
+        BitmapPixels* pixels = GetBitmapPixels(bmp->GetBitmap());
+        if (!pixels) {
+            return false;
         }
-    } else {
-        for (int pageNo = 1; pageNo <= engine.PageCount(); pageNo++) {
-            if (!BoundSelectionOnPage(pd.sel, pageNo).IsEmpty()) {
-                total++;
+        Size size = pixels->size;
+        str::Str s;
+        s.AppendFmt("band %d %d %d %d %d %d %d %d\n", pageNo, rc.x, rc.y, rc.dx, rc.dy, size.dx, size.dy,
+                    pixels->nBytesPerPixel);
+        Write(s.Get(), s.size());
+        size_t rowBytes = (size_t)size.dx * pixels->nBytesPerPixel;
+        if ((size_t)pixels->nBytesPerRow == rowBytes) {
+            Write(pixels->pixels, rowBytes * size.dy);
+        } else {
+            for (int y = 0; y < size.dy; y++) {
+                Write(pixels->pixels + (size_t)y * pixels->nBytesPerRow, rowBytes);
             }
         }
+        FinalizeBitmapPixels(pixels);
+        return ok;
     }
-    CrashIf(total <= 0);
-    if (0 == total) {
-        return false;
+    bool EndPage() override {
+        return ok;
+    }
+    void EndDoc() override {
+        CloseHandle(h);
+        h = INVALID_HANDLE_VALUE;
     }
+    void AbortDoc() override {
+        EndDoc();
+        file::Delete(path);
+    }
+    ~RawFilePrintSink() override {
+        if (h != INVALID_HANDLE_VALUE) {
+            CloseHandle(h);
+        }
+    }
+};
 
-    if (progressUI) {
-        progressUI->UpdateProgress(current, total);
+PrintSink* NewRawFilePrintSink(const WCHAR* path, Size paperSize, float dpi) {
+    auto sink = new RawFilePrintSink();
+    sink->path.SetCopy(path);
+    sink->paperSize = paperSize;
+    sink->printable = Rect(0, 0, paperSize.dx, paperSize.dy);
+    sink->dpiX = dpi;
+    sink->dpiY = dpi;
+    sink->isPortrait = paperSize.dx < paperSize.dy;
+    return sink;
+}
+
+// bands are at most this big, so that large pages printed at high
+// resolution don't need a huge bitmap
+constexpr i64 kMaxPrintBandBytes = 16 * 1024 * 1024;
+// how far rendering can get ahead of sending bands to the printer
+constexpr i64 kMaxQueuedPrintBytes = 64 * 1024 * 1024;
+
+// part of a page to render and where to put it on the printed sheet
+struct PrintPageItem {
+    int pageNo = 0;
+    float zoom = 0;
+    int rotation = 0;
+    // in page coordinates, empty for the whole page
+    RectF pageRect;
+    // position of the top-left corner, relative to the printable area
+    Point offset;
+};
+
+struct PrintBand {
+    // nullptr for the first band of a sheet
+    RenderedBitmap* bmp = nullptr;
+    Rect rc;
+    // 1-based number of the printed sheet this band is on
+    int sheetNo = 0;
+};
+
+// bands rendered by PrintRenderThread, waiting to be sent to the sink
+class PrintBandQueue {
+    CRITICAL_SECTION cs;
+    CONDITION_VARIABLE changed;
+    Vec<PrintBand> bands;
+    i64 queuedBytes = 0;
+    bool finished = false;
+    bool canceled = false;
+
+    static i64 BandBytes(const PrintBand& band) {
+        if (!band.bmp) {
+            return 0;
+        }
+        Size size = band.bmp->Size();
+        return (i64)size.dx * size.dy * 4;
     }
 
-    auto devMode = pd.printer->devMode;
-    // http://blogs.msdn.com/b/oldnewthing/archive/2012/11/09/10367057.aspx
-    AutoDeleteDC hdc(CreateDCW(nullptr, pd.printer->name, nullptr, devMode));
-    if (!hdc) {
-        return false;
+  public:
+    PrintBandQueue() {
+        InitializeCriticalSection(&cs);
+        InitializeConditionVariable(&changed);
+    }
+    ~PrintBandQueue() {
+        for (auto& band : bands) {
+            delete band.bmp;
+        }
+        DeleteCriticalSection(&cs);
     }
 
-    // for PDF Printer, this shows a file dialog to pick file name for destination PDF
-    if (StartDoc(hdc, &di) <= 0) {
-        return false;
+    // waits while the queue is full, returns false if the consumer gave up
+    bool Push(const PrintBand& band) {
+        i64 n = BandBytes(band);
+        ScopedCritSec scope(&cs);
+        while (!canceled && queuedBytes > 0 && queuedBytes + n > kMaxQueuedPrintBytes) {
+            SleepConditionVariableCS(&changed, &cs, INFINITE);
+        }
+        if (canceled) {
+            delete band.bmp;
+            return false;
+        }
+        bands.Append(band);
+        queuedBytes += n;
+        WakeAllConditionVariable(&changed);
+        return true;
     }
 
-    // MM_TEXT: Each logical unit is mapped to one device pixel.
-    // Positive x is to the right; positive y is down.
-    SetMapMode(hdc, MM_TEXT);
+    // waits for the next band, returns false when there are no more
+    bool Pop(PrintBand& band) {
+        ScopedCritSec scope(&cs);
+        while (bands.size() == 0 && !finished && !canceled) {
+            SleepConditionVariableCS(&changed, &cs, INFINITE);
+        }
+        if (bands.size() == 0 || canceled) {
+            return false;
+        }
+        band = bands[0];
+        bands.RemoveAt(0);
+        queuedBytes -= BandBytes(band);
+        WakeAllConditionVariable(&changed);
+        return true;
+    }
 
-    const Size paperSize(GetDeviceCaps(hdc, PHYSICALWIDTH), GetDeviceCaps(hdc, PHYSICALHEIGHT));
-    const Rect printable(GetDeviceCaps(hdc, PHYSICALOFFSETX), GetDeviceCaps(hdc, PHYSICALOFFSETY),
-                         GetDeviceCaps(hdc, HORZRES), GetDeviceCaps(hdc, VERTRES));
+    void Finish() {
+        ScopedCritSec scope(&cs);
+        finished = true;
+        WakeAllConditionVariable(&changed);
+    }
+
+    void Cancel() {
+        ScopedCritSec scope(&cs);
+        canceled = true;
+        WakeAllConditionVariable(&changed);
+    }
+
+    bool WasCanceled() {
+        ScopedCritSec scope(&cs);
+        return canceled;
+    }
+};
+
+// layout of a page printed from a page range
+static PrintPageItem LayoutPageForPrint(EngineBase& engine, PrintSink* sink, const Print_Advanced_Data& advData,
+                                        int pageNo) {
+    const Size paperSize = sink->paperSize;
+    const Rect printable = sink->printable;
     float fileDPI = engine.GetFileDPI();
-    float px = (float)GetDeviceCaps(hdc, LOGPIXELSX);
-    float py = (float)GetDeviceCaps(hdc, LOGPIXELSY);
-    float dpiFactor = std::min(px / fileDPI, py / fileDPI);
-    bool bPrintPortrait = paperSize.dx < paperSize.dy;
-    if (devMode && (devMode->dmFields & DM_ORIENTATION)) {
-        bPrintPortrait = DMORIENT_PORTRAIT == devMode->dmOrientation;
-    }
-    if (pd.advData.rotation == PrintRotationAdv::Portrait) {
+    float dpiFactor = std::min(sink->dpiX / fileDPI, sink->dpiY / fileDPI);
+    bool bPrintPortrait = sink->isPortrait;
+    if (advData.rotation == PrintRotationAdv::Portrait) {
         bPrintPortrait = true;
-    } else if (pd.advData.rotation == PrintRotationAdv::Landscape) {
+    } else if (advData.rotation == PrintRotationAdv::Landscape) {
         bPrintPortrait = false;
     }
 
-    if (pd.sel.size() > 0) {
-        for (int pageNo = 1; pageNo <= engine.PageCount(); pageNo++) {
-            RectF bounds = BoundSelectionOnPage(pd.sel, pageNo);
-            if (bounds.IsEmpty()) {
-                continue;
-            }
-
-            if (progressUI) {
-                progressUI->UpdateProgress(current, total);
-            }
+    SizeF pSize = engine.PageMediabox(pageNo).Size();
+    int rotation = 0;
+    // Turn the document by 90 deg if it isn't in portrait mode
+    if (pSize.dx > pSize.dy) {
+        rotation += 90;
+        std::swap(pSize.dx, pSize.dy);
+    }
+    // make sure not to print upside-down
+    rotation = (rotation % 180) == 0 ? 0 : 270;
+    // finally turn the page by (another) 90 deg in landscape mode
+    if (!bPrintPortrait) {
+        rotation = (rotation + 90) % 360;
+        std::swap(pSize.dx, pSize.dy);
+    }
+
+    // dpiFactor means no physical zoom
+    float zoom = dpiFactor;
+    // offset of the top-left corner of the page from the printable area
+    // (negative values move the page into the left/top margins, etc.);
+    // offset adjustments are needed because the GDI coordinate system
+    // starts at the corner of the printable area and we rather want to
+    // center the page on the physical paper (except for PrintScaleNone
+    // where the page starts at the very top left of the physical paper so
+    // that printing forms/labels of varying size remains reliably possible)
+    Point offset(-printable.x, -printable.y);
+
+    if (advData.scale != PrintScaleAdv::None) {
+        // make sure to fit all content into the printable area when scaling
+        // and the whole document page on the physical paper
+        RectF rect = engine.PageContentBox(pageNo, RenderTarget::Print);
+        RectF cbox = engine.Transform(rect, pageNo, 1.0, rotation);
+        zoom = std::min((float)printable.dx / cbox.dx,
+                        std::min((float)printable.dy / cbox.dy,
+                                 std::min((float)paperSize.dx / pSize.dx, (float)paperSize.dy / pSize.dy)));
+        // use the correct zoom values, if the page fits otherwise
+        // and the user didn't ask for anything else (default setting)
+        if (PrintScaleAdv::Shrink == advData.scale && dpiFactor < zoom) {
+            zoom = dpiFactor;
+        }
+        // center the page on the physical paper
+        offset.x += (int)(paperSize.dx - pSize.dx * zoom) / 2;
+        offset.y += (int)(paperSize.dy - pSize.dy * zoom) / 2;
+        // make sure that no content lies in the non-printable paper margins
+        RectF onPaper(printable.x + offset.x + cbox.x * zoom, printable.y + offset.y + cbox.y * zoom, cbox.dx * zoom,
+                      cbox.dy * zoom);
+        if (onPaper.x < printable.x) {
+            offset.x += (int)(printable.x - onPaper.x);
+        } else if (onPaper.BR().x > printable.BR().x) {
+            offset.x -= (int)(onPaper.BR().x - printable.BR().x);
+        }
+        if (onPaper.y < printable.y) {
+            offset.y += (int)(printable.y - onPaper.y);
+        } else if (onPaper.BR().y > printable.BR().y) {
+            offset.y -= (int)(onPaper.BR().y - printable.BR().y);
+        }
+    }
 
-            StartPage(hdc);
+    PrintPageItem item;
+    item.pageNo = pageNo;
+    item.zoom = zoom;
+    item.rotation = rotation;
+    item.offset = offset;
+    return item;
+}
 
-            SizeF bSize = bounds.Size();
-            float zoom = std::min((float)printable.dx / bSize.dx, (float)printable.dy / bSize.dy);
-            // use the correct zoom values, if the page fits otherwise
-            // and the user didn't ask for anything else (default setting)
-            if (PrintScaleAdv::Shrink == pd.advData.scale) {
-                zoom = std::min(dpiFactor, zoom);
-            } else if (PrintScaleAdv::None == pd.advData.scale) {
-                zoom = dpiFactor;
-            }
+// layout of the selected parts of a page, all printed on one sheet
+static void LayoutSelectionForPrint(EngineBase& engine, PrintSink* sink, const PrintData& pd, int pageNo,
+                                    Vec<PrintPageItem>& items) {
+    const Rect printable = sink->printable;
+    float fileDPI = engine.GetFileDPI();
+    float dpiFactor = std::min(sink->dpiX / fileDPI, sink->dpiY / fileDPI);
+
+    RectF bounds = BoundSelectionOnPage(pd.sel, pageNo);
+    SizeF bSize = bounds.Size();
+    float zoom = std::min((float)printable.dx / bSize.dx, (float)printable.dy / bSize.dy);
+    // use the correct zoom values, if the page fits otherwise
+    // and the user didn't ask for anything else (default setting)
+    if (PrintScaleAdv::Shrink == pd.advData.scale) {
+        zoom = std::min(dpiFactor, zoom);
+    } else if (PrintScaleAdv::None == pd.advData.scale) {
+        zoom = dpiFactor;
+    }
+
+    for (size_t i = 0; i < pd.sel.size(); i++) {
+        if (pd.sel.at(i).pageNo != pageNo) {
+            continue;
+        }
 
-            for (size_t i = 0; i < pd.sel.size(); i++) {
-                if (pd.sel.at(i).pageNo != pageNo) {
-                    continue;
-                }
+        RectF clipRegion = pd.sel.at(i).rect;
+        Point offset((int)((clipRegion.x - bounds.x) * zoom), (int)((clipRegion.y - bounds.y) * zoom));
+        if (pd.advData.scale != PrintScaleAdv::None) {
+            // center the selection on the physical paper
+            offset.x += (int)(printable.dx - bSize.dx * zoom) / 2;
+            offset.y += (int)(printable.dy - bSize.dy * zoom) / 2;
+        }
 
-                RectF* clipRegion = &pd.sel.at(i).rect;
-                Point offset((int)((clipRegion->x - bounds.x) * zoom), (int)((clipRegion->y - bounds.y) * zoom));
-                if (pd.advData.scale != PrintScaleAdv::None) {
-                    // center the selection on the physical paper
-                    offset.x += (int)(printable.dx - bSize.dx * zoom) / 2;
-                    offset.y += (int)(printable.dy - bSize.dy * zoom) / 2;
-                }
+        PrintPageItem item;
+        item.pageNo = pageNo;
+        item.zoom = zoom;
+        item.rotation = pd.rotation;
+        item.pageRect = clipRegion;
+        item.offset = offset;
+        items.Append(item);
+    }
+}
 
-                bool ok = false;
-                short shrink = 1;
-                do {
-                    RenderPageArgs args(pd.sel.at(i).pageNo, zoom / shrink, pd.rotation, clipRegion,
-                                        RenderTarget::Print);
-                    if (abortCookie) {
-                        args.cookie_out = &abortCookie->cookie;
-                    }
-                    RenderedBitmap* bmp = engine.RenderPage(args);
-                    if (abortCookie) {
-                        abortCookie->Clear();
-                    }
-                    if (bmp && bmp->GetBitmap()) {
-                        Rect rc(offset.x, offset.y, bmp->Size().dx * shrink, bmp->Size().dy * shrink);
-                        ok = bmp->StretchDIBits(hdc, rc);
-                    }
-                    delete bmp;
-                    shrink *= 2;
-                } while (!ok && shrink < 32 && !(progressUI && progressUI->WasCanceled()));
+// renders the pages to be printed, one band at a time, while
+// the printing thread sends the already rendered bands to the sink
+class PrintRenderThread : public ThreadBase {
+  public:
+    const PrintData& pd;
+    PrintSink* sink = nullptr;
+    PrintBandQueue* queue = nullptr;
+    // page to print on each sheet
+    Vec<int> sheetPages;
+
+    PrintRenderThread(const PrintData& pd, PrintSink* sink, PrintBandQueue* queue)
+        : ThreadBase("PrintRenderThread"), pd(pd), sink(sink), queue(queue) {
+    }
+
+    RenderedBitmap* RenderBand(const PrintPageItem& item, RectF* pageRect) {
+        EngineBase& engine = *pd.engine;
+        auto abortCookie = pd.abortCookie;
+        // if we run out of memory, print at a lower resolution
+        for (short shrink = 1; shrink < 32 && !queue->WasCanceled(); shrink *= 2) {
+            RenderPageArgs args(item.pageNo, item.zoom / shrink, item.rotation, pageRect, RenderTarget::Print);
+            if (abortCookie) {
+                args.cookie_out = &abortCookie->cookie;
             }
-            // TODO: abort if !ok?
-
-            if (EndPage(hdc) <= 0 || (progressUI && progressUI->WasCanceled())) {
-                AbortDoc(hdc);
-                return false;
+            RenderedBitmap* bmp = engine.RenderPage(args);
+            if (abortCookie) {
+                abortCookie->Clear();
+            }
+            if (bmp && bmp->GetBitmap()) {
+                return bmp;
             }
-            current++;
+            delete bmp;
         }
-
-        EndDoc(hdc);
-        return false;
+        return nullptr;
     }
 
-    // print all the pages the user requested
-    for (size_t i = 0; i < pd.ranges.size(); i++) {
-        int dir = pd.ranges.at(i).nFromPage > pd.ranges.at(i).nToPage ? -1 : 1;
-        for (DWORD pageNo = pd.ranges.at(i).nFromPage; pageNo != pd.ranges.at(i).nToPage + dir; pageNo += dir) {
-            if ((PrintRangeAdv::Even == pd.advData.range && pageNo % 2 != 0) ||
-                (PrintRangeAdv::Odd == pd.advData.range && pageNo % 2 == 0)) {
+    bool RenderItem(const PrintPageItem& item, int sheetNo) {
+        EngineBase& engine = *pd.engine;
+        RectF pageRect = item.pageRect;
+        bool isWholePage = pageRect.IsEmpty();
+        if (isWholePage) {
+            pageRect = engine.PageMediabox(item.pageNo);
+        }
+        Rect full = engine.Transform(pageRect, item.pageNo, item.zoom, item.rotation).Round();
+        if (full.IsEmpty()) {
+            return true;
+        }
+        int bandDy = (int)std::max(kMaxPrintBandBytes / ((i64)full.dx * 4), (i64)1);
+        for (int y = 0; y < full.dy; y += bandDy) {
+            int dy = std::min(bandDy, full.dy - y);
+            RenderedBitmap* bmp = nullptr;
+            if (dy == full.dy) {
+                bmp = RenderBand(item, isWholePage ? nullptr : &pageRect);
+            } else {
+                RectF band((float)full.x, (float)(full.y + y), (float)full.dx, (float)dy);
+                RectF bandRect = engine.Transform(band, item.pageNo, item.zoom, item.rotation, true);
+                bmp = RenderBand(item, &bandRect);
+            }
+            if (!bmp) {
+                // like before banding, a part of the page that failed to render (even at
+                // lower resolution) is left blank instead of failing the whole print job
+                logf("PrintRenderThread: failed to render page %d, band at y=%d\n", item.pageNo, y);
                 continue;
             }
-            if (progressUI) {
-                progressUI->UpdateProgress(current, total);
+            PrintBand pb;
+            pb.bmp = bmp;
+            pb.rc = Rect(item.offset.x, item.offset.y + y, full.dx, dy);
+            pb.sheetNo = sheetNo;
+            if (!queue->Push(pb)) {
+                return false;
             }
-
-            StartPage(hdc);
-
-            SizeF pSize = engine.PageMediabox(pageNo).Size();
-            int rotation = 0;
-            // Turn the document by 90 deg if it isn't in portrait mode
-            if (pSize.dx > pSize.dy) {
-                rotation += 90;
-                std::swap(pSize.dx, pSize.dy);
+        }
+        return true;
+    }
+
+    void Run() override {
+        EngineBase& engine = *pd.engine;
+        Vec<PrintPageItem> items;
+        for (int i = 0; i < sheetPages.isize(); i++) {
+            int sheetNo = i + 1;
+            PrintBand start;
+            start.sheetNo = sheetNo;
+            if (!queue->Push(start)) {
+                break;
             }
-            // make sure not to print upside-down
-            rotation = (rotation % 180) == 0 ? 0 : 270;
-            // finally turn the page by (another) 90 deg in landscape mode
-            if (!bPrintPortrait) {
-                rotation = (rotation + 90) % 360;
-                std::swap(pSize.dx, pSize.dy);
+            items.Reset();
+            if (pd.sel.size() > 0) {
+                LayoutSelectionForPrint(engine, sink, pd, sheetPages[i], items);
+            } else {
+                items.Append(LayoutPageForPrint(engine, sink, pd.advData, sheetPages[i]));
             }
-
-            // dpiFactor means no physical zoom
-            float zoom = dpiFactor;
-            // offset of the top-left corner of the page from the printable area
-            // (negative values move the page into the left/top margins, etc.);
-            // offset adjustments are needed because the GDI coordinate system
-            // starts at the corner of the printable area and we rather want to
-            // center the page on the physical paper (except for PrintScaleNone
-            // where the page starts at the very top left of the physical paper so
-            // that printing forms/labels of varying size remains reliably possible)
-            Point offset(-printable.x, -printable.y);
-
-            if (pd.advData.scale != PrintScaleAdv::None) {
-                // make sure to fit all content into the printable area when scaling
-                // and the whole document page on the physical paper
-                RectF rect = engine.PageContentBox(pageNo, RenderTarget::Print);
-                RectF cbox = engine.Transform(rect, pageNo, 1.0, rotation);
-                zoom = std::min((float)printable.dx / cbox.dx,
-                                std::min((float)printable.dy / cbox.dy,
-                                         std::min((float)paperSize.dx / pSize.dx, (float)paperSize.dy / pSize.dy)));
-                // use the correct zoom values, if the page fits otherwise
-                // and the user didn't ask for anything else (default setting)
-                if (PrintScaleAdv::Shrink == pd.advData.scale && dpiFactor < zoom) {
-                    zoom = dpiFactor;
-                }
-                // center the page on the physical paper
-                offset.x += (int)(paperSize.dx - pSize.dx * zoom) / 2;
-                offset.y += (int)(paperSize.dy - pSize.dy * zoom) / 2;
-                // make sure that no content lies in the non-printable paper margins
-                RectF onPaper(printable.x + offset.x + cbox.x * zoom, printable.y + offset.y + cbox.y * zoom,
-                              cbox.dx * zoom, cbox.dy * zoom);
-                if (onPaper.x < printable.x) {
-                    offset.x += (int)(printable.x - onPaper.x);
-                } else if (onPaper.BR().x > printable.BR().x) {
-                    offset.x -= (int)(onPaper.BR().x - printable.BR().x);
-                }
-                if (onPaper.y < printable.y) {
-                    offset.y += (int)(printable.y - onPaper.y);
-                } else if (onPaper.BR().y > printable.BR().y) {
-                    offset.y -= (int)(onPaper.BR().y - printable.BR().y);
+            bool ok = true;
+            for (auto& item : items) {
+                ok = RenderItem(item, sheetNo);
+                if (!ok) {
+                    break;
                 }
             }
+            if (!ok) {
+                break;
+            }
+        }
+        queue->Finish();
+        DestroyTempAllocator();
+    }
+};
 
-            bool ok = false;
-            short shrink = 1;
-            do {
-                RenderPageArgs args(pageNo, zoom / shrink, rotation, nullptr, RenderTarget::Print);
-                if (abortCookie) {
-                    args.cookie_out = &abortCookie->cookie;
-                }
-                RenderedBitmap* bmp = engine.RenderPage(args);
-                if (abortCookie) {
-                    abortCookie->Clear();
-                }
-                if (bmp && bmp->GetBitmap()) {
-                    auto size = bmp->Size();
-                    Rect rc(offset.x, offset.y, size.dx * shrink, size.dy * shrink);
-                    ok = bmp->StretchDIBits(hdc, rc);
+static bool PrintDataToSink(const PrintData& pd, PrintSink* sink, const WCHAR* docName) {
+    auto progressUI = pd.progressUI;
+    EngineBase& engine = *pd.engine;
+
+    Vec<int> sheetPages;
+    if (pd.sel.size() == 0) {
+        for (size_t i = 0; i < pd.ranges.size(); i++) {
+            int dir = pd.ranges.at(i).nFromPage > pd.ranges.at(i).nToPage ? -1 : 1;
+            for (DWORD pageNo = pd.ranges.at(i).nFromPage; pageNo != pd.ranges.at(i).nToPage + dir; pageNo += dir) {
+                if ((PrintRangeAdv::Even == pd.advData.range && pageNo % 2 != 0) ||
+                    (PrintRangeAdv::Odd == pd.advData.range && pageNo % 2 == 0)) {
+                    continue;
                 }
-                delete bmp;
-                shrink *= 2;
-            } while (!ok && shrink < 32 && !(progressUI && progressUI->WasCanceled()));
-            // TODO: abort if !ok?
+                sheetPages.Append((int)pageNo);
+            }
+        }
+    } else {
+        for (int pageNo = 1; pageNo <= engine.PageCount(); pageNo++) {
+            if (!BoundSelectionOnPage(pd.sel, pageNo).IsEmpty()) {
+                sheetPages.Append(pageNo);
+            }
+        }
+    }
+    int total = sheetPages.isize();
+    if (0 == total) {
+        return false;
+    }
 
-            if (EndPage(hdc) <= 0 || (progressUI && progressUI->WasCanceled())) {
-                AbortDoc(hdc);
-                return false;
+    if (progressUI) {
+        progressUI->UpdateProgress(1, total);
+    }
+
+    if (!sink->StartDoc(docName)) {
+        return false;
+    }
+
+    // render the next bands (and pages) on a separate thread
+    // while we're waiting for the printer to accept the current ones
+    PrintBandQueue queue;
+    auto renderer = new PrintRenderThread(pd, sink, &queue);
+    renderer->sheetPages = sheetPages;
+    renderer->Start();
+
+    bool ok = true;
+    int sheetNo = 0;
+    PrintBand band;
+    while (queue.Pop(band)) {
+        if (band.sheetNo != sheetNo) {
+            if (sheetNo > 0 && !sink->EndPage()) {
+                ok = false;
+            } else {
+                sheetNo = band.sheetNo;
+                if (progressUI) {
+                    progressUI->UpdateProgress(sheetNo, total);
+                }
+                ok = sink->StartPage();
             }
-            current++;
+        }
+        if (ok && band.bmp && !sink->DrawBand(band.bmp, band.rc)) {
+            ok = false;
+        }
+        delete band.bmp;
+        if (!ok || (progressUI && progressUI->WasCanceled())) {
+            ok = false;
+            queue.Cancel();
+            break;
         }
     }
+    renderer->Join();
+    delete renderer;
 
-    EndDoc(hdc);
+    if (ok && sheetNo > 0) {
+        ok = sink->EndPage();
+    }
+    if (!ok) {
+        sink->AbortDoc();
+        return false;
+    }
+    sink->EndDoc();
     return true;
 }
 
+static bool PrintToDevice(const PrintData& pd) {
+    CrashIf(!pd.engine);
+    if (!pd.engine) {
+        return false;
+    }
+    CrashIf(!pd.printer);
+    if (!pd.printer) {
+        return false;
+    }
+
+    EngineBase& engine = *pd.engine;
+    AutoFreeWstr fileName;
+    const WCHAR* docName = engine.FileName();
+    if (gPluginMode) {
+        fileName.Set(url::GetFileName(gPluginURL));
+        // fall back to a generic "filename" instead of the more confusing temporary filename
+        docName = fileName ? fileName.Get() : L"filename";
+    }
+
+    auto devMode = pd.printer->devMode;
+    // http://blogs.msdn.com/b/oldnewthing/archive/2012/11/09/10367057.aspx
+    HDC hdc = CreateDCW(nullptr, pd.printer->name, nullptr, devMode);
+    if (!hdc) {
+        return false;
+    }
+    HdcPrintSink sink(hdc, devMode);
+    return PrintDataToSink(pd, &sink, docName);
+}
+
+bool PrintToSink(EngineBase* engine, PrintSink* sink, Vec<PRINTPAGERANGE>& ranges, Print_Advanced_Data& advData,
+                 ProgressUpdateUI* progressUI) {
+    PrintData pd(engine, nullptr, ranges, advData);
+    if (!pd.engine) {
+        return false;
+    }
+    pd.progressUI = progressUI;
+    return PrintDataToSink(pd, sink, engine->FileName());
+}
+
 class PrintThreadData : public ProgressUpdateUI {
   public:
     NotificationWnd* wnd = nullptr;
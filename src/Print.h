@@ -1,6 +1,8 @@
 /* Copyright 2021 the SumatraPDF project authors (see AUTHORS file).
    License: GPLv3 */
 
+struct Print_Advanced_Data;
+
 struct Printer {
     WCHAR* name{nullptr};
     DEVMODEW* devMode{nullptr};
@@ -30,6 +32,34 @@ struct Printer {
 
 Printer* NewPrinter(const WCHAR* name);
 
+// Destination of a print job. Pages are rendered in horizontal bands
+// (so that memory use doesn't depend on page size and printer resolution)
+// and each band is drawn separately.
+struct PrintSink {
+    // physical size of the paper and the printable area on it, in device pixels
+    Size paperSize;
+    Rect printable;
+    // resolution of the device
+    float dpiX{0};
+    float dpiY{0};
+    bool isPortrait{true};
+
+    virtual bool StartDoc(const WCHAR* docName) = 0;
+    virtual bool StartPage() = 0;
+    // draw bmp, stretched to rc (relative to the printable area)
+    virtual bool DrawBand(RenderedBitmap* bmp, Rect rc) = 0;
+    virtual bool EndPage() = 0;
+    virtual void EndDoc() = 0;
+    virtual void AbortDoc() = 0;
+    virtual ~PrintSink() = default;
+};
+
+// writes the rendered bands to a file instead of a printer, for testing
+// and timing printing without a printer. paperSize is in device pixels.
+PrintSink* NewRawFilePrintSink(const WCHAR* path, Size paperSize, float dpi);
+bool PrintToSink(EngineBase* engine, PrintSink* sink, Vec<PRINTPAGERANGE>& ranges, Print_Advanced_Data& advData,
+                 ProgressUpdateUI* progressUI = nullptr);
+
 bool PrintFile(const WCHAR* fileName, WCHAR* printerName = nullptr, bool displayErrors = true,
                const WCHAR* settings = nullptr);
 bool PrintFile(EngineBase* engine, WCHAR* printerName = nullptr, bool displayErrors = true,
@@ -5,6 +5,7 @@
 #include "utils/ScopedWin.h"
 #include "utils/WinUtil.h"
 #include "utils/Timer.h"
+#include "utils/Trace.h"
 
 #include "wingui/TreeModel.h"
 #include "DisplayMode.h"
@@ -62,14 +63,14 @@ RenderCache::~RenderCache() {
 
 /* Find a bitmap for a page defined by <dm> and <pageNo> and optionally also
    <rotation> and <zoom> in the cache - call DropCacheEntry when you
-   no longer need a found entry. */
+   no longer need a found entry. Previews are only found for INVALID_ZOOM. */
 BitmapCacheEntry* RenderCache::Find(DisplayModel* dm, int pageNo, int rotation, float zoom, TilePosition* tile) {
     ScopedCritSec scope(&cacheAccess);
     rotation = NormalizeRotation(rotation);
     for (int i = 0; i < cacheCount; i++) {
         BitmapCacheEntry* e = cache[i];
         if ((dm == e->dm) && (pageNo == e->pageNo) && (rotation == e->rotation) &&
-            (INVALID_ZOOM == zoom || zoom == e->zoom) && (!tile || e->tile == *tile)) {
+            (INVALID_ZOOM == zoom || zoom == e->zoom && !e->isPreview) && (!tile || e->tile == *tile)) {
             e->refs++;
             CrashIf(i != e->cacheIdx);
             return e;
@@ -166,6 +167,12 @@ void RenderCache::Add(PageRenderRequest& req, RenderedBitmap* bmp) {
     req.rotation = NormalizeRotation(req.rotation);
     CrashIf(cacheCount > MAX_BITMAPS_CACHED);
 
+    // don't replace a full quality bitmap with its preview
+    if (req.isPreview && Exists(req.dm, req.pageNo, req.rotation, req.zoom, &req.tile)) {
+        delete bmp;
+        return;
+    }
+
     /* It's possible there still is a cached bitmap with different zoom/rotation */
     FreePage(req.dm, req.pageNo, &req.tile);
 
@@ -175,6 +182,7 @@ void RenderCache::Add(PageRenderRequest& req, RenderedBitmap* bmp) {
 
     // Copy the PageRenderRequest as it will be reused
     auto entry = new BitmapCacheEntry(req.dm, req.pageNo, req.rotation, req.zoom, req.tile, bmp);
+    entry->isPreview = req.isPreview;
     entry->cacheIdx = cacheCount;
     cache[cacheCount] = entry;
     cacheCount++;
@@ -436,26 +444,46 @@ void RenderCache::RequestRendering(DisplayModel* dm, int pageNo, TilePosition ti
         ClearQueueForDisplayModel(dm, pageNo, &tile);
     }
 
+    // there might be two requests for the tile (its preview and the full quality rendering)
+    bool isQueued = false;
+    bool moveToTop = false;
     for (int i = 0; i < requestCount; i++) {
         PageRenderRequest* req = &(requests[i]);
         if ((req->pageNo == pageNo) && (req->dm == dm) && (req->tile == tile)) {
+            isQueued = true;
             if ((req->zoom == zoom) && (req->rotation == rotation)) {
-                /* Request with exactly the same parameters already queued for
-                   rendering. Move it to the top of the queue so that it'll
-                   be rendered faster. */
-                PageRenderRequest tmp;
-                tmp = requests[requestCount - 1];
-                requests[requestCount - 1] = *req;
-                *req = tmp;
+                moveToTop = true;
             } else {
                 /* There was a request queued for the same page but with different
                    zoom or rotation, so only replace this request */
                 req->zoom = zoom;
                 req->rotation = rotation;
             }
-            return;
         }
     }
+    if (moveToTop) {
+        /* Request with exactly the same parameters already queued for
+           rendering. Move it to the top of the queue so that it'll
+           be rendered faster (keeping a preview on top of its request). */
+        PageRenderRequest moved[MAX_PAGE_REQUESTS];
+        int nMoved = 0;
+        int n = 0;
+        for (int i = 0; i < requestCount; i++) {
+            PageRenderRequest& req = requests[i];
+            if ((req.pageNo == pageNo) && (req.dm == dm) && (req.tile == tile)) {
+                moved[nMoved++] = req;
+            } else {
+                requests[n++] = req;
+            }
+        }
+        for (int i = 0; i < nMoved; i++) {
+            requests[n++] = moved[i];
+        }
+        CrashIf(n != requestCount);
+    }
+    if (isQueued) {
+        return;
+    }
 
     if (Exists(dm, pageNo, rotation, zoom, &tile)) {
         /* This page has already been rendered in the correct dimensions
@@ -463,7 +491,55 @@ void RenderCache::RequestRendering(DisplayModel* dm, int pageNo, TilePosition ti
         return;
     }
 
+    // the queue is a stack, so the preview is rendered first
+    bool needsPreview = NeedsPreview(dm, pageNo, rotation, zoom, tile);
     Render(dm, pageNo, rotation, zoom, &tile);
+    if (needsPreview) {
+        Render(dm, pageNo, rotation, zoom, &tile, nullptr, nullptr, true);
+    }
+}
+
+// a tile needs a preview if nothing that's at least as good would be shown
+// while it's rendering (e.g. after scrolling to a new page or zooming in)
+bool RenderCache::NeedsPreview(DisplayModel* dm, int pageNo, int rotation, float zoom, TilePosition tile) {
+    ScopedCritSec scope(&requestAccess);
+    // replacements aren't painted for remote sessions
+    if (isRemoteSession || requestCount + 2 > MAX_PAGE_REQUESTS) {
+        return false;
+    }
+    // don't slow down pre-rendering of pages that aren't visible yet
+    if (!IsTileVisible(dm, pageNo, tile)) {
+        return false;
+    }
+
+    ScopedCritSec scopeCache(&cacheAccess);
+    for (int i = 0; i < cacheCount; i++) {
+        auto e = cache[i];
+        if (e->dm != dm || e->pageNo != pageNo || e->rotation != rotation || e->outOfDate) {
+            continue;
+        }
+        float effectiveZoom = e->isPreview ? e->zoom * kPreviewZoomFactor : e->zoom;
+        if (effectiveZoom < zoom * kPreviewZoomFactor || e->tile.res > tile.res) {
+            continue;
+        }
+        // is the tile (part of) the cached tile?
+        int shift = tile.res - e->tile.res;
+        if ((tile.row >> shift) == e->tile.row && (tile.col >> shift) == e->tile.col) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool RenderCache::HasPreview(DisplayModel* dm, int pageNo, TilePosition tile) {
+    ScopedCritSec scope(&cacheAccess);
+    for (int i = 0; i < cacheCount; i++) {
+        auto e = cache[i];
+        if (e->dm == dm && e->pageNo == pageNo && e->tile == tile && e->isPreview) {
+            return true;
+        }
+    }
+    return false;
 }
 
 void RenderCache::Render(DisplayModel* dm, int pageNo, int rotation, float zoom, RectF pageRect,
@@ -475,7 +551,7 @@ void RenderCache::Render(DisplayModel* dm, int pageNo, int rotation, float zoom,
 }
 
 bool RenderCache::Render(DisplayModel* dm, int pageNo, int rotation, float zoom, TilePosition* tile, RectF* pageRect,
-                         RenderingCallback* renderCb) {
+                         RenderingCallback* renderCb, bool isPreview) {
     logf("RenderCache::Render(): pageNo %d\n", pageNo);
     CrashIf(!dm);
     if (!dm || dm->dontRenderFlag) {
@@ -518,6 +594,9 @@ bool RenderCache::Render(DisplayModel* dm, int pageNo, int rotation, float zoom,
     } else {
         CrashMe();
     }
+    // only tiles are cached and can thus be replaced
+    CrashIf(isPreview && !tile);
+    newRequest->isPreview = isPreview && tile != nullptr;
     newRequest->abort = false;
     newRequest->abortCookie = nullptr;
     newRequest->timestamp = GetTickCount();
@@ -629,6 +708,14 @@ void RenderCache::AbortCurrentRequest() {
     curReq->abort = true;
 }
 
+static TraceHistogram gTraceRenderUs("RenderCache.render.us");
+static TraceHistogram gTracePreviewUs("RenderCache.preview.us");
+// time from requesting a tile until anything of it could be painted
+static TraceHistogram gTraceFirstPixelUs("RenderCache.firstpixel.us");
+static TraceCounter gTraceRenderAborted("RenderCache.render.aborted");
+static TraceCounter gTraceTileHits("RenderCache.tile.hits");
+static TraceCounter gTraceTileMisses("RenderCache.tile.misses");
+
 DWORD WINAPI RenderCache::RenderCacheThread(LPVOID data) {
     RenderCache* cache = (RenderCache*)data;
     PageRenderRequest req;
@@ -661,15 +748,25 @@ DWORD WINAPI RenderCache::RenderCacheThread(LPVOID data) {
         // make sure that we have extracted page text for
         // all rendered pages to allow text selection and
         // searching without any further delays
-        if (!req.dm->textCache->HasTextForPage(req.pageNo)) {
+        // (but not before showing a preview)
+        if (!req.isPreview && !req.dm->textCache->HasTextForPage(req.pageNo)) {
             req.dm->textCache->GetTextForPage(req.pageNo);
         }
 
         CrashIf(req.abortCookie != nullptr);
         EngineBase* engine = req.dm->GetEngine();
-        RenderPageArgs args(req.pageNo, req.zoom, req.rotation, &req.pageRect, RenderTarget::View, &req.abortCookie);
-        bmp = engine->RenderPage(args);
+        float zoom = req.isPreview ? req.zoom * kPreviewZoomFactor : req.zoom;
+        RenderPageArgs args(req.pageNo, zoom, req.rotation, &req.pageRect, RenderTarget::View, &req.abortCookie);
+        args.isPreview = req.isPreview;
+        if (req.isPreview) {
+            TraceScope scope("RenderCache.preview", req.pageNo, &gTracePreviewUs);
+            bmp = engine->RenderPage(args);
+        } else {
+            TraceScope scope("RenderCache.render", req.pageNo, &gTraceRenderUs);
+            bmp = engine->RenderPage(args);
+        }
         if (req.abort) {
+            gTraceRenderAborted.Add();
             delete bmp;
             if (req.renderCb) {
                 req.renderCb->Callback(nullptr);
@@ -681,7 +778,12 @@ DWORD WINAPI RenderCache::RenderCacheThread(LPVOID data) {
             // the callback must free the RenderedBitmap
             req.renderCb->Callback(bmp);
             req.renderCb = (RenderingCallback*)1; // will crash if accessed again, which should not happen
+        } else if (req.isPreview && !bmp) {
+            // the full quality rendering will report the failure
         } else {
+            if (req.isPreview || !cache->HasPreview(req.dm, req.pageNo, req.tile)) {
+                gTraceFirstPixelUs.Record((i64)(GetTickCount() - req.timestamp) * 1000);
+            }
             // don't replace colors for individual images
             if (bmp && !engine->IsImageCollection()) {
                 UpdateBitmapColors(bmp->GetBitmap(), cache->textColor, cache->backgroundColor);
@@ -702,7 +804,10 @@ int RenderCache::PaintTile(HDC hdc, Rect bounds, DisplayModel* dm, int pageNo, T
     BitmapCacheEntry* entry = Find(dm, pageNo, dm->GetRotation(), zoom, &tile);
     int renderDelay = 0;
 
-    if (!entry) {
+    if (entry) {
+        gTraceTileHits.Add();
+    } else {
+        gTraceTileMisses.Add();
         if (!isRemoteSession) {
             if (renderedReplacement) {
                 *renderedReplacement = true;
@@ -12,6 +12,8 @@ constexpr int RENDER_DELAY_UNDEFINED = std::numeric_limits<int>::max() - 2;
 // TODO: this should be based on amount of memory taken by rendered pages
 // i.e. one big page can use as much memory as lots of small pages
 #define MAX_BITMAPS_CACHED 64
+// tiles are first rendered at this fraction of their zoom (see PageRenderRequest.isPreview)
+constexpr float kPreviewZoomFactor = 0.25f;
 
 class RenderingCallback {
   public:
@@ -51,6 +53,9 @@ struct BitmapCacheEntry {
     // owned by the BitmapCacheEntry
     RenderedBitmap* bitmap = nullptr;
     bool outOfDate = false;
+    // rendered at kPreviewZoomFactor * zoom, only used until
+    // the full quality bitmap replaces it
+    bool isPreview = false;
     int refs = 1;
 
     BitmapCacheEntry(DisplayModel* dm, int pageNo, int rotation, float zoom, TilePosition tile,
@@ -78,6 +83,9 @@ struct PageRenderRequest {
     TilePosition tile;
 
     RectF pageRect; // calculated from TilePosition
+    // a quick, low quality rendering of a tile that's queued on top of the
+    // request for the same tile at full quality. Both are cancelled together.
+    bool isPreview = false;
     bool abort = false;
     AbortCookie* abortCookie = nullptr;
     DWORD timestamp = 0;
@@ -139,8 +147,10 @@ class RenderCache {
     }
     int GetRenderDelay(DisplayModel* dm, int pageNo, TilePosition tile);
     void RequestRendering(DisplayModel* dm, int pageNo, TilePosition tile, bool clearQueueForPage = true);
+    bool NeedsPreview(DisplayModel* dm, int pageNo, int rotation, float zoom, TilePosition tile);
+    bool HasPreview(DisplayModel* dm, int pageNo, TilePosition tile);
     bool Render(DisplayModel* dm, int pageNo, int rotation, float zoom, TilePosition* tile = nullptr,
-                RectF* pageRect = nullptr, RenderingCallback* renderCb = nullptr);
+                RectF* pageRect = nullptr, RenderingCallback* renderCb = nullptr, bool isPreview = false);
     void ClearQueueForDisplayModel(DisplayModel* dm, int pageNo = INVALID_PAGE_NO, TilePosition* tile = nullptr);
     void AbortCurrentRequest();
 
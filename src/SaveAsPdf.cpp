@@ -8,6 +8,7 @@ extern "C" {
 
 #include "utils/BaseUtil.h"
 #include "utils/BitManip.h"
+#include "utils/Dict.h"
 #include "utils/FileUtil.h"
 #include "utils/ScopedWin.h"
 #include "utils/WinUtil.h"
@@ -27,24 +28,11 @@ extern "C" {
 
 // based on pdfmerge.c in mupdf
 
-const pdf_write_options pdf_default_write_options2 = {
-    0,   /* do_incremental */
-    0,   /* do_pretty */
-    0,   /* do_ascii */
-    0,   /* do_compress */
-    0,   /* do_compress_images */
-    0,   /* do_compress_fonts */
-    0,   /* do_decompress */
-    0,   /* do_garbage */
-    0,   /* do_linear */
-    0,   /* do_clean */
-    0,   /* do_sanitize */
-    0,   /* do_appearance */
-    0,   /* do_encrypt */
-    ~0,  /* permissions */
-    {0}, /* opwd_utf8[128] */
-    {0}, /* upwd_utf8[128] */
-};
+// Instead of grafting pages into a pdf_document and saving it at the end,
+// objects used by the pages are written to the output as soon as they're
+// copied, so memory use doesn't grow with the size of the output.
+// Objects with identical content (e.g. the same fonts and images embedded
+// in many of the merged files) are only written once.
 
 /* Copy as few key/value pairs as we can. Do not include items that reference other pages. */
 // clang-format off
@@ -61,56 +49,262 @@ static pdf_obj* const copy_list[] = {
 };
 // clang-format on
 
+// uncompressed streams smaller than this are not worth compressing
+constexpr size_t kMinCompressStreamSize = 64;
+
 struct PdfMerger {
     fz_context* ctx = nullptr;
-    pdf_document* doc_des = nullptr;
+    fz_output* out = nullptr;
     pdf_document* doc_src = nullptr;
     VecStr filePaths;
 
+    // offset of each object in the output, indexed by object number
+    Vec<i64> offsets;
+    int catalogObj = 0;
+    int pagesObj = 0;
+    Vec<int> pageObjs;
+
+    // number of the copy in the output for each object in doc_src (0 if not copied yet)
+    Vec<int> srcToDest;
+    // objects of doc_src that are being copied, to detect reference cycles
+    Vec<bool> inProgress;
+    // sha256 of the content of written objects => object number
+    dict::MapStrToInt contentHashes;
+
+    int nObjectsCopied = 0;
+    int nObjectsDeduped = 0;
+    i64 bytesDeduped = 0;
+
     PdfMerger() = default;
     ~PdfMerger();
     bool MergeAndSave(TocItem*, char* dstPath);
     bool MergePdfFile(std::string_view);
-    void MergePdfPage(int page_from, int page_to, pdf_graft_map* graft_map) const;
+    void MergePdfPage(int pageNo);
+
+    int NewObjNum();
+    void WriteObj(int num, fz_buffer* body, fz_buffer* data, bool compress);
+    void SerializeObj(fz_output* o, pdf_obj* obj);
+    int CopyObject(int srcNum);
 };
 
 PdfMerger::~PdfMerger() {
-    pdf_drop_document(ctx, doc_des);
+    fz_drop_output(ctx, out);
     fz_flush_warnings(ctx);
     fz_drop_context(ctx);
 }
 
-void PdfMerger::MergePdfPage(int page_from, int page_to, pdf_graft_map* graft_map) const {
-    pdf_obj* page_ref = nullptr;
-    pdf_obj* page_dict = nullptr;
+int PdfMerger::NewObjNum() {
+    offsets.Append(0);
+    return offsets.isize() - 1;
+}
+
+// body is the serialized object, for streams it's the stream dictionary
+// without /Length and the closing ">>" and data is the raw stream content
+void PdfMerger::WriteObj(int num, fz_buffer* body, fz_buffer* data, bool compress) {
+    offsets[num] = fz_tell_output(ctx, out);
+    fz_write_printf(ctx, out, "%d 0 obj\n", num);
+    u8* d = nullptr;
+    size_t len = fz_buffer_storage(ctx, body, &d);
+    fz_write_data(ctx, out, d, len);
+    if (!data) {
+        fz_write_string(ctx, out, "\nendobj\n");
+        return;
+    }
+
+    len = fz_buffer_storage(ctx, data, &d);
+    u8* compressed = nullptr;
+    fz_var(compressed);
+    fz_try(ctx) {
+        if (compress && len >= kMinCompressStreamSize) {
+            compressed = fz_new_deflated_data_from_buffer(ctx, &len, data, FZ_DEFLATE_DEFAULT);
+            d = compressed;
+            fz_write_string(ctx, out, "/Filter/FlateDecode");
+        }
+        fz_write_printf(ctx, out, "/Length %d>>\nstream\n", (int)len);
+        fz_write_data(ctx, out, d, len);
+        fz_write_string(ctx, out, "\nendstream\nendobj\n");
+    }
+    fz_always(ctx) {
+        fz_free(ctx, compressed);
+    }
+    fz_catch(ctx) {
+        fz_rethrow(ctx);
+    }
+}
+
+// like pdf_print_obj() but with references to objects of doc_src
+// replaced with references to their copies in the output
+void PdfMerger::SerializeObj(fz_output* o, pdf_obj* obj) {
+    if (pdf_is_indirect(ctx, obj)) {
+        int num = CopyObject(pdf_to_num(ctx, obj));
+        if (num == 0) {
+            fz_write_string(ctx, o, "null");
+        } else {
+            fz_write_printf(ctx, o, "%d 0 R", num);
+        }
+        return;
+    }
+    if (pdf_is_array(ctx, obj)) {
+        fz_write_byte(ctx, o, '[');
+        int n = pdf_array_len(ctx, obj);
+        for (int i = 0; i < n; i++) {
+            if (i > 0) {
+                fz_write_byte(ctx, o, ' ');
+            }
+            SerializeObj(o, pdf_array_get(ctx, obj, i));
+        }
+        fz_write_byte(ctx, o, ']');
+        return;
+    }
+    if (pdf_is_dict(ctx, obj)) {
+        fz_write_string(ctx, o, "<<");
+        int n = pdf_dict_len(ctx, obj);
+        for (int i = 0; i < n; i++) {
+            pdf_print_obj(ctx, o, pdf_dict_get_key(ctx, obj, i), 1, 0);
+            fz_write_byte(ctx, o, ' ');
+            SerializeObj(o, pdf_dict_get_val(ctx, obj, i));
+        }
+        fz_write_string(ctx, o, ">>");
+        return;
+    }
+    pdf_print_obj(ctx, o, obj, 1, 0);
+}
+
+// copies object srcNum of doc_src (and all objects it references) to the
+// output unless an object with the same content has already been written.
+// Returns the object number in the output (0 for broken references)
+int PdfMerger::CopyObject(int srcNum) {
+    if (srcNum <= 0 || srcNum >= srcToDest.isize()) {
+        return 0;
+    }
+    if (inProgress[srcNum]) {
+        // a reference cycle: the object needs a number before
+        // we know its content, so it won't be de-duplicated
+        if (srcToDest[srcNum] == 0) {
+            srcToDest[srcNum] = NewObjNum();
+        }
+        return srcToDest[srcNum];
+    }
+    if (srcToDest[srcNum] != 0) {
+        return srcToDest[srcNum];
+    }
+
+    inProgress[srcNum] = true;
     pdf_obj* obj = nullptr;
-    pdf_obj* ref = nullptr;
-    int i;
+    fz_buffer* body = nullptr;
+    fz_buffer* data = nullptr;
+    fz_output* o = nullptr;
+    fz_var(obj);
+    fz_var(body);
+    fz_var(data);
+    fz_var(o);
+    fz_try(ctx) {
+        obj = pdf_load_object(ctx, doc_src, srcNum);
+        body = fz_new_buffer(ctx, 256);
+        o = fz_new_output_with_buffer(ctx, body);
+        if (pdf_obj_num_is_stream(ctx, doc_src, srcNum)) {
+            // the content is copied as is (still compressed)
+            data = pdf_load_raw_stream_number(ctx, doc_src, srcNum);
+            fz_write_string(ctx, o, "<<");
+            int n = pdf_dict_len(ctx, obj);
+            for (int i = 0; i < n; i++) {
+                pdf_obj* key = pdf_dict_get_key(ctx, obj, i);
+                if (pdf_name_eq(ctx, key, PDF_NAME(Length))) {
+                    continue;
+                }
+                pdf_print_obj(ctx, o, key, 1, 0);
+                fz_write_byte(ctx, o, ' ');
+                SerializeObj(o, pdf_dict_get_val(ctx, obj, i));
+            }
+        } else {
+            SerializeObj(o, obj);
+        }
+        fz_close_output(ctx, o);
+        inProgress[srcNum] = false;
+
+        // compress streams that aren't compressed yet
+        bool compress = data && !pdf_dict_get(ctx, obj, PDF_NAME(Filter)) &&
+                        !pdf_dict_get(ctx, obj, PDF_NAME(DecodeParms));
+        int destNum = srcToDest[srcNum];
+        if (destNum != 0) {
+            // part of a reference cycle
+            WriteObj(destNum, body, data, compress);
+        } else {
+            fz_sha256 sha;
+            u8 digest[32];
+            fz_sha256_init(&sha);
+            u8* d = nullptr;
+            size_t len = fz_buffer_storage(ctx, body, &d);
+            fz_sha256_update(&sha, d, len);
+            if (data) {
+                len = fz_buffer_storage(ctx, data, &d);
+                fz_sha256_update(&sha, d, len);
+            }
+            fz_sha256_final(&sha, digest);
+            char* key = str::MemToHex(digest, dimof(digest));
+            bool isDuplicate = contentHashes.Get(key, &destNum);
+            if (!isDuplicate) {
+                destNum = NewObjNum();
+                contentHashes.Insert(key, destNum);
+            }
+            free(key);
+            if (isDuplicate) {
+                nObjectsDeduped++;
+                bytesDeduped += (i64)fz_buffer_storage(ctx, body, nullptr);
+                if (data) {
+                    bytesDeduped += (i64)fz_buffer_storage(ctx, data, nullptr);
+                }
+                srcToDest[srcNum] = destNum;
+            } else {
+                srcToDest[srcNum] = destNum;
+                WriteObj(destNum, body, data, compress);
+                nObjectsCopied++;
+            }
+        }
+    }
+    fz_always(ctx) {
+        fz_drop_output(ctx, o);
+        fz_drop_buffer(ctx, data);
+        fz_drop_buffer(ctx, body);
+        pdf_drop_obj(ctx, obj);
+    }
+    fz_catch(ctx) {
+        fz_rethrow(ctx);
+    }
+    return srcToDest[srcNum];
+}
 
-    fz_var(ref);
-    fz_var(page_dict);
+void PdfMerger::MergePdfPage(int pageNo) {
+    fz_buffer* body = nullptr;
+    fz_output* o = nullptr;
+    fz_var(body);
+    fz_var(o);
 
     fz_try(ctx) {
-        page_ref = pdf_lookup_page_obj(ctx, doc_src, page_from - 1);
+        pdf_obj* page_ref = pdf_lookup_page_obj(ctx, doc_src, pageNo - 1);
         pdf_flatten_inheritable_page_items(ctx, page_ref);
 
-        page_dict = pdf_new_dict(ctx, doc_des, 4);
-
-        pdf_dict_put(ctx, page_dict, PDF_NAME(Type), PDF_NAME(Page));
-        for (i = 0; i < (int)nelem(copy_list); i++) {
-            obj = pdf_dict_get(ctx, page_ref, copy_list[i]);
+        body = fz_new_buffer(ctx, 256);
+        o = fz_new_output_with_buffer(ctx, body);
+        fz_write_printf(ctx, o, "<</Type/Page/Parent %d 0 R", pagesObj);
+        for (int i = 0; i < (int)nelem(copy_list); i++) {
+            pdf_obj* obj = pdf_dict_get(ctx, page_ref, copy_list[i]);
             if (obj != nullptr) {
-                pdf_dict_put_drop(ctx, page_dict, copy_list[i], pdf_graft_mapped_object(ctx, graft_map, obj));
+                pdf_print_obj(ctx, o, copy_list[i], 1, 0);
+                fz_write_byte(ctx, o, ' ');
+                SerializeObj(o, obj);
             }
         }
+        fz_write_string(ctx, o, ">>");
+        fz_close_output(ctx, o);
 
-        ref = pdf_add_object(ctx, doc_des, page_dict);
-
-        pdf_insert_page(ctx, doc_des, page_to - 1, ref);
+        int num = NewObjNum();
+        WriteObj(num, body, nullptr, false);
+        pageObjs.Append(num);
     }
     fz_always(ctx) {
-        pdf_drop_obj(ctx, page_dict);
-        pdf_drop_obj(ctx, ref);
+        fz_drop_output(ctx, o);
+        fz_drop_buffer(ctx, body);
     }
     fz_catch(ctx) {
         fz_rethrow(ctx);
@@ -118,24 +312,23 @@ void PdfMerger::MergePdfPage(int page_from, int page_to, pdf_graft_map* graft_ma
 }
 
 bool PdfMerger::MergePdfFile(std::string_view path) {
-    doc_src = pdf_open_document(ctx, path.data());
-    if (!doc_src) {
-        return false;
-    }
-
-    int nPages = 0;
-    pdf_graft_map* graft_map = nullptr;
-
     fz_try(ctx) {
-        nPages = pdf_count_pages(ctx, doc_src);
-        graft_map = pdf_new_graft_map(ctx, doc_des);
+        doc_src = pdf_open_document(ctx, path.data());
+        int n = pdf_xref_len(ctx, doc_src);
+        srcToDest.Reset();
+        srcToDest.AppendBlanks(n);
+        inProgress.Reset();
+        inProgress.AppendBlanks(n);
+
+        int nPages = pdf_count_pages(ctx, doc_src);
         for (int i = 1; i <= nPages; i++) {
-            MergePdfPage(i, -1, graft_map);
+            MergePdfPage(i);
         }
     }
     fz_always(ctx) {
-        pdf_drop_graft_map(ctx, graft_map);
+        // we're done with this document, free its memory before opening the next one
         pdf_drop_document(ctx, doc_src);
+        doc_src = nullptr;
     }
     fz_catch(ctx) {
         // TODO: show error message
@@ -160,43 +353,63 @@ bool PdfMerger::MergeAndSave(TocItem* root, char* dstPath) {
         return false;
     }
 
-    ctx = fz_new_context(nullptr, nullptr, FZ_STORE_UNLIMITED);
+    ctx = fz_new_context(nullptr, nullptr, FZ_STORE_DEFAULT);
+    if (!ctx) {
+        return false;
+    }
 
     // TODO: install warnigngs redirect
     fz_try(ctx) {
-        doc_des = pdf_create_document(ctx);
+        out = fz_new_output_with_path(ctx, dstPath, 0);
+        fz_write_string(ctx, out, "%PDF-1.7\n%\xE2\xE3\xCF\xD3\n");
     }
     fz_catch(ctx) {
-        doc_des = nullptr;
-    }
-    if (doc_des == nullptr) {
         return false;
     }
+    // object 0 is the head of the free list
+    NewObjNum();
+    catalogObj = NewObjNum();
+    pagesObj = NewObjNum();
 
-    bool ok;
-    for (int i = 0; i < nFiles; i++) {
+    bool ok = true;
+    for (int i = 0; ok && i < nFiles; i++) {
         std::string_view path = filePaths.at(i);
         ok = MergePdfFile(path);
-        if (!ok) {
-            // TODO: show error message
-            return false;
-        }
     }
-
-    pdf_write_options opts = pdf_default_write_options2;
-    // TODO: compare results with and without compression
-    opts.do_compress = 1;
-    opts.do_compress_images = 1;
-    opts.do_compress_fonts = 1;
+    logf("PdfMerger: %d objects written, %d duplicates (%d kB) skipped\n", nObjectsCopied, nObjectsDeduped,
+         (int)(bytesDeduped / 1024));
 
     fz_try(ctx) {
-        pdf_save_document(ctx, doc_des, dstPath, &opts);
+        if (ok) {
+            offsets[pagesObj] = fz_tell_output(ctx, out);
+            fz_write_printf(ctx, out, "%d 0 obj\n<</Type/Pages/Count %d/Kids[", pagesObj, pageObjs.isize());
+            for (int i = 0; i < pageObjs.isize(); i++) {
+                fz_write_printf(ctx, out, i > 0 ? " %d 0 R" : "%d 0 R", pageObjs[i]);
+            }
+            fz_write_string(ctx, out, "]>>\nendobj\n");
+            offsets[catalogObj] = fz_tell_output(ctx, out);
+            fz_write_printf(ctx, out, "%d 0 obj\n<</Type/Catalog/Pages %d 0 R>>\nendobj\n", catalogObj, pagesObj);
+
+            i64 xrefPos = fz_tell_output(ctx, out);
+            fz_write_printf(ctx, out, "xref\n0 %d\n0000000000 65535 f \n", offsets.isize());
+            for (int i = 1; i < offsets.isize(); i++) {
+                fz_write_printf(ctx, out, "%010ld 00000 n \n", offsets[i]);
+            }
+            fz_write_printf(ctx, out, "trailer\n<</Size %d/Root %d 0 R>>\nstartxref\n%ld\n%%%%EOF\n",
+                            offsets.isize(), catalogObj, xrefPos);
+        }
+        fz_close_output(ctx, out);
     }
     fz_catch(ctx) {
         // TODO: show an error message?
-        return false;
+        ok = false;
     }
-    return true;
+    fz_drop_output(ctx, out);
+    out = nullptr;
+    if (!ok) {
+        file::Delete(dstPath);
+    }
+    return ok;
 }
 
 bool SaveVirtualAsPdf(TocItem* root, char* dstPath) {
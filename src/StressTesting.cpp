@@ -3,6 +3,7 @@
 
 #include "utils/BaseUtil.h"
 #include "utils/ScopedWin.h"
+#include "utils/BenchReport.h"
 #include "utils/DirIter.h"
 #include "utils/FileUtil.h"
 #include "utils/GuessFileType.h"
@@ -69,6 +70,18 @@ static bool IsFullRange(Vec<PageRange>& ranges) {
     return isFull;
 }
 
+// timings of all benchmarked files, for -bench-report
+struct BenchTimings {
+    BenchSamples load;
+    // time to load and render a page
+    BenchSamples render;
+    int files = 0;
+    int failedFiles = 0;
+    i64 pages = 0;
+};
+
+static BenchTimings gBenchTimings;
+
 static void BenchLoadRender(EngineBase* engine, int pagenum) {
     auto t = TimeGet();
     bool ok = engine->BenchLoadPage(pagenum);
@@ -77,8 +90,8 @@ static void BenchLoadRender(EngineBase* engine, int pagenum) {
         logf(L"Error: failed to load page %d\n", pagenum);
         return;
     }
-    double timeMs = TimeSinceInMs(t);
-    logf(L"pageload   %3d: %.2f ms\n", pagenum, timeMs);
+    double loadMs = TimeSinceInMs(t);
+    logf(L"pageload   %3d: %.2f ms\n", pagenum, loadMs);
 
     t = TimeGet();
     RenderPageArgs args(pagenum, 1.0, 0);
@@ -89,8 +102,10 @@ static void BenchLoadRender(EngineBase* engine, int pagenum) {
         return;
     }
     delete rendered;
-    timeMs = TimeSinceInMs(t);
+    double timeMs = TimeSinceInMs(t);
     logf(L"pagerender %3d: %.2f ms\n", pagenum, timeMs);
+    gBenchTimings.render.Add(loadMs + timeMs);
+    gBenchTimings.pages++;
 }
 
 static void BenchChmLoadOnly(const WCHAR* filePath) {
@@ -134,15 +149,18 @@ static void BenchFile(const WCHAR* filePath, const WCHAR* pagesSpec) {
     auto total = TimeGet();
     logf(L"Starting: %s\n", filePath);
 
+    gBenchTimings.files++;
     auto t = TimeGet();
     EngineBase* engine = CreateEngine(filePath, nullptr, true);
     if (!engine) {
         logf(L"Error: failed to load %s\n", filePath);
+        gBenchTimings.failedFiles++;
         return;
     }
 
     double timeMs = TimeSinceInMs(t);
     logf("load: %.2f ms\n", timeMs);
+    gBenchTimings.load.Add(timeMs);
     int pages = engine->PageCount();
     logf("page count: %d\n", pages);
 
@@ -197,7 +215,25 @@ static void BenchDir(WCHAR* dir) {
     }
 }
 
-void BenchFileOrDir(WStrVec& pathsToBench) {
+static void WriteBenchReport(const WCHAR* reportPath, double wallMs) {
+    BenchReport report;
+    report.files = gBenchTimings.files;
+    report.failedFiles = gBenchTimings.failedFiles;
+    report.pages = gBenchTimings.pages;
+    report.wallMs = wallMs;
+    report.peakMemBytes = GetPeakMemoryUsage();
+    report.metrics[(int)BenchMetric::Load] = gBenchTimings.load.Summarize();
+    report.metrics[(int)BenchMetric::Render] = gBenchTimings.render.Summarize();
+
+    str::Str json;
+    BenchReportToJson(report, json);
+    if (!file::WriteFile(reportPath, json.AsByteSlice())) {
+        logf(L"Error: failed to write %s\n", reportPath);
+    }
+}
+
+void BenchFileOrDir(WStrVec& pathsToBench, const WCHAR* reportPath) {
+    auto t = TimeGet();
     size_t n = pathsToBench.size() / 2;
     for (size_t i = 0; i < n; i++) {
         WCHAR* path = pathsToBench.at(2 * i);
@@ -209,6 +245,9 @@ void BenchFileOrDir(WStrVec& pathsToBench) {
             logf(L"Error: file or dir %s doesn't exist", path);
         }
     }
+    if (reportPath) {
+        WriteBenchReport(reportPath, TimeSinceInMs(t));
+    }
 }
 
 static bool IsStressTestSupportedFile(const WCHAR* filePath, const WCHAR* filter) {
@@ -1,7 +1,7 @@
 /* Copyright 2021 the SumatraPDF project authors (see AUTHORS file).
    License: GPLv3 */
 
-void BenchFileOrDir(WStrVec& pathsToBench);
+void BenchFileOrDir(WStrVec& pathsToBench, const WCHAR* reportPath = nullptr);
 bool IsStressTesting();
 void BenchEbookLayout(WCHAR* filePath);
 
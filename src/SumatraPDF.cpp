@@ -18,6 +18,7 @@
 #include "utils/WinUtil.h"
 #include "utils/GdiPlusUtil.h"
 #include "utils/Archive.h"
+#include "utils/Trace.h"
 
 #include "wingui/WinGui.h"
 #include "wingui/Layout.h"
@@ -71,6 +72,7 @@
 #include "ExternalViewers.h"
 #include "Favorites.h"
 #include "FileThumbnails.h"
+#include "ContentBoxCache.h"
 #include "Menu.h"
 #include "Print.h"
 #include "SearchAndDDE.h"
@@ -641,6 +643,7 @@ struct ControllerCallbackHandler : ControllerCallback {
     void RequestRendering(int pageNo) override;
     void CleanUp(DisplayModel* dm) override;
     void RenderThumbnail(DisplayModel* dm, Size size, const onBitmapRenderedCb&) override;
+    void LoadProgress(DisplayModel* dm, int pageNo) override;
     void GotoLink(IPageDestination* dest) override {
         win->linkHandler->GotoLink(dest);
     }
@@ -721,6 +724,39 @@ void ControllerCallbackHandler::RequestRendering(int pageNo) {
     }
 }
 
+void ControllerCallbackHandler::LoadProgress(DisplayModel* dm, int pageNo) {
+    WindowInfo* win = this->win;
+    uitask::Post([=] {
+        if (!WindowInfoStillValid(win)) {
+            return;
+        }
+        TabInfo* tab = nullptr;
+        for (TabInfo* t : win->tabs) {
+            if (t->AsFixed() == dm) {
+                tab = t;
+            }
+        }
+        // the document might have been closed in the meantime
+        if (!tab) {
+            return;
+        }
+        bool isCurrent = tab == win->currentTab;
+        if (pageNo > 0) {
+            gRenderCache.Invalidate(dm, pageNo, dm->GetEngine()->PageMediabox(pageNo));
+        } else {
+            // page sizes and the ToC are only known once the whole document has been read
+            dm->PageSizesChanged();
+            if (isCurrent && !tab->currToc && tab->showToc && dm->HacToc()) {
+                ClearTocBox(win);
+                SetSidebarVisibility(win, true, gGlobalPrefs->showFavorites);
+            }
+        }
+        if (isCurrent) {
+            RepaintAsync(win, 0);
+        }
+    });
+}
+
 void ControllerCallbackHandler::CleanUp(DisplayModel* dm) {
     gRenderCache.CancelRendering(dm);
     gRenderCache.FreeForDisplayModel(dm);
@@ -1533,6 +1569,7 @@ static void scheduleReloadTab(TabInfo* tab) {
 // window or creating a new window for the document)
 WindowInfo* LoadDocument(LoadArgs& args) {
     CrashAlwaysIf(gCrashOnOpen);
+    TraceScope scope("LoadDocument");
 
     int threadID = (int)GetCurrentThreadId();
     AutoFreeWstr fullPath(path::Normalize(args.fileName));
@@ -1935,6 +1972,24 @@ void UpdateDocumentColors() {
     RerenderEverything();
 }
 
+// PDFs with a broken xref are only repaired the first time they're opened,
+// the repair is saved next to the other cached data
+void UpdateRepairCacheDir() {
+    if (!HasPermission(Perm::SavePreferences | Perm::DiskAccess) || !gGlobalPrefs->rememberOpenedFiles) {
+        SetEngineMupdfRepairCacheDir(nullptr);
+        return;
+    }
+    AutoFreeWstr cacheDir = AppGenDataFilename(L"sumatrapdfcache");
+    SetEngineMupdfRepairCacheDir(cacheDir);
+}
+
+void CleanUpRepairCache(bool removeAll) {
+    AutoFreeWstr cacheDir = AppGenDataFilename(L"sumatrapdfcache");
+    if (cacheDir) {
+        CleanUpEngineMupdfRepairCache(cacheDir, removeAll);
+    }
+}
+
 void UpdateFixedPageScrollbarsVisibility() {
     bool hideScrollbars = gGlobalPrefs->fixedPageUI.hideScrollbars;
     bool scrollbarsVisible = false; // assume no scrollbars by default
@@ -2560,8 +2615,9 @@ static void OnMenuSaveAs(WindowInfo* win) {
         PdfCreator::SetProducerName(producerName);
         ok = engine->SaveFileAsPDF(pathA.Get());
         if (!ok && gIsDebugBuild) {
-            // rendering includes all page annotations
-            ok = PdfCreator::RenderToFile(pathA.Get(), engine);
+            // rendering includes all page annotations.
+            // use only a few threads so that the ui stays responsive
+            ok = PdfCreator::RenderToFile(pathA.Get(), engine, 150, 2);
         }
     } else if (!file::Exists(srcFileName) && engine) {
         // Recreate inexistant files from memory...
@@ -3243,7 +3299,10 @@ static void OnMenuOptions(HWND hwnd) {
     if (!gGlobalPrefs->rememberOpenedFiles) {
         gFileHistory.Clear(true);
         CleanUpThumbnailCache(gFileHistory);
+        CleanUpContentBoxCache(true);
+        CleanUpRepairCache(true);
     }
+    UpdateRepairCacheDir();
     UpdateDocumentColors();
 
     // note: ideally we would also update state for useTabs changes but that's complicated since
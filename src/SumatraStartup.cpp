@@ -18,6 +18,7 @@
 #include "utils/WinUtil.h"
 #include "utils/Archive.h"
 #include "utils/LzmaSimpleArchive.h"
+#include "utils/Trace.h"
 
 #include "SumatraConfig.h"
 
@@ -58,6 +59,7 @@
 #include "Caption.h"
 #include "CrashHandler.h"
 #include "FileThumbnails.h"
+#include "ContentBoxCache.h"
 #include "Print.h"
 #include "SearchAndDDE.h"
 #include "Selection.h"
@@ -836,6 +838,23 @@ static void testLogf() {
 
 // in mupdf_load_system_font.c
 extern "C" void destroy_system_font_list();
+extern "C" void start_system_font_index(const WCHAR* indexPath);
+
+// the index of the system fonts is kept next to the other cached data,
+// it's only rebuilt for fonts that were added or modified since
+static void StartSystemFontIndex() {
+    AutoFreeWstr indexPath;
+    if (HasPermission(Perm::SavePreferences | Perm::DiskAccess)) {
+        indexPath.Set(AppGenDataFilename(L"sumatrapdfcache\\systemfonts.idx"));
+    }
+    if (indexPath) {
+        AutoFreeWstr cacheDir = path::GetDir(indexPath);
+        if (!dir::Create(cacheDir)) {
+            indexPath.Reset();
+        }
+    }
+    start_system_font_index(indexPath);
+}
 
 // in MemLeakDetect.cpp
 extern bool MemLeakInit();
@@ -927,6 +946,9 @@ int APIENTRY WinMain(HINSTANCE hInstance, __unused HINSTANCE hPrevInstance, __un
     Flags flags;
     ParseFlags(GetCommandLineW(), flags);
     gCli = &flags;
+    if (flags.tracePath) {
+        TraceStart();
+    }
 
 #if defined(DEBUG)
     if (gIsDebugBuild || gIsPreReleaseBuild) {
@@ -1060,6 +1082,9 @@ int APIENTRY WinMain(HINSTANCE hInstance, __unused HINSTANCE hPrevInstance, __un
     UpdateGlobalPrefs(flags);
     SetCurrentLang(flags.lang ? flags.lang : gGlobalPrefs->uiLanguage);
 
+    StartSystemFontIndex();
+    UpdateRepairCacheDir();
+
     // This allows ad-hoc comparison of gdi, gdi+ and gdi+ quick when used
     // in layout
 #if 0
@@ -1084,7 +1109,7 @@ int APIENTRY WinMain(HINSTANCE hInstance, __unused HINSTANCE hPrevInstance, __un
     }
 
     if (flags.pathsToBenchmark.size() > 0) {
-        BenchFileOrDir(flags.pathsToBenchmark);
+        BenchFileOrDir(flags.pathsToBenchmark, flags.benchReportPath);
     }
 
     if (flags.exitImmediately) {
@@ -1281,10 +1306,17 @@ int APIENTRY WinMain(HINSTANCE hInstance, __unused HINSTANCE hPrevInstance, __un
     retCode = RunMessageLoop();
     SafeCloseHandle(&hMutex);
     CleanUpThumbnailCache(gFileHistory);
+    CleanUpContentBoxCache(false);
+    CleanUpRepairCache(false);
 
 Exit:
     prefs::UnregisterForFileChanges();
 
+    if (flags.tracePath) {
+        TraceStop();
+        TraceWriteChromeJson(ToUtf8Temp(flags.tracePath));
+    }
+
     HandleRedirectedConsoleOnShutdown();
 
     if (fastExit) {
@@ -246,18 +246,33 @@ void ToggleTocBox(WindowInfo* win) {
     }
 }
 
+// like VisitTocTree() but doesn't load children that haven't been loaded yet
+static bool VisitLoadedTocItems(TocItem* ti, const std::function<bool(TocItem*)>& f) {
+    while (ti) {
+        if (!f(ti)) {
+            return false;
+        }
+        if (ti->child && !VisitLoadedTocItems(ti->child, f)) {
+            return false;
+        }
+        ti = ti->next;
+    }
+    return true;
+}
+
 // find the closest item in tree view to a given page number
+// children that aren't loaded yet are only in collapsed items,
+// which is where the selection would end up anyway
 static TocItem* TreeItemForPageNo(TreeCtrl* treeCtrl, int pageNo) {
     TocItem* bestMatch = nullptr;
     int bestMatchPageNo = 0;
 
-    TreeModel* tm = treeCtrl->treeModel;
-    if (!tm) {
+    TocTree* tocTree = (TocTree*)treeCtrl->treeModel;
+    if (!tocTree) {
         return 0;
     }
     int nItems = 0;
-    VisitTreeModelItems(tm, [&](TreeModel* tm, TreeItem ti) {
-        auto tocItem = (TocItem*)ti;
+    VisitLoadedTocItems(tocTree->root, [&](TocItem* tocItem) {
         if (!tocItem) {
             return true;
         }
@@ -318,15 +333,20 @@ void UpdateTocSelection(WindowInfo* win, int currPageNo) {
     treeCtrl->SelectItem(toSelect);
 }
 
+// children that aren't loaded yet have the default state (see SetInitialExpandState)
 static void UpdateDocTocExpansionStateRecur(TreeCtrl* treeCtrl, Vec<int>& tocState, TocItem* tocItem) {
     while (tocItem) {
         // items without children cannot be toggled
-        if (tocItem->child) {
+        if (tocItem->HasChildren()) {
             // we have to query the state of the tree view item because
             // isOpenToggled is not kept in sync
             // TODO: keep toggle state on TocItem in sync
             // by subscribing to the right notifications
-            bool isExpanded = treeCtrl->IsExpanded((TreeItem)tocItem);
+            // items are only in the tree view if their parent was expanded
+            bool isExpanded = tocItem->IsExpanded();
+            if (tocItem->hItem) {
+                isExpanded = treeCtrl->IsExpanded((TreeItem)tocItem);
+            }
             bool wasToggled = isExpanded != tocItem->isOpenDefault;
             if (wasToggled) {
                 tocState.Append(tocItem->id);
@@ -398,12 +418,27 @@ next:
     goto next;
 }
 
-static void SetInitialExpandState(TocItem* item, Vec<int>& tocState) {
+static bool HasIdBetween(Vec<int>& tocState, int firstId, int endId) {
+    for (int id : tocState) {
+        if (firstId <= id && id < endId) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// children that aren't loaded yet are only loaded if the state of one of
+// them was saved. ids are assigned in pre-order, so the ids of the children
+// of an item are between its id and the id of the item after it
+static void SetInitialExpandState(TocItem* item, Vec<int>& tocState, int endId) {
     while (item) {
         if (tocState.Contains(item->id)) {
             item->isOpenToggled = true;
         }
-        SetInitialExpandState(item->child, tocState);
+        int nextId = item->next ? item->next->id : endId;
+        if (item->child || HasIdBetween(tocState, item->id + 1, nextId)) {
+            SetInitialExpandState(item->GetChild(), tocState, nextId);
+        }
         item = item->next;
     }
 }
@@ -612,7 +647,7 @@ void LoadTocTree(WindowInfo* win) {
     SetRtl(hwnd, isRTL);
 
     UpdateTreeCtrlColors(win);
-    SetInitialExpandState(tocTree->root, tab->tocState);
+    SetInitialExpandState(tocTree->root, tab->tocState, INT_MAX);
     AutoExpandTopLevelItems(tocTree->root->child);
 
     treeCtrl->SetTreeModel(tocTree);
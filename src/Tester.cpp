@@ -7,6 +7,7 @@
 
 #include "utils/BaseUtil.h"
 #include "utils/ScopedWin.h"
+#include "utils/BlockCachedStream.h"
 #include "utils/CmdLineArgsIter.h"
 #include "utils/CryptoUtil.h"
 #include "utils/DirIter.h"
@@ -16,19 +17,28 @@
 #include "utils/HtmlParserLookup.h"
 #include "utils/HtmlPrettyPrint.h"
 #include "mui/Mui.h"
+#include "utils/PixelConvert.h"
 #include "utils/Timer.h"
 #include "utils/WinUtil.h"
 #include "utils/ZipUtil.h"
+#include "utils/Archive.h"
 
 #include "wingui/TreeModel.h"
 #include "DisplayMode.h"
 #include "Controller.h"
 #include "EngineBase.h"
+#include "EngineAll.h"
 #include "EbookBase.h"
 #include "PalmDbReader.h"
 #include "MobiDoc.h"
 #include "HtmlFormatter.h"
 #include "EbookFormatter.h"
+#include "PdfSync.h"
+#include "ProgressUpdateUI.h"
+#include "SumatraDialogs.h"
+#include "Print.h"
+#include "PdfCreator.h"
+#include "SaveAsPdf.h"
 
 // if true, we'll save html content of a mobi ebook as well
 // as pretty-printed html to MOBI_SAVE_DIR. The name will be
@@ -51,6 +61,21 @@ static int Usage() {
     printf("  -save-images - will save images extracted from mobi files\n");
     printf("  -zip-create - creates a sample zip file that needs to be manually checked that it worked\n");
     printf("  -bench-md5 - compare Window's md5 vs. our code\n");
+    printf("  -bench-pdfsync - build the index of a generated 50 MB .pdfsync file\n");
+    printf("  -bench-stream file.pdf - load and render a PDF from a slow IStream with different block sizes\n");
+    printf("  -bench-archive - look up every entry of a generated zip file with 50k entries\n");
+    printf("  -bench-layout file.mobi - layout speed in words/sec with and without the text measure cache\n");
+    printf("  -bench-print file.pdf - print all pages to a raw file at 300 and 600 dpi\n");
+    printf("  -bench-merge - merge 200 generated PDF files that share the same image\n");
+    printf("  -bench-glyphcache file.pdf - render pages in tiles at 300%% zoom with different glyph cache sizes\n");
+    printf("  -bench-fontindex [dir] - index fonts in dir (default: Windows fonts) with and without a saved index\n");
+    printf("  -bench-repair file.pdf - open a PDF with a broken xref with and without a saved repair\n");
+    printf("  -bench-jpx file.pdf - render pages with JPEG 2000 images with 1 and all cpus, at 100%% and 25%% zoom\n");
+    printf("  -test-jpx-smask - render a generated PDF with an image whose soft mask is a JPEG 2000 image\n");
+    printf("  -bench-toc - build the ToC of a generated PDF with a 200k items outline, on demand and all of it\n");
+    printf("  -bench-progressive file.pdf [kbps] - time to first page of a linearized PDF read at kbps kB/s\n");
+    printf("  -bench-pixconvert - throughput of pixel conversion kernels on a 4K frame, scalar and simd\n");
+    printf("  -bench-color file.pdf - render pages twice and show the time spent converting colors\n");
     system("pause");
     return 1;
 }
@@ -108,6 +133,51 @@ static void MobiLayout(MobiDoc* mobiDoc) {
     delete pages;
 }
 
+// lays out a mobi file at a few page sizes (as when resizing the window),
+// without and then with caching of measured words
+static void BenchLayout(const WCHAR* filePath) {
+    MobiDoc* mobiDoc = MobiDoc::CreateFromFile(filePath);
+    if (!mobiDoc) {
+        printf("failed to load %s\n", ToUtf8Temp(filePath).Get());
+        return;
+    }
+    float pageSizes[][2] = {{640, 480}, {600, 800}, {800, 600}, {1024, 768}};
+    for (bool cache : {false, true}) {
+        i64 nWords = 0;
+        auto t = TimeGet();
+        for (auto& size : pageSizes) {
+            PoolAllocator textAllocator;
+            HtmlFormatterArgs args;
+            args.pageDx = size[0];
+            args.pageDy = size[1];
+            args.SetFontName(L"Tahoma");
+            args.fontSize = 12;
+            args.htmlStr = mobiDoc->GetHtmlData();
+            args.textAllocator = &textAllocator;
+            args.cacheTextMeasure = cache;
+
+            MobiFormatter mf(&args, mobiDoc);
+            Vec<HtmlPage*>* pages = mf.FormatAllPages();
+            for (HtmlPage* page : *pages) {
+                for (DrawInstr& i : page->instructions) {
+                    if (DrawInstrType::String == i.type || DrawInstrType::RtlString == i.type) {
+                        nWords++;
+                    }
+                }
+            }
+            DeleteVecMembers<HtmlPage*>(*pages);
+            delete pages;
+        }
+        double dur = TimeSinceInMs(t);
+        printf("%s cache: %d layouts, %lld words in %.2f ms, %.0f words/sec\n", cache ? "with" : "without",
+               (int)dimof(pageSizes), nWords, dur, dur > 0 ? (double)nWords * 1000.0 / dur : 0);
+    }
+    auto stats = mui::GetCachedFont(L"Tahoma", 12, FontStyleRegular)->GetMeasureCache()->GetStats();
+    printf("measure cache of default font: %d strings, %lld hits, %lld misses\n", stats.count, stats.hits,
+           stats.misses);
+    delete mobiDoc;
+}
+
 static void MobiTestFile(const WCHAR* filePath) {
     wprintf(L"Testing file '%s'\n", filePath);
     MobiDoc* mobiDoc = MobiDoc::CreateFromFile(filePath);
@@ -187,6 +257,656 @@ void ZipCreateTest() {
     }
 }
 
+// creates a zip with 50k entries (like a huge EPUB) and looks up every
+// entry by name, as loading an EPUB does for each manifest item
+static void BenchArchive() {
+    const WCHAR* zipFileName = L"tester-tmp-50k.zip";
+    const int nFiles = 50000;
+    file::Delete(zipFileName);
+
+    str::Str name;
+    {
+        ZipCreator zc(zipFileName);
+        for (int i = 0; i < nFiles; i++) {
+            name.Reset();
+            name.AppendFmt("OEBPS/Text/chapter %05d.xhtml", i);
+            if (!zc.AddFileData(name.Get(), name.Get(), name.size())) {
+                printf("BenchArchive: failed to add %s\n", name.Get());
+                return;
+            }
+        }
+        if (!zc.Finish()) {
+            printf("BenchArchive: ZipCreator::Finish() failed\n");
+            return;
+        }
+    }
+
+    auto t = TimeGet();
+    MultiFormatArchive* archive = OpenZipArchive(zipFileName, false);
+    if (!archive) {
+        printf("BenchArchive: failed to open %s\n", ToUtf8Temp(zipFileName).Get());
+        return;
+    }
+    double openMs = TimeSinceInMs(t);
+
+    // look up names as they appear in EPUB manifests
+    t = TimeGet();
+    int nFound = 0;
+    for (int i = 0; i < nFiles; i++) {
+        name.Reset();
+        name.AppendFmt("./oebps/text/Chapter%%20%05d.xhtml", i);
+        if (archive->GetFileId(name.Get()) == (size_t)i) {
+            nFound++;
+        }
+    }
+    double lookupMs = TimeSinceInMs(t);
+    printf("%d entries: open %.2f ms, %d lookups %.2f ms, %d found\n", nFiles, openMs, nFiles, lookupMs, nFound);
+
+    // what it used to cost to scan all entries for each lookup
+    const int nSample = 1000;
+    auto& fileInfos = archive->GetFileInfos();
+    t = TimeGet();
+    for (int i = 0; i < nFiles; i += nFiles / nSample) {
+        name.Reset();
+        name.AppendFmt("OEBPS/Text/chapter %05d.xhtml", i);
+        for (auto fi : fileInfos) {
+            if (str::EqI(fi->name.data(), name.Get())) {
+                break;
+            }
+        }
+    }
+    double linearMs = TimeSinceInMs(t) * nFiles / nSample;
+    printf("linear scan: %d lookups %.2f ms (extrapolated from %d)\n", nFiles, linearMs, nSample);
+
+    delete archive;
+    file::Delete(zipFileName);
+}
+
+// generates a .pdfsync file of ~50 MB in the shape that the pdfsync package
+// writes for a big book: nested input files with a few records per line
+static void BenchPdfsync() {
+    const WCHAR* syncFileName = L"tester-tmp.pdfsync";
+    const int nPages = 2000;
+    const size_t targetSize = 50 * 1024 * 1024;
+
+    str::Str s(targetSize + 1024);
+    s.Append("book\nversion 1\n");
+    u32 rec = 1;
+    int page = 1;
+    int chapter = 1;
+    while (s.size() < targetSize) {
+        s.AppendFmt("(chapter%d\n", chapter);
+        for (int line = 1; line < 2000 && s.size() < targetSize; line++) {
+            if (line % 60 == 0 && page < nPages) {
+                page++;
+                s.AppendFmt("s %d\n", page);
+            }
+            s.AppendFmt("l %u %d %d\n", rec, line, line % 80);
+            s.AppendFmt("p %u %d %d\n", rec, 4000000 + (line % 7) * 100000, (line % 60) * 800000);
+            rec++;
+        }
+        s.Append(")\n");
+        chapter++;
+    }
+    file::WriteFile(syncFileName, s.AsByteSlice());
+    BenchPdfsyncIndex(syncFileName, nPages);
+    file::Delete(syncFileName);
+}
+
+// simulates loading a PDF from a slow shell stream (as in the previewer)
+// to see how the block size of BlockCachedStream affects the number
+// of reads of the source stream and the time it takes
+static void BenchStream(const WCHAR* filePath) {
+    ScopedGdiPlus gdi;
+    int blockSizes[] = {4 * 1024, 16 * 1024, 64 * 1024, 256 * 1024};
+    for (int blockSize : blockSizes) {
+        LONG nReads = 0, nSeeks = 0;
+        // 1 ms per call is optimistic for a network share
+        ScopedComPtr<IStream> src(CreateTestFileStream(filePath, 1, &nReads, &nSeeks));
+        if (!src) {
+            printf("failed to open %s\n", ToUtf8Temp(filePath).Get());
+            return;
+        }
+        ScopedComPtr<IStream> cached(BlockCachedStream::Create(src, blockSize));
+        auto t = TimeGet();
+        EngineBase* engine = CreateEngineMupdfFromStream(cached, "foo.pdf");
+        if (!engine) {
+            printf("failed to load %s\n", ToUtf8Temp(filePath).Get());
+            return;
+        }
+        double loadMs = TimeSinceInMs(t);
+        RenderPageArgs args(1, 1.0f, 0);
+        delete engine->RenderPage(args);
+        double totalMs = TimeSinceInMs(t);
+        delete engine;
+        printf("block size: %6d, load: %.2f ms, load + render page 1: %.2f ms, reads: %d, seeks: %d\n", blockSize,
+               loadMs, totalMs, (int)nReads, (int)nSeeks);
+    }
+}
+
+// time printing without a printer, using a sink that writes
+// the rendered bands to a file
+static void BenchPrint(const WCHAR* filePath) {
+    ScopedGdiPlus gdi;
+    EngineBase* engine = CreateEngine(filePath, nullptr, true);
+    if (!engine) {
+        printf("failed to load %s\n", ToUtf8Temp(filePath).Get());
+        return;
+    }
+    AutoFreeWstr outPath = path::GetTempFilePath(L"prn");
+    float dpis[] = {300, 600};
+    for (float dpi : dpis) {
+        // letter paper
+        Size paperSize((int)(8.5f * dpi), (int)(11 * dpi));
+        PrintSink* sink = NewRawFilePrintSink(outPath, paperSize, dpi);
+        Vec<PRINTPAGERANGE> ranges;
+        PRINTPAGERANGE pr = {1, (DWORD)engine->PageCount()};
+        ranges.Append(pr);
+        Print_Advanced_Data advData;
+        auto t = TimeGet();
+        bool ok = PrintToSink(engine, sink, ranges, advData);
+        double ms = TimeSinceInMs(t);
+        delete sink;
+        i64 size = file::GetSize(ToUtf8Temp(outPath).AsView());
+        printf("dpi: %d, ok: %d, %d pages in %.2f ms (%.2f pages/sec), %lld bytes, peak memory: %lld\n", (int)dpi,
+               (int)ok, engine->PageCount(), ms, engine->PageCount() * 1000.0 / ms, size, GetPeakMemoryUsage());
+        file::Delete(outPath);
+    }
+    delete engine;
+}
+
+static Gdiplus::Bitmap* NewPatternBitmap(int seed) {
+    auto bmp = new Gdiplus::Bitmap(800, 600, PixelFormat24bppRGB);
+    Gdiplus::Graphics g(bmp);
+    for (int y = 0; y < 600; y += 20) {
+        for (int x = 0; x < 800; x += 20) {
+            int c = (x * 7 + y * 13 + seed * 31) & 0xff;
+            Gdiplus::SolidBrush br(Gdiplus::Color(255, (BYTE)c, (BYTE)(255 - c), (BYTE)(c ^ seed)));
+            g.FillRectangle(&br, x, y, 20, 20);
+        }
+    }
+    return bmp;
+}
+
+// simulates merging many reports with the same logo: every file has
+// a page with the same image and a page with an image of its own
+static void BenchMerge() {
+    ScopedGdiPlus gdi;
+    const int nFiles = 200;
+    AutoFreeWstr dirPath = path::GetTempFilePath(L"mrg");
+    file::Delete(dirPath);
+    dir::Create(dirPath);
+    Gdiplus::Bitmap* logo = NewPatternBitmap(0);
+    TocItem* root = nullptr;
+    i64 inputSize = 0;
+    for (int i = 0; i < nFiles; i++) {
+        AutoFreeWstr fileName = str::Format(L"%d.pdf", i);
+        AutoFreeWstr filePath = path::Join(dirPath, fileName);
+        auto filePathA = ToUtf8Temp(filePath);
+        auto c = new PdfCreator();
+        Gdiplus::Bitmap* bmp = NewPatternBitmap(i + 1);
+        c->AddPageFromGdiplusBitmap(logo, 96);
+        c->AddPageFromGdiplusBitmap(bmp, 96);
+        c->SaveToFile(filePathA.Get());
+        delete bmp;
+        delete c;
+        inputSize += file::GetSize(filePathA.AsView());
+
+        auto ti = new TocItem(nullptr, fileName, 1);
+        ti->engineFilePath = str::Dup(filePathA.Get());
+        if (root) {
+            root->AddSiblingAtEnd(ti);
+        } else {
+            root = ti;
+        }
+    }
+    delete logo;
+
+    AutoFreeWstr dstPath = path::Join(dirPath, L"merged.pdf");
+    auto dstPathA = ToUtf8Temp(dstPath);
+    i64 memBefore = GetPeakMemoryUsage();
+    auto t = TimeGet();
+    bool ok = SaveVirtualAsPdf(root, (char*)dstPathA.Get());
+    double ms = TimeSinceInMs(t);
+    i64 outputSize = file::GetSize(dstPathA.AsView());
+    printf("ok: %d, %d files, input: %lld bytes, output: %lld bytes, time: %.2f ms, peak memory: %lld (%lld before)\n",
+           (int)ok, nFiles, inputSize, outputSize, ms, GetPeakMemoryUsage(), memBefore);
+
+    delete root;
+    dir::RemoveAll(dirPath);
+}
+
+// renders pages like RenderCache does at high zoom (in several tiles per page),
+// so that the same glyphs are needed again for every tile
+static void BenchGlyphCache(const WCHAR* filePath) {
+    i64 sizes[] = {1024 * 1024, 4 * 1024 * 1024, 16 * 1024 * 1024, 64 * 1024 * 1024};
+    const int kMaxPages = 20;
+    const float zoom = 3.f;
+    for (i64 size : sizes) {
+        // a new engine for every run, to start with an empty glyph cache
+        EngineBase* engine = CreateEngineMupdfFromFile(filePath, 96);
+        if (!engine) {
+            printf("failed to load %s\n", ToUtf8Temp(filePath).Get());
+            return;
+        }
+        EngineMupdfSetGlyphCacheSize(engine, size);
+        int nPages = std::min(engine->PageCount(), kMaxPages);
+        auto t = TimeGet();
+        for (int pageNo = 1; pageNo <= nPages; pageNo++) {
+            RectF mediabox = engine->PageMediabox(pageNo);
+            // 4 x 4 tiles
+            for (int i = 0; i < 16; i++) {
+                RectF tile(mediabox.x + (i % 4) * mediabox.dx / 4, mediabox.y + (i / 4) * mediabox.dy / 4,
+                           mediabox.dx / 4, mediabox.dy / 4);
+                RenderPageArgs args(pageNo, zoom, 0, &tile);
+                delete engine->RenderPage(args);
+            }
+        }
+        double ms = TimeSinceInMs(t);
+        GlyphCacheStats stats;
+        EngineMupdfGetGlyphCacheStats(engine, &stats);
+        printf("cache: %5lld KB, %d pages in %.2f ms, hits: %lld, misses: %lld, evictions: %lld, cached: %d glyphs\n",
+               size / 1024, nPages, ms, stats.hits, stats.misses, stats.evictions, stats.entries);
+        delete engine;
+    }
+}
+
+// in mupdf_load_system_font.c
+extern "C" int index_fonts_in_dir(const WCHAR* dir, const WCHAR* indexPath);
+
+static void BenchFontIndex(const WCHAR* fontDir) {
+    AutoFreeWstr winFontDir;
+    if (!fontDir) {
+        WCHAR winDir[MAX_PATH]{};
+        GetWindowsDirectoryW(winDir, dimof(winDir));
+        winFontDir.Set(path::Join(winDir, L"Fonts"));
+        fontDir = winFontDir;
+    }
+    AutoFreeWstr indexPath = path::GetTempFilePath(L"fnt");
+    file::Delete(indexPath);
+
+    auto t = TimeGet();
+    int n = index_fonts_in_dir(fontDir, nullptr);
+    printf("no index:      %d faces in %.2f ms\n", n, TimeSinceInMs(t));
+    t = TimeGet();
+    n = index_fonts_in_dir(fontDir, indexPath);
+    printf("create index:  %d faces in %.2f ms\n", n, TimeSinceInMs(t));
+    t = TimeGet();
+    n = index_fonts_in_dir(fontDir, indexPath);
+    printf("use index:     %d faces in %.2f ms, index size: %lld bytes\n", n, TimeSinceInMs(t),
+           file::GetSize(ToUtf8Temp(indexPath).AsView()));
+    file::Delete(indexPath);
+}
+
+static void BenchRepair(const WCHAR* filePath) {
+    AutoFreeWstr cacheDir = path::GetTempFilePath(L"xrf");
+    file::Delete(cacheDir);
+    const char* runs[] = {"no saved repair:", "save repair:", "use saved repair:"};
+    for (int i = 0; i < (int)dimof(runs); i++) {
+        SetEngineMupdfRepairCacheDir(i == 0 ? nullptr : cacheDir.Get());
+        EngineBase* engine = CreateEngineMupdfFromFile(filePath, 96);
+        if (!engine) {
+            printf("failed to load %s\n", ToUtf8Temp(filePath).Get());
+            break;
+        }
+        PdfRepairStats stats;
+        EngineMupdfGetRepairStats(engine, &stats);
+        delete engine;
+        if (!stats.wasRepaired) {
+            printf("%s doesn't need to be repaired\n", ToUtf8Temp(filePath).Get());
+            break;
+        }
+        printf("%-18s %.2f ms%s\n", runs[i], stats.ms, stats.usedSavedRepair ? "" : " (full scan)");
+    }
+    SetEngineMupdfRepairCacheDir(nullptr);
+    dir::RemoveAll(cacheDir);
+}
+
+static void BenchJpx(const WCHAR* filePath) {
+    const int kMaxPages = 20;
+    int threads[] = {1, 0};
+    float zooms[] = {1.f, 0.25f};
+    for (int nThreads : threads) {
+        SetEngineMupdfJpxThreads(nThreads);
+        for (float zoom : zooms) {
+            // a new engine for every run, to start without decoded images
+            EngineBase* engine = CreateEngineMupdfFromFile(filePath, 96);
+            if (!engine) {
+                printf("failed to load %s\n", ToUtf8Temp(filePath).Get());
+                SetEngineMupdfJpxThreads(0);
+                return;
+            }
+            int nPages = std::min(engine->PageCount(), kMaxPages);
+            auto t = TimeGet();
+            for (int pageNo = 1; pageNo <= nPages; pageNo++) {
+                RenderPageArgs args(pageNo, zoom, 0);
+                delete engine->RenderPage(args);
+            }
+            double ms = TimeSinceInMs(t);
+            printf("threads: %s, zoom: %3d%%, %d pages in %.2f ms\n", nThreads == 0 ? "all" : "  1",
+                   (int)(zoom * 100), nPages, ms);
+            delete engine;
+        }
+    }
+    SetEngineMupdfJpxThreads(0);
+}
+
+// 8x8 gray JPEG 2000 codestream, left half 255, right half 0
+static const u8 gJpxSmask[] = {
+    0xff, 0x4f, 0xff, 0x51, 0x00, 0x29, 0x00, 0x00, 0x00, 0x00, 0x00, 0x08,
+    0x00, 0x00, 0x00, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x08, 0x00, 0x00, 0x00, 0x08, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x07, 0x01, 0x01, 0xff, 0x52, 0x00,
+    0x0c, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x04, 0x04, 0x00, 0x01, 0xff,
+    0x5c, 0x00, 0x04, 0x40, 0x40, 0xff, 0x90, 0x00, 0x0a, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x49, 0x00, 0x01, 0xff, 0x93, 0xdf, 0x81, 0xc0, 0x26, 0x89,
+    0x0c, 0xfc, 0x81, 0xd9, 0x00, 0xbe, 0xd0, 0x0c, 0x1c, 0x22, 0x9d, 0x1c,
+    0x03, 0x02, 0x0a, 0x7b, 0x4a, 0x3c, 0xd8, 0x7e, 0x6c, 0x3f, 0x36, 0x1f,
+    0x9b, 0x0f, 0xcd, 0x87, 0xe6, 0xc3, 0xf3, 0x61, 0xf9, 0xb0, 0xfc, 0xd8,
+    0x7e, 0x6c, 0x3f, 0x36, 0x1f, 0x9b, 0x0f, 0xcd, 0x87, 0xe6, 0xc3, 0xf3,
+    0x61, 0xf9, 0xb0, 0xfc, 0xd8, 0x7f, 0xff, 0xd9,
+};
+
+// a 100x100 page filled with a red image whose soft mask (a JPEG 2000 image)
+// only shows its left half. Soft masks are decoded differently from other images
+static bool CreatePdfWithJpxSmask(const WCHAR* path) {
+    Vec<i64> offsets;
+    str::Str s;
+    s.Append("%PDF-1.5\n");
+    offsets.Append(s.size());
+    s.Append("1 0 obj\n<< /Type /Catalog /Pages 2 0 R >>\nendobj\n");
+    offsets.Append(s.size());
+    s.Append("2 0 obj\n<< /Type /Pages /Kids [3 0 R] /Count 1 >>\nendobj\n");
+    offsets.Append(s.size());
+    s.Append("3 0 obj\n<< /Type /Page /Parent 2 0 R /MediaBox [0 0 100 100] /Contents 4 0 R ");
+    s.Append("/Resources << /XObject << /Im0 5 0 R >> >> >>\nendobj\n");
+    const char* content = "q 100 0 0 100 0 0 cm /Im0 Do Q";
+    offsets.Append(s.size());
+    s.AppendFmt("4 0 obj\n<< /Length %d >>\nstream\n%s\nendstream\nendobj\n", (int)str::Len(content), content);
+    str::Str pixels;
+    for (int i = 0; i < 8 * 8; i++) {
+        pixels.Append("FF0000");
+    }
+    pixels.Append(">");
+    offsets.Append(s.size());
+    s.Append("5 0 obj\n<< /Type /XObject /Subtype /Image /Width 8 /Height 8 /ColorSpace /DeviceRGB ");
+    s.AppendFmt("/BitsPerComponent 8 /SMask 6 0 R /Filter /ASCIIHexDecode /Length %d >>\nstream\n", (int)pixels.size());
+    s.Append(pixels.Get());
+    s.Append("\nendstream\nendobj\n");
+    offsets.Append(s.size());
+    s.Append("6 0 obj\n<< /Type /XObject /Subtype /Image /Width 8 /Height 8 /ColorSpace /DeviceGray ");
+    s.AppendFmt("/BitsPerComponent 8 /Filter /JPXDecode /Length %d >>\nstream\n", (int)sizeof(gJpxSmask));
+    s.Append((const char*)gJpxSmask, sizeof(gJpxSmask));
+    s.Append("\nendstream\nendobj\n");
+    int nObjs = offsets.isize() + 1;
+    i64 xrefOffset = s.size();
+    s.AppendFmt("xref\n0 %d\n0000000000 65535 f \n", nObjs);
+    for (i64 off : offsets) {
+        s.AppendFmt("%010lld 00000 n \n", off);
+    }
+    s.AppendFmt("trailer\n<< /Size %d /Root 1 0 R >>\nstartxref\n%lld\n%%%%EOF\n", nObjs, xrefOffset);
+    return file::WriteFile(path, s.AsSpan());
+}
+
+static void TestJpxSmask() {
+    AutoFreeWstr filePath = path::GetTempFilePath(L"jpx");
+    if (!CreatePdfWithJpxSmask(filePath)) {
+        printf("TestJpxSmask: failed to create %s\n", ToUtf8Temp(filePath).Get());
+        return;
+    }
+    EngineBase* engine = CreateEngineMupdfFromFile(filePath, 96);
+    if (!engine) {
+        printf("TestJpxSmask: failed to load %s\n", ToUtf8Temp(filePath).Get());
+        file::Delete(filePath);
+        return;
+    }
+    RenderPageArgs args(1, 1.f, 0);
+    RenderedBitmap* bmp = engine->RenderPage(args);
+    bool ok = false;
+    if (bmp) {
+        Size size = bmp->Size();
+        BitmapPixels* pixels = GetBitmapPixels(bmp->GetBitmap());
+        // blue-green-red(-alpha)
+        auto getPixel = [pixels](int x, int y) -> COLORREF {
+            u8* p = pixels->pixels + y * pixels->nBytesPerRow + x * pixels->nBytesPerPixel;
+            return RGB(p[2], p[1], p[0]);
+        };
+        if (pixels) {
+            COLORREF left = getPixel(size.dx / 4, size.dy / 2);
+            COLORREF right = getPixel(size.dx * 3 / 4, size.dy / 2);
+            ok = left == RGB(0xff, 0, 0) && right == RGB(0xff, 0xff, 0xff);
+            printf("TestJpxSmask: left: 0x%06x, right: 0x%06x\n", (uint)left, (uint)right);
+            FinalizeBitmapPixels(pixels);
+        }
+    }
+    printf("TestJpxSmask: %s\n", ok ? "ok" : "failed");
+    delete bmp;
+    delete engine;
+    file::Delete(filePath);
+}
+
+static void BenchProgressive(const WCHAR* filePath, int kbps) {
+    i64 fileSize = file::GetSize(ToUtf8Temp(filePath).AsView());
+    // without progressive loading, the whole file has to be read before showing anything
+    double fullReadMs = (double)fileSize * 1000.0 / (kbps * 1024.0);
+
+    SetEngineMupdfProgressiveThrottle(kbps);
+    auto t = TimeGet();
+    EngineBase* engine = CreateEngineMupdfFromFile(filePath, 96);
+    if (!engine) {
+        printf("failed to load %s\n", ToUtf8Temp(filePath).Get());
+        SetEngineMupdfProgressiveThrottle(0);
+        return;
+    }
+    double openMs = TimeSinceInMs(t);
+    // register before rendering anything, the load might complete any time
+    HANDLE loaded = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+    engine->SetLoadProgressCallback([loaded](int pageNo) {
+        if (pageNo == 0) {
+            SetEvent(loaded);
+        }
+    });
+    // the file might have been loaded completely (or not progressively)
+    // before the callback was set, in which case it won't be called
+    if (!EngineMupdfIsLoadingProgressively(engine)) {
+        SetEvent(loaded);
+    }
+
+    RenderPageArgs args(1, 1.f, 0);
+    delete engine->RenderPage(args);
+    double firstPageMs = TimeSinceInMs(t);
+
+    DWORD timeoutMs = (DWORD)fullReadMs * 2 + 5000;
+    bool isLoaded = WaitForSingleObject(loaded, timeoutMs) == WAIT_OBJECT_0;
+    double loadedMs = TimeSinceInMs(t);
+    printf("%lld bytes at %d kB/s: open %.2f ms, first page %.2f ms, fully loaded %s%.2f ms (whole file: %.2f ms)\n",
+           fileSize, kbps, openMs, firstPageMs, isLoaded ? "" : "(timed out) ", loadedMs, fullReadMs);
+
+    engine->SetLoadProgressCallback(nullptr);
+    delete engine;
+    CloseHandle(loaded);
+    SetEngineMupdfProgressiveThrottle(0);
+}
+
+// a single page PDF whose outline has nTop items with nChildren children each
+static bool CreatePdfWithOutline(const WCHAR* path, int nTop, int nChildren) {
+    int nItems = nTop * (1 + nChildren);
+    // objects: 1 catalog, 2 pages, 3 page, 4 outlines, items in pre-order from 5
+    int nObjs = 5 + nItems;
+    Vec<i64> offsets;
+    str::Str s;
+    s.Append("%PDF-1.4\n");
+    offsets.Append(s.size());
+    s.Append("1 0 obj\n<< /Type /Catalog /Pages 2 0 R /Outlines 4 0 R >>\nendobj\n");
+    offsets.Append(s.size());
+    s.Append("2 0 obj\n<< /Type /Pages /Kids [3 0 R] /Count 1 >>\nendobj\n");
+    offsets.Append(s.size());
+    s.Append("3 0 obj\n<< /Type /Page /Parent 2 0 R /MediaBox [0 0 612 792] >>\nendobj\n");
+    offsets.Append(s.size());
+    int lastTop = 5 + (nTop - 1) * (1 + nChildren);
+    s.AppendFmt("4 0 obj\n<< /Type /Outlines /First 5 0 R /Last %d 0 R /Count %d >>\nendobj\n", lastTop, nTop);
+    for (int i = 0; i < nTop; i++) {
+        int top = 5 + i * (1 + nChildren);
+        offsets.Append(s.size());
+        s.AppendFmt("%d 0 obj\n<< /Title (Chapter %d) /Parent 4 0 R", top, i + 1);
+        if (i > 0) {
+            s.AppendFmt(" /Prev %d 0 R", top - (1 + nChildren));
+        }
+        if (i < nTop - 1) {
+            s.AppendFmt(" /Next %d 0 R", top + (1 + nChildren));
+        }
+        if (nChildren > 0) {
+            s.AppendFmt(" /First %d 0 R /Last %d 0 R /Count -%d", top + 1, top + nChildren, nChildren);
+        }
+        s.Append(" /Dest [3 0 R /XYZ null null null] >>\nendobj\n");
+        for (int j = 1; j <= nChildren; j++) {
+            offsets.Append(s.size());
+            s.AppendFmt("%d 0 obj\n<< /Title (Section %d.%d) /Parent %d 0 R", top + j, i + 1, j, top);
+            if (j > 1) {
+                s.AppendFmt(" /Prev %d 0 R", top + j - 1);
+            }
+            if (j < nChildren) {
+                s.AppendFmt(" /Next %d 0 R", top + j + 1);
+            }
+            s.Append(" /Dest [3 0 R /XYZ null null null] >>\nendobj\n");
+        }
+    }
+    i64 xrefOffset = s.size();
+    s.AppendFmt("xref\n0 %d\n0000000000 65535 f \n", nObjs);
+    for (i64 off : offsets) {
+        s.AppendFmt("%010lld 00000 n \n", off);
+    }
+    s.AppendFmt("trailer\n<< /Size %d /Root 1 0 R >>\nstartxref\n%lld\n%%%%EOF\n", nObjs, xrefOffset);
+    return file::WriteFile(path, s.AsSpan());
+}
+
+// opening the ToC only loads the top-level items, the rest is
+// loaded when the items are expanded
+static void BenchToc() {
+    const int nTop = 1000;
+    const int nChildren = 199;
+    AutoFreeWstr filePath = path::GetTempFilePath(L"toc");
+    if (!CreatePdfWithOutline(filePath, nTop, nChildren)) {
+        printf("BenchToc: failed to create %s\n", ToUtf8Temp(filePath).Get());
+        return;
+    }
+
+    auto t = TimeGet();
+    EngineBase* engine = CreateEngineMupdfFromFile(filePath, 96);
+    if (!engine) {
+        printf("BenchToc: failed to load %s\n", ToUtf8Temp(filePath).Get());
+        file::Delete(filePath);
+        return;
+    }
+    double openMs = TimeSinceInMs(t);
+
+    t = TimeGet();
+    TocTree* tocTree = engine->GetToc();
+    int nTopLoaded = tocTree ? tocTree->root->ChildCount() : 0;
+    double tocMs = TimeSinceInMs(t);
+
+    // what building the whole ToC costs (which is what we used to do in GetToc())
+    t = TimeGet();
+    int nItems = 0;
+    if (tocTree) {
+        VisitTocTree(tocTree->root->child, [&nItems](TocItem*) {
+            nItems++;
+            return true;
+        });
+    }
+    double allMs = TimeSinceInMs(t);
+    printf("%d items: open %.2f ms, top-level (%d items) %.2f ms, all (%d items) %.2f ms, peak memory: %lld\n",
+           nTop * (1 + nChildren), openMs, nTopLoaded, tocMs, nItems, allMs, GetPeakMemoryUsage());
+    delete engine;
+    file::Delete(filePath);
+}
+
+// throughput of the pixel conversion kernels on a 4K frame,
+// for every implementation supported by the cpu
+static void BenchPixelConvert() {
+    const size_t nPixels = 3840 * 2160;
+    const int nRounds = 20;
+    u8* src = AllocArray<u8>(nPixels * 4);
+    u8* dst = AllocArray<u8>(nPixels * 4);
+    for (size_t i = 0; i < nPixels * 4; i++) {
+        src[i] = (u8)(i * 7 + (i >> 5));
+    }
+
+    struct {
+        const char* name;
+        void (*convert)(const u8*, u8*, size_t);
+    } rowKernels[] = {
+        {"RGBA -> BGRA", ConvertRgbaToBgra}, {"RGB -> BGRA", ConvertRgbToBgra},
+        {"gray -> BGRA", ConvertGrayToBgra}, {"gray+alpha -> BGRA", ConvertGrayAlphaToBgra},
+        {"CMYK -> BGRA", ConvertCmykToBgra},
+    };
+    struct {
+        const char* name;
+        void (*convert)(u8*, size_t);
+    } inPlaceKernels[] = {
+        {"premultiply", PremultiplyBgra},
+        {"unpremultiply", UnpremultiplyBgra},
+    };
+
+    for (int impl = 0; impl <= (int)GetBestPixelConvertImpl(); impl++) {
+        SetPixelConvertImpl((PixelConvertImpl)impl);
+        const char* implName = PixelConvertImplName((PixelConvertImpl)impl);
+        for (auto& k : rowKernels) {
+            auto t = TimeGet();
+            for (int i = 0; i < nRounds; i++) {
+                k.convert(src, dst, nPixels);
+            }
+            double ms = TimeSinceInMs(t) / nRounds;
+            printf("%-6s %-20s %6.2f ms/frame, %7.1f Mpixels/sec\n", implName, k.name, ms, nPixels / ms / 1000.0);
+        }
+        for (auto& k : inPlaceKernels) {
+            memcpy(dst, src, nPixels * 4);
+            auto t = TimeGet();
+            for (int i = 0; i < nRounds; i++) {
+                k.convert(dst, nPixels);
+            }
+            double ms = TimeSinceInMs(t) / nRounds;
+            printf("%-6s %-20s %6.2f ms/frame, %7.1f Mpixels/sec\n", implName, k.name, ms, nPixels / ms / 1000.0);
+        }
+    }
+    SetPixelConvertImpl(GetBestPixelConvertImpl());
+    free(src);
+    free(dst);
+}
+
+// the second run renders the same pages again, with the ICC links already built
+static void BenchColor(const WCHAR* filePath) {
+    const int kMaxPages = 20;
+    EngineBase* engine = CreateEngineMupdfFromFile(filePath, 96);
+    if (!engine) {
+        printf("failed to load %s\n", ToUtf8Temp(filePath).Get());
+        return;
+    }
+    int nPages = std::min(engine->PageCount(), kMaxPages);
+    ColorConversionStats prev;
+    for (int run = 1; run <= 2; run++) {
+        auto t = TimeGet();
+        for (int pageNo = 1; pageNo <= nPages; pageNo++) {
+            RenderPageArgs args(pageNo, 1.f, 0);
+            delete engine->RenderPage(args);
+        }
+        double ms = TimeSinceInMs(t);
+        ColorConversionStats stats;
+        EngineMupdfGetColorConversionStats(engine, &stats);
+        printf("run %d: %d pages in %.2f ms, converting colors: %.2f ms (%lld pixmaps, %lld Mpixels)\n", run, nPages,
+               ms, stats.convertMs - prev.convertMs, stats.pixmaps - prev.pixmaps,
+               (stats.pixels - prev.pixels) / 1000000);
+        printf("       links: %d built in %.2f ms (%d identity), %lld lookups, %lld cache hits\n",
+               stats.linksCreated - prev.linksCreated, stats.linkMs - prev.linkMs,
+               stats.identityLinks - prev.identityLinks, stats.linkLookups - prev.linkLookups,
+               stats.linkCacheHits - prev.linkCacheHits);
+        printf("       pixmaps: %lld without ICC, %lld with a lookup table\n", stats.fastPixmaps - prev.fastPixmaps,
+               stats.lutPixmaps - prev.lutPixmaps);
+        prev = stats;
+    }
+    delete engine;
+}
+
 int TesterMain() {
     RedirectIOToConsole();
 
@@ -222,6 +942,94 @@ int TesterMain() {
         } else if (str::Eq(arg, L"-save-images")) {
             gSaveImages = true;
             ++i;
+        } else if (str::Eq(arg, L"-bench-pdfsync")) {
+            BenchPdfsync();
+            ++i;
+        } else if (str::Eq(arg, L"-bench-stream")) {
+            ++i;
+            if (i == nArgs) {
+                return Usage();
+            }
+            BenchStream(argv.at(i));
+            ++i;
+        } else if (str::Eq(arg, L"-bench-layout")) {
+            ++i;
+            if (i == nArgs) {
+                return Usage();
+            }
+            BenchLayout(argv.at(i));
+            ++i;
+        } else if (str::Eq(arg, L"-bench-print")) {
+            ++i;
+            if (i == nArgs) {
+                return Usage();
+            }
+            BenchPrint(argv.at(i));
+            ++i;
+        } else if (str::Eq(arg, L"-bench-merge")) {
+            BenchMerge();
+            ++i;
+        } else if (str::Eq(arg, L"-bench-glyphcache")) {
+            ++i;
+            if (i == nArgs) {
+                return Usage();
+            }
+            BenchGlyphCache(argv.at(i));
+            ++i;
+        } else if (str::Eq(arg, L"-bench-fontindex")) {
+            ++i;
+            const WCHAR* fontDir = nullptr;
+            if (i < nArgs && argv.at(i)[0] != '-') {
+                fontDir = argv.at(i);
+                ++i;
+            }
+            BenchFontIndex(fontDir);
+        } else if (str::Eq(arg, L"-bench-repair")) {
+            ++i;
+            if (i == nArgs) {
+                return Usage();
+            }
+            BenchRepair(argv.at(i));
+            ++i;
+        } else if (str::Eq(arg, L"-bench-jpx")) {
+            ++i;
+            if (i == nArgs) {
+                return Usage();
+            }
+            BenchJpx(argv.at(i));
+            ++i;
+        } else if (str::Eq(arg, L"-test-jpx-smask")) {
+            TestJpxSmask();
+            ++i;
+        } else if (str::Eq(arg, L"-bench-toc")) {
+            BenchToc();
+            ++i;
+        } else if (str::Eq(arg, L"-bench-pixconvert")) {
+            BenchPixelConvert();
+            ++i;
+        } else if (str::Eq(arg, L"-bench-color")) {
+            ++i;
+            if (i == nArgs) {
+                return Usage();
+            }
+            BenchColor(argv.at(i));
+            ++i;
+        } else if (str::Eq(arg, L"-bench-progressive")) {
+            ++i;
+            if (i == nArgs) {
+                return Usage();
+            }
+            const WCHAR* filePath = argv.at(i);
+            ++i;
+            int kbps = 1024;
+            if (i < nArgs && argv.at(i)[0] != '-') {
+                str::Parse(argv.at(i), L"%d", &kbps);
+                ++i;
+            }
+            BenchProgressive(filePath, std::max(kbps, 1));
+        } else if (str::Eq(arg, L"-bench-archive")) {
+            BenchArchive();
+            ++i;
         } else if (str::Eq(arg, L"-zip-create")) {
             ZipCreateTest();
             ++i;
@@ -528,7 +528,7 @@ IPageDestination* LinkHandler::FindTocItem(TocItem* item, const WCHAR* name, boo
                 return item->GetPageDestination();
             }
         }
-        IPageDestination* dest = FindTocItem(item->child, name, partially);
+        IPageDestination* dest = FindTocItem(item->GetChild(), name, partially);
         if (dest) {
             return dest;
         }
@@ -3,6 +3,7 @@
 
 #include "utils/BaseUtil.h"
 #include "utils/ScopedWin.h"
+#include "utils/BlockCachedStream.h"
 #include "utils/Archive.h"
 #include "utils/GdiPlusUtil.h"
 #include "utils/HtmlParserLookup.h"
@@ -35,18 +36,9 @@ HRESULT EpubFilter::OnInit() {
 
     CleanUp();
 
-    // TODO: EpubDoc::CreateFromStream never returns with
-    //       m_pStream instead of a clone - why?
-
-    // load content of EPUB document into a seekable stream
-    HRESULT res;
-    AutoFree data = GetDataFromStream(m_pStream, &res);
-    if (data.empty()) {
-        return res;
-    }
-
-    auto strm = CreateStreamFromData(data.AsSpan());
-    ScopedComPtr<IStream> stream(strm);
+    // read the document through a block cache instead of
+    // loading all of it into memory
+    ScopedComPtr<IStream> stream(GetBlockCachedStream(m_pStream));
     if (!stream) {
         return E_FAIL;
     }
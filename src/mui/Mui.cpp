@@ -87,6 +87,7 @@ class FontListItem {
         str::Free(cf.name);
         ::delete cf.font;
         DeleteObject(cf.hFont);
+        delete cf.measureCache;
         delete next;
     }
 
@@ -200,6 +201,14 @@ HFONT CachedFont::GetHFont() {
     return hFont;
 }
 
+TextMeasureCache* CachedFont::GetMeasureCache() {
+    ScopedMuiCritSec muiCs;
+    if (!measureCache) {
+        measureCache = new TextMeasureCache();
+    }
+    return measureCache;
+}
+
 // convenience function: given cached style, get a Font object matching the font
 // properties.
 // Caller should not delete the font - it's cached for performance and deleted at exit
@@ -9,6 +9,8 @@ using Gdiplus::Graphics;
 
 namespace mui {
 
+class TextMeasureCache;
+
 struct CachedFont {
     const WCHAR* name;
     float sizePt;
@@ -18,7 +20,11 @@ struct CachedFont {
     // hFont is created out of font
     HFONT hFont;
 
+    // created on demand, see TextRenderMeasureCached
+    TextMeasureCache* measureCache = nullptr;
+
     HFONT GetHFont();
+    TextMeasureCache* GetMeasureCache();
     [[nodiscard]] Gdiplus::FontStyle GetStyle() const {
         return style;
     }
@@ -2,6 +2,7 @@
    License: Simplified BSD (see COPYING.BSD) */
 
 #include "utils/BaseUtil.h"
+#include "utils/ScopedWin.h"
 #include "utils/WinUtil.h"
 #include "utils/GdiPlusUtil.h"
 #include "utils/HtmlParserLookup.h"
@@ -474,6 +475,190 @@ TextRenderHdc::~TextRenderHdc() {
     DeleteDC(hdc);
 }
 
+struct TextMeasureCache::Entry {
+    Entry* next;
+    u32 hash;
+    TextRenderMethod method;
+    u32 len;
+    RectF bbox;
+    // followed by len WCHARs
+    WCHAR* Str() {
+        return (WCHAR*)(this + 1);
+    }
+};
+
+static u32 HashMeasured(TextRenderMethod method, const WCHAR* s, size_t sLen) {
+    return MurmurHash2(s, sLen * sizeof(WCHAR)) ^ ((u32)method * 0x9e3779b9);
+}
+
+TextMeasureCache::TextMeasureCache() {
+    InitializeCriticalSection(&cs);
+    allocator.minBlockSize = 64 * 1024;
+}
+
+TextMeasureCache::~TextMeasureCache() {
+    free(buckets);
+    DeleteCriticalSection(&cs);
+}
+
+void TextMeasureCache::Clear() {
+    free(buckets);
+    buckets = nullptr;
+    nBuckets = 0;
+    stats.count = 0;
+    allocator.FreeAll();
+}
+
+void TextMeasureCache::Grow() {
+    int newSize = nBuckets == 0 ? 1024 : nBuckets * 2;
+    Entry** newBuckets = AllocArray<Entry*>(newSize);
+    for (int i = 0; i < nBuckets; i++) {
+        Entry* e = buckets[i];
+        while (e) {
+            Entry* next = e->next;
+            u32 idx = e->hash & (newSize - 1);
+            e->next = newBuckets[idx];
+            newBuckets[idx] = e;
+            e = next;
+        }
+    }
+    free(buckets);
+    buckets = newBuckets;
+    nBuckets = newSize;
+}
+
+bool TextMeasureCache::Get(TextRenderMethod method, const WCHAR* s, size_t sLen, RectF& bboxOut) {
+    u32 hash = HashMeasured(method, s, sLen);
+    ScopedCritSec scope(&cs);
+    if (nBuckets > 0) {
+        for (Entry* e = buckets[hash & (nBuckets - 1)]; e; e = e->next) {
+            if (e->hash == hash && e->method == method && e->len == sLen && memeq(e->Str(), s, sLen * sizeof(WCHAR))) {
+                bboxOut = e->bbox;
+                stats.hits++;
+                return true;
+            }
+        }
+    }
+    stats.misses++;
+    return false;
+}
+
+void TextMeasureCache::Add(TextRenderMethod method, const WCHAR* s, size_t sLen, RectF bbox) {
+    u32 hash = HashMeasured(method, s, sLen);
+    ScopedCritSec scope(&cs);
+    if (stats.count >= kMaxEntries) {
+        Clear();
+    }
+    if (stats.count >= nBuckets) {
+        Grow();
+    }
+    // another thread might have added it in the meantime, which is harmless
+    Entry* e = (Entry*)allocator.Alloc(sizeof(Entry) + sLen * sizeof(WCHAR));
+    if (!e) {
+        return;
+    }
+    e->hash = hash;
+    e->method = method;
+    e->len = (u32)sLen;
+    e->bbox = bbox;
+    memcpy(e->Str(), s, sLen * sizeof(WCHAR));
+    u32 idx = hash & (nBuckets - 1);
+    e->next = buckets[idx];
+    buckets[idx] = e;
+    stats.count++;
+}
+
+TextMeasureCache::Stats TextMeasureCache::GetStats() {
+    ScopedCritSec scope(&cs);
+    return stats;
+}
+
+TextRenderMeasureCached* TextRenderMeasureCached::Create(ITextRender* textRender) {
+    TextRenderMeasureCached* res = new TextRenderMeasureCached();
+    res->textRender = textRender;
+    res->method = textRender->method;
+    return res;
+}
+
+void TextRenderMeasureCached::SetFont(CachedFont* font) {
+    if (font != currFont) {
+        currFont = font;
+        cache = font->GetMeasureCache();
+    }
+}
+
+void TextRenderMeasureCached::SetTextRenderFont() {
+    if (textRenderFont != currFont) {
+        textRender->SetFont(currFont);
+        textRenderFont = currFont;
+    }
+}
+
+void TextRenderMeasureCached::SetTextColor(Gdiplus::Color col) {
+    textRender->SetTextColor(col);
+}
+
+void TextRenderMeasureCached::SetTextBgColor(Gdiplus::Color col) {
+    textRender->SetTextBgColor(col);
+}
+
+float TextRenderMeasureCached::GetCurrFontLineSpacing() {
+    SetTextRenderFont();
+    return textRender->GetCurrFontLineSpacing();
+}
+
+RectF TextRenderMeasureCached::Measure(const char* s, size_t sLen) {
+    auto ws = ToWstrTemp(s, sLen);
+    return Measure(ws.Get(), ws.size());
+}
+
+RectF TextRenderMeasureCached::Measure(const WCHAR* s, size_t sLen) {
+    CrashIf(!cache);
+    RectF bbox;
+    if (cache->Get(method, s, sLen, bbox)) {
+        return bbox;
+    }
+    SetTextRenderFont();
+    bbox = textRender->Measure(s, sLen);
+    cache->Add(method, s, sLen, bbox);
+    return bbox;
+}
+
+void TextRenderMeasureCached::Lock() {
+    textRender->Lock();
+}
+
+void TextRenderMeasureCached::Unlock() {
+    textRender->Unlock();
+}
+
+void TextRenderMeasureCached::Draw(const char* s, size_t sLen, RectF bb, bool isRtl) {
+    SetTextRenderFont();
+    textRender->Draw(s, sLen, bb, isRtl);
+}
+
+void TextRenderMeasureCached::Draw(const WCHAR* s, size_t sLen, RectF bb, bool isRtl) {
+    SetTextRenderFont();
+    textRender->Draw(s, sLen, bb, isRtl);
+}
+
+// individual characters are measured once per font, so
+// this is mostly cache lookups
+float TextRenderMeasureCached::EstimateWidth(const WCHAR* s, size_t sLen) {
+    float dx = 0;
+    for (size_t i = 0; i < sLen; i++) {
+        // measure surrogate pairs together
+        size_t n = (IS_HIGH_SURROGATE(s[i]) && i + 1 < sLen) ? 2 : 1;
+        dx += Measure(s + i, n).dx;
+        i += n - 1;
+    }
+    return dx;
+}
+
+TextRenderMeasureCached::~TextRenderMeasureCached() {
+    delete textRender;
+}
+
 ITextRender* CreateTextRender(TextRenderMethod method, Graphics* gfx, int dx, int dy) {
     ITextRender* res = nullptr;
     if (TextRenderMethod::Gdiplus == method) {
@@ -508,6 +693,17 @@ size_t StringLenForWidth(ITextRender* textMeasure, const WCHAR* s, size_t len, f
     }
     // make the best guess of the length that fits
     size_t n = (size_t)((dx / r.dx) * (float)len);
+    if (textMeasure->EstimateWidth(s, 1) >= 0) {
+        // widths of characters are a better guess than their average
+        // width, e.g. for CJK text mixed with latin text
+        float estDx = 0;
+        for (n = 0; n < len; n++) {
+            estDx += textMeasure->EstimateWidth(s + n, 1);
+            if (estDx > dx) {
+                break;
+            }
+        }
+    }
     CrashIf(n > len);
     r = textMeasure->Measure(s, n);
     // find the length len of s that fits within dx iff width of len+1 exceeds dx
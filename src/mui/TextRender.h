@@ -36,6 +36,13 @@ class ITextRender {
     virtual void Draw(const char* s, size_t sLen, RectF bb, bool isRtl) = 0;
     virtual void Draw(const WCHAR* s, size_t sLen, RectF bb, bool isRtl) = 0;
 
+    // sum of the widths of the characters of s, which is a cheap estimate
+    // of Measure(s, sLen).dx (kerning and shaping make the real width differ).
+    // returns a negative value if there's no cheaper way than Measure()
+    virtual float EstimateWidth(__unused const WCHAR* s, __unused size_t sLen) {
+        return -1;
+    }
+
     virtual ~ITextRender() = default;
     ;
 
@@ -170,6 +177,80 @@ class TextRenderHdc : public ITextRender {
     ~TextRenderHdc() override;
 };
 
+// Widths of strings (mostly words) measured with a given font, for each
+// TextRenderMethod. Owned by CachedFont (see CachedFont::GetMeasureCache())
+// so measurements are shared by all layouts using the same font.
+class TextMeasureCache {
+  public:
+    // the cache is emptied when it grows beyond that many strings
+    static constexpr int kMaxEntries = 256 * 1024;
+
+    struct Stats {
+        i64 hits = 0;
+        i64 misses = 0;
+        int count = 0;
+    };
+
+    TextMeasureCache();
+    TextMeasureCache(TextMeasureCache const&) = delete;
+    TextMeasureCache& operator=(TextMeasureCache const&) = delete;
+    ~TextMeasureCache();
+
+    bool Get(TextRenderMethod method, const WCHAR* s, size_t sLen, RectF& bboxOut);
+    void Add(TextRenderMethod method, const WCHAR* s, size_t sLen, RectF bbox);
+    Stats GetStats();
+
+  private:
+    struct Entry;
+
+    void Grow();
+    void Clear();
+
+    CRITICAL_SECTION cs;
+    PoolAllocator allocator;
+    Entry** buckets = nullptr;
+    int nBuckets = 0;
+    Stats stats;
+};
+
+// Forwards to another ITextRender (which it owns) and caches the result of
+// Measure() in the TextMeasureCache of the current font. Useful for layout,
+// which measures the same words over and over.
+class TextRenderMeasureCached : public ITextRender {
+  private:
+    ITextRender* textRender = nullptr;
+    TextMeasureCache* cache = nullptr;
+    CachedFont* currFont = nullptr;
+    // the font is only set on textRender when it's needed,
+    // so that cache hits don't select fonts into a DC
+    CachedFont* textRenderFont = nullptr;
+
+    TextRenderMeasureCached() = default;
+    void SetTextRenderFont();
+
+  public:
+    static TextRenderMeasureCached* Create(ITextRender* textRender);
+
+    void SetFont(CachedFont* font) override;
+    void SetTextColor(Gdiplus::Color col) override;
+    void SetTextBgColor(Gdiplus::Color col) override;
+
+    float GetCurrFontLineSpacing() override;
+
+    RectF Measure(const char* s, size_t sLen) override;
+    RectF Measure(const WCHAR* s, size_t sLen) override;
+
+    void Lock() override;
+    void Unlock() override;
+
+    void Draw(const char* s, size_t sLen, RectF bb, bool isRtl) override;
+    void Draw(const WCHAR* s, size_t sLen, RectF bb, bool isRtl) override;
+
+    float EstimateWidth(const WCHAR* s, size_t sLen) override;
+
+    ~TextRenderMeasureCached() override;
+};
+
 ITextRender* CreateTextRender(TextRenderMethod method, Graphics* gfx, int dx, int dy);
 
 size_t StringLenForWidth(ITextRender* textMeasure, const WCHAR* s, size_t len, float dx);
@@ -48,11 +48,14 @@ class PreviewBase : public IThumbnailProvider,
 
     // IInitializeWithStream
     IFACEMETHODIMP Initialize(IStream* pStm, __unused DWORD grfMode) {
-        m_pStream = pStm;
-        if (!m_pStream) {
+        if (!pStm) {
             return E_INVALIDARG;
         }
-        m_pStream->AddRef();
+        // engines seek a lot, so they read the shell's stream through a block cache
+        m_pStream = GetBlockCachedStream(pStm);
+        if (!m_pStream) {
+            return E_FAIL;
+        }
         return S_OK;
     };
 
@@ -3,6 +3,7 @@
 
 #include "utils/BaseUtil.h"
 #include "utils/ScopedWin.h"
+#include "utils/BlockCachedStream.h"
 #include "utils/FileUtil.h"
 #include "utils/WinUtil.h"
 
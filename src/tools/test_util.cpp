@@ -11,14 +11,19 @@ extern void BaseUtils_UnitTests();
 extern void SumatraPDF_UnitTests();
 
 extern void BaseUtilTest();
+extern void BenchReportTest();
+extern void BlockCachedStreamTest();
 extern void ByteOrderTests();
 extern void CryptoUtilTest();
 extern void CssParser_UnitTests();
 extern void DictTest();
+extern void FileChangeDebouncerTest();
 extern void FileUtilTest();
 extern void HtmlPrettyPrintTest();
 extern void HtmlPullParser_UnitTests();
 extern void JsonTest();
+extern void PageResultCacheTest();
+extern void PixelConvertTest();
 extern void SettingsUtilTest();
 extern void SimpleLogTest();
 extern void SquareTreeTest();
@@ -38,14 +43,19 @@ int main(__unused int argc, __unused char** argv) {
 
     InitDynCalls();
     BaseUtilTest();
+    BenchReportTest();
+    BlockCachedStreamTest();
     ByteOrderTests();
     CryptoUtilTest();
     CssParser_UnitTests();
     DictTest();
+    FileChangeDebouncerTest();
     FileUtilTest();
     HtmlPrettyPrintTest();
     HtmlPullParser_UnitTests();
     JsonTest();
+    PageResultCacheTest();
+    PixelConvertTest();
     SettingsUtilTest();
     SimpleLogTest();
     SquareTreeTest();
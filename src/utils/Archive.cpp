@@ -6,6 +6,7 @@
 #include "utils/ScopedWin.h"
 #include "utils/WinUtil.h"
 #include "utils/CryptoUtil.h"
+#include "utils/Dict.h"
 
 #include "utils/Archive.h"
 
@@ -83,6 +84,7 @@ bool MultiFormatArchive::Open(ar_stream* data, const char* archivePath) {
 
         fileId++;
     }
+    BuildNameIndex();
     return true;
 }
 
@@ -92,15 +94,74 @@ MultiFormatArchive::~MultiFormatArchive() {
     for (auto& fi : fileInfos_) {
         free((void*)fi->data);
     }
+    delete nameIndex_;
 }
 
-size_t getFileIdByName(Vec<MultiFormatArchive::FileInfo*>& fileInfos, const char* name) {
-    for (auto fileInfo : fileInfos) {
-        if (str::EqI(fileInfo->name.data(), name)) {
-            return fileInfo->fileId;
+static int HexDigitVal(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+void NormalizeArchiveName(const char* name, str::Str& out) {
+    out.Reset();
+    for (const char* s = name; *s;) {
+        char c = *s++;
+        if (c == '%' && HexDigitVal(s[0]) >= 0 && HexDigitVal(s[1]) >= 0) {
+            c = (char)(HexDigitVal(s[0]) * 16 + HexDigitVal(s[1]));
+            s += 2;
+        }
+        if (c == '\\') {
+            c = '/';
+        }
+        // skip "./" at the start of a path segment
+        bool segmentStart = out.size() == 0 || out.Last() == '/';
+        if (segmentStart && c == '.' && (*s == '/' || *s == '\\')) {
+            s++;
+            continue;
+        }
+        if (c >= 'A' && c <= 'Z') {
+            c += 'a' - 'A';
         }
+        out.AppendChar(c);
+    }
+}
+
+// formats like EPUB look up many files by name, so we
+// don't want to scan all file infos for each lookup
+void MultiFormatArchive::BuildNameIndex() {
+    CrashIf(nameIndex_);
+    size_t size = 64;
+    while (size < fileInfos_.size()) {
+        size *= 2;
+    }
+    nameIndex_ = new dict::MapStrToInt(size);
+    str::Str name;
+    for (FileInfo* fi : fileInfos_) {
+        NormalizeArchiveName(fi->name.data(), name);
+        // if there are duplicate names, the first one wins
+        nameIndex_->Insert(name.Get(), (int)fi->fileId);
+    }
+}
+
+static size_t getFileIdByName(dict::MapStrToInt* nameIndex, const char* name) {
+    if (!nameIndex || !name) {
+        return (size_t)-1;
+    }
+    str::Str normalized;
+    NormalizeArchiveName(name, normalized);
+    int fileId;
+    if (!nameIndex->Get(normalized.Get(), &fileId)) {
+        return (size_t)-1;
     }
-    return (size_t)-1;
+    return (size_t)fileId;
 }
 
 Vec<MultiFormatArchive::FileInfo*> const& MultiFormatArchive::GetFileInfos() {
@@ -108,7 +169,7 @@ Vec<MultiFormatArchive::FileInfo*> const& MultiFormatArchive::GetFileInfos() {
 }
 
 size_t MultiFormatArchive::GetFileId(const char* fileName) {
-    return getFileIdByName(fileInfos_, fileName);
+    return getFileIdByName(nameIndex_, fileName);
 }
 
 ByteSlice MultiFormatArchive::GetFileDataByName(const WCHAR* fileName) {
@@ -117,7 +178,7 @@ ByteSlice MultiFormatArchive::GetFileDataByName(const WCHAR* fileName) {
 }
 
 ByteSlice MultiFormatArchive::GetFileDataByName(const char* fileName) {
-    size_t fileId = getFileIdByName(fileInfos_, fileName);
+    size_t fileId = getFileIdByName(nameIndex_, fileName);
     return GetFileDataById(fileId);
 }
 
@@ -441,5 +502,6 @@ bool MultiFormatArchive::OpenUnrarFallback(const char* rarPath) {
     RARCloseArchive(hArc);
 
     rarFilePath_ = str::Dup(&allocator_, rarPath);
+    BuildNameIndex();
     return true;
 }
@@ -8,6 +8,10 @@ typedef struct ar_archive_s ar_archive;
 
 typedef ar_archive* (*archive_opener_t)(ar_stream*);
 
+namespace dict {
+class MapStrToInt;
+}
+
 class MultiFormatArchive {
   public:
     enum class Format { Zip, Rar, SevenZip, Tar };
@@ -34,6 +38,8 @@ class MultiFormatArchive {
 
     Vec<FileInfo*> const& GetFileInfos();
 
+    // returns (size_t)-1 if there's no such file. Names are compared
+    // case-insensitively and after NormalizeArchiveName()
     size_t GetFileId(const char* fileName);
 
     ByteSlice GetFileDataByName(const WCHAR* filename);
@@ -49,6 +55,8 @@ class MultiFormatArchive {
     // used for allocating strings that are referenced by ArchFileInfo::name
     PoolAllocator allocator_;
     Vec<FileInfo*> fileInfos_;
+    // normalized name => fileId, built after reading the list of files
+    dict::MapStrToInt* nameIndex_ = nullptr;
 
     archive_opener_t opener_ = nullptr;
     ar_stream* data_ = nullptr;
@@ -57,6 +65,7 @@ class MultiFormatArchive {
     // only set when we loaded file infos using unrar.dll fallback
     const char* rarFilePath_ = nullptr;
 
+    void BuildNameIndex();
     bool OpenUnrarFallback(const char* rarPathUtf);
     ByteSlice GetFileDataByIdUnarrDll(size_t fileId);
     [[nodiscard]] bool LoadedUsingUnrarDll() const {
@@ -64,6 +73,10 @@ class MultiFormatArchive {
     }
 };
 
+// lower-cases ASCII letters, decodes %xx escapes (as used in e.g. EPUB
+// manifests), converts backslashes to '/' and removes "./" path segments
+void NormalizeArchiveName(const char* name, str::Str& out);
+
 MultiFormatArchive* OpenZipArchive(const char* path, bool deflatedOnly);
 MultiFormatArchive* Open7zArchive(const char* path);
 MultiFormatArchive* OpenTarArchive(const char* path);
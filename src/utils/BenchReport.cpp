@@ -0,0 +1,203 @@
+/* Copyright 2021 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+#include "utils/BaseUtil.h"
+#include "utils/JsonParser.h"
+#include "utils/BenchReport.h"
+
+static const char* gBenchMetricNames[] = {"load", "render", "text", "toc"};
+static_assert(dimof(gBenchMetricNames) == (int)BenchMetric::Count, "gBenchMetricNames out of sync with BenchMetric");
+
+const char* BenchMetricName(BenchMetric m) {
+    int i = (int)m;
+    CrashIf(i < 0 || i >= (int)BenchMetric::Count);
+    return gBenchMetricNames[i];
+}
+
+void BenchSamples::Add(double timeMs) {
+    ms.Append(timeMs);
+}
+
+void BenchSamples::Append(const BenchSamples& other) {
+    for (double v : other.ms) {
+        ms.Append(v);
+    }
+}
+
+double BenchPercentile(const Vec<double>& sorted, int p) {
+    int n = sorted.isize();
+    if (n == 0) {
+        return 0;
+    }
+    // nearest-rank: smallest value such that p% of samples are <= it
+    int rank = (int)(((i64)n * p + 99) / 100);
+    rank = std::clamp(rank, 1, n);
+    return sorted[rank - 1];
+}
+
+BenchSummary BenchSamples::Summarize() {
+    BenchSummary res;
+    int n = ms.isize();
+    if (n == 0) {
+        return res;
+    }
+    std::sort(ms.begin(), ms.end());
+    double sum = 0;
+    for (double v : ms) {
+        sum += v;
+    }
+    res.count = n;
+    res.mean = sum / n;
+    res.p50 = BenchPercentile(ms, 50);
+    res.p95 = BenchPercentile(ms, 95);
+    res.p99 = BenchPercentile(ms, 99);
+    res.max = ms[n - 1];
+    return res;
+}
+
+double BenchReport::PagesPerSec() const {
+    if (wallMs <= 0) {
+        return 0;
+    }
+    return (double)pages * 1000.0 / wallMs;
+}
+
+void BenchReportToJson(const BenchReport& report, str::Str& out) {
+    out.AppendFmt("{\n  \"workers\": %d,\n  \"files\": %d,\n  \"failedFiles\": %d,\n  \"pages\": %lld,\n",
+                  report.workers, report.files, report.failedFiles, report.pages);
+    out.AppendFmt("  \"wallMs\": %.3f,\n  \"pagesPerSec\": %.3f,\n  \"peakMemBytes\": %lld,\n", report.wallMs,
+                  report.PagesPerSec(), report.peakMemBytes);
+    out.Append("  \"metrics\": {\n");
+    for (int i = 0; i < (int)BenchMetric::Count; i++) {
+        const BenchSummary& s = report.metrics[i];
+        out.AppendFmt(
+            "    \"%s\": {\"count\": %lld, \"mean\": %.3f, \"p50\": %.3f, \"p95\": %.3f, \"p99\": %.3f, \"max\": %.3f}%s\n",
+            gBenchMetricNames[i], s.count, s.mean, s.p50, s.p95, s.p99, s.max,
+            i + 1 < (int)BenchMetric::Count ? "," : "");
+    }
+    out.Append("  }\n}\n");
+}
+
+class BenchReportParser : public json::ValueVisitor {
+  public:
+    BenchReport& report;
+    int nValues = 0;
+
+    explicit BenchReportParser(BenchReport& report) : report(report) {
+    }
+
+    bool Visit(const char* path, const char* value, json::Type type) override {
+        if (type != json::Type::Number) {
+            return true;
+        }
+        double v = strtod(value, nullptr);
+        nValues++;
+        if (str::Eq(path, "/workers")) {
+            report.workers = (int)v;
+        } else if (str::Eq(path, "/files")) {
+            report.files = (int)v;
+        } else if (str::Eq(path, "/failedFiles")) {
+            report.failedFiles = (int)v;
+        } else if (str::Eq(path, "/pages")) {
+            report.pages = (i64)v;
+        } else if (str::Eq(path, "/wallMs")) {
+            report.wallMs = v;
+        } else if (str::Eq(path, "/peakMemBytes")) {
+            report.peakMemBytes = (i64)v;
+        } else if (str::StartsWith(path, "/metrics/")) {
+            VisitMetric(path + 9, v);
+        }
+        return true;
+    }
+
+    void VisitMetric(const char* path, double v) {
+        for (int i = 0; i < (int)BenchMetric::Count; i++) {
+            const char* name = gBenchMetricNames[i];
+            size_t nameLen = str::Len(name);
+            if (!str::StartsWith(path, name) || path[nameLen] != '/') {
+                continue;
+            }
+            const char* field = path + nameLen + 1;
+            BenchSummary& s = report.metrics[i];
+            if (str::Eq(field, "count")) {
+                s.count = (i64)v;
+            } else if (str::Eq(field, "mean")) {
+                s.mean = v;
+            } else if (str::Eq(field, "p50")) {
+                s.p50 = v;
+            } else if (str::Eq(field, "p95")) {
+                s.p95 = v;
+            } else if (str::Eq(field, "p99")) {
+                s.p99 = v;
+            } else if (str::Eq(field, "max")) {
+                s.max = v;
+            }
+            return;
+        }
+    }
+};
+
+bool BenchReportFromJson(const char* data, BenchReport& out) {
+    out = BenchReport();
+    BenchReportParser parser(out);
+    if (!json::Parse(data, &parser)) {
+        return false;
+    }
+    return parser.nValues > 0;
+}
+
+static bool IsWorse(double base, double curr, double thresholdPercent) {
+    return curr > base * (1.0 + thresholdPercent / 100.0);
+}
+
+static double PercentChange(double base, double curr) {
+    if (base == 0) {
+        return 0;
+    }
+    return (curr - base) * 100.0 / base;
+}
+
+int CompareBenchReports(const BenchReport& base, const BenchReport& curr, double thresholdPercent, double minDiffMs,
+                        str::Str& out) {
+    int nRegressions = 0;
+    for (int i = 0; i < (int)BenchMetric::Count; i++) {
+        const BenchSummary& b = base.metrics[i];
+        const BenchSummary& c = curr.metrics[i];
+        if (b.count == 0 || c.count == 0) {
+            continue;
+        }
+        struct {
+            const char* name;
+            double base;
+            double curr;
+        } values[] = {{"p50", b.p50, c.p50}, {"p95", b.p95, c.p95}, {"p99", b.p99, c.p99}};
+        for (auto& v : values) {
+            if (v.curr - v.base < minDiffMs || !IsWorse(v.base, v.curr, thresholdPercent)) {
+                continue;
+            }
+            out.AppendFmt("regression: %s.%s %.2f ms => %.2f ms (%+.1f%%)\n", gBenchMetricNames[i], v.name, v.base,
+                          v.curr, PercentChange(v.base, v.curr));
+            nRegressions++;
+        }
+    }
+
+    // pages/sec is only comparable when using the same number of workers
+    double bPps = base.PagesPerSec();
+    double cPps = curr.PagesPerSec();
+    if (base.workers == curr.workers && bPps > 0 && IsWorse(cPps, bPps, thresholdPercent)) {
+        out.AppendFmt("regression: pagesPerSec %.2f => %.2f (%+.1f%%)\n", bPps, cPps, PercentChange(bPps, cPps));
+        nRegressions++;
+    }
+    double bMem = (double)base.peakMemBytes;
+    double cMem = (double)curr.peakMemBytes;
+    if (bMem > 0 && IsWorse(bMem, cMem, thresholdPercent)) {
+        out.AppendFmt("regression: peakMemBytes %lld => %lld (%+.1f%%)\n", base.peakMemBytes, curr.peakMemBytes,
+                      PercentChange(bMem, cMem));
+        nRegressions++;
+    }
+    if (curr.failedFiles > base.failedFiles) {
+        out.AppendFmt("regression: failedFiles %d => %d\n", base.failedFiles, curr.failedFiles);
+        nRegressions++;
+    }
+    return nRegressions;
+}
@@ -0,0 +1,64 @@
+/* Copyright 2021 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+// Machine-readable results of benchmarking a set of documents
+// (used by EngineDump -bench and SumatraPDF -bench -bench-report).
+//
+// Timings are collected as samples (in ms) and summarized as count,
+// mean, p50/p95/p99 and max. Reports are saved as JSON and two reports
+// can be compared to find regressions, e.g.:
+// {
+//   "workers": 4, "files": 120, "failedFiles": 1, "pages": 8311,
+//   "wallMs": 93512.3, "pagesPerSec": 88.9, "peakMemBytes": 512000000,
+//   "metrics": {
+//     "load": {"count": 119, "mean": 12.1, "p50": 8.0, "p95": 40.2, "p99": 77.0, "max": 91.3},
+//     ...
+//   }
+// }
+
+enum class BenchMetric { Load = 0, Render, Text, Toc, Count };
+
+const char* BenchMetricName(BenchMetric m);
+
+struct BenchSummary {
+    i64 count = 0;
+    double mean = 0;
+    double p50 = 0;
+    double p95 = 0;
+    double p99 = 0;
+    double max = 0;
+};
+
+// timings of a single metric, in ms
+struct BenchSamples {
+    Vec<double> ms;
+
+    void Add(double timeMs);
+    void Append(const BenchSamples& other);
+    // sorts the samples
+    BenchSummary Summarize();
+};
+
+struct BenchReport {
+    int workers = 1;
+    int files = 0;
+    int failedFiles = 0;
+    i64 pages = 0;
+    double wallMs = 0;
+    i64 peakMemBytes = 0;
+    BenchSummary metrics[(int)BenchMetric::Count];
+
+    double PagesPerSec() const;
+};
+
+// value at percentile p (0..100) using nearest-rank; samples must be sorted
+double BenchPercentile(const Vec<double>& sorted, int p);
+
+void BenchReportToJson(const BenchReport& report, str::Str& out);
+bool BenchReportFromJson(const char* data, BenchReport& out);
+
+// appends a description of each metric of curr that is worse than in base
+// by more than thresholdPercent and returns the number of such regressions.
+// latency differences smaller than minDiffMs are treated as noise.
+int CompareBenchReports(const BenchReport& base, const BenchReport& curr, double thresholdPercent, double minDiffMs,
+                        str::Str& out);
@@ -0,0 +1,402 @@
+/* Copyright 2021 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+#include "utils/BaseUtil.h"
+#include "utils/ScopedWin.h"
+#include "utils/BlockCachedStream.h"
+
+// {9C1B5F43-7D2E-4A8B-9F5C-3E6A1D0B7C21}, only used to recognize our own streams
+static const IID IID_BlockCachedStream = {0x9c1b5f43, 0x7d2e, 0x4a8b, {0x9f, 0x5c, 0x3e, 0x6a, 0x1d, 0x0b, 0x7c, 0x21}};
+
+struct BlockCachedStream::Block {
+    i64 blockNo = -1;
+    u8* data = nullptr;
+    // less than blockSize for the last block
+    int size = 0;
+    u64 lastUse = 0;
+};
+
+static i64 GetStreamSize(IStream* stream) {
+    STATSTG stat;
+    HRESULT res = stream->Stat(&stat, STATFLAG_NONAME);
+    if (SUCCEEDED(res)) {
+        return (i64)stat.cbSize.QuadPart;
+    }
+    // not all streams implement Stat()
+    LARGE_INTEGER zero{};
+    ULARGE_INTEGER end;
+    res = stream->Seek(zero, STREAM_SEEK_END, &end);
+    if (FAILED(res)) {
+        return -1;
+    }
+    return (i64)end.QuadPart;
+}
+
+BlockCachedStream* BlockCachedStream::Create(IStream* src, int blockSize, int maxBlocks) {
+    if (!src || blockSize <= 0 || maxBlocks <= 0) {
+        return nullptr;
+    }
+    i64 size = GetStreamSize(src);
+    if (size < 0) {
+        return nullptr;
+    }
+    return new BlockCachedStream(src, size, blockSize, maxBlocks);
+}
+
+BlockCachedStream::BlockCachedStream(IStream* src, i64 size, int blockSize, int maxBlocks)
+    : src(src), size(size), blockSize(blockSize), maxBlocks(maxBlocks) {
+    src->AddRef();
+    InitializeCriticalSection(&cs);
+}
+
+BlockCachedStream::~BlockCachedStream() {
+    for (Block* b : blocks) {
+        free(b->data);
+        delete b;
+    }
+    DeleteCriticalSection(&cs);
+    src->Release();
+}
+
+// reads a block from the source stream, re-using the least recently used
+// block if the cache is full
+BlockCachedStream::Block* BlockCachedStream::GetBlock(i64 blockNo) {
+    useCounter++;
+    if (lastBlock && lastBlock->blockNo == blockNo) {
+        lastBlock->lastUse = useCounter;
+        stats.hits++;
+        return lastBlock;
+    }
+    Block* lru = nullptr;
+    for (Block* b : blocks) {
+        if (b->blockNo == blockNo) {
+            b->lastUse = useCounter;
+            lastBlock = b;
+            stats.hits++;
+            return b;
+        }
+        if (!lru || b->lastUse < lru->lastUse) {
+            lru = b;
+        }
+    }
+    stats.misses++;
+
+    Block* b = lru;
+    if (blocks.isize() < maxBlocks) {
+        b = new Block();
+        b->data = AllocArray<u8>(blockSize);
+        if (!b->data) {
+            delete b;
+            return nullptr;
+        }
+        blocks.Append(b);
+    }
+    // invalidate the block in case reading fails
+    b->blockNo = -1;
+    lastBlock = nullptr;
+
+    i64 off = blockNo * blockSize;
+    LARGE_INTEGER li;
+    li.QuadPart = off;
+    HRESULT res = src->Seek(li, STREAM_SEEK_SET, nullptr);
+    if (FAILED(res)) {
+        return nullptr;
+    }
+    int toRead = (int)std::min((i64)blockSize, size - off);
+    int nRead = 0;
+    // Read() is allowed to return less than asked for
+    while (nRead < toRead) {
+        ULONG n = 0;
+        res = src->Read(b->data + nRead, (ULONG)(toRead - nRead), &n);
+        stats.sourceReads++;
+        if (FAILED(res)) {
+            return nullptr;
+        }
+        if (n == 0) {
+            break;
+        }
+        nRead += (int)n;
+        stats.sourceBytesRead += n;
+    }
+    b->blockNo = blockNo;
+    b->size = nRead;
+    b->lastUse = useCounter;
+    lastBlock = b;
+    return b;
+}
+
+i64 BlockCachedStream::ReadAt(i64 off, void* buf, i64 n) {
+    if (off < 0 || n < 0) {
+        return -1;
+    }
+    ScopedCritSec scope(&cs);
+    u8* dst = (u8*)buf;
+    i64 nRead = 0;
+    while (nRead < n && off < size) {
+        i64 blockNo = off / blockSize;
+        Block* b = GetBlock(blockNo);
+        if (!b) {
+            return nRead > 0 ? nRead : -1;
+        }
+        int blockOff = (int)(off - blockNo * blockSize);
+        if (blockOff >= b->size) {
+            // the source is shorter than it claimed to be
+            break;
+        }
+        i64 toCopy = std::min(n - nRead, (i64)(b->size - blockOff));
+        memcpy(dst + nRead, b->data + blockOff, (size_t)toCopy);
+        nRead += toCopy;
+        off += toCopy;
+    }
+    return nRead;
+}
+
+BlockCachedStream::Stats BlockCachedStream::GetStats() {
+    ScopedCritSec scope(&cs);
+    return stats;
+}
+
+IFACEMETHODIMP BlockCachedStream::QueryInterface(REFIID riid, void** ppv) {
+    if (IsEqualIID(riid, IID_BlockCachedStream)) {
+        AddRef();
+        *ppv = this;
+        return S_OK;
+    }
+    static const QITAB qit[] = {QITABENT(BlockCachedStream, IStream), QITABENT(BlockCachedStream, ISequentialStream),
+                                {nullptr}};
+    return QISearch(this, qit, riid, ppv);
+}
+
+IFACEMETHODIMP_(ULONG) BlockCachedStream::AddRef() {
+    return InterlockedIncrement(&refCount);
+}
+
+IFACEMETHODIMP_(ULONG) BlockCachedStream::Release() {
+    LONG res = InterlockedDecrement(&refCount);
+    CrashIf(res < 0);
+    if (0 == res) {
+        delete this;
+    }
+    return res;
+}
+
+IFACEMETHODIMP BlockCachedStream::Read(void* buf, ULONG cb, ULONG* pcbRead) {
+    i64 off;
+    {
+        ScopedCritSec scope(&cs);
+        off = pos;
+    }
+    i64 n = ReadAt(off, buf, cb);
+    if (n < 0) {
+        return E_FAIL;
+    }
+    {
+        ScopedCritSec scope(&cs);
+        pos = off + n;
+    }
+    if (pcbRead) {
+        *pcbRead = (ULONG)n;
+    }
+    return n < cb ? S_FALSE : S_OK;
+}
+
+IFACEMETHODIMP BlockCachedStream::Write(__unused const void* buf, __unused ULONG cb, __unused ULONG* pcbWritten) {
+    return STG_E_ACCESSDENIED;
+}
+
+IFACEMETHODIMP BlockCachedStream::Seek(LARGE_INTEGER move, DWORD origin, ULARGE_INTEGER* newPos) {
+    ScopedCritSec scope(&cs);
+    i64 base = 0;
+    switch (origin) {
+        case STREAM_SEEK_SET:
+            base = 0;
+            break;
+        case STREAM_SEEK_CUR:
+            base = pos;
+            break;
+        case STREAM_SEEK_END:
+            base = size;
+            break;
+        default:
+            return STG_E_INVALIDFUNCTION;
+    }
+    i64 newOff = base + move.QuadPart;
+    if (newOff < 0) {
+        return STG_E_INVALIDFUNCTION;
+    }
+    pos = newOff;
+    if (newPos) {
+        newPos->QuadPart = (ULONGLONG)pos;
+    }
+    return S_OK;
+}
+
+IFACEMETHODIMP BlockCachedStream::SetSize(__unused ULARGE_INTEGER newSize) {
+    return STG_E_ACCESSDENIED;
+}
+
+IFACEMETHODIMP BlockCachedStream::CopyTo(__unused IStream* dst, __unused ULARGE_INTEGER cb,
+                                         __unused ULARGE_INTEGER* pcbRead, __unused ULARGE_INTEGER* pcbWritten) {
+    return E_NOTIMPL;
+}
+
+IFACEMETHODIMP BlockCachedStream::Commit(__unused DWORD flags) {
+    return S_OK;
+}
+
+IFACEMETHODIMP BlockCachedStream::Revert() {
+    return S_OK;
+}
+
+IFACEMETHODIMP BlockCachedStream::LockRegion(__unused ULARGE_INTEGER off, __unused ULARGE_INTEGER cb,
+                                             __unused DWORD lockType) {
+    return STG_E_INVALIDFUNCTION;
+}
+
+IFACEMETHODIMP BlockCachedStream::UnlockRegion(__unused ULARGE_INTEGER off, __unused ULARGE_INTEGER cb,
+                                               __unused DWORD lockType) {
+    return STG_E_INVALIDFUNCTION;
+}
+
+IFACEMETHODIMP BlockCachedStream::Stat(STATSTG* stat, DWORD flags) {
+    if (!stat) {
+        return STG_E_INVALIDPOINTER;
+    }
+    HRESULT res = src->Stat(stat, flags);
+    if (FAILED(res)) {
+        ZeroMemory(stat, sizeof(*stat));
+        stat->type = STGTY_STREAM;
+    }
+    stat->cbSize.QuadPart = (ULONGLONG)size;
+    return S_OK;
+}
+
+IFACEMETHODIMP BlockCachedStream::Clone(__unused IStream** ppstm) {
+    return E_NOTIMPL;
+}
+
+BlockCachedStream* GetBlockCachedStream(IStream* stream) {
+    if (!stream) {
+        return nullptr;
+    }
+    BlockCachedStream* cached = nullptr;
+    HRESULT res = stream->QueryInterface(IID_BlockCachedStream, (void**)&cached);
+    if (SUCCEEDED(res) && cached) {
+        return cached;
+    }
+    return BlockCachedStream::Create(stream);
+}
+
+class TestFileStream : public IStream {
+  public:
+    LONG refCount = 1;
+    HANDLE hFile = INVALID_HANDLE_VALUE;
+    DWORD latencyMs = 0;
+    LONG* readCount = nullptr;
+    LONG* seekCount = nullptr;
+
+    ~TestFileStream() {
+        if (hFile != INVALID_HANDLE_VALUE) {
+            CloseHandle(hFile);
+        }
+    }
+
+    void SimulateLatency(LONG* counter) {
+        if (counter) {
+            InterlockedIncrement(counter);
+        }
+        if (latencyMs > 0) {
+            Sleep(latencyMs);
+        }
+    }
+
+    IFACEMETHODIMP QueryInterface(REFIID riid, void** ppv) override {
+        static const QITAB qit[] = {QITABENT(TestFileStream, IStream), QITABENT(TestFileStream, ISequentialStream),
+                                    {nullptr}};
+        return QISearch(this, qit, riid, ppv);
+    }
+    IFACEMETHODIMP_(ULONG) AddRef() override {
+        return InterlockedIncrement(&refCount);
+    }
+    IFACEMETHODIMP_(ULONG) Release() override {
+        LONG res = InterlockedDecrement(&refCount);
+        if (0 == res) {
+            delete this;
+        }
+        return res;
+    }
+
+    IFACEMETHODIMP Read(void* buf, ULONG cb, ULONG* pcbRead) override {
+        SimulateLatency(readCount);
+        DWORD n = 0;
+        if (!ReadFile(hFile, buf, cb, &n, nullptr)) {
+            return HRESULT_FROM_WIN32(GetLastError());
+        }
+        if (pcbRead) {
+            *pcbRead = n;
+        }
+        return n < cb ? S_FALSE : S_OK;
+    }
+    IFACEMETHODIMP Write(__unused const void* buf, __unused ULONG cb, __unused ULONG* pcbWritten) override {
+        return STG_E_ACCESSDENIED;
+    }
+    IFACEMETHODIMP Seek(LARGE_INTEGER move, DWORD origin, ULARGE_INTEGER* newPos) override {
+        SimulateLatency(seekCount);
+        LARGE_INTEGER res;
+        // STREAM_SEEK_* have the same values as FILE_BEGIN, FILE_CURRENT, FILE_END
+        if (!SetFilePointerEx(hFile, move, &res, origin)) {
+            return HRESULT_FROM_WIN32(GetLastError());
+        }
+        if (newPos) {
+            newPos->QuadPart = (ULONGLONG)res.QuadPart;
+        }
+        return S_OK;
+    }
+    IFACEMETHODIMP SetSize(__unused ULARGE_INTEGER newSize) override {
+        return STG_E_ACCESSDENIED;
+    }
+    IFACEMETHODIMP CopyTo(__unused IStream* dst, __unused ULARGE_INTEGER cb, __unused ULARGE_INTEGER* pcbRead,
+                          __unused ULARGE_INTEGER* pcbWritten) override {
+        return E_NOTIMPL;
+    }
+    IFACEMETHODIMP Commit(__unused DWORD flags) override {
+        return S_OK;
+    }
+    IFACEMETHODIMP Revert() override {
+        return S_OK;
+    }
+    IFACEMETHODIMP LockRegion(__unused ULARGE_INTEGER off, __unused ULARGE_INTEGER cb,
+                              __unused DWORD lockType) override {
+        return STG_E_INVALIDFUNCTION;
+    }
+    IFACEMETHODIMP UnlockRegion(__unused ULARGE_INTEGER off, __unused ULARGE_INTEGER cb,
+                                __unused DWORD lockType) override {
+        return STG_E_INVALIDFUNCTION;
+    }
+    IFACEMETHODIMP Stat(STATSTG* stat, __unused DWORD flags) override {
+        ZeroMemory(stat, sizeof(*stat));
+        stat->type = STGTY_STREAM;
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(hFile, &size)) {
+            return HRESULT_FROM_WIN32(GetLastError());
+        }
+        stat->cbSize.QuadPart = (ULONGLONG)size.QuadPart;
+        return S_OK;
+    }
+    IFACEMETHODIMP Clone(__unused IStream** ppstm) override {
+        return E_NOTIMPL;
+    }
+};
+
+IStream* CreateTestFileStream(const WCHAR* path, DWORD latencyMs, LONG* readCountOut, LONG* seekCountOut) {
+    HANDLE h = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (h == INVALID_HANDLE_VALUE) {
+        return nullptr;
+    }
+    auto res = new TestFileStream();
+    res->hFile = h;
+    res->latencyMs = latencyMs;
+    res->readCount = readCountOut;
+    res->seekCount = seekCountOut;
+    return res;
+}
@@ -0,0 +1,91 @@
+/* Copyright 2021 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+// Read-only, seekable IStream with 64-bit offsets that reads another
+// IStream through an LRU cache of fixed-size blocks.
+//
+// The previewer and ifilter hosts get an IStream from the shell. Every
+// Read()/Seek() on it is a COM call that might end up on a network
+// share or inside a zip file. Engines do lots of small, random reads
+// (PDF xref, zip central directory) so reading through the cache turns
+// them into few block-sized reads of the source stream.
+//
+// It's an IStream itself so it can be passed to any
+// CreateEngine*FromStream() and shared by all engines.
+
+class BlockCachedStream : public IStream {
+  public:
+    static constexpr int kDefaultBlockSize = 64 * 1024;
+    static constexpr int kDefaultMaxBlocks = 256;
+
+    struct Stats {
+        i64 sourceReads = 0;
+        i64 sourceBytesRead = 0;
+        i64 hits = 0;
+        i64 misses = 0;
+    };
+
+    // returns nullptr if the size of src can't be determined
+    static BlockCachedStream* Create(IStream* src, int blockSize = kDefaultBlockSize,
+                                     int maxBlocks = kDefaultMaxBlocks);
+
+    // reads up to n bytes at off, returns number of bytes read (0 at the
+    // end of stream) or -1 on read error. Doesn't change the stream position.
+    i64 ReadAt(i64 off, void* buf, i64 n);
+    i64 Size() const {
+        return size;
+    }
+    Stats GetStats();
+
+    // IUnknown
+    IFACEMETHODIMP QueryInterface(REFIID riid, void** ppv) override;
+    IFACEMETHODIMP_(ULONG) AddRef() override;
+    IFACEMETHODIMP_(ULONG) Release() override;
+
+    // ISequentialStream
+    IFACEMETHODIMP Read(void* buf, ULONG cb, ULONG* pcbRead) override;
+    IFACEMETHODIMP Write(const void* buf, ULONG cb, ULONG* pcbWritten) override;
+
+    // IStream
+    IFACEMETHODIMP Seek(LARGE_INTEGER move, DWORD origin, ULARGE_INTEGER* newPos) override;
+    IFACEMETHODIMP SetSize(ULARGE_INTEGER newSize) override;
+    IFACEMETHODIMP CopyTo(IStream* dst, ULARGE_INTEGER cb, ULARGE_INTEGER* pcbRead,
+                          ULARGE_INTEGER* pcbWritten) override;
+    IFACEMETHODIMP Commit(DWORD flags) override;
+    IFACEMETHODIMP Revert() override;
+    IFACEMETHODIMP LockRegion(ULARGE_INTEGER off, ULARGE_INTEGER cb, DWORD lockType) override;
+    IFACEMETHODIMP UnlockRegion(ULARGE_INTEGER off, ULARGE_INTEGER cb, DWORD lockType) override;
+    IFACEMETHODIMP Stat(STATSTG* stat, DWORD flags) override;
+    IFACEMETHODIMP Clone(IStream** ppstm) override;
+
+  private:
+    struct Block;
+
+    BlockCachedStream(IStream* src, i64 size, int blockSize, int maxBlocks);
+    ~BlockCachedStream();
+
+    Block* GetBlock(i64 blockNo);
+
+    LONG refCount = 1;
+    IStream* src = nullptr;
+    i64 size = 0;
+    int blockSize = 0;
+    int maxBlocks = 0;
+    // current position for Read() and Seek()
+    i64 pos = 0;
+
+    CRITICAL_SECTION cs;
+    Vec<Block*> blocks;
+    Block* lastBlock = nullptr;
+    u64 useCounter = 0;
+    Stats stats;
+};
+
+// returns stream (with an added reference) if it already is a
+// BlockCachedStream, a new BlockCachedStream reading from it otherwise
+BlockCachedStream* GetBlockCachedStream(IStream* stream);
+
+// IStream over a local file that counts Read()/Seek() calls and can add
+// a delay to each call, to simulate a slow shell stream. For tests and
+// benchmarking access patterns of engines.
+IStream* CreateTestFileStream(const WCHAR* path, DWORD latencyMs, LONG* readCountOut, LONG* seekCountOut);
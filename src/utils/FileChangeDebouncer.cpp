@@ -0,0 +1,147 @@
+/* Copyright 2021 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+#include "utils/BaseUtil.h"
+#include "utils/FileChangeDebouncer.h"
+
+struct FileChangeDebouncer::File {
+    void* file{nullptr};
+    bool isPolled{false};
+
+    // true if we got a change notification and are waiting for the file to settle
+    bool isPending{false};
+    i64 firstChangeMs{0};
+    i64 lastChangeMs{0};
+    // state at the time of the last notification (or poll)
+    FileState state;
+
+    i64 pollIntervalMs{0};
+    i64 nextPollMs{0};
+};
+
+FileChangeDebouncer::FileChangeDebouncer(const GetStateFunc& getState) : getState(getState) {
+}
+
+FileChangeDebouncer::~FileChangeDebouncer() {
+    DeleteVecMembers(files);
+}
+
+FileChangeDebouncer::File* FileChangeDebouncer::Find(void* file) const {
+    for (File* f : files) {
+        if (f->file == file) {
+            return f;
+        }
+    }
+    return nullptr;
+}
+
+void FileChangeDebouncer::Add(void* file, bool isPolled, i64 nowMs) {
+    CrashIf(Find(file));
+    File* f = new File();
+    f->file = file;
+    f->isPolled = isPolled;
+    f->pollIntervalMs = minPollMs;
+    f->nextPollMs = nowMs + minPollMs;
+    getState(file, &f->state);
+    files.Append(f);
+}
+
+void FileChangeDebouncer::Remove(void* file) {
+    File* f = Find(file);
+    if (f) {
+        files.Remove(f);
+        delete f;
+    }
+}
+
+static void MarkChanged(FileChangeDebouncer::File* f, const FileChangeDebouncer::FileState& state, i64 nowMs) {
+    if (!f->isPending) {
+        f->isPending = true;
+        f->firstChangeMs = nowMs;
+    }
+    f->lastChangeMs = nowMs;
+    f->state = state;
+}
+
+void FileChangeDebouncer::OnChanged(void* file, i64 nowMs) {
+    File* f = Find(file);
+    if (!f) {
+        return;
+    }
+    FileState state;
+    getState(file, &state);
+    MarkChanged(f, state, nowMs);
+}
+
+void FileChangeDebouncer::Process(i64 nowMs, Vec<void*>& changed) {
+    for (File* f : files) {
+        FileState state;
+        if (f->isPolled && !f->isPending && nowMs >= f->nextPollMs) {
+            getState(f->file, &state);
+            if (!state.Eq(f->state)) {
+                MarkChanged(f, state, nowMs);
+                f->pollIntervalMs = minPollMs;
+            } else {
+                // back off polling files that don't change
+                f->pollIntervalMs = std::min(f->pollIntervalMs * 2, maxPollMs);
+            }
+            f->nextPollMs = nowMs + f->pollIntervalMs;
+        }
+
+        if (!f->isPending) {
+            continue;
+        }
+        // checked first because every notification restarts the quiet period
+        bool timedOut = nowMs - f->firstChangeMs >= maxDelayMs;
+        if (!timedOut && nowMs - f->lastChangeMs < debounceMs) {
+            continue;
+        }
+        bool exists = getState(f->file, &state);
+        bool settled = exists && state.Eq(f->state);
+        if (!exists && timedOut) {
+            // the file was deleted, not re-written
+            f->isPending = false;
+            f->state = state;
+            continue;
+        }
+        if (!settled && !timedOut) {
+            // still being written, wait for another quiet period
+            MarkChanged(f, state, nowMs);
+            continue;
+        }
+        f->isPending = false;
+        f->state = state;
+        f->pollIntervalMs = minPollMs;
+        f->nextPollMs = nowMs + minPollMs;
+        changed.Append(f->file);
+    }
+}
+
+i64 FileChangeDebouncer::NextTimeoutMs(i64 nowMs) const {
+    i64 next = -1;
+    for (File* f : files) {
+        i64 t;
+        if (f->isPending) {
+            t = std::min(f->lastChangeMs + debounceMs, f->firstChangeMs + maxDelayMs);
+        } else if (f->isPolled) {
+            t = f->nextPollMs;
+        } else {
+            continue;
+        }
+        t = std::max(t - nowMs, (i64)0);
+        if (next < 0 || t < next) {
+            next = t;
+        }
+    }
+    return next;
+}
+
+int FileChangeDebouncer::PendingCount() const {
+    int n = 0;
+    for (File* f : files) {
+        if (f->isPending) {
+            n++;
+        }
+    }
+    return n;
+}
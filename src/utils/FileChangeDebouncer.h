@@ -0,0 +1,71 @@
+/* Copyright 2021 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+// Turns a stream of raw file change notifications into one notification
+// per file once the file has stopped changing.
+//
+// A program re-writing a file (e.g. pdflatex) does that in several writes
+// and each write can generate a change notification. Reloading on every
+// notification means reloading a partially written file several times.
+//
+// A file is reported as changed after:
+//  - no notification was received for debounceMs and
+//  - its size and modification time are the same as when the last
+//    notification arrived (i.e. it has settled)
+// or, for files that never settle, maxDelayMs after the first notification.
+//
+// Files for which we don't get notifications (e.g. on network drives)
+// are polled, with the poll interval growing from minPollMs to maxPollMs
+// for as long as the file doesn't change.
+//
+// It doesn't know about threads, time or the file system: the caller
+// provides the current time and a function to get file state. That way
+// it can be driven by synthetic events in tests.
+
+struct FileChangeDebouncer {
+    // state used to detect that a file has changed and has settled
+    struct FileState {
+        i64 mtime{0};
+        i64 size{-1};
+        bool Eq(const FileState& other) const {
+            return mtime == other.mtime && size == other.size;
+        }
+    };
+
+    // returns false if the file doesn't exist (e.g. in the middle of being replaced)
+    using GetStateFunc = std::function<bool(void* file, FileState* stateOut)>;
+
+    struct File;
+
+    i64 debounceMs = 300;
+    i64 maxDelayMs = 10 * 1000;
+    i64 minPollMs = 500;
+    i64 maxPollMs = 8 * 1000;
+
+    explicit FileChangeDebouncer(const GetStateFunc& getState);
+    ~FileChangeDebouncer();
+
+    // file is an opaque value identifying the file, reported back by Process()
+    void Add(void* file, bool isPolled, i64 nowMs);
+    void Remove(void* file);
+
+    // call for every raw change notification
+    void OnChanged(void* file, i64 nowMs);
+
+    // polls files that are due and appends files that changed and
+    // have settled to changed, all of them in a single batch
+    void Process(i64 nowMs, Vec<void*>& changed);
+
+    // returns number of ms until Process() should be called next
+    // or -1 if there's nothing to wait for
+    i64 NextTimeoutMs(i64 nowMs) const;
+
+    // number of files waiting to settle
+    int PendingCount() const;
+
+  private:
+    GetStateFunc getState;
+    Vec<File*> files;
+
+    File* Find(void* file) const;
+};
@@ -3,6 +3,7 @@
 
 #include "utils/BaseUtil.h"
 #include "utils/FileUtil.h"
+#include "utils/CryptoUtil.h"
 #include "utils/ScopedWin.h"
 #include "utils/WinUtil.h"
 
@@ -730,6 +731,26 @@ bool DeleteZoneIdentifier(const char* filePath) {
     return !!DeleteFileW(pathW);
 }
 
+// fingerprint of a file that's much quicker to calculate than a hash of its content:
+// md5 of path, size and modification time as hex (e.g. as a name for cached data).
+// returns nullptr if the file doesn't exist or is a directory. caller must free()
+char* GetFingerprint(const WCHAR* filePath) {
+    WIN32_FILE_ATTRIBUTE_DATA fa{};
+    if (!filePath || !GetFileAttributesExW(filePath, GetFileExInfoStandard, &fa)) {
+        return nullptr;
+    }
+    if (fa.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+        return nullptr;
+    }
+    str::Str key;
+    key.Append(ToUtf8Temp(filePath).Get());
+    key.AppendFmt("|%u|%u|%u|%u", (uint)fa.nFileSizeHigh, (uint)fa.nFileSizeLow,
+                  (uint)fa.ftLastWriteTime.dwHighDateTime, (uint)fa.ftLastWriteTime.dwLowDateTime);
+    u8 digest[16]{0};
+    CalcMD5Digest(key.Get(), key.size(), digest);
+    return _MemToHex(&digest);
+}
+
 } // namespace file
 
 namespace dir {
@@ -786,6 +807,38 @@ bool RemoveAll(const WCHAR* dir) {
     return res == 0;
 }
 
+static u64 FileTimeToU64(FILETIME ft) {
+    return ((u64)ft.dwHighDateTime << 32) | ft.dwLowDateTime;
+}
+
+// deletes files in dir matching pattern (e.g. "*.tmp") that haven't been
+// modified in the last maxAgeDays days (all of them if maxAgeDays is 0)
+void DeleteOldFiles(const WCHAR* dir, const WCHAR* pattern, int maxAgeDays) {
+    AutoFreeWstr filter = path::Join(dir, pattern);
+
+    FILETIME now;
+    GetSystemTimeAsFileTime(&now);
+    // FILETIME is in 100 ns units
+    u64 maxAge = (u64)maxAgeDays * 24 * 60 * 60 * 10000000;
+
+    WIN32_FIND_DATAW fdata;
+    HANDLE hfind = FindFirstFileW(filter, &fdata);
+    if (INVALID_HANDLE_VALUE == hfind) {
+        return;
+    }
+    do {
+        if (fdata.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+            continue;
+        }
+        u64 lastModified = FileTimeToU64(fdata.ftLastWriteTime);
+        if (maxAgeDays == 0 || lastModified + maxAge < FileTimeToU64(now)) {
+            AutoFreeWstr filePath = path::Join(dir, fdata.cFileName);
+            file::Delete(filePath);
+        }
+    } while (FindNextFileW(hfind, &fdata));
+    FindClose(hfind);
+}
+
 } // namespace dir
 
 bool FileTimeEq(const FILETIME& a, const FILETIME& b) {
@@ -71,6 +71,8 @@ HANDLE OpenReadOnly(const WCHAR* path);
 
 bool Copy(const WCHAR* dst, const WCHAR* src, bool dontOverwrite);
 
+char* GetFingerprint(const WCHAR* path);
+
 } // namespace file
 
 namespace dir {
@@ -80,6 +82,7 @@ bool Create(const WCHAR* dir);
 bool CreateForFile(const WCHAR* path);
 bool CreateAll(const WCHAR* dir);
 bool RemoveAll(const WCHAR* dir);
+void DeleteOldFiles(const WCHAR* dir, const WCHAR* pattern, int maxAgeDays);
 } // namespace dir
 
 bool FileTimeEq(const FILETIME& a, const FILETIME& b);
@@ -3,6 +3,7 @@
 
 #include "utils/BaseUtil.h"
 #include "utils/FileWatcher.h"
+#include "utils/FileChangeDebouncer.h"
 #include "utils/ScopedWin.h"
 #include "utils/FileUtil.h"
 #include "utils/ThreadUtil.h"
@@ -31,17 +32,17 @@ worker thread so must be protected via g_threadCritSec.
 ReadDirectChangesW() doesn't always work for files on network drives,
 so for those files, we do manual checks, by using a timeout to
 periodically wake up thread.
+
+Programs re-writing a file usually do it in several writes, each of which
+generates a notification. Notifications (and detected changes of manually
+checked files) go through g_debouncer which only reports a file once it
+stops changing, so that we reload a document once per re-write.
 */
 
 /*
 TODO:
   - should I end the thread when there are no files to watch?
 
-  - a single file copy can generate multiple notifications for the same
-    file. add some delay mechanism so that subsequent change notifications
-    cancel a previous, delayed one ? E.g. a copy f2.pdf f.pdf generates 3
-    notifications if f2.pdf is 2 MB.
-
   - try to handle short file names as well: http://blogs.msdn.com/b/ericgu/archive/2005/10/07/478396.aspx
     but how to test it?
 
@@ -50,21 +51,12 @@ TODO:
     probably an overkill
 */
 
-// there's a balance between responsiveness to changes and efficiency
-#define FILEWATCH_DELAY_IN_MS 1000
-
 // Some people use overlapped.hEvent to store data but I'm playing it safe.
 struct OverlappedEx {
     OVERLAPPED overlapped{};
     void* data{nullptr};
 };
 
-// info needed to detect that a file has changed
-struct FileWatcherState {
-    FILETIME time{0};
-    i64 size{0};
-};
-
 struct WatchedDir {
     WatchedDir* next{nullptr};
     const WCHAR* dirPath{nullptr};
@@ -84,7 +76,6 @@ struct WatchedFile {
     // to check if it changed manually, by periodically checking
     // file state for changes
     bool isManualCheck{false};
-    FileWatcherState fileState;
 };
 
 static HANDLE g_threadHandle = nullptr;
@@ -98,6 +89,7 @@ static CRITICAL_SECTION g_threadCritSec;
 
 static WatchedDir* g_watchedDirs = nullptr;
 static WatchedFile* g_watchedFiles = nullptr;
+static FileChangeDebouncer* g_debouncer = nullptr;
 
 static LONG gRemovalsPending = 0;
 
@@ -107,47 +99,27 @@ static void AwakeWatcherThread() {
     SetEvent(g_threadControlHandle);
 }
 
-static void GetFileState(const WCHAR* filePath, FileWatcherState* fs) {
+static bool GetFileState(const WCHAR* filePath, FileChangeDebouncer::FileState* fs) {
     // Note: in my testing on network drive that is mac volume mounted
     // via parallels, lastWriteTime is not updated. lastAccessTime is,
     // but it's also updated when the file is being read from (e.g.
     // copy f.pdf f2.pdf will change lastAccessTime of f.pdf)
     // So I'm sticking with lastWriteTime
-    fs->time = file::GetModificationTime(filePath);
+    FILETIME time = file::GetModificationTime(filePath);
+    fs->mtime = ((i64)time.dwHighDateTime << 32) | (i64)time.dwLowDateTime;
     auto path = ToUtf8Temp(filePath);
     fs->size = file::GetSize(path.AsView());
+    return fs->size >= 0;
 }
 
-static bool FileStateEq(FileWatcherState* fs1, FileWatcherState* fs2) {
-    if (0 != CompareFileTime(&fs1->time, &fs2->time)) {
-        return false;
-    }
-    if (fs1->size != fs2->size) {
-        return false;
-    }
-    return true;
-}
-
-static bool FileStateChanged(const WCHAR* filePath, FileWatcherState* fs) {
-    FileWatcherState fsTmp;
-
-    GetFileState(filePath, &fsTmp);
-    if (FileStateEq(fs, &fsTmp)) {
-        return false;
-    }
-
-    memcpy(fs, &fsTmp, sizeof(*fs));
-    return true;
+static bool GetWatchedFileState(void* file, FileChangeDebouncer::FileState* fs) {
+    WatchedFile* wf = (WatchedFile*)file;
+    return GetFileState(wf->filePath, fs);
 }
 
 // TODO: per internet, fileName could be short, 8.3 dos-style name
 // and we don't handle that. On the other hand, I've only seen references
 // to it wrt. to rename/delete operation, which we don't get notified about
-//
-// TODO: to collapse multiple notifications for the same file, could put it on a
-// queue, restart the thread with a timeout, restart the process if we
-// get notified again before timeout expires, call OnFileChanges() when
-// timeout expires
 static void NotifyAboutFile(WatchedDir* d, const WCHAR* fileName) {
     // logf(L"NotifyAboutFile(): %s", fileName);
 
@@ -165,7 +137,8 @@ static void NotifyAboutFile(WatchedDir* d, const WCHAR* fileName) {
         // because the time granularity is so big that this can cause genuine
         // file notifications to be ignored. (This happens for instance for
         // PDF files produced by pdftex from small.tex document)
-        wf->onFileChangedCb();
+        // The debouncer only uses the state to tell if the file has settled.
+        g_debouncer->OnChanged(wf, (i64)GetTickCount64());
     }
 }
 
@@ -265,25 +238,24 @@ static void StartMonitoringDirForChanges(WatchedDir* wd) {
 
 static DWORD GetTimeoutInMs() {
     ScopedCritSec cs(&g_threadCritSec);
-    for (WatchedFile* wf = g_watchedFiles; wf; wf = wf->next) {
-        if (wf->isManualCheck) {
-            return FILEWATCH_DELAY_IN_MS;
-        }
+    i64 timeout = g_debouncer->NextTimeoutMs((i64)GetTickCount64());
+    if (timeout < 0) {
+        return INFINITE;
     }
-    return INFINITE;
+    return (DWORD)timeout;
 }
 
+// checks manually checked files that are due and notifies
+// about all files that changed and stopped changing
 static void RunManualChecks() {
     ScopedCritSec cs(&g_threadCritSec);
 
-    for (WatchedFile* wf = g_watchedFiles; wf; wf = wf->next) {
-        if (!wf->isManualCheck) {
-            continue;
-        }
-        if (FileStateChanged(wf->filePath, &wf->fileState)) {
-            // logf(L"RunManualCheck() %s changed\n", wf->filePath);
-            wf->onFileChangedCb();
-        }
+    Vec<void*> changed;
+    g_debouncer->Process((i64)GetTickCount64(), changed);
+    for (void* file : changed) {
+        WatchedFile* wf = (WatchedFile*)file;
+        // logf(L"RunManualCheck() %s changed\n", wf->filePath);
+        wf->onFileChangedCb();
     }
 }
 
@@ -303,8 +275,12 @@ static DWORD WINAPI FileWatcherThread(__unused void* param) {
         }
 
         if (WAIT_IO_COMPLETION == obj) {
-            // APC complete. Nothing to do
+            // APC complete. A steady stream of notifications keeps us from timing out,
+            // so polling and reporting files that never settle might be due
             // logf("FileWatcherThread(): APC complete\n");
+            if (GetTimeoutInMs() == 0) {
+                RunManualChecks();
+            }
             continue;
         }
 
@@ -328,6 +304,7 @@ static void StartThreadIfNecessary() {
     }
 
     InitializeCriticalSection(&g_threadCritSec);
+    g_debouncer = new FileChangeDebouncer(GetWatchedFileState);
     g_threadControlHandle = CreateEvent(nullptr, TRUE, FALSE, nullptr);
 
     g_threadHandle = CreateThread(nullptr, 0, FileWatcherThread, nullptr, 0, &g_threadId);
@@ -401,9 +378,9 @@ static WatchedFile* NewWatchedFile(const WCHAR* filePath, const std::function<vo
     wf->isManualCheck = isManualCheck;
 
     ListInsert(&g_watchedFiles, wf);
+    g_debouncer->Add(wf, isManualCheck, (i64)GetTickCount64());
 
     if (wf->isManualCheck) {
-        GetFileState(filePath, &wf->fileState);
         AwakeWatcherThread();
     } else {
         if (newDir) {
@@ -488,6 +465,7 @@ static void RemoveWatchedFile(WatchedFile* wf) {
     WatchedDir* wd = wf->watchedDir;
     bool ok = ListRemove(&g_watchedFiles, wf);
     CrashIf(!ok);
+    g_debouncer->Remove(wf);
 
     bool needsAwakeThread = wf->isManualCheck;
     DeleteWatchedFile(wf);
@@ -0,0 +1,215 @@
+/* Copyright 2021 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+#include "utils/BaseUtil.h"
+#include "utils/CryptoUtil.h"
+#include "utils/FileUtil.h"
+#include "utils/PageResultCache.h"
+
+constexpr const char* kPageResultsHeader = "PageResults 1\n";
+
+static void HashToHex(const void* data, size_t len, char hexOut[33]) {
+    u8 digest[16];
+    CalcMD5Digest(data, len, digest);
+    for (int i = 0; i < 16; i++) {
+        sprintf_s(hexOut + 2 * i, 3, "%02x", digest[i]);
+    }
+}
+
+DocResults::~DocResults() {
+    Reset();
+}
+
+void DocResults::Reset() {
+    for (PageResult& pr : pages) {
+        free(pr.text);
+    }
+    pages.Reset();
+    nPages = 0;
+    loadMs = 0;
+    tocMs = 0;
+}
+
+PageResult* DocResults::GetPage(int pageNo) {
+    for (PageResult& pr : pages) {
+        if (pr.pageNo == pageNo) {
+            return &pr;
+        }
+    }
+    return nullptr;
+}
+
+void DocResults::SetPage(int pageNo, ByteSlice bitmap, const char* text, double renderMs, double textMs) {
+    PageResult* pr = GetPage(pageNo);
+    if (!pr) {
+        size_t idx = 0;
+        while (idx < pages.size() && pages[idx].pageNo < pageNo) {
+            idx++;
+        }
+        PageResult empty;
+        empty.pageNo = pageNo;
+        pages.InsertAt(idx, empty);
+        pr = &pages[idx];
+    }
+    pr->renderHash[0] = 0;
+    if (!bitmap.empty()) {
+        HashToHex(bitmap.data(), bitmap.size(), pr->renderHash);
+    }
+    text = text ? text : "";
+    HashToHex(text, str::Len(text), pr->textHash);
+    str::ReplaceWithCopy(&pr->text, text);
+    pr->renderMs = renderMs;
+    pr->textMs = textMs;
+}
+
+bool DocResults::IsComplete() const {
+    if (nPages <= 0 || pages.isize() != nPages) {
+        return false;
+    }
+    // pages are sorted and unique, so this means all of 1..nPages are known
+    return pages[0].pageNo == 1 && pages.Last().pageNo == nPages;
+}
+
+char* PageResultsKey(const u8 docDigest[16], const char* engineVersion, float zoom, const char* options) {
+    str::Str s;
+    AutoFree docHex = str::MemToHex(docDigest, 16);
+    s.AppendFmt("%s|%s|%.4f|%s", docHex.Get(), engineVersion ? engineVersion : "", zoom, options ? options : "");
+    char hex[33];
+    HashToHex(s.Get(), s.size(), hex);
+    return str::Dup(hex);
+}
+
+void PageResultsToText(const DocResults& res, str::Str& out) {
+    out.Append(kPageResultsHeader);
+    out.AppendFmt("pages %d\nloadMs %.3f\ntocMs %.3f\n", res.nPages, res.loadMs, res.tocMs);
+    for (const PageResult& pr : res.pages) {
+        const char* text = pr.text ? pr.text : "";
+        size_t textLen = str::Len(text);
+        out.AppendFmt("page %d %.3f %.3f %s %s %d\n", pr.pageNo, pr.renderMs, pr.textMs,
+                      pr.renderHash[0] ? pr.renderHash : "-", pr.textHash, (int)textLen);
+        out.Append(text, textLen);
+        out.Append("\n");
+    }
+}
+
+// returns the next line (without '\n') and advances s past it
+static std::string_view NextLine(const char*& s, const char* end) {
+    const char* start = s;
+    while (s < end && *s != '\n') {
+        s++;
+    }
+    std::string_view line(start, s - start);
+    if (s < end) {
+        s++;
+    }
+    return line;
+}
+
+static bool CopyHash(const char* hex, size_t len, char hashOut[33]) {
+    if (len == 1 && hex[0] == '-') {
+        hashOut[0] = 0;
+        return true;
+    }
+    if (len != 32) {
+        return false;
+    }
+    memcpy(hashOut, hex, 32);
+    hashOut[32] = 0;
+    return true;
+}
+
+static bool ParsePageLine(std::string_view line, PageResult& pr, int& textLen) {
+    AutoFree s = str::Dup(line.data(), line.size());
+    char* p = s.Get();
+    if (!str::StartsWith(p, "page ")) {
+        return false;
+    }
+    p += 5;
+    pr.pageNo = (int)strtol(p, &p, 10);
+    pr.renderMs = strtod(p, &p);
+    pr.textMs = strtod(p, &p);
+    char* hashes[2];
+    char* hashesOut[2] = {pr.renderHash, pr.textHash};
+    for (int i = 0; i < 2; i++) {
+        while (*p == ' ') {
+            p++;
+        }
+        hashes[i] = p;
+        while (*p && *p != ' ') {
+            p++;
+        }
+        if (!CopyHash(hashes[i], p - hashes[i], hashesOut[i])) {
+            return false;
+        }
+    }
+    textLen = (int)strtol(p, &p, 10);
+    return pr.pageNo > 0 && textLen >= 0 && *p == 0;
+}
+
+bool PageResultsFromText(const char* data, size_t len, DocResults& res) {
+    res.Reset();
+    const char* s = data;
+    const char* end = data + len;
+    if (NextLine(s, end) != std::string_view(kPageResultsHeader, str::Len(kPageResultsHeader) - 1)) {
+        return false;
+    }
+    for (auto field : {"pages ", "loadMs ", "tocMs "}) {
+        std::string_view line = NextLine(s, end);
+        if (!str::StartsWith(line, field)) {
+            return false;
+        }
+        AutoFree v = str::Dup(line.data() + str::Len(field), line.size() - str::Len(field));
+        double d = strtod(v.Get(), nullptr);
+        if (str::Eq(field, "pages ")) {
+            res.nPages = (int)d;
+        } else if (str::Eq(field, "loadMs ")) {
+            res.loadMs = d;
+        } else {
+            res.tocMs = d;
+        }
+    }
+    while (s < end) {
+        PageResult pr;
+        int textLen = 0;
+        if (!ParsePageLine(NextLine(s, end), pr, textLen) || textLen > end - s) {
+            res.Reset();
+            return false;
+        }
+        // pages are saved in order
+        if (res.pages.size() > 0 && res.pages.Last().pageNo >= pr.pageNo) {
+            res.Reset();
+            return false;
+        }
+        pr.text = str::Dup(s, (size_t)textLen);
+        s += textLen;
+        NextLine(s, end);
+        res.pages.Append(pr);
+    }
+    return true;
+}
+
+static WCHAR* PageResultsPath(const WCHAR* cacheDir, const char* key) {
+    AutoFreeWstr fileName = strconv::Utf8ToWstr(key);
+    AutoFreeWstr path = path::Join(cacheDir, fileName);
+    return str::Join(path, L".pres");
+}
+
+bool LoadPageResults(const WCHAR* cacheDir, const char* key, DocResults& res) {
+    AutoFreeWstr path = PageResultsPath(cacheDir, key);
+    AutoFree data = file::ReadFile(path);
+    if (data.empty()) {
+        res.Reset();
+        return false;
+    }
+    return PageResultsFromText(data.Get(), data.size(), res);
+}
+
+bool SavePageResults(const WCHAR* cacheDir, const char* key, const DocResults& res) {
+    if (!dir::CreateAll(cacheDir)) {
+        return false;
+    }
+    str::Str data;
+    PageResultsToText(res, data);
+    AutoFreeWstr path = PageResultsPath(cacheDir, key);
+    return file::WriteFile(path, data.AsByteSlice());
+}
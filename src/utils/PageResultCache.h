@@ -0,0 +1,63 @@
+/* Copyright 2021 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+// Results of rendering a document and extracting its text, per page, saved
+// in a cache directory (used by EngineDump -bench -cache <dir>).
+//
+// Results are content-addressed: they're saved under a key derived from a
+// hash of the document's content, the engine version, the zoom and other
+// options that affect the output, so a regression run only has to render
+// documents (and pages) whose results aren't cached yet. Looking up the
+// results of the same document under a baseline engine version tells
+// which pages render differently.
+//
+// A cache file is text:
+// PageResults 1
+// pages 12
+// loadMs 10.125
+// tocMs 0.250
+// page 1 21.500 1.750 <md5 of rendered page or -> <md5 of text> <text length>
+// <text (utf-8)>
+// page 2 ...
+
+struct PageResult {
+    int pageNo = 0;
+    // hex md5 of the rendered page, empty if the page failed to render
+    char renderHash[33]{};
+    // hex md5 of the extracted text (utf-8)
+    char textHash[33]{};
+    double renderMs = 0;
+    double textMs = 0;
+    // owned by DocResults
+    char* text = nullptr;
+};
+
+struct DocResults {
+    int nPages = 0;
+    double loadMs = 0;
+    double tocMs = 0;
+    // in order of pageNo, can have gaps
+    Vec<PageResult> pages;
+
+    DocResults() = default;
+    DocResults(DocResults const&) = delete;
+    DocResults& operator=(DocResults const&) = delete;
+    ~DocResults();
+
+    PageResult* GetPage(int pageNo);
+    // sets the hashes from bitmap (nullptr if rendering failed) and text (copied)
+    void SetPage(int pageNo, ByteSlice bitmap, const char* text, double renderMs, double textMs);
+    // true if the results for all nPages pages are known
+    bool IsComplete() const;
+    void Reset();
+};
+
+// caller must free. options are e.g. command line flags that affect the output
+char* PageResultsKey(const u8 docDigest[16], const char* engineVersion, float zoom, const char* options);
+
+bool LoadPageResults(const WCHAR* cacheDir, const char* key, DocResults& res);
+bool SavePageResults(const WCHAR* cacheDir, const char* key, const DocResults& res);
+
+// parsing and serializing, exposed for tests
+bool PageResultsFromText(const char* data, size_t len, DocResults& res);
+void PageResultsToText(const DocResults& res, str::Str& out);
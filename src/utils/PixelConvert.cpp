@@ -0,0 +1,476 @@
+/* Copyright 2021 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+#include "utils/BaseUtil.h"
+#include "utils/PixelConvert.h"
+
+#if defined(_M_IX86) || defined(_M_X64)
+#define PIXEL_CONVERT_X86 1
+#include <intrin.h>
+#endif
+
+using RowConvertFunc = void (*)(const u8* src, u8* dst, size_t n);
+using InPlaceConvertFunc = void (*)(u8* px, size_t n);
+
+// scalar implementation, also used for the pixels left over by the simd kernels
+
+static inline u8 Mul255(int a, int b) {
+    // same as fz_mul255()
+    int x = a * b + 128;
+    x += x >> 8;
+    return (u8)(x >> 8);
+}
+
+static void RgbaToBgraScalar(const u8* s, u8* d, size_t n) {
+    for (size_t i = 0; i < n; i++, s += 4, d += 4) {
+        u8 r = s[0];
+        d[0] = s[2];
+        d[1] = s[1];
+        d[2] = r;
+        d[3] = s[3];
+    }
+}
+
+static void RgbToBgraScalar(const u8* s, u8* d, size_t n) {
+    for (size_t i = 0; i < n; i++, s += 3, d += 4) {
+        d[0] = s[2];
+        d[1] = s[1];
+        d[2] = s[0];
+        d[3] = 255;
+    }
+}
+
+static void GrayToBgraScalar(const u8* s, u8* d, size_t n) {
+    for (size_t i = 0; i < n; i++, s++, d += 4) {
+        d[0] = d[1] = d[2] = s[0];
+        d[3] = 255;
+    }
+}
+
+static void GrayAlphaToBgraScalar(const u8* s, u8* d, size_t n) {
+    for (size_t i = 0; i < n; i++, s += 2, d += 4) {
+        d[0] = d[1] = d[2] = s[0];
+        d[3] = s[1];
+    }
+}
+
+static void CmykToBgraScalar(const u8* s, u8* d, size_t n) {
+    for (size_t i = 0; i < n; i++, s += 4, d += 4) {
+        int c = s[0], m = s[1], y = s[2], k = s[3];
+        d[0] = (u8)(255 - std::min(y + k, 255));
+        d[1] = (u8)(255 - std::min(m + k, 255));
+        d[2] = (u8)(255 - std::min(c + k, 255));
+        d[3] = 255;
+    }
+}
+
+static void PremultiplyScalar(u8* px, size_t n) {
+    for (size_t i = 0; i < n; i++, px += 4) {
+        int a = px[3];
+        px[0] = Mul255(px[0], a);
+        px[1] = Mul255(px[1], a);
+        px[2] = Mul255(px[2], a);
+    }
+}
+
+static void UnpremultiplyScalar(u8* px, size_t n) {
+    for (size_t i = 0; i < n; i++, px += 4) {
+        int a = px[3];
+        for (int j = 0; j < 3; j++) {
+            px[j] = a == 0 ? 0 : (u8)std::min((px[j] * 255 + a / 2) / a, 255);
+        }
+    }
+}
+
+#if PIXEL_CONVERT_X86
+
+// SSE2
+
+static void RgbaToBgraSSE2(const u8* s, u8* d, size_t n) {
+    const __m128i maskAG = _mm_set1_epi32((int)0xFF00FF00);
+    const __m128i maskRB = _mm_set1_epi32(0x00FF00FF);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i x = _mm_loadu_si128((const __m128i*)(s + i * 4));
+        __m128i rb = _mm_and_si128(x, maskRB);
+        __m128i br = _mm_or_si128(_mm_slli_epi32(rb, 16), _mm_srli_epi32(rb, 16));
+        _mm_storeu_si128((__m128i*)(d + i * 4), _mm_or_si128(_mm_and_si128(x, maskAG), br));
+    }
+    RgbaToBgraScalar(s + i * 4, d + i * 4, n - i);
+}
+
+static void GrayToBgraSSE2(const u8* s, u8* d, size_t n) {
+    const __m128i ff = _mm_set1_epi8(-1);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i g = _mm_loadu_si128((const __m128i*)(s + i));
+        // g g and g 255 pairs, interleaved to g g g 255
+        __m128i ggLo = _mm_unpacklo_epi8(g, g);
+        __m128i ggHi = _mm_unpackhi_epi8(g, g);
+        __m128i gaLo = _mm_unpacklo_epi8(g, ff);
+        __m128i gaHi = _mm_unpackhi_epi8(g, ff);
+        __m128i* out = (__m128i*)(d + i * 4);
+        _mm_storeu_si128(out, _mm_unpacklo_epi16(ggLo, gaLo));
+        _mm_storeu_si128(out + 1, _mm_unpackhi_epi16(ggLo, gaLo));
+        _mm_storeu_si128(out + 2, _mm_unpacklo_epi16(ggHi, gaHi));
+        _mm_storeu_si128(out + 3, _mm_unpackhi_epi16(ggHi, gaHi));
+    }
+    GrayToBgraScalar(s + i, d + i * 4, n - i);
+}
+
+static void GrayAlphaToBgraSSE2(const u8* s, u8* d, size_t n) {
+    const __m128i maskG = _mm_set1_epi16(0x00FF);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i ga = _mm_loadu_si128((const __m128i*)(s + i * 2));
+        __m128i g = _mm_and_si128(ga, maskG);
+        __m128i gg = _mm_or_si128(g, _mm_slli_epi16(g, 8));
+        __m128i* out = (__m128i*)(d + i * 4);
+        _mm_storeu_si128(out, _mm_unpacklo_epi16(gg, ga));
+        _mm_storeu_si128(out + 1, _mm_unpackhi_epi16(gg, ga));
+    }
+    GrayAlphaToBgraScalar(s + i * 2, d + i * 4, n - i);
+}
+
+static void CmykToBgraSSE2(const u8* s, u8* d, size_t n) {
+    const __m128i ff = _mm_set1_epi8(-1);
+    const __m128i maskG = _mm_set1_epi32(0x0000FF00);
+    const __m128i maskRB = _mm_set1_epi32(0x00FF00FF);
+    const __m128i alpha = _mm_set1_epi32((int)0xFF000000);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i x = _mm_loadu_si128((const __m128i*)(s + i * 4));
+        __m128i k = _mm_srli_epi32(x, 24);
+        k = _mm_or_si128(k, _mm_slli_epi32(k, 8));
+        k = _mm_or_si128(k, _mm_slli_epi32(k, 16));
+        // 255 - min(c + k, 255) == max(255 - c - k, 0)
+        __m128i rgb = _mm_subs_epu8(_mm_xor_si128(x, ff), k);
+        __m128i rb = _mm_and_si128(rgb, maskRB);
+        __m128i br = _mm_or_si128(_mm_slli_epi32(rb, 16), _mm_srli_epi32(rb, 16));
+        __m128i bgra = _mm_or_si128(_mm_or_si128(_mm_and_si128(rgb, maskG), br), alpha);
+        _mm_storeu_si128((__m128i*)(d + i * 4), bgra);
+    }
+    CmykToBgraScalar(s + i * 4, d + i * 4, n - i);
+}
+
+// multiplies 4 pixels (as 16-bit values) by their alpha like fz_mul255()
+static inline __m128i Mul255SSE2(__m128i px16) {
+    __m128i a = _mm_shufflelo_epi16(px16, _MM_SHUFFLE(3, 3, 3, 3));
+    a = _mm_shufflehi_epi16(a, _MM_SHUFFLE(3, 3, 3, 3));
+    __m128i x = _mm_add_epi16(_mm_mullo_epi16(px16, a), _mm_set1_epi16(128));
+    x = _mm_add_epi16(x, _mm_srli_epi16(x, 8));
+    return _mm_srli_epi16(x, 8);
+}
+
+static void PremultiplySSE2(u8* px, size_t n) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i maskA = _mm_set1_epi32((int)0xFF000000);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i* p = (__m128i*)(px + i * 4);
+        __m128i x = _mm_loadu_si128(p);
+        __m128i lo = Mul255SSE2(_mm_unpacklo_epi8(x, zero));
+        __m128i hi = Mul255SSE2(_mm_unpackhi_epi8(x, zero));
+        __m128i res = _mm_packus_epi16(lo, hi);
+        _mm_storeu_si128(p, _mm_or_si128(_mm_andnot_si128(maskA, res), _mm_and_si128(x, maskA)));
+    }
+    PremultiplyScalar(px + i * 4, n - i);
+}
+
+// the division is exact: for results below 255, the distance of c * 255 / a
+// to the next integer is at least 1/255, far more than float's rounding error
+static inline __m128i UnpremultiplyChannelSSE2(__m128i x, int shift, __m128i half, __m128 af, __m128i nonZero) {
+    __m128i c = _mm_and_si128(_mm_srli_epi32(x, shift), _mm_set1_epi32(0xFF));
+    __m128i num = _mm_add_epi32(_mm_sub_epi32(_mm_slli_epi32(c, 8), c), half);
+    __m128 q = _mm_min_ps(_mm_div_ps(_mm_cvtepi32_ps(num), af), _mm_set1_ps(255.f));
+    __m128i res = _mm_and_si128(_mm_cvttps_epi32(q), nonZero);
+    return _mm_slli_epi32(res, shift);
+}
+
+static void UnpremultiplySSE2(u8* px, size_t n) {
+    const __m128i maskA = _mm_set1_epi32((int)0xFF000000);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i* p = (__m128i*)(px + i * 4);
+        __m128i x = _mm_loadu_si128(p);
+        __m128i a = _mm_srli_epi32(x, 24);
+        __m128i half = _mm_srli_epi32(a, 1);
+        __m128 af = _mm_cvtepi32_ps(a);
+        __m128i nonZero = _mm_cmpgt_epi32(a, _mm_setzero_si128());
+        __m128i b = UnpremultiplyChannelSSE2(x, 0, half, af, nonZero);
+        __m128i g = UnpremultiplyChannelSSE2(x, 8, half, af, nonZero);
+        __m128i r = UnpremultiplyChannelSSE2(x, 16, half, af, nonZero);
+        __m128i res = _mm_or_si128(_mm_or_si128(b, g), _mm_or_si128(r, _mm_and_si128(x, maskA)));
+        _mm_storeu_si128(p, res);
+    }
+    UnpremultiplyScalar(px + i * 4, n - i);
+}
+
+// SSSE3 (the same as SSE2 where byte shuffles don't help)
+
+static void RgbaToBgraSSSE3(const u8* s, u8* d, size_t n) {
+    const __m128i mask = _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i x = _mm_loadu_si128((const __m128i*)(s + i * 4));
+        _mm_storeu_si128((__m128i*)(d + i * 4), _mm_shuffle_epi8(x, mask));
+    }
+    RgbaToBgraScalar(s + i * 4, d + i * 4, n - i);
+}
+
+static void RgbToBgraSSSE3(const u8* s, u8* d, size_t n) {
+    const __m128i mask = _mm_setr_epi8(2, 1, 0, -128, 5, 4, 3, -128, 8, 7, 6, -128, 11, 10, 9, -128);
+    const __m128i alpha = _mm_set1_epi32((int)0xFF000000);
+    size_t i = 0;
+    // 16 pixels are 48 bytes, i.e. 3 full loads
+    for (; i + 16 <= n; i += 16) {
+        const __m128i* in = (const __m128i*)(s + i * 3);
+        __m128i a = _mm_loadu_si128(in);
+        __m128i b = _mm_loadu_si128(in + 1);
+        __m128i c = _mm_loadu_si128(in + 2);
+        __m128i p0 = a;
+        __m128i p1 = _mm_alignr_epi8(b, a, 12);
+        __m128i p2 = _mm_alignr_epi8(c, b, 8);
+        __m128i p3 = _mm_srli_si128(c, 4);
+        __m128i* out = (__m128i*)(d + i * 4);
+        _mm_storeu_si128(out, _mm_or_si128(_mm_shuffle_epi8(p0, mask), alpha));
+        _mm_storeu_si128(out + 1, _mm_or_si128(_mm_shuffle_epi8(p1, mask), alpha));
+        _mm_storeu_si128(out + 2, _mm_or_si128(_mm_shuffle_epi8(p2, mask), alpha));
+        _mm_storeu_si128(out + 3, _mm_or_si128(_mm_shuffle_epi8(p3, mask), alpha));
+    }
+    RgbToBgraScalar(s + i * 3, d + i * 4, n - i);
+}
+
+static void CmykToBgraSSSE3(const u8* s, u8* d, size_t n) {
+    const __m128i ff = _mm_set1_epi8(-1);
+    const __m128i maskK = _mm_setr_epi8(3, 3, 3, 3, 7, 7, 7, 7, 11, 11, 11, 11, 15, 15, 15, 15);
+    const __m128i maskBgr = _mm_setr_epi8(2, 1, 0, -128, 6, 5, 4, -128, 10, 9, 8, -128, 14, 13, 12, -128);
+    const __m128i alpha = _mm_set1_epi32((int)0xFF000000);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i x = _mm_loadu_si128((const __m128i*)(s + i * 4));
+        __m128i k = _mm_shuffle_epi8(x, maskK);
+        __m128i rgb = _mm_subs_epu8(_mm_xor_si128(x, ff), k);
+        _mm_storeu_si128((__m128i*)(d + i * 4), _mm_or_si128(_mm_shuffle_epi8(rgb, maskBgr), alpha));
+    }
+    CmykToBgraScalar(s + i * 4, d + i * 4, n - i);
+}
+
+// AVX2 (RGB -> BGRA uses SSSE3 because 3-byte pixels don't fit 128-bit lanes)
+
+static void RgbaToBgraAVX2(const u8* s, u8* d, size_t n) {
+    const __m256i mask = _mm256_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15, 2, 1, 0, 3, 6, 5, 4, 7,
+                                          10, 9, 8, 11, 14, 13, 12, 15);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i x = _mm256_loadu_si256((const __m256i*)(s + i * 4));
+        _mm256_storeu_si256((__m256i*)(d + i * 4), _mm256_shuffle_epi8(x, mask));
+    }
+    _mm256_zeroupper();
+    RgbaToBgraScalar(s + i * 4, d + i * 4, n - i);
+}
+
+static void GrayToBgraAVX2(const u8* s, u8* d, size_t n) {
+    const __m256i mask0 = _mm256_setr_epi8(0, 0, 0, -128, 1, 1, 1, -128, 2, 2, 2, -128, 3, 3, 3, -128, 4, 4, 4, -128, 5,
+                                           5, 5, -128, 6, 6, 6, -128, 7, 7, 7, -128);
+    const __m256i mask1 = _mm256_add_epi8(mask0, _mm256_set1_epi32(0x00080808));
+    const __m256i alpha = _mm256_set1_epi32((int)0xFF000000);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        // the 16 gray pixels in both lanes, the masks pick 4 for each lane
+        __m256i g = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)(s + i)));
+        __m256i* out = (__m256i*)(d + i * 4);
+        _mm256_storeu_si256(out, _mm256_or_si256(_mm256_shuffle_epi8(g, mask0), alpha));
+        _mm256_storeu_si256(out + 1, _mm256_or_si256(_mm256_shuffle_epi8(g, mask1), alpha));
+    }
+    _mm256_zeroupper();
+    GrayToBgraScalar(s + i, d + i * 4, n - i);
+}
+
+static void CmykToBgraAVX2(const u8* s, u8* d, size_t n) {
+    const __m256i ff = _mm256_set1_epi8(-1);
+    const __m256i maskK = _mm256_setr_epi8(3, 3, 3, 3, 7, 7, 7, 7, 11, 11, 11, 11, 15, 15, 15, 15, 3, 3, 3, 3, 7, 7, 7,
+                                           7, 11, 11, 11, 11, 15, 15, 15, 15);
+    const __m256i maskBgr = _mm256_setr_epi8(2, 1, 0, -128, 6, 5, 4, -128, 10, 9, 8, -128, 14, 13, 12, -128, 2, 1, 0,
+                                             -128, 6, 5, 4, -128, 10, 9, 8, -128, 14, 13, 12, -128);
+    const __m256i alpha = _mm256_set1_epi32((int)0xFF000000);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i x = _mm256_loadu_si256((const __m256i*)(s + i * 4));
+        __m256i k = _mm256_shuffle_epi8(x, maskK);
+        __m256i rgb = _mm256_subs_epu8(_mm256_xor_si256(x, ff), k);
+        _mm256_storeu_si256((__m256i*)(d + i * 4), _mm256_or_si256(_mm256_shuffle_epi8(rgb, maskBgr), alpha));
+    }
+    _mm256_zeroupper();
+    CmykToBgraScalar(s + i * 4, d + i * 4, n - i);
+}
+
+static inline __m256i Mul255AVX2(__m256i px16) {
+    __m256i a = _mm256_shufflelo_epi16(px16, _MM_SHUFFLE(3, 3, 3, 3));
+    a = _mm256_shufflehi_epi16(a, _MM_SHUFFLE(3, 3, 3, 3));
+    __m256i x = _mm256_add_epi16(_mm256_mullo_epi16(px16, a), _mm256_set1_epi16(128));
+    x = _mm256_add_epi16(x, _mm256_srli_epi16(x, 8));
+    return _mm256_srli_epi16(x, 8);
+}
+
+static void PremultiplyAVX2(u8* px, size_t n) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i maskA = _mm256_set1_epi32((int)0xFF000000);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i* p = (__m256i*)(px + i * 4);
+        __m256i x = _mm256_loadu_si256(p);
+        // unpacking and packing are per 128-bit lane, so the order is preserved
+        __m256i lo = Mul255AVX2(_mm256_unpacklo_epi8(x, zero));
+        __m256i hi = Mul255AVX2(_mm256_unpackhi_epi8(x, zero));
+        __m256i res = _mm256_packus_epi16(lo, hi);
+        _mm256_storeu_si256(p, _mm256_or_si256(_mm256_andnot_si256(maskA, res), _mm256_and_si256(x, maskA)));
+    }
+    _mm256_zeroupper();
+    PremultiplyScalar(px + i * 4, n - i);
+}
+
+static inline __m256i UnpremultiplyChannelAVX2(__m256i x, int shift, __m256i half, __m256 af, __m256i nonZero) {
+    __m256i c = _mm256_and_si256(_mm256_srli_epi32(x, shift), _mm256_set1_epi32(0xFF));
+    __m256i num = _mm256_add_epi32(_mm256_sub_epi32(_mm256_slli_epi32(c, 8), c), half);
+    __m256 q = _mm256_min_ps(_mm256_div_ps(_mm256_cvtepi32_ps(num), af), _mm256_set1_ps(255.f));
+    __m256i res = _mm256_and_si256(_mm256_cvttps_epi32(q), nonZero);
+    return _mm256_slli_epi32(res, shift);
+}
+
+static void UnpremultiplyAVX2(u8* px, size_t n) {
+    const __m256i maskA = _mm256_set1_epi32((int)0xFF000000);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i* p = (__m256i*)(px + i * 4);
+        __m256i x = _mm256_loadu_si256(p);
+        __m256i a = _mm256_srli_epi32(x, 24);
+        __m256i half = _mm256_srli_epi32(a, 1);
+        __m256 af = _mm256_cvtepi32_ps(a);
+        __m256i nonZero = _mm256_cmpgt_epi32(a, _mm256_setzero_si256());
+        __m256i b = UnpremultiplyChannelAVX2(x, 0, half, af, nonZero);
+        __m256i g = UnpremultiplyChannelAVX2(x, 8, half, af, nonZero);
+        __m256i r = UnpremultiplyChannelAVX2(x, 16, half, af, nonZero);
+        __m256i res = _mm256_or_si256(_mm256_or_si256(b, g), _mm256_or_si256(r, _mm256_and_si256(x, maskA)));
+        _mm256_storeu_si256(p, res);
+    }
+    _mm256_zeroupper();
+    UnpremultiplyScalar(px + i * 4, n - i);
+}
+
+#endif
+
+struct PixelConvertFuncs {
+    RowConvertFunc rgbaToBgra;
+    RowConvertFunc rgbToBgra;
+    RowConvertFunc grayToBgra;
+    RowConvertFunc grayAlphaToBgra;
+    RowConvertFunc cmykToBgra;
+    InPlaceConvertFunc premultiply;
+    InPlaceConvertFunc unpremultiply;
+};
+
+// indexed by PixelConvertImpl
+static const PixelConvertFuncs gPixelConvertFuncs[] = {
+    {RgbaToBgraScalar, RgbToBgraScalar, GrayToBgraScalar, GrayAlphaToBgraScalar, CmykToBgraScalar, PremultiplyScalar,
+     UnpremultiplyScalar},
+#if PIXEL_CONVERT_X86
+    {RgbaToBgraSSE2, RgbToBgraScalar, GrayToBgraSSE2, GrayAlphaToBgraSSE2, CmykToBgraSSE2, PremultiplySSE2,
+     UnpremultiplySSE2},
+    {RgbaToBgraSSSE3, RgbToBgraSSSE3, GrayToBgraSSE2, GrayAlphaToBgraSSE2, CmykToBgraSSSE3, PremultiplySSE2,
+     UnpremultiplySSE2},
+    {RgbaToBgraAVX2, RgbToBgraSSSE3, GrayToBgraAVX2, GrayAlphaToBgraSSE2, CmykToBgraAVX2, PremultiplyAVX2,
+     UnpremultiplyAVX2},
+#endif
+};
+
+static PixelConvertImpl DetectPixelConvertImpl() {
+#if PIXEL_CONVERT_X86
+    int info[4];
+    __cpuid(info, 0);
+    int maxLeaf = info[0];
+    __cpuid(info, 1);
+    bool hasSSE2 = info[3] & (1 << 26);
+    bool hasSSSE3 = info[2] & (1 << 9);
+    bool hasOSXSave = info[2] & (1 << 27);
+    bool hasAVX = info[2] & (1 << 28);
+    bool hasAVX2 = false;
+    // the os must also save the ymm registers on context switches
+    if (maxLeaf >= 7 && hasOSXSave && hasAVX && (_xgetbv(0) & 6) == 6) {
+        __cpuidex(info, 7, 0);
+        hasAVX2 = info[1] & (1 << 5);
+    }
+    if (hasAVX2 && hasSSSE3) {
+        return PixelConvertImpl::AVX2;
+    }
+    if (hasSSSE3 && hasSSE2) {
+        return PixelConvertImpl::SSSE3;
+    }
+    if (hasSSE2) {
+        return PixelConvertImpl::SSE2;
+    }
+#endif
+    return PixelConvertImpl::Scalar;
+}
+
+static PixelConvertImpl gBestPixelConvertImpl = DetectPixelConvertImpl();
+static PixelConvertImpl gPixelConvertImpl = gBestPixelConvertImpl;
+static const PixelConvertFuncs* gFuncs = &gPixelConvertFuncs[(int)gBestPixelConvertImpl];
+
+void ConvertRgbaToBgra(const u8* src, u8* dst, size_t n) {
+    gFuncs->rgbaToBgra(src, dst, n);
+}
+
+void ConvertRgbToBgra(const u8* src, u8* dst, size_t n) {
+    gFuncs->rgbToBgra(src, dst, n);
+}
+
+void ConvertGrayToBgra(const u8* src, u8* dst, size_t n) {
+    gFuncs->grayToBgra(src, dst, n);
+}
+
+void ConvertGrayAlphaToBgra(const u8* src, u8* dst, size_t n) {
+    gFuncs->grayAlphaToBgra(src, dst, n);
+}
+
+void ConvertCmykToBgra(const u8* src, u8* dst, size_t n) {
+    gFuncs->cmykToBgra(src, dst, n);
+}
+
+void PremultiplyBgra(u8* px, size_t n) {
+    gFuncs->premultiply(px, n);
+}
+
+void UnpremultiplyBgra(u8* px, size_t n) {
+    gFuncs->unpremultiply(px, n);
+}
+
+PixelConvertImpl GetBestPixelConvertImpl() {
+    return gBestPixelConvertImpl;
+}
+
+PixelConvertImpl GetPixelConvertImpl() {
+    return gPixelConvertImpl;
+}
+
+PixelConvertImpl SetPixelConvertImpl(PixelConvertImpl impl) {
+    if ((int)impl > (int)gBestPixelConvertImpl) {
+        impl = gBestPixelConvertImpl;
+    }
+    gPixelConvertImpl = impl;
+    gFuncs = &gPixelConvertFuncs[(int)impl];
+    return impl;
+}
+
+const char* PixelConvertImplName(PixelConvertImpl impl) {
+    switch (impl) {
+        case PixelConvertImpl::SSE2:
+            return "SSE2";
+        case PixelConvertImpl::SSSE3:
+            return "SSSE3";
+        case PixelConvertImpl::AVX2:
+            return "AVX2";
+        default:
+            return "scalar";
+    }
+}
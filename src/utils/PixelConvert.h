@@ -0,0 +1,46 @@
+/* Copyright 2021 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+// Converts rows of pixels to BGRA, the format of 32-bit GDI bitmaps.
+//
+// The kernels use SSE2, SSSE3 or AVX2 depending on what the cpu supports
+// (the best is picked on start-up) and produce exactly the same pixels as
+// the scalar implementation.
+//
+// Conversions from mupdf's colorspaces match what fz_convert_pixmap() does
+// without color management (e.g. CMYK is converted with the naive formula
+// R = 255 - min(C + K, 255)). Premultiplication matches fz_mul255().
+//
+// n is the number of pixels. src and dst must not overlap unless noted.
+
+enum class PixelConvertImpl {
+    Scalar = 0,
+    SSE2,
+    SSSE3,
+    AVX2,
+};
+
+// RGBA -> BGRA, src can be the same as dst
+void ConvertRgbaToBgra(const u8* src, u8* dst, size_t n);
+// RGB -> BGRA with alpha 255
+void ConvertRgbToBgra(const u8* src, u8* dst, size_t n);
+// gray -> BGRA with alpha 255
+void ConvertGrayToBgra(const u8* src, u8* dst, size_t n);
+// gray + alpha -> BGRA
+void ConvertGrayAlphaToBgra(const u8* src, u8* dst, size_t n);
+// CMYK (no alpha) -> BGRA with alpha 255, src can be the same as dst
+void ConvertCmykToBgra(const u8* src, u8* dst, size_t n);
+
+// in place, straight alpha -> premultiplied alpha
+void PremultiplyBgra(u8* px, size_t n);
+// in place, premultiplied alpha -> straight alpha
+// (c = round(c * 255 / a), pixels with a == 0 become 0)
+void UnpremultiplyBgra(u8* px, size_t n);
+
+// the best implementation supported by this cpu
+PixelConvertImpl GetBestPixelConvertImpl();
+PixelConvertImpl GetPixelConvertImpl();
+// only meant for tests and benchmarks. impl is limited to the best
+// supported implementation, returns the one that is used
+PixelConvertImpl SetPixelConvertImpl(PixelConvertImpl impl);
+const char* PixelConvertImplName(PixelConvertImpl impl);
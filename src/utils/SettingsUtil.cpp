@@ -559,3 +559,283 @@ void FreeStruct(const StructInfo* info, void* strct) {
     }
     free(strct);
 }
+
+// binary form of the settings, see SerializeStructBinary()
+
+#if defined(PRE_RELEASE_VER) || defined(DEBUG)
+static const bool kSerializePrerelease = true;
+#else
+static const bool kSerializePrerelease = false;
+#endif
+
+static const u32 kNullStrLen = (u32)-1;
+
+static void AppendU32(str::Str& out, u32 v) {
+    out.Append((const char*)&v, sizeof(v));
+}
+
+static void AppendBinaryStr(str::Str& out, const char* s) {
+    if (!s) {
+        AppendU32(out, kNullStrLen);
+        return;
+    }
+    u32 len = (u32)str::Len(s);
+    AppendU32(out, len);
+    out.Append(s, len);
+}
+
+struct BinaryReader {
+    const u8* d = nullptr;
+    size_t left = 0;
+    bool ok = true;
+
+    bool Read(void* dst, size_t n) {
+        if (!ok || n > left) {
+            ok = false;
+            return false;
+        }
+        memcpy(dst, d, n);
+        d += n;
+        left -= n;
+        return true;
+    }
+
+    u32 ReadU32() {
+        u32 v = 0;
+        Read(&v, sizeof(v));
+        return v;
+    }
+
+    char* ReadStr() {
+        u32 len = ReadU32();
+        if (!ok || len == kNullStrLen) {
+            return nullptr;
+        }
+        if (len > left) {
+            ok = false;
+            return nullptr;
+        }
+        char* s = str::Dup((const char*)d, len);
+        d += len;
+        left -= len;
+        return s;
+    }
+};
+
+// the text form only has the precision of "%g" so round floats the same way
+// in order for both forms to deserialize to the same values
+static float RoundFloatAsText(float f) {
+    char buf[32];
+    str::BufFmt(buf, dimof(buf), "%g", f);
+    float res = f;
+    str::Parse(buf, "%f", &res);
+    return res;
+}
+
+static void SerializeStructBinaryRec(str::Str& out, const StructInfo* info, const u8* base);
+
+static void SerializeFieldBinary(str::Str& out, const u8* base, const FieldInfo& field) {
+    const u8* fieldPtr = base + field.offset;
+    switch (field.type) {
+        case SettingType::Struct:
+        case SettingType::Compact:
+            SerializeStructBinaryRec(out, GetSubstruct(field), fieldPtr);
+            break;
+        case SettingType::Prerelease:
+            if (kSerializePrerelease) {
+                SerializeStructBinaryRec(out, GetSubstruct(field), fieldPtr);
+            }
+            break;
+        case SettingType::Array: {
+            Vec<void*>* array = *(Vec<void*>**)fieldPtr;
+            u32 n = array ? (u32)array->size() : 0;
+            AppendU32(out, n);
+            for (u32 i = 0; i < n; i++) {
+                SerializeStructBinaryRec(out, GetSubstruct(field), (const u8*)array->at(i));
+            }
+            break;
+        }
+        case SettingType::Bool:
+            out.AppendChar(*(bool*)fieldPtr ? 1 : 0);
+            break;
+        case SettingType::Int:
+            AppendU32(out, *(u32*)fieldPtr);
+            break;
+        case SettingType::Float: {
+            float f = RoundFloatAsText(*(float*)fieldPtr);
+            out.Append((const char*)&f, sizeof(f));
+            break;
+        }
+        case SettingType::String:
+        case SettingType::Color:
+            AppendBinaryStr(out, *(const char**)fieldPtr);
+            break;
+        case SettingType::FloatArray:
+        case SettingType::IntArray: {
+            Vec<int>* v = *(Vec<int>**)fieldPtr;
+            u32 n = v ? (u32)v->size() : 0;
+            AppendU32(out, n);
+            for (u32 i = 0; i < n; i++) {
+                if (SettingType::FloatArray == field.type) {
+                    float f = RoundFloatAsText(*(float*)&v->at(i));
+                    out.Append((const char*)&f, sizeof(f));
+                } else {
+                    AppendU32(out, (u32)v->at(i));
+                }
+            }
+            break;
+        }
+        case SettingType::ColorArray:
+        case SettingType::StringArray: {
+            Vec<char*>* v = *(Vec<char*>**)fieldPtr;
+            u32 n = v ? (u32)v->size() : 0;
+            AppendU32(out, n);
+            for (u32 i = 0; i < n; i++) {
+                AppendBinaryStr(out, v->at(i));
+            }
+            break;
+        }
+        case SettingType::Comment:
+            break;
+        default:
+            CrashIf(true);
+    }
+}
+
+static void SerializeStructBinaryRec(str::Str& out, const StructInfo* info, const u8* base) {
+    for (size_t i = 0; i < info->fieldCount; i++) {
+        SerializeFieldBinary(out, base, info->fields[i]);
+    }
+}
+
+static void DeserializeStructBinaryRec(BinaryReader& r, const StructInfo* info, u8* base);
+
+// base must be zero-initialized, so that on failure
+// the partially deserialized struct can be freed
+static void DeserializeFieldBinary(BinaryReader& r, const FieldInfo& field, u8* base) {
+    u8* fieldPtr = base + field.offset;
+    switch (field.type) {
+        case SettingType::Struct:
+        case SettingType::Compact:
+            DeserializeStructBinaryRec(r, GetSubstruct(field), fieldPtr);
+            break;
+        case SettingType::Prerelease:
+            if (kSerializePrerelease) {
+                DeserializeStructBinaryRec(r, GetSubstruct(field), fieldPtr);
+            } else {
+                DeserializeStructRec(GetSubstruct(field), nullptr, fieldPtr, true);
+            }
+            break;
+        case SettingType::Array: {
+            Vec<void*>* array = new Vec<void*>();
+            *(Vec<void*>**)fieldPtr = array;
+            u32 n = r.ReadU32();
+            for (u32 i = 0; i < n && r.ok; i++) {
+                u8* item = AllocArray<u8>(GetSubstruct(field)->structSize);
+                array->Append(item);
+                DeserializeStructBinaryRec(r, GetSubstruct(field), item);
+            }
+            break;
+        }
+        case SettingType::Bool: {
+            u8 b = 0;
+            r.Read(&b, 1);
+            *(bool*)fieldPtr = b != 0;
+            break;
+        }
+        case SettingType::Int:
+        case SettingType::Float:
+            r.Read(fieldPtr, 4);
+            break;
+        case SettingType::String:
+        case SettingType::Color:
+            *(char**)fieldPtr = r.ReadStr();
+            break;
+        case SettingType::FloatArray:
+        case SettingType::IntArray: {
+            Vec<int>* v = new Vec<int>();
+            *(Vec<int>**)fieldPtr = v;
+            u32 n = r.ReadU32();
+            if (!r.ok || n > r.left / 4) {
+                r.ok = false;
+                break;
+            }
+            r.Read(v->AppendBlanks(n), (size_t)n * 4);
+            break;
+        }
+        case SettingType::ColorArray:
+        case SettingType::StringArray: {
+            Vec<char*>* v = new Vec<char*>();
+            *(Vec<char*>**)fieldPtr = v;
+            u32 n = r.ReadU32();
+            for (u32 i = 0; i < n && r.ok; i++) {
+                // entries can be nullptr
+                char* s = r.ReadStr();
+                if (r.ok) {
+                    v->Append(s);
+                }
+            }
+            break;
+        }
+        case SettingType::Comment:
+            break;
+        default:
+            CrashIf(true);
+            r.ok = false;
+    }
+}
+
+static void DeserializeStructBinaryRec(BinaryReader& r, const StructInfo* info, u8* base) {
+    for (size_t i = 0; i < info->fieldCount && r.ok; i++) {
+        DeserializeFieldBinary(r, info->fields[i], base);
+    }
+}
+
+void SerializeStructBinary(str::Str& out, const StructInfo* info, const void* strct) {
+    SerializeStructBinaryRec(out, info, (const u8*)strct);
+}
+
+void* DeserializeStructBinary(const StructInfo* info, ByteSlice& data) {
+    BinaryReader r;
+    r.d = data.data();
+    r.left = data.size();
+    u8* base = AllocArray<u8>(info->structSize);
+    DeserializeStructBinaryRec(r, info, base);
+    if (!r.ok) {
+        FreeStruct(info, base);
+        return nullptr;
+    }
+    data = ByteSlice((u8*)r.d, r.left);
+    return base;
+}
+
+static void AppendStructInfoDesc(str::Str& out, const StructInfo* info) {
+    out.AppendFmt("{%d:", (int)info->structSize);
+    const char* fieldName = info->fieldNames;
+    for (size_t i = 0; i < info->fieldCount; i++, fieldName += str::Len(fieldName) + 1) {
+        const FieldInfo& field = info->fields[i];
+        if (SettingType::Comment == field.type) {
+            continue;
+        }
+        out.AppendFmt("%s=%d@%d", fieldName, (int)field.type, (int)field.offset);
+        switch (field.type) {
+            case SettingType::Struct:
+            case SettingType::Compact:
+            case SettingType::Prerelease:
+            case SettingType::Array:
+                AppendStructInfoDesc(out, GetSubstruct(field));
+                break;
+            default:
+                break;
+        }
+        out.AppendChar(';');
+    }
+    out.AppendChar('}');
+}
+
+u32 StructInfoHash(const StructInfo* info) {
+    str::Str desc;
+    desc.AppendFmt("prerelease:%d", kSerializePrerelease ? 1 : 0);
+    AppendStructInfoDesc(desc, info);
+    return MurmurHash2(desc.Get(), desc.size());
+}
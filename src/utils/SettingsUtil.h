@@ -62,3 +62,12 @@ struct StructInfo {
 ByteSlice SerializeStruct(const StructInfo* info, const void* strct, const char* prevData = nullptr);
 void* DeserializeStruct(const StructInfo* info, const char* data, void* strct = nullptr);
 void FreeStruct(const StructInfo* info, void* strct);
+
+// Compact binary form of the same data, for caching parsed settings.
+// Unlike the text form it has no field names, defaults or unknown fields,
+// so it's only valid for the exact StructInfo it was written with,
+// as identified by StructInfoHash().
+void SerializeStructBinary(str::Str& out, const StructInfo* info, const void* strct);
+// advances data past the struct. returns nullptr if data is truncated
+void* DeserializeStructBinary(const StructInfo* info, ByteSlice& data);
+u32 StructInfoHash(const StructInfo* info);
@@ -0,0 +1,283 @@
+/* Copyright 2021 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+#include "utils/BaseUtil.h"
+#include "utils/FileUtil.h"
+#include "utils/Trace.h"
+
+/*
+Each thread that records events gets its own ring buffer, so recording
+doesn't need a lock. Buffers are linked into a global list (with a
+lock-free push) when a thread records its first event and are never
+freed: when a thread exits its buffer is marked as free and re-used
+by the next thread that needs one. That keeps the number of buffers
+bounded by the max number of concurrent threads.
+
+Counters and histograms are usually static variables. They link
+themselves into global lists in their constructor, also lock-free, because
+they might be constructed before any code in this file runs.
+*/
+
+// must be a power of 2
+constexpr u32 kTraceEventsPerThread = 8 * 1024;
+
+struct TraceEvent {
+    const char* name;
+    i64 tsUs;
+    i64 durUs;
+    i64 arg;
+    // per event because a buffer is re-used by other threads
+    DWORD threadId;
+    char kind; // 'X' : span, 'i' : instant, 'C' : counter
+};
+
+struct TraceThreadBuffer {
+    TraceThreadBuffer* next = nullptr;
+    std::atomic<bool> inUse = true;
+    // thread currently using the buffer, only accessed by that thread
+    DWORD threadId = 0;
+    // total number of events written, index into events is nWritten % size
+    std::atomic<u32> nWritten = 0;
+    TraceEvent events[kTraceEventsPerThread];
+};
+
+std::atomic<bool> gTraceEnabled = false;
+
+static std::atomic<TraceThreadBuffer*> gTraceBuffers = nullptr;
+static std::atomic<TraceCounter*> gTraceCounters = nullptr;
+static std::atomic<TraceHistogram*> gTraceHistograms = nullptr;
+static i64 gTraceStartUs = 0;
+
+template <typename T>
+static void PushLockFree(std::atomic<T*>& head, T* el) {
+    T* curr = head.load();
+    do {
+        el->next = curr;
+    } while (!head.compare_exchange_weak(curr, el));
+}
+
+// marks the buffer as re-usable when a thread exits
+struct TraceThreadBufferRef {
+    TraceThreadBuffer* buf = nullptr;
+    ~TraceThreadBufferRef() {
+        if (buf) {
+            buf->inUse = false;
+        }
+    }
+};
+
+thread_local static TraceThreadBufferRef gThreadBuffer;
+
+static TraceThreadBuffer* GetThreadBuffer() {
+    TraceThreadBuffer* buf = gThreadBuffer.buf;
+    if (buf) {
+        return buf;
+    }
+    for (buf = gTraceBuffers.load(); buf; buf = buf->next) {
+        bool expected = false;
+        if (buf->inUse.compare_exchange_strong(expected, true)) {
+            break;
+        }
+    }
+    if (!buf) {
+        buf = new TraceThreadBuffer();
+        PushLockFree(gTraceBuffers, buf);
+    }
+    buf->threadId = GetCurrentThreadId();
+    gThreadBuffer.buf = buf;
+    return buf;
+}
+
+static void RecordEvent(char kind, const char* name, i64 tsUs, i64 durUs, i64 arg) {
+    TraceThreadBuffer* buf = GetThreadBuffer();
+    // only this thread writes to buf
+    u32 n = buf->nWritten.load(std::memory_order_relaxed);
+    TraceEvent& e = buf->events[n % kTraceEventsPerThread];
+    e.name = name;
+    e.tsUs = tsUs;
+    e.durUs = durUs;
+    e.arg = arg;
+    e.threadId = buf->threadId;
+    e.kind = kind;
+    buf->nWritten.store(n + 1, std::memory_order_release);
+}
+
+i64 TraceNowUs() {
+    // initialization of function-local statics is thread-safe
+    static const i64 freq = [] {
+        LARGE_INTEGER f;
+        QueryPerformanceFrequency(&f);
+        return (i64)f.QuadPart;
+    }();
+    LARGE_INTEGER t;
+    QueryPerformanceCounter(&t);
+    // split to avoid overflow of t * 1000000
+    i64 secs = t.QuadPart / freq;
+    i64 rest = t.QuadPart % freq;
+    return secs * 1000000 + (rest * 1000000) / freq;
+}
+
+TraceCounter::TraceCounter(const char* name) : name(name) {
+    PushLockFree(gTraceCounters, this);
+}
+
+void TraceCounter::Add(i64 n) {
+    i64 v = value.fetch_add(n, std::memory_order_relaxed) + n;
+    if (gTraceEnabled.load(std::memory_order_relaxed)) {
+        RecordEvent('C', name, TraceNowUs(), 0, v);
+    }
+}
+
+TraceHistogram::TraceHistogram(const char* name) : name(name) {
+    PushLockFree(gTraceHistograms, this);
+}
+
+static int BucketForValue(i64 v) {
+    int b = 0;
+    while (v > 0 && b < TraceHistogram::kBuckets - 1) {
+        v >>= 1;
+        b++;
+    }
+    return b;
+}
+
+void TraceHistogram::Record(i64 v) {
+    if (v < 0) {
+        v = 0;
+    }
+    count.fetch_add(1, std::memory_order_relaxed);
+    sum.fetch_add(v, std::memory_order_relaxed);
+    buckets[BucketForValue(v)].fetch_add(1, std::memory_order_relaxed);
+    i64 currMax = max.load(std::memory_order_relaxed);
+    while (v > currMax && !max.compare_exchange_weak(currMax, v)) {
+        // currMax was updated by compare_exchange_weak
+    }
+}
+
+i64 TraceHistogram::Percentile(int p) const {
+    i64 n = count.load();
+    if (n == 0) {
+        return 0;
+    }
+    i64 target = (n * p + 99) / 100;
+    i64 seen = 0;
+    for (int i = 0; i < kBuckets; i++) {
+        seen += buckets[i].load();
+        if (seen >= target) {
+            // upper bound of the bucket
+            i64 upper = i == 0 ? 0 : ((i64)1 << i) - 1;
+            return std::min(upper, max.load());
+        }
+    }
+    return max.load();
+}
+
+void TraceScope::End() {
+    i64 durUs = TraceNowUs() - startUs;
+    if (histogram) {
+        histogram->Record(durUs);
+    }
+    if (gTraceEnabled.load(std::memory_order_relaxed)) {
+        RecordEvent('X', name, startUs, durUs, arg);
+    }
+    name = nullptr;
+}
+
+void TraceInstant(const char* name, i64 arg) {
+    if (gTraceEnabled.load(std::memory_order_relaxed)) {
+        RecordEvent('i', name, TraceNowUs(), 0, arg);
+    }
+}
+
+void TraceStart() {
+    if (gTraceStartUs == 0) {
+        gTraceStartUs = TraceNowUs();
+    }
+    gTraceEnabled = true;
+}
+
+void TraceStop() {
+    gTraceEnabled = false;
+}
+
+static void AppendJsonStr(str::Str& s, const char* v) {
+    s.AppendChar('"');
+    for (const char* c = v; c && *c; c++) {
+        if (*c == '"' || *c == '\\') {
+            s.AppendChar('\\');
+        }
+        s.AppendChar(*c);
+    }
+    s.AppendChar('"');
+}
+
+// note: events recorded while exporting might be missing or garbled
+// so it's best to call it after TraceStop()
+bool TraceWriteChromeJson(const char* path) {
+    str::Str s(1024 * 1024);
+    s.Append("{\"traceEvents\":[\n");
+    bool first = true;
+    auto sep = [&] {
+        if (!first) {
+            s.Append(",\n");
+        }
+        first = false;
+    };
+    DWORD pid = GetCurrentProcessId();
+
+    for (TraceThreadBuffer* buf = gTraceBuffers.load(); buf; buf = buf->next) {
+        u32 n = buf->nWritten.load(std::memory_order_acquire);
+        u32 start = n > kTraceEventsPerThread ? n - kTraceEventsPerThread : 0;
+        for (u32 i = start; i < n; i++) {
+            TraceEvent& e = buf->events[i % kTraceEventsPerThread];
+            i64 ts = e.tsUs - gTraceStartUs;
+            sep();
+            s.Append("{\"name\":");
+            AppendJsonStr(s, e.name);
+            s.AppendFmt(",\"ph\":\"%c\",\"ts\":%lld,\"pid\":%u,\"tid\":%u", e.kind, ts, (uint)pid, (uint)e.threadId);
+            if (e.kind == 'X') {
+                s.AppendFmt(",\"dur\":%lld,\"args\":{\"arg\":%lld}}", e.durUs, e.arg);
+            } else if (e.kind == 'C') {
+                s.AppendFmt(",\"args\":{\"value\":%lld}}", e.arg);
+            } else {
+                s.AppendFmt(",\"s\":\"t\",\"args\":{\"arg\":%lld}}", e.arg);
+            }
+        }
+    }
+    s.Append("\n],\n\"metadata\":{\"counters\":{");
+    first = true;
+    for (TraceCounter* c = gTraceCounters.load(); c; c = c->next) {
+        sep();
+        AppendJsonStr(s, c->name);
+        s.AppendFmt(":%lld", c->value.load());
+    }
+    s.Append("},\n\"histograms\":{");
+    first = true;
+    for (TraceHistogram* h = gTraceHistograms.load(); h; h = h->next) {
+        sep();
+        AppendJsonStr(s, h->name);
+        s.AppendFmt(":{\"count\":%lld,\"sum\":%lld,\"max\":%lld,\"p50\":%lld,\"p95\":%lld,\"p99\":%lld,\"buckets\":[",
+                    h->count.load(), h->sum.load(), h->max.load(), h->Percentile(50), h->Percentile(95),
+                    h->Percentile(99));
+        for (int i = 0; i < TraceHistogram::kBuckets; i++) {
+            s.AppendFmt(i == 0 ? "%lld" : ",%lld", h->buckets[i].load());
+        }
+        s.Append("]}");
+    }
+    s.Append("}}}\n");
+    return file::WriteFile(path, s.AsByteSlice());
+}
+
+void TraceGetSummary(str::Str& s) {
+    for (TraceCounter* c = gTraceCounters.load(); c; c = c->next) {
+        s.AppendFmt("%s: %lld\n", c->name, c->value.load());
+    }
+    for (TraceHistogram* h = gTraceHistograms.load(); h; h = h->next) {
+        i64 n = h->count.load();
+        if (n == 0) {
+            continue;
+        }
+        s.AppendFmt("%s: count: %lld, avg: %lld, p50: %lld, p95: %lld, p99: %lld, max: %lld\n", h->name, n,
+                    h->sum.load() / n, h->Percentile(50), h->Percentile(95), h->Percentile(99), h->max.load());
+    }
+}
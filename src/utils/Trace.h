@@ -0,0 +1,88 @@
+/* Copyright 2021 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+// Low-overhead tracing of timed spans plus always-on counters and histograms.
+//
+// Tracing is off by default. When off, a span costs a load and a branch
+// (plus reading the clock if it feeds a histogram). When on, events are
+// appended to a per-thread ring buffer without taking a lock. Nothing is
+// formatted when recording: names must be string literals.
+//
+// The trace can be exported in Chrome's trace event format
+// (load it in chrome://tracing or https://ui.perfetto.dev).
+//
+// How to use:
+//   static TraceHistogram gRenderUs("render.us");
+//   TraceScope scope("RenderPage", pageNo, &gRenderUs); // times enclosing scope
+//
+//   static TraceCounter gCacheHits("cache.hits");
+//   gCacheHits.Add();
+
+extern std::atomic<bool> gTraceEnabled;
+
+i64 TraceNowUs();
+
+// counter that is always updated, events are only recorded when tracing
+struct TraceCounter {
+    const char* name = nullptr;
+    std::atomic<i64> value = 0;
+    TraceCounter* next = nullptr;
+
+    explicit TraceCounter(const char* name);
+    void Add(i64 n = 1);
+};
+
+// histogram with power-of-2 buckets (bucket i has values in [2^(i-1), 2^i))
+struct TraceHistogram {
+    static constexpr int kBuckets = 40;
+
+    const char* name = nullptr;
+    std::atomic<i64> count = 0;
+    std::atomic<i64> sum = 0;
+    std::atomic<i64> max = 0;
+    std::atomic<i64> buckets[kBuckets]{};
+    TraceHistogram* next = nullptr;
+
+    explicit TraceHistogram(const char* name);
+    void Record(i64 v);
+    // estimate of the value at percentile p (0..100), from the buckets
+    i64 Percentile(int p) const;
+};
+
+// records a span of time spent in the enclosing scope, with an optional
+// numeric argument (e.g. page number). If histogram is given, the duration
+// in microseconds is also recorded there, even when tracing is disabled.
+struct TraceScope {
+    const char* name = nullptr;
+    i64 arg = 0;
+    i64 startUs = 0;
+    TraceHistogram* histogram = nullptr;
+
+    explicit TraceScope(const char* name, i64 arg = 0, TraceHistogram* histogram = nullptr) {
+        if (!gTraceEnabled.load(std::memory_order_relaxed) && !histogram) {
+            return;
+        }
+        this->name = name;
+        this->arg = arg;
+        this->histogram = histogram;
+        startUs = TraceNowUs();
+    }
+    ~TraceScope() {
+        if (name) {
+            End();
+        }
+    }
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+    void End();
+};
+
+// records a point-in-time event
+void TraceInstant(const char* name, i64 arg = 0);
+
+void TraceStart();
+void TraceStop();
+bool TraceWriteChromeJson(const char* path);
+// human-readable summary of counters and histograms
+void TraceGetSummary(str::Str& s);
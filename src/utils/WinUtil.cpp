@@ -10,6 +10,7 @@
 #include "utils/WinUtil.h"
 
 #include <mlang.h>
+#include <psapi.h>
 
 #include "utils/Log.h"
 
@@ -1385,7 +1386,7 @@ IStream* CreateStreamFromData(ByteSlice d) {
     return stream;
 }
 
-static HRESULT GetDataFromStream(IStream* stream, void** data, ULONG* len) {
+static HRESULT GetDataFromStream(IStream* stream, void** data, size_t* len) {
     if (!stream) {
         return E_INVALIDARG;
     }
@@ -1395,11 +1396,12 @@ static HRESULT GetDataFromStream(IStream* stream, void** data, ULONG* len) {
     if (FAILED(res)) {
         return res;
     }
-    if (stat.cbSize.HighPart > 0 || stat.cbSize.LowPart > UINT_MAX - sizeof(WCHAR) - 1) {
+    // the size must fit in memory (only a limit for 32-bit builds)
+    if (stat.cbSize.QuadPart > (ULONGLONG)(SIZE_MAX - sizeof(WCHAR) - 1)) {
         return E_OUTOFMEMORY;
     }
 
-    ULONG n = stat.cbSize.LowPart;
+    size_t n = (size_t)stat.cbSize.QuadPart;
     // zero-terminate the stream's content, so that it could be
     // used directly as either a char* or a WCHAR* string
     char* d = AllocArray<char>(n + sizeof(WCHAR) + 1);
@@ -1407,13 +1409,22 @@ static HRESULT GetDataFromStream(IStream* stream, void** data, ULONG* len) {
         return E_OUTOFMEMORY;
     }
 
-    ULONG read;
     LARGE_INTEGER zero = {0};
     stream->Seek(zero, STREAM_SEEK_SET, nullptr);
-    res = stream->Read(d, stat.cbSize.LowPart, &read);
-    if (FAILED(res) || read != n) {
+    // Read() takes a ULONG size, so read files > 4 GB in chunks
+    size_t nRead = 0;
+    while (nRead < n) {
+        ULONG toRead = (ULONG)std::min(n - nRead, (size_t)(1 << 30));
+        ULONG read = 0;
+        res = stream->Read(d + nRead, toRead, &read);
+        if (FAILED(res) || read == 0) {
+            break;
+        }
+        nRead += read;
+    }
+    if (FAILED(res) || nRead != n) {
         free(d);
-        return res;
+        return FAILED(res) ? res : E_FAIL;
     }
 
     *len = n;
@@ -1423,7 +1434,7 @@ static HRESULT GetDataFromStream(IStream* stream, void** data, ULONG* len) {
 
 ByteSlice GetDataFromStream(IStream* stream, HRESULT* resOpt) {
     void* data = nullptr;
-    ULONG size = 0;
+    size_t size = 0;
     HRESULT res = GetDataFromStream(stream, &data, &size);
     if (resOpt) {
         *resOpt = res;
@@ -1900,6 +1911,16 @@ double GetProcessRunningTime() {
     return timeInMs;
 }
 
+// peak working set of this process, in bytes
+i64 GetPeakMemoryUsage() {
+    PROCESS_MEMORY_COUNTERS pmc{};
+    pmc.cb = sizeof(pmc);
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc))) {
+        return 0;
+    }
+    return (i64)pmc.PeakWorkingSetSize;
+}
+
 bool IsValidHandle(HANDLE h) {
     return !(h == nullptr || h == INVALID_HANDLE_VALUE);
 }
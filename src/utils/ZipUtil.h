@@ -13,7 +13,6 @@ class ZipCreator {
     size_t fileCount;
 
     bool WriteData(const void* data, size_t size);
-    bool AddFileData(const char* nameUtf8, const void* data, size_t size, u32 dosdate = 0);
 
   public:
     explicit ZipCreator(const WCHAR* zipFilePath);
@@ -23,6 +22,7 @@ class ZipCreator {
     ZipCreator(ZipCreator const&) = delete;
     ZipCreator& operator=(ZipCreator const&) = delete;
 
+    bool AddFileData(const char* nameUtf8, const void* data, size_t size, u32 dosdate = 0);
     bool AddFile(const WCHAR* filePath, const WCHAR* nameInZip = nullptr);
     bool AddFileFromDir(const WCHAR* filePath, const WCHAR* dir);
     bool AddDir(const WCHAR* dirPath, bool recursive = false);
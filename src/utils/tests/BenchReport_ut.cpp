@@ -0,0 +1,120 @@
+/* Copyright 2021 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+#include "utils/BaseUtil.h"
+#include "utils/BenchReport.h"
+
+// must be last due to assert() over-write
+#include "utils/UtAssert.h"
+
+static void SummarizeTest() {
+    BenchSamples empty;
+    BenchSummary s = empty.Summarize();
+    utassert(s.count == 0 && s.p50 == 0 && s.max == 0);
+
+    // 100 .. 1, unsorted on purpose
+    BenchSamples samples;
+    for (int i = 100; i >= 1; i--) {
+        samples.Add((double)i);
+    }
+    s = samples.Summarize();
+    utassert(s.count == 100);
+    utassert(s.mean == 50.5);
+    utassert(s.p50 == 50);
+    utassert(s.p95 == 95);
+    utassert(s.p99 == 99);
+    utassert(s.max == 100);
+
+    BenchSamples one;
+    one.Add(7);
+    BenchSamples merged;
+    merged.Append(one);
+    merged.Append(one);
+    s = merged.Summarize();
+    utassert(s.count == 2 && s.p50 == 7 && s.p99 == 7);
+}
+
+static void JsonRoundTripTest() {
+    BenchReport r;
+    r.workers = 4;
+    r.files = 12;
+    r.failedFiles = 1;
+    r.pages = 1000;
+    r.wallMs = 2000;
+    r.peakMemBytes = 123456789;
+    BenchSummary& load = r.metrics[(int)BenchMetric::Load];
+    load.count = 11;
+    load.mean = 1.5;
+    load.p50 = 1.25;
+    load.p95 = 3.5;
+    load.p99 = 4.75;
+    load.max = 5;
+    utassert(r.PagesPerSec() == 500);
+
+    str::Str json;
+    BenchReportToJson(r, json);
+    BenchReport r2;
+    utassert(BenchReportFromJson(json.Get(), r2));
+    utassert(r2.workers == 4 && r2.files == 12 && r2.failedFiles == 1);
+    utassert(r2.pages == 1000 && r2.wallMs == 2000 && r2.peakMemBytes == 123456789);
+    const BenchSummary& load2 = r2.metrics[(int)BenchMetric::Load];
+    utassert(load2.count == 11 && load2.mean == 1.5 && load2.p50 == 1.25);
+    utassert(load2.p95 == 3.5 && load2.p99 == 4.75 && load2.max == 5);
+    utassert(r2.metrics[(int)BenchMetric::Toc].count == 0);
+
+    utassert(!BenchReportFromJson("{", r2));
+    utassert(!BenchReportFromJson("{\"foo\": \"bar\"}", r2));
+}
+
+static void CompareTest() {
+    BenchReport base;
+    base.pages = 100;
+    base.wallMs = 1000;
+    base.peakMemBytes = 1000;
+    BenchSummary& render = base.metrics[(int)BenchMetric::Render];
+    render.count = 100;
+    render.p50 = 10;
+    render.p95 = 20;
+    render.p99 = 30;
+
+    str::Str out;
+    utassert(0 == CompareBenchReports(base, base, 10, 1, out));
+    utassert(out.size() == 0);
+
+    // within threshold or below noise floor
+    BenchReport curr = base;
+    curr.metrics[(int)BenchMetric::Render].p50 = 10.9;
+    curr.metrics[(int)BenchMetric::Render].p99 = 32.9;
+    curr.wallMs = 1050;
+    utassert(0 == CompareBenchReports(base, curr, 10, 1, out));
+
+    curr.metrics[(int)BenchMetric::Render].p95 = 25;
+    utassert(1 == CompareBenchReports(base, curr, 10, 1, out));
+    utassert(str::Find(out.Get(), "render.p95"));
+
+    out.Reset();
+    curr.wallMs = 2000;
+    curr.peakMemBytes = 2000;
+    curr.failedFiles = 1;
+    utassert(4 == CompareBenchReports(base, curr, 10, 1, out));
+    utassert(str::Find(out.Get(), "pagesPerSec"));
+    utassert(str::Find(out.Get(), "peakMemBytes"));
+    utassert(str::Find(out.Get(), "failedFiles"));
+
+    // improvements are not regressions
+    out.Reset();
+    utassert(0 == CompareBenchReports(curr, base, 10, 1, out));
+
+    // different number of workers: pages/sec is not compared
+    out.Reset();
+    BenchReport slower = base;
+    slower.workers = 2;
+    slower.wallMs = 5000;
+    utassert(0 == CompareBenchReports(base, slower, 10, 1, out));
+}
+
+void BenchReportTest() {
+    SummarizeTest();
+    JsonRoundTripTest();
+    CompareTest();
+}
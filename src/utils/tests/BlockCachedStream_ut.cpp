@@ -0,0 +1,138 @@
+/* Copyright 2021 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+#include "utils/BaseUtil.h"
+#include "utils/ScopedWin.h"
+#include "utils/FileUtil.h"
+#include "utils/BlockCachedStream.h"
+
+// must be last due to assert() over-write
+#include "utils/UtAssert.h"
+
+static u8 ByteAt(i64 off) {
+    return (u8)((off * 7) ^ (off >> 8));
+}
+
+static bool ReadAtMatches(BlockCachedStream* s, i64 off, int n) {
+    u8 buf[1024];
+    CrashIf(n > (int)sizeof(buf));
+    i64 nRead = s->ReadAt(off, buf, n);
+    i64 expected = std::max(std::min((i64)n, s->Size() - off), (i64)0);
+    if (nRead != expected) {
+        return false;
+    }
+    for (int i = 0; i < (int)nRead; i++) {
+        if (buf[i] != ByteAt(off + i)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void RandomAccessTest(const WCHAR* path, int fileSize) {
+    LONG nReads = 0, nSeeks = 0;
+    ScopedComPtr<IStream> src(CreateTestFileStream(path, 0, &nReads, &nSeeks));
+    utassert(src);
+    // small blocks and cache so that we exercise eviction
+    BlockCachedStream* s = BlockCachedStream::Create(src, 4096, 4);
+    utassert(s && s->Size() == fileSize);
+
+    // reads spanning blocks, at the end and beyond the end
+    utassert(ReadAtMatches(s, 0, 1000));
+    utassert(ReadAtMatches(s, 4000, 1000));
+    utassert(ReadAtMatches(s, fileSize - 10, 100));
+    utassert(ReadAtMatches(s, fileSize, 10));
+    utassert(ReadAtMatches(s, fileSize + 1000, 10));
+    utassert(s->ReadAt(-1, nullptr, 10) == -1);
+
+    // pseudo-random reads
+    u32 seed = 1;
+    for (int i = 0; i < 2000; i++) {
+        seed = seed * 1103515245 + 12345;
+        i64 off = (seed >> 4) % fileSize;
+        utassert(ReadAtMatches(s, off, 1 + (int)(seed % 700)));
+    }
+
+    // many small reads within a block only read it from the source once
+    LONG readsBefore = nReads;
+    BlockCachedStream::Stats stats = s->GetStats();
+    for (int i = 0; i < 4096; i += 16) {
+        utassert(ReadAtMatches(s, 8192 + i, 16));
+    }
+    utassert(nReads - readsBefore <= 1);
+    BlockCachedStream::Stats stats2 = s->GetStats();
+    utassert(stats2.hits - stats.hits >= 255);
+
+    // IStream interface
+    LARGE_INTEGER off;
+    off.QuadPart = -10;
+    ULARGE_INTEGER newPos;
+    utassert(S_OK == s->Seek(off, STREAM_SEEK_END, &newPos));
+    utassert(newPos.QuadPart == (ULONGLONG)fileSize - 10);
+    u8 buf[32];
+    ULONG nRead = 0;
+    utassert(S_FALSE == s->Read(buf, sizeof(buf), &nRead));
+    utassert(nRead == 10 && buf[0] == ByteAt(fileSize - 10));
+    off.QuadPart = -(fileSize + 1);
+    utassert(FAILED(s->Seek(off, STREAM_SEEK_CUR, nullptr)));
+    STATSTG stat;
+    utassert(S_OK == s->Stat(&stat, STATFLAG_NONAME));
+    utassert(stat.cbSize.QuadPart == (ULONGLONG)fileSize);
+
+    // wrapping a cached stream again returns the same stream
+    BlockCachedStream* s2 = GetBlockCachedStream(s);
+    utassert(s2 == s);
+    s2->Release();
+    s->Release();
+}
+
+// a sparse file with data beyond 4 GB, to check for 32-bit offset truncation
+static void LargeFileTest(const WCHAR* path) {
+    HANDLE h = CreateFileW(path, GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL,
+                           nullptr);
+    utassert(h != INVALID_HANDLE_VALUE);
+    DWORD n;
+    BOOL ok = DeviceIoControl(h, FSCTL_SET_SPARSE, nullptr, 0, nullptr, 0, &n, nullptr);
+    if (!ok) {
+        // file system doesn't support sparse files, skip the test
+        CloseHandle(h);
+        return;
+    }
+    const i64 dataOff = (5LL << 30) + 12345;
+    LARGE_INTEGER li;
+    li.QuadPart = dataOff;
+    SetFilePointerEx(h, li, nullptr, FILE_BEGIN);
+    const char* data = "beyond 4 GB";
+    WriteFile(h, data, (DWORD)str::Len(data), &n, nullptr);
+    CloseHandle(h);
+
+    ScopedComPtr<IStream> src(CreateTestFileStream(path, 0, nullptr, nullptr));
+    utassert(src);
+    BlockCachedStream* s = BlockCachedStream::Create(src);
+    utassert(s && s->Size() == dataOff + (i64)str::Len(data));
+    char buf[32]{};
+    utassert(s->ReadAt(dataOff, buf, sizeof(buf)) == (i64)str::Len(data));
+    utassert(str::Eq(buf, data));
+    // the same offset truncated to 32 bits is inside the sparse (zero) area
+    utassert(s->ReadAt((u32)dataOff, buf, 4) == 4 && buf[0] == 0);
+    s->Release();
+}
+
+void BlockCachedStreamTest() {
+    AutoFreeWstr filePath = path::GetTempFilePath(L"bcs");
+    utassert(filePath);
+    if (!filePath) {
+        return;
+    }
+    const int fileSize = 100 * 1000 + 17;
+    u8* d = AllocArray<u8>(fileSize);
+    for (int i = 0; i < fileSize; i++) {
+        d[i] = ByteAt(i);
+    }
+    utassert(file::WriteFile(filePath, {d, (size_t)fileSize}));
+    free(d);
+
+    RandomAccessTest(filePath, fileSize);
+    LargeFileTest(filePath);
+    file::Delete(filePath);
+}
@@ -0,0 +1,179 @@
+/* Copyright 2021 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+#include "utils/BaseUtil.h"
+#include "utils/FileChangeDebouncer.h"
+
+// must be last due to assert() over-write
+#include "utils/UtAssert.h"
+
+// simulated files, identified by their index
+static FileChangeDebouncer::FileState gStates[3];
+
+static bool GetTestFileState(void* file, FileChangeDebouncer::FileState* fs) {
+    *fs = gStates[(intptr_t)file];
+    return fs->size >= 0;
+}
+
+static void Write(intptr_t file, i64 nowMs, i64 size) {
+    gStates[file].mtime = nowMs;
+    gStates[file].size = size;
+}
+
+static int ProcessCount(FileChangeDebouncer& d, i64 nowMs, Vec<void*>& changed) {
+    changed.Reset();
+    d.Process(nowMs, changed);
+    return changed.isize();
+}
+
+static void DebounceMultipleWritesTest() {
+    Vec<void*> changed;
+    FileChangeDebouncer d(GetTestFileState);
+    d.debounceMs = 100;
+    Write(0, 0, 10);
+    d.Add((void*)0, false, 0);
+    utassert(d.NextTimeoutMs(0) == -1);
+
+    // a file written in 3 chunks, each generating a notification
+    for (i64 t = 1000; t <= 1100; t += 50) {
+        Write(0, t, t);
+        d.OnChanged((void*)0, t);
+        utassert(0 == ProcessCount(d, t, changed));
+    }
+    utassert(1 == d.PendingCount());
+    utassert(d.NextTimeoutMs(1100) == 100);
+    utassert(0 == ProcessCount(d, 1150, changed));
+    utassert(1 == ProcessCount(d, 1200, changed));
+    utassert(changed[0] == (void*)0);
+    utassert(0 == d.PendingCount());
+    utassert(0 == ProcessCount(d, 5000, changed));
+}
+
+static void SettleTest() {
+    Vec<void*> changed;
+    FileChangeDebouncer d(GetTestFileState);
+    d.debounceMs = 100;
+    Write(0, 0, 10);
+    d.Add((void*)0, false, 0);
+
+    // a writer that doesn't generate notifications for every write
+    Write(0, 1000, 20);
+    d.OnChanged((void*)0, 1000);
+    Write(0, 1050, 30);
+    utassert(0 == ProcessCount(d, 1100, changed));
+    // the file didn't change during the next quiet period
+    utassert(1 == ProcessCount(d, 1200, changed));
+
+    // the file is temporarily missing while being replaced
+    Write(0, 2000, -1);
+    d.OnChanged((void*)0, 2000);
+    utassert(0 == ProcessCount(d, 2100, changed));
+    Write(0, 2150, 40);
+    d.OnChanged((void*)0, 2150);
+    utassert(1 == ProcessCount(d, 2250, changed));
+
+    // a deleted file is not reported
+    Write(0, 3000, -1);
+    d.OnChanged((void*)0, 3000);
+    for (i64 t = 3100; t < 3000 + d.maxDelayMs + 200; t += 100) {
+        utassert(0 == ProcessCount(d, t, changed));
+    }
+    utassert(0 == d.PendingCount());
+}
+
+static void MaxDelayTest() {
+    Vec<void*> changed;
+    FileChangeDebouncer d(GetTestFileState);
+    d.debounceMs = 100;
+    d.maxDelayMs = 1000;
+    Write(0, 0, 10);
+    d.Add((void*)0, false, 0);
+
+    // a file that never stops changing is reported once, maxDelayMs after the first change
+    int n = 0;
+    for (i64 t = 1000; t <= 2100; t += 50) {
+        Write(0, t, t);
+        d.OnChanged((void*)0, t);
+        if (t == 1950) {
+            // before the quiet period would end
+            utassert(d.NextTimeoutMs(t) == 50);
+        }
+        int nChanged = ProcessCount(d, t, changed);
+        utassert(nChanged == (t == 2000 ? 1 : 0));
+        n += nChanged;
+    }
+    utassert(1 == n);
+    // the changes after the report are reported once the file settles
+    utassert(1 == d.PendingCount());
+    utassert(1 == ProcessCount(d, 2200, changed));
+}
+
+static void CoalesceFilesTest() {
+    Vec<void*> changed;
+    FileChangeDebouncer d(GetTestFileState);
+    d.debounceMs = 100;
+    Write(0, 0, 10);
+    Write(1, 0, 10);
+    d.Add((void*)0, false, 0);
+    d.Add((void*)1, false, 0);
+
+    // e.g. .pdf and .synctex.gz written by one compilation
+    Write(0, 1000, 20);
+    d.OnChanged((void*)0, 1000);
+    Write(1, 1030, 20);
+    d.OnChanged((void*)1, 1030);
+    Write(0, 1060, 30);
+    d.OnChanged((void*)0, 1060);
+    utassert(2 == d.PendingCount());
+    utassert(0 == ProcessCount(d, 1100, changed));
+    utassert(1 == ProcessCount(d, 1130, changed));
+    utassert(changed[0] == (void*)1);
+    utassert(1 == ProcessCount(d, 1160, changed));
+    utassert(changed[0] == (void*)0);
+
+    d.Remove((void*)0);
+    Write(1, 2000, 30);
+    d.OnChanged((void*)0, 2000);
+    d.OnChanged((void*)1, 2000);
+    utassert(1 == d.PendingCount());
+    utassert(1 == ProcessCount(d, 2100, changed));
+    utassert(changed[0] == (void*)1);
+}
+
+static void PollBackOffTest() {
+    Vec<void*> changed;
+    FileChangeDebouncer d(GetTestFileState);
+    d.debounceMs = 100;
+    d.minPollMs = 500;
+    d.maxPollMs = 4000;
+    Write(2, 0, 10);
+    d.Add((void*)2, true, 0);
+
+    // poll interval doubles while the file doesn't change
+    i64 t = 0;
+    i64 expected[] = {500, 1000, 2000, 4000, 4000};
+    for (i64 exp : expected) {
+        i64 timeout = d.NextTimeoutMs(t);
+        utassert(timeout == exp || (t == 0 && timeout == 500));
+        t += timeout;
+        utassert(0 == ProcessCount(d, t, changed));
+    }
+
+    // a change detected by polling is debounced and resets the interval
+    Write(2, t, 20);
+    t += d.NextTimeoutMs(t);
+    utassert(0 == ProcessCount(d, t, changed));
+    utassert(1 == d.PendingCount());
+    utassert(d.NextTimeoutMs(t) == 100);
+    t += 100;
+    utassert(1 == ProcessCount(d, t, changed));
+    utassert(d.NextTimeoutMs(t) == 500);
+}
+
+void FileChangeDebouncerTest() {
+    DebounceMultipleWritesTest();
+    SettleTest();
+    MaxDelayTest();
+    CoalesceFilesTest();
+    PollBackOffTest();
+}
@@ -0,0 +1,93 @@
+/* Copyright 2021 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+#include "utils/BaseUtil.h"
+#include "utils/PageResultCache.h"
+
+// must be last due to assert() over-write
+#include "utils/UtAssert.h"
+
+static void RoundTripTest() {
+    DocResults res;
+    res.nPages = 3;
+    res.loadMs = 10.125;
+    res.tocMs = 0.25;
+    const char* bmp = "fake bitmap data";
+    ByteSlice bmpData((u8*)bmp, str::Len(bmp));
+    // out of order, with text that looks like a page line
+    res.SetPage(3, bmpData, "page 9 1 1 - - 0\nlast", 3.5, 0.5);
+    res.SetPage(1, bmpData, "hello\n", 21.5, 1.75);
+    utassert(!res.IsComplete());
+    // failed to render
+    res.SetPage(2, {}, nullptr, 0, 0.125);
+    utassert(res.IsComplete());
+    utassert(res.pages[0].pageNo == 1 && res.pages[2].pageNo == 3);
+    utassert(str::Eq(res.GetPage(1)->renderHash, res.GetPage(3)->renderHash));
+    utassert(str::Len(res.GetPage(1)->renderHash) == 32);
+    utassert(res.GetPage(2)->renderHash[0] == 0);
+    utassert(!str::Eq(res.GetPage(1)->textHash, res.GetPage(3)->textHash));
+    utassert(res.GetPage(4) == nullptr);
+
+    str::Str s;
+    PageResultsToText(res, s);
+    DocResults res2;
+    utassert(PageResultsFromText(s.Get(), s.size(), res2));
+    utassert(res2.nPages == 3 && res2.loadMs == 10.125 && res2.tocMs == 0.25);
+    utassert(res2.IsComplete());
+    for (int pageNo = 1; pageNo <= 3; pageNo++) {
+        PageResult* a = res.GetPage(pageNo);
+        PageResult* b = res2.GetPage(pageNo);
+        utassert(b && str::Eq(a->renderHash, b->renderHash) && str::Eq(a->textHash, b->textHash));
+        utassert(str::Eq(a->text, b->text) && a->renderMs == b->renderMs && a->textMs == b->textMs);
+    }
+
+    // updating a page replaces its results
+    res2.SetPage(2, bmpData, "now with text", 5, 1);
+    utassert(res2.pages.size() == 3 && str::Eq(res2.GetPage(2)->renderHash, res.GetPage(1)->renderHash));
+}
+
+static void ParseErrorsTest() {
+    DocResults res;
+    const char* bad[] = {
+        "",
+        "PageResults 2\npages 1\nloadMs 0\ntocMs 0\n",
+        "PageResults 1\npages 1\nloadMs 0\n",
+        // text length beyond the end of data
+        "PageResults 1\npages 1\nloadMs 0\ntocMs 0\npage 1 1 1 - 0123456789abcdef0123456789abcdef 10\nabc\n",
+        // bad hash
+        "PageResults 1\npages 1\nloadMs 0\ntocMs 0\npage 1 1 1 - 0123 0\n\n",
+        // pages out of order
+        "PageResults 1\npages 2\nloadMs 0\ntocMs 0\npage 2 1 1 - 0123456789abcdef0123456789abcdef 0\n\n"
+        "page 1 1 1 - 0123456789abcdef0123456789abcdef 0\n\n",
+    };
+    for (const char* s : bad) {
+        utassert(!PageResultsFromText(s, str::Len(s), res));
+        utassert(res.pages.size() == 0);
+    }
+
+    const char* ok = "PageResults 1\npages 2\nloadMs 1.5\ntocMs 0\npage 2 1 1 - 0123456789abcdef0123456789abcdef 0\n\n";
+    utassert(PageResultsFromText(ok, str::Len(ok), res));
+    utassert(res.nPages == 2 && res.pages.size() == 1 && !res.IsComplete());
+}
+
+static void KeyTest() {
+    u8 digest[16]{};
+    AutoFree k1 = PageResultsKey(digest, "1.0", 1.f, "");
+    AutoFree k2 = PageResultsKey(digest, "1.0", 1.f, "");
+    AutoFree k3 = PageResultsKey(digest, "1.1", 1.f, "");
+    AutoFree k4 = PageResultsKey(digest, "1.0", 0.5f, "");
+    AutoFree k5 = PageResultsKey(digest, "1.0", 1.f, "-text");
+    digest[15] = 1;
+    AutoFree k6 = PageResultsKey(digest, "1.0", 1.f, "");
+    utassert(str::Len(k1) == 32 && str::Eq(k1, k2));
+    const char* others[] = {k3, k4, k5, k6};
+    for (const char* k : others) {
+        utassert(!str::Eq(k1, k));
+    }
+}
+
+void PageResultCacheTest() {
+    RoundTripTest();
+    ParseErrorsTest();
+    KeyTest();
+}
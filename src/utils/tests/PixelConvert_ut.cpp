@@ -0,0 +1,120 @@
+/* Copyright 2021 the SumatraPDF project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+#include "utils/BaseUtil.h"
+#include "utils/PixelConvert.h"
+
+// must be last due to assert() over-write
+#include "utils/UtAssert.h"
+
+static void FillRandom(u8* d, size_t len, u32& seed) {
+    for (size_t i = 0; i < len; i++) {
+        seed = seed * 1103515245 + 12345;
+        d[i] = (u8)(seed >> 16);
+    }
+}
+
+// sizes that exercise the scalar handling of left over pixels
+static const size_t kPixelCounts[] = {0, 1, 3, 4, 7, 8, 15, 16, 17, 31, 33, 63, 100, 1001};
+
+// compares every implementation supported by the cpu against the scalar one
+static void CompareRowConvert(void (*convert)(const u8*, u8*, size_t), int srcBytesPerPixel) {
+    u32 seed = 1;
+    for (size_t n : kPixelCounts) {
+        // +1 so that src and dst aren't aligned
+        std::vector<u8> src(n * srcBytesPerPixel + 1);
+        FillRandom(src.data(), src.size(), seed);
+        std::vector<u8> expected(n * 4 + 1);
+        SetPixelConvertImpl(PixelConvertImpl::Scalar);
+        convert(src.data() + 1, expected.data() + 1, n);
+
+        for (int impl = 1; impl <= (int)GetBestPixelConvertImpl(); impl++) {
+            SetPixelConvertImpl((PixelConvertImpl)impl);
+            std::vector<u8> res(n * 4 + 1);
+            convert(src.data() + 1, res.data() + 1, n);
+            utassert(expected == res);
+        }
+    }
+    SetPixelConvertImpl(GetBestPixelConvertImpl());
+}
+
+static void CompareInPlaceConvert(void (*convert)(u8*, size_t), const std::vector<u8>& px) {
+    size_t n = px.size() / 4;
+    std::vector<u8> expected = px;
+    SetPixelConvertImpl(PixelConvertImpl::Scalar);
+    convert(expected.data(), n);
+    for (int impl = 1; impl <= (int)GetBestPixelConvertImpl(); impl++) {
+        SetPixelConvertImpl((PixelConvertImpl)impl);
+        std::vector<u8> res = px;
+        convert(res.data(), n);
+        utassert(expected == res);
+    }
+    SetPixelConvertImpl(GetBestPixelConvertImpl());
+}
+
+static void KnownValuesTest() {
+    SetPixelConvertImpl(PixelConvertImpl::Scalar);
+    u8 rgba[] = {1, 2, 3, 4};
+    u8 res[4];
+    ConvertRgbaToBgra(rgba, res, 1);
+    utassert(res[0] == 3 && res[1] == 2 && res[2] == 1 && res[3] == 4);
+    // in place
+    ConvertRgbaToBgra(rgba, rgba, 1);
+    utassert(memcmp(rgba, res, 4) == 0);
+
+    u8 rgb[] = {10, 20, 30};
+    ConvertRgbToBgra(rgb, res, 1);
+    utassert(res[0] == 30 && res[1] == 20 && res[2] == 10 && res[3] == 255);
+
+    u8 ga[] = {7, 9};
+    ConvertGrayAlphaToBgra(ga, res, 1);
+    utassert(res[0] == 7 && res[1] == 7 && res[2] == 7 && res[3] == 9);
+
+    // R = 255 - min(C + K, 255)
+    u8 cmyk[] = {100, 200, 0, 60};
+    ConvertCmykToBgra(cmyk, res, 1);
+    utassert(res[0] == 195 && res[1] == 0 && res[2] == 95 && res[3] == 255);
+
+    u8 px[] = {255, 128, 0, 128};
+    PremultiplyBgra(px, 1);
+    utassert(px[0] == 128 && px[1] == 64 && px[2] == 0 && px[3] == 128);
+    UnpremultiplyBgra(px, 1);
+    utassert(px[0] == 255 && px[1] == 128 && px[2] == 0 && px[3] == 128);
+    SetPixelConvertImpl(GetBestPixelConvertImpl());
+}
+
+void PixelConvertTest() {
+    KnownValuesTest();
+
+    CompareRowConvert(ConvertRgbaToBgra, 4);
+    CompareRowConvert(ConvertRgbToBgra, 3);
+    CompareRowConvert(ConvertGrayToBgra, 1);
+    CompareRowConvert(ConvertGrayAlphaToBgra, 2);
+    CompareRowConvert(ConvertCmykToBgra, 4);
+
+    // all combinations of color and alpha values
+    std::vector<u8> px(256 * 256 * 4);
+    u8* p = px.data();
+    for (int a = 0; a < 256; a++) {
+        for (int c = 0; c < 256; c++, p += 4) {
+            p[0] = (u8)c;
+            p[1] = (u8)(255 - c);
+            p[2] = (u8)std::min(c, a);
+            p[3] = (u8)a;
+        }
+    }
+    CompareInPlaceConvert(PremultiplyBgra, px);
+    CompareInPlaceConvert(UnpremultiplyBgra, px);
+
+    // premultiplying and unpremultiplying again is lossless for opaque pixels
+    u32 seed = 7;
+    std::vector<u8> opaque(1000 * 4);
+    FillRandom(opaque.data(), opaque.size(), seed);
+    for (size_t i = 3; i < opaque.size(); i += 4) {
+        opaque[i] = 255;
+    }
+    std::vector<u8> roundTrip = opaque;
+    PremultiplyBgra(roundTrip.data(), 1000);
+    UnpremultiplyBgra(roundTrip.data(), 1000);
+    utassert(roundTrip == opaque);
+}
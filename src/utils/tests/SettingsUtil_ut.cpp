@@ -83,6 +83,45 @@ static const StructInfo gSutStructInfo = {sizeof(SutStruct), 17, gSutStructField
                                           "\0Utf8String\0NullUtf8String\0EscapedUtf8String\0IntArray\0StrArray\0EmptySt"
                                           "rArray\0Point\0\0SutStructItems"};
 
+static void BinaryRoundTripTest(const char* serialized) {
+    SutStruct* data = (SutStruct*)DeserializeStruct(&gSutStructInfo, serialized);
+    str::Str bin;
+    SerializeStructBinary(bin, &gSutStructInfo, data);
+    AutoFree text(SerializeStruct(&gSutStructInfo, data));
+
+    ByteSlice d = bin.AsSpan();
+    SutStruct* data2 = (SutStruct*)DeserializeStructBinary(&gSutStructInfo, d);
+    utassert(data2 && d.size() == 0);
+    AutoFree text2(SerializeStruct(&gSutStructInfo, data2));
+    utassert(str::Eq(text, text2));
+    utassert(!data2->nullString && data2->emptyStrArray && 0 == data2->emptyStrArray->size());
+    utassert(2 == data2->sutStructItems->size());
+    FreeStruct(&gSutStructInfo, data2);
+
+    // the text form can't have nullptr entries but the binary one keeps them
+    size_t nStrs = data->strArray->size();
+    data->strArray->Append(nullptr);
+    str::Str binWithNull;
+    SerializeStructBinary(binWithNull, &gSutStructInfo, data);
+    d = binWithNull.AsSpan();
+    data2 = (SutStruct*)DeserializeStructBinary(&gSutStructInfo, d);
+    utassert(data2 && d.size() == 0);
+    utassert(data2->strArray->size() == nStrs + 1 && !data2->strArray->at(nStrs));
+    utassert(str::Eq(data2->strArray->at(0), data->strArray->at(0)));
+    FreeStruct(&gSutStructInfo, data2);
+    data->strArray->Pop();
+
+    // truncated data
+    for (size_t len = 0; len < bin.size(); len += 7) {
+        ByteSlice part((u8*)bin.Get(), len);
+        utassert(!DeserializeStructBinary(&gSutStructInfo, part));
+    }
+    FreeStruct(&gSutStructInfo, data);
+
+    utassert(StructInfoHash(&gSutStructInfo) == StructInfoHash(&gSutStructInfo));
+    utassert(StructInfoHash(&gSutStructInfo) != StructInfoHash(&gSutStructItemInfo));
+}
+
 void SettingsUtilTest() {
     static const char* serialized = UTF8_BOM
         "# This file will be overwritten - modify at your own risk!\r\n\r\n\
@@ -212,4 +251,6 @@ Key = Value";
         utassert(data->boolean == ((i % 2) == 0));
         FreeStruct(&gSutStructInfo, data);
     }
+
+    BinaryRoundTripTest(serialized);
 }
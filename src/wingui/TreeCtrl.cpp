@@ -185,16 +185,14 @@ static TVITEMW* GetTVITEM(TreeCtrl* tree, TreeItem ti) {
 // expand if collapse, collapse if expanded
 static void TreeViewToggle(TreeCtrl* tree, HTREEITEM hItem, bool recursive) {
     HWND hTree = tree->hwnd;
-    HTREEITEM child = TreeView_GetChild(hTree, hItem);
-    if (!child) {
-        // only applies to nodes with children
-        return;
-    }
-
     TVITEMW* item = GetTVITEM(tree, hItem);
     if (!item) {
         return;
     }
+    // only applies to nodes with children (which might not be inserted yet)
+    if (item->cChildren == 0) {
+        return;
+    }
     uint flag = TVE_EXPAND;
     bool isExpanded = bitmask::IsSet(item->state, TVIS_EXPANDED);
     if (isExpanded) {
@@ -207,6 +205,8 @@ static void TreeViewToggle(TreeCtrl* tree, HTREEITEM hItem, bool recursive) {
     }
 }
 
+void PopulateTreeItem(TreeCtrl* treeCtrl, TreeItem item, HTREEITEM parent);
+
 static void SetTreeItemState(uint uState, TreeItemState& state) {
     state.isExpanded = bitmask::IsSet(uState, TVIS_EXPANDED);
     state.isSelected = bitmask::IsSet(uState, TVIS_SELECTED);
@@ -226,6 +226,16 @@ static void Handle_WM_NOTIFY(void* user, WndEvent* ev) {
     LPARAM lp = ev->lp;
     NMTREEVIEWW* nmtv = (NMTREEVIEWW*)(lp);
 
+    // https://docs.microsoft.com/en-us/windows/win32/controls/tvn-itemexpanding
+    // children are inserted when an item is expanded for the first time
+    if (nmtv->hdr.code == TVN_ITEMEXPANDING && (nmtv->action & TVE_EXPAND) && w->treeModel) {
+        HTREEITEM hItem = nmtv->itemNew.hItem;
+        TreeItem ti = (TreeItem)nmtv->itemNew.lParam;
+        if (ti != TreeModel::kNullItem && !TreeView_GetChild(w->hwnd, hItem)) {
+            PopulateTreeItem(w, ti, hItem);
+        }
+    }
+
     if (w->onNotify) {
         WmNotifyEvent a{};
         CopyWndEvent cp(&a, ev);
@@ -600,7 +610,31 @@ void TreeCtrl::CollapseAll() {
     ResumeRedraw();
 }
 
+// resets the handles of the items in the tree view before they're deleted,
+// so that a handle is only set for items that are inserted (see GetHandleByTreeItem)
+static void ClearHandles(TreeCtrl* treeCtrl) {
+    TreeModel* tm = treeCtrl->treeModel;
+    if (!tm) {
+        return;
+    }
+    HWND hwnd = treeCtrl->hwnd;
+    HTREEITEM hi = TreeView_GetRoot(hwnd);
+    while (hi) {
+        tm->SetHandle(treeCtrl->GetTreeItemByHandle(hi), nullptr);
+        // depth-first, without recursion
+        HTREEITEM next = TreeView_GetChild(hwnd, hi);
+        while (!next && hi) {
+            next = TreeView_GetNextSibling(hwnd, hi);
+            if (!next) {
+                hi = TreeView_GetParent(hwnd, hi);
+            }
+        }
+        hi = next;
+    }
+}
+
 void TreeCtrl::Clear() {
+    ClearHandles(this);
     treeModel = nullptr;
 
     HWND hwnd = this->hwnd;
@@ -638,6 +672,20 @@ TreeItem TreeCtrl::GetItemAt(int x, int y) {
 }
 
 HTREEITEM TreeCtrl::GetHandleByTreeItem(TreeItem item) {
+    HTREEITEM hi = treeModel->GetHandle(item);
+    if (hi || item == TreeModel::kNullItem) {
+        return hi;
+    }
+    // the item isn't inserted if its parent was never expanded
+    TreeItem parent = treeModel->Parent(item);
+    if (parent == TreeModel::kNullItem || parent == treeModel->Root()) {
+        return nullptr;
+    }
+    HTREEITEM hParent = GetHandleByTreeItem(parent);
+    if (!hParent || TreeView_GetChild(hwnd, hParent)) {
+        return nullptr;
+    }
+    PopulateTreeItem(this, parent, hParent);
     return treeModel->GetHandle(item);
 }
 
@@ -654,8 +702,10 @@ TreeItem TreeCtrl::GetTreeItemByHandle(HTREEITEM item) {
 }
 
 void FillTVITEM(TVITEMEXW* tvitem, TreeModel* tm, TreeItem ti, bool withCheckboxes) {
-    uint mask = TVIF_TEXT | TVIF_PARAM | TVIF_STATE;
+    uint mask = TVIF_TEXT | TVIF_PARAM | TVIF_STATE | TVIF_CHILDREN;
     tvitem->mask = mask;
+    // shows the expand button even if the children aren't inserted yet
+    tvitem->cChildren = tm->HasChildren(ti) ? 1 : 0;
 
     uint stateMask = TVIS_EXPANDED;
     uint state = 0;
@@ -734,6 +784,8 @@ bool TreeCtrl::UpdateItem(TreeItem ti) {
 
 // complicated because it inserts items backwards, as described in
 // https://devblogs.microsoft.com/oldnewthing/20111125-00/?p=9033
+// children of collapsed items are only inserted when they're expanded
+// (see TVN_ITEMEXPANDING), which makes showing trees with lots of items fast
 void PopulateTreeItem(TreeCtrl* treeCtrl, TreeItem item, HTREEITEM parent) {
 #if 0
     auto tm = treeCtrl->treeModel;
@@ -772,7 +824,7 @@ void PopulateTreeItem(TreeCtrl* treeCtrl, TreeItem item, HTREEITEM parent) {
         HTREEITEM h = insertItemFront(treeCtrl, ti, parent);
         tm->SetHandle(ti, h);
         // avoid recursing if not needed because we use a lot of stack space
-        if (tm->ChildCount(ti) > 0) {
+        if (tm->IsExpanded(ti) && tm->HasChildren(ti)) {
             PopulateTreeItem(treeCtrl, ti, h);
         }
     }
@@ -793,6 +845,7 @@ void TreeCtrl::SetTreeModel(TreeModel* tm) {
 
     SuspendRedraw();
 
+    ClearHandles(this);
     TreeView_DeleteAllItems(hwnd);
 
     treeModel = tm;
@@ -17,10 +17,17 @@ struct TreeModel {
     virtual TreeItem Parent(TreeItem) = 0;
     virtual int ChildCount(TreeItem) = 0;
     virtual TreeItem ChildAt(TreeItem, int index) = 0;
+    // like ChildCount() > 0 but for models that load children on demand,
+    // it shouldn't load them
+    virtual bool HasChildren(TreeItem ti) {
+        return ChildCount(ti) > 0;
+    }
     // true if this tree item should be expanded i.e. showing children
     virtual bool IsExpanded(TreeItem) = 0;
     // when showing checkboxes
     virtual bool IsChecked(TreeItem) = 0;
+    // TreeCtrl inserts children of collapsed items on demand, the handle
+    // is nullptr for items that aren't in the tree view (yet)
     virtual void SetHandle(TreeItem, HTREEITEM) = 0;
     virtual HTREEITEM GetHandle(TreeItem) = 0;
 };